@@ -2,11 +2,12 @@
 
 #import "ViewController.h"
 #import "Metal4Renderer.h"
+#import "FallbackRenderer.h"
 
 @implementation ViewController
 {
     MTKView *view;
-    Metal4Renderer *renderer;
+    id<MTKViewDelegate> renderer;
 }
 
 - (void)viewDidLoad
@@ -20,12 +21,36 @@
 
     if ([view.device supportsFamily:MTLGPUFamilyMetal4]) {
         // Create a Metal 4 renderer instance for the app's lifetime.
-        renderer = [[Metal4Renderer alloc] initWithView:view];
-        NSAssert(renderer, @"The app couldn't create a renderer.");
+        Metal4Renderer *metal4Renderer = [[Metal4Renderer alloc] initWithView:view];
+        NSAssert(metal4Renderer, @"The app couldn't create a renderer.");
+        
+        // Launch the app with `-ShowsStatsOverlay YES` to show the frame statistics.
+        metal4Renderer.showsStatsOverlay = [[NSUserDefaults standardUserDefaults] boolForKey:@"ShowsStatsOverlay"];
+        
+        // Launch the app with `-SimulatesBubbles YES` to let the GPU move the bubbles.
+        metal4Renderer.simulatesBubbles = [[NSUserDefaults standardUserDefaults] boolForKey:@"SimulatesBubbles"];
+        
+        // Launch the app with `-ShaderReloadPath <path>` to reload the shaders of a file each time it changes.
+        NSString *shaderReloadPath = [[NSUserDefaults standardUserDefaults] stringForKey:@"ShaderReloadPath"];
+        if (nil != shaderReloadPath)
+        {
+            metal4Renderer.shaderReloadURL = [NSURL fileURLWithPath:shaderReloadPath];
+        }
+        
+        // Launch the app with `-BubbleStreamPath <path>` to start from the bubbles of a scene file.
+        NSString *bubbleStreamPath = [[NSUserDefaults standardUserDefaults] stringForKey:@"BubbleStreamPath"];
+        if (nil != bubbleStreamPath)
+        {
+            [metal4Renderer enqueueBubbleRecordsWithContentsOfURL:[NSURL fileURLWithPath:bubbleStreamPath]];
+        }
+        
+        renderer = metal4Renderer;
     }
     else
     {
-        NSAssert(view.device, @"This system doesn't support Metal 4.");
+        // Compute the SDF on the CPU, and only draw the composite on the GPU.
+        renderer = [[FallbackRenderer alloc] initWithView:view];
+        NSAssert(renderer, @"The app couldn't create a fallback renderer.");
     }
 
     // Initialize our renderer with the view size.
@@ -0,0 +1,36 @@
+#import <Metal/Metal.h>
+
+/// A type that measures ``Metal4Renderer`` offscreen, against scripted scenes of bubbles.
+///
+/// The benchmark sweeps the number of bubbles of each scene, at fixed drawable sizes and
+/// for both SDF pass variants. The report of each case has the GPU durations of the passes,
+/// the CPU durations of the updates and the encoding, the number of bubbles the SDF
+/// pass evaluates per texel next to the number its bins hold, and the largest difference
+/// that skipping the bubbles out of reach of the tiles makes to the SDF, which needs to be zero. Each configuration also
+/// draws batches of scenes offscreen, and reports their throughput in scenes per second.
+/// The report also has the largest difference between the fields of the specialized SDF
+/// pipelines and the generic one, which needs to be zero too.
+/// Each configuration counts where a sequential model of the GPU grouping passes differs
+/// from the grouping on the CPU, which needs to be zero as well, and the number of stream
+/// records with invalid bubbles that the stream or the renderer accepts, which also needs to be zero.
+/// It also compares the field of the GPU with the one of `CPUSDFRenderer` for the same scenes, and
+/// reports their largest differences, which only come from the precision of the texels of the GPU.
+@interface Benchmark : NSObject
+
+/// Creates a benchmark of the renderers of a device.
+- (nonnull instancetype)initWithDevice:(nonnull id<MTLDevice>)device;
+
+/// The location of a scene file or a recorded bubble stream that the benchmark also measures, or `nil`.
+///
+/// Each configuration then runs one more case, whose frames each apply the next record
+/// of the stream through the renderer's ingest, until the stream runs out.
+@property (nonatomic, copy, nullable) NSURL *bubbleStreamURL;
+
+/// Runs every case of the benchmark.
+///
+/// The method runs the main run loop while the renderers compile their pipelines.
+///
+/// - Returns: A report that `NSJSONSerialization` can write.
+- (nonnull NSDictionary<NSString*, id>*)run;
+
+@end
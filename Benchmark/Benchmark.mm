@@ -0,0 +1,737 @@
+#import <MetalKit/MetalKit.h>
+
+#import "Benchmark.h"
+#import "Metal4Renderer.h"
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <initializer_list>
+#include <limits>
+#include <span>
+#include <vector>
+
+#import "BenchmarkGroupingModel.h"
+#import "BenchmarkScenes.h"
+#import "BubbleStream.h"
+#import "CPUSDFRenderer.h"
+
+using namespace simd;
+
+/// The bubble counts of the sweep, up to well beyond the count from which the renderer groups them on the GPU.
+static const size_t kBenchmarkBubbleCounts[] = { 1, 4, 16, 64, 256, 1024, 4096, 16384 };
+
+/// The drawable sizes of the benchmark, in pixels: an iPhone and a large iPad in portrait.
+static const CGSize kBenchmarkDrawableSizes[] = { { 1179, 2556 }, { 2048, 2732 } };
+
+/// The number of frames each case draws before the measured ones, which fills the pipeline.
+constexpr uint32_t kNbWarmUpFrames = 8;
+
+/// The number of frames each case measures.
+constexpr uint32_t kNbMeasuredFrames = 64;
+
+/// The number of tiles of each case whose texels the benchmark evaluates with and without pruning.
+constexpr size_t kNbValidatedTiles = 256;
+
+/// The bubble counts of the scenes whose grouping the benchmark models, from the one at which the renderer groups them on the GPU.
+static const size_t kModeledBubbleCounts[] = { 4096, 16384 };
+
+/// The largest group size the renderer specializes the SDF pipeline for.
+constexpr uint32_t kMaxSpecializedGroupSize = 16;
+
+/// The number of scenes of each batch of the case that draws them offscreen, and their number of bubbles.
+constexpr uint32_t kNbBatchScenes = 16;
+constexpr size_t kNbBatchSceneBubbles = 256;
+
+/// The scene and the numbers of bubbles of the case that compares the field of the GPU with the one of the CPU.
+constexpr BenchmarkScene kFieldComparisonScene = BenchmarkScene::RandomBubbles;
+static const size_t kFieldComparisonBubbleCounts[] = { 256, 4096 };
+
+/// The number of batches the case measures after a warm-up one, and the size of their slices in pixels.
+constexpr uint32_t kNbMeasuredBatches = 8;
+constexpr NSUInteger kBatchSliceSize = 256;
+
+static NSDictionary* percentilesDictionary(SDFPercentiles percentiles)
+{
+    return @{ @"p50" : @(percentiles.p50), @"p99" : @(percentiles.p99) };
+}
+
+/// Returns the largest difference between the distances and gradients the SDF templates
+/// find while they skip the bubbles out of reach of each tile, and without skipping any.
+///
+/// The function evaluates the corners and the center of tiles spread over the field of the
+/// bubbles of a set, which it groups on the CPU. The pruning is exact, so the difference needs to be zero.
+static float pruningError(BubbleSet& bubbleSet, float2 contentSize)
+{
+    // The benchmark computes the field at full resolution.
+    const float2 fieldTexelSize { 1.f, 1.f };
+    const uint2 nbTiles {
+        uint32_t(std::ceil(contentSize.x / float(SDFTileSize))),
+        uint32_t(std::ceil(contentSize.y / float(SDFTileSize)))
+    };
+    bubbleSet.update(nbTiles, fieldTexelSize);
+    
+    const auto& groups = bubbleSet.groups();
+    const auto& bubbles = bubbleSet.groupedBubbles();
+    const auto& tileBins = bubbleSet.tileBins();
+    const auto& tileGroupIndices = bubbleSet.tileGroupIndices();
+    
+    const size_t nbTilesOfField = size_t(nbTiles.x) * nbTiles.y;
+    const size_t tileStride = std::max<size_t>(nbTilesOfField / kNbValidatedTiles, 1);
+    const uint2 texelsOfTile[] = { { 0, 0 }, { SDFTileSize - 1, SDFTileSize - 1 }, { SDFTileSize / 2, SDFTileSize / 2 } };
+    
+    float error = 0.f;
+    for (size_t tileIndex = 0; tileIndex < nbTilesOfField; tileIndex += tileStride)
+    {
+        const uint2 tile { uint32_t(tileIndex % nbTiles.x), uint32_t(tileIndex / nbTiles.x) };
+        const TileBin& bin = tileBins[tileIndex];
+        
+        for (const uint2 texel : texelsOfTile)
+        {
+            const uint2 gridId = tile * uint32_t(SDFTileSize) + texel;
+            const float2 pt = texelPositionInSDFSpace(gridId, fieldTexelSize);
+            const TileBounds bounds = tileBoundsOfTexel(gridId, fieldTexelSize);
+            
+            for (uint32_t i = 0; i < bin.nbGroups; ++i)
+            {
+                const BubbleGroup& group = groups[tileGroupIndices[bin.firstGroupIndex + i]];
+                const Bubble* groupBubbles = &bubbles[group.firstBubble];
+                
+                const float3 pruned = computeGroupSDF<float3>(group, groupBubbles, pt, bounds);
+                const float3 reference = computeGroupSDF<float3>(group, groupBubbles, pt, unboundedTile());
+                error = std::max(error, reduce_max(abs(pruned - reference)));
+            }
+        }
+    }
+    
+    return error;
+}
+
+/// Returns the largest difference between the distances and gradients that the specialized
+/// SDF pipelines and the generic one find for the same groups.
+///
+/// The function groups chains of 1 to `kMaxSpecializedGroupSize` overlapping bubbles on the CPU,
+/// and evaluates each group over a grid of texels around it, both with the evaluation of the smallest
+/// specialized size that the group fits in and with the one of the generic pipeline.
+/// A field whose tiles mix the two evaluations only has no seams if the difference is zero.
+static float specializationError()
+{
+    const float2 fieldTexelSize { 1.f, 1.f };
+    const float2 extent { 1024.f, 64.f + 120.f * kMaxSpecializedGroupSize };
+    const uint2 nbTiles {
+        uint32_t(std::ceil(extent.x / float(SDFTileSize))),
+        uint32_t(std::ceil(extent.y / float(SDFTileSize)))
+    };
+    
+    // Chains of different radii, whose smooth unions depend on the order of the fold.
+    BubbleSet bubbleSet;
+    for (uint32_t nbBubbles = 1; nbBubbles <= kMaxSpecializedGroupSize; ++nbBubbles)
+    {
+        for (uint32_t i = 0; i < nbBubbles; ++i)
+        {
+            const float2 origin { 40.f + 36.f * float(i), 64.f + 120.f * float(nbBubbles - 1) };
+            bubbleSet.add(origin, 20.f + 4.f * float(i % 3));
+        }
+    }
+    bubbleSet.update(nbTiles, fieldTexelSize);
+    
+    const auto& bubbles = bubbleSet.groupedBubbles();
+    
+    float error = 0.f;
+    for (const BubbleGroup& group : bubbleSet.groups())
+    {
+        if (group.nbBubbles > kMaxSpecializedGroupSize)
+        {
+            continue;
+        }
+        
+        const Bubble* groupBubbles = &bubbles[group.firstBubble];
+        const uint32_t specializedSize = std::bit_ceil(uint32_t(group.nbBubbles));
+        
+        float2 lo = groupBubbles[0].origin;
+        float2 hi = lo;
+        for (size_t i = 0; i < group.nbBubbles; ++i)
+        {
+            lo = min(lo, groupBubbles[i].origin - groupBubbles[i].radius);
+            hi = max(hi, groupBubbles[i].origin + groupBubbles[i].radius);
+        }
+        
+        constexpr uint32_t kTexelStep = 7;
+        for (float y = std::max(lo.y - 32.f, 0.f); y < std::min(hi.y + 32.f, extent.y); y += kTexelStep)
+        {
+            for (float x = std::max(lo.x - 32.f, 0.f); x < std::min(hi.x + 32.f, extent.x); x += kTexelStep)
+            {
+                const uint2 gridId { uint32_t(x), uint32_t(y) };
+                const float2 pt = texelPositionInSDFSpace(gridId, fieldTexelSize);
+                const TileBounds bounds = tileBoundsOfTexel(gridId, fieldTexelSize);
+                
+                const float3 specialized = computeGroupSDF<float3>(group, groupBubbles, pt, bounds, specializedSize);
+                const float3 generic = computeGroupSDF<float3>(group, groupBubbles, pt, bounds);
+                const float3 sequential = computeSDF<float3>(groupBubbles, group.nbBubbles, group.smoothFactor,
+                                                             pt, bounds, group.prunesBubbles);
+                
+                error = std::max(error, reduce_max(abs(specialized - generic)));
+                error = std::max(error, reduce_max(abs(specialized - sequential)));
+            }
+        }
+    }
+    
+    return error;
+}
+
+/// Returns the number of groups, bubbles and bins on which a sequential model of the GPU grouping
+/// differs from the grouping of ``BubbleSet``, over the scenes of the benchmark, which needs to be zero.
+static size_t groupingModelMismatches(float2 contentSize)
+{
+    const float2 fieldTexelSize { 1.f, 1.f };
+    const uint2 nbTiles {
+        uint32_t(std::ceil(contentSize.x / float(SDFTileSize))),
+        uint32_t(std::ceil(contentSize.y / float(SDFTileSize)))
+    };
+    
+    size_t mismatches = 0;
+    for (const BenchmarkScene scene : kBenchmarkScenes)
+    {
+        for (const size_t nbBubbles : kModeledBubbleCounts)
+        {
+            BubbleSet bubbleSet;
+            BenchmarkSceneScript script { scene, nbBubbles, contentSize };
+            script.build(bubbleSet);
+            bubbleSet.update(nbTiles, fieldTexelSize);
+            
+            BenchmarkGroupingModel model;
+            model.group(bubbleSet, nbTiles, fieldTexelSize);
+            mismatches += model.mismatches(bubbleSet);
+        }
+    }
+    
+    return mismatches;
+}
+
+/// Returns records of a stream that each hold one bubble the stream must reject, next to valid ones.
+///
+/// The bubbles have origins or radii that aren't finite, radii that aren't positive, and bubbles
+/// that reach far past the content, through every array of the scene and deltas records.
+static std::vector<std::vector<uint8_t>> invalidBubbleRecords(float2 contentSize)
+{
+    const float nan = std::numeric_limits<float>::quiet_NaN();
+    const float infinity = std::numeric_limits<float>::infinity();
+    const float farAway = 1000.f * std::max(contentSize.x, contentSize.y);
+    
+    const float2 validOrigin = contentSize * 0.5f;
+    const float validRadius = 50.f;
+    
+    const float2 invalidOrigins[] = { { nan, 0.f }, { 0.f, infinity }, { -infinity, 0.f }, { farAway, 0.f }, { 0.f, -1e30f } };
+    const float invalidRadii[] = { nan, infinity, -infinity, 0.f, -1.f, farAway };
+    
+    std::vector<std::vector<uint8_t>> records;
+    auto appendScene = [&](float2 origin, float radius) {
+        const float2 origins[] = { validOrigin, origin };
+        const float radii[] = { validRadius, radius };
+        appendBubbleScene(records.emplace_back(), origins, radii, contentSize);
+    };
+    auto appendDeltas = [&](const BubbleDeltaBatch& batch) {
+        batch.appendTo(records.emplace_back());
+    };
+    
+    for (const float2 origin : invalidOrigins)
+    {
+        appendScene(origin, validRadius);
+        
+        BubbleDeltaBatch moves;
+        moves.move(0, origin);
+        appendDeltas(moves);
+        
+        BubbleDeltaBatch additions;
+        additions.add(1, origin, validRadius);
+        appendDeltas(additions);
+    }
+    
+    for (const float radius : invalidRadii)
+    {
+        appendScene(validOrigin, radius);
+        
+        BubbleDeltaBatch resizes;
+        resizes.resize(0, radius);
+        appendDeltas(resizes);
+        
+        BubbleDeltaBatch additions;
+        additions.add(1, validOrigin, radius);
+        appendDeltas(additions);
+    }
+    
+    return records;
+}
+
+/// Returns the number of the records of `invalidBubbleRecords` that a ``BubbleStream``
+/// or a renderer accepts, which needs to be zero.
+///
+/// The stream applies each record to a set of one bubble, which needs to keep it as it is.
+static size_t acceptedInvalidBubbleRecords(Metal4Renderer* renderer)
+{
+    const float2 contentSize { float(renderer.contentSize.width), float(renderer.contentSize.height) };
+    
+    const float2 origin = contentSize * 0.5f;
+    const float radius = 50.f;
+    
+    std::vector<uint8_t> scene;
+    appendBubbleScene(scene, std::span { &origin, 1 }, std::span { &radius, 1 }, contentSize);
+    
+    size_t nbAccepted = 0;
+    for (const std::vector<uint8_t>& record : invalidBubbleRecords(contentSize))
+    {
+        BubbleSet bubbleSet;
+        BubbleStream stream;
+        stream.apply(bubbleSet, scene.data(), scene.size(), contentSize);
+        
+        const size_t nbApplied = stream.apply(bubbleSet, record.data(), record.size(), contentSize);
+        const bool changesSet = bubbleSet.size() != 1
+                             || any(bubbleSet.origins()[0] != origin)
+                             || bubbleSet.radii()[0] != radius;
+        
+        const BOOL enqueued = [renderer enqueueBubbleRecords:[NSData dataWithBytes:record.data() length:record.size()]];
+        
+        nbAccepted += (nbApplied != 0 || changesSet || enqueued) ? 1 : 0;
+    }
+    
+    return nbAccepted;
+}
+
+/// Returns the report of a case.
+static NSDictionary* caseReport(NSString* scene, size_t nbBubbles, const SDFFrameStats& stats, float pruningError)
+{
+    return @{
+        @"scene" : scene,
+        @"bubbles" : @(nbBubbles),
+        @"bubbleGroups" : @(stats.nbBubbleGroups),
+        @"frames" : @(stats.nbFrames),
+        @"gpuMilliseconds" : @{
+            @"simulation" : percentilesDictionary(stats.simulationPass),
+            @"grouping" : percentilesDictionary(stats.groupingPass),
+            @"sdf" : percentilesDictionary(stats.sdfPass),
+            @"gradient" : percentilesDictionary(stats.gradientPass),
+            @"pyramid" : percentilesDictionary(stats.pyramidPass),
+            @"render" : percentilesDictionary(stats.renderPass),
+        },
+        @"cpuMilliseconds" : @{
+            @"uniformsUpdate" : percentilesDictionary(stats.uniformsUpdate),
+            @"sceneUpdate" : percentilesDictionary(stats.sceneUpdate),
+            @"encoding" : percentilesDictionary(stats.encoding),
+        },
+        @"dirtyTiles" : percentilesDictionary(stats.dirtyTiles),
+        @"bubblesPerTexel" : percentilesDictionary(stats.bubblesPerTexel),
+        @"binnedBubblesPerTexel" : percentilesDictionary(stats.binnedBubblesPerTexel),
+        @"pruningError" : @(pruningError),
+    };
+}
+
+@implementation Benchmark
+{
+    id<MTLDevice> device;
+}
+
+- (nonnull instancetype)initWithDevice:(nonnull id<MTLDevice>)aDevice
+{
+    self = [super init];
+    if (nil == self) { return nil; }
+    
+    device = aDevice;
+    return self;
+}
+
+/// Creates a renderer for a view that isn't on screen, and waits for its pipelines.
+- (Metal4Renderer*)newRendererWithDrawableSize:(CGSize)drawableSize fusedSDFPass:(BOOL)fusedSDFPass
+{
+    MTKView *view = [[MTKView alloc] initWithFrame:CGRectMake(0, 0, drawableSize.width, drawableSize.height)
+                                            device:device];
+    view.autoResizeDrawable = NO;
+    view.drawableSize = drawableSize;
+    view.paused = YES;
+    
+    // Compute the field at full resolution, so that the cases of all devices compare.
+    Metal4Renderer *renderer = [[Metal4Renderer alloc] initWithView:view
+                                                       fusedSDFPass:fusedSDFPass
+                                                         fieldScale:SDFFieldScaleFull];
+    
+    // The compilations finish on the main queue.
+    while (renderer.compilesPipelines)
+    {
+        [[NSRunLoop mainRunLoop] runMode:NSDefaultRunLoopMode
+                              beforeDate:[NSDate dateWithTimeIntervalSinceNow:0.01]];
+    }
+    
+    return renderer;
+}
+
+/// Draws a frame of a case, and retries once the GPU finishes the frames in flight if it's late.
+- (void)drawFrameWithRenderer:(Metal4Renderer*)renderer
+                       script:(BenchmarkSceneScript&)script
+                        frame:(uint32_t)frame
+                  intoTexture:(id<MTLTexture>)texture
+{
+    // The static scenes recompute the whole field each frame, while the drag
+    // measures the incremental updates.
+    if (!script.animate([renderer bubbleSet], frame))
+    {
+        [renderer invalidateField];
+    }
+    
+    while (![renderer drawIntoTexture:texture])
+    {
+        [renderer waitUntilFramesCompleted];
+    }
+}
+
+/// Runs a case, and returns its report.
+- (NSDictionary*)runScene:(BenchmarkScene)scene
+                nbBubbles:(size_t)nbBubbles
+                 renderer:(Metal4Renderer*)renderer
+              intoTexture:(id<MTLTexture>)texture
+{
+    const float2 contentSize { float(renderer.contentSize.width), float(renderer.contentSize.height) };
+    
+    BenchmarkSceneScript script { scene, nbBubbles, contentSize };
+    script.build([renderer bubbleSet]);
+    renderer.simulatesBubbles = script.simulatesBubbles();
+    
+    uint32_t frame = 0;
+    for (uint32_t i = 0; i < kNbWarmUpFrames; ++i)
+    {
+        [self drawFrameWithRenderer:renderer script:script frame:frame++ intoTexture:texture];
+    }
+    
+    [renderer waitUntilFramesCompleted];
+    [renderer resetFrameStats];
+    
+    for (uint32_t i = 0; i < kNbMeasuredFrames; ++i)
+    {
+        [self drawFrameWithRenderer:renderer script:script frame:frame++ intoTexture:texture];
+    }
+    
+    [renderer waitUntilFramesCompleted];
+    const SDFFrameStats stats = renderer.frameStats;
+    renderer.simulatesBubbles = NO;
+    
+    BubbleSet bubbleSet;
+    script.build(bubbleSet);
+    
+    return caseReport(@(benchmarkSceneName(scene)), nbBubbles, stats, pruningError(bubbleSet, contentSize));
+}
+
+/// Draws a scene, and returns the largest differences between the distances and gradients of
+/// the field of the GPU and the ones that `CPUSDFRenderer` finds for the same bubbles.
+///
+/// The two evaluate the same groups, so the field of the GPU only differs by the precision of
+/// its texels and, for the two passes, by its gradient of finite differences.
+- (NSDictionary*)fieldErrorOfScene:(BenchmarkScene)scene
+                         nbBubbles:(size_t)nbBubbles
+                          renderer:(Metal4Renderer*)renderer
+                       intoTexture:(id<MTLTexture>)texture
+{
+    const float2 contentSize { float(renderer.contentSize.width), float(renderer.contentSize.height) };
+    
+    BenchmarkSceneScript script { scene, nbBubbles, contentSize };
+    script.build([renderer bubbleSet]);
+    [renderer invalidateField];
+    
+    while (![renderer drawIntoTexture:texture])
+    {
+        [renderer waitUntilFramesCompleted];
+    }
+    
+    NSData *gpuTexels = [renderer fieldTexels];
+    if (nil == gpuTexels)
+    {
+        return @{ @"scene" : @(benchmarkSceneName(scene)), @"bubbles" : @(nbBubbles), @"failed" : @YES };
+    }
+    
+    const uint2 fieldSize { uint32_t(renderer.fieldSize.width), uint32_t(renderer.fieldSize.height) };
+    const float2 fieldTexelSize = contentSize / float2 { float(fieldSize.x), float(fieldSize.y) };
+    
+    BubbleSet bubbleSet;
+    script.build(bubbleSet);
+    
+    CPUSDFRenderer cpuRenderer { fieldSize, fieldTexelSize };
+    bubbleSet.update(cpuRenderer.nbTiles(), fieldTexelSize);
+    cpuRenderer.renderAll(bubbleSet);
+    
+    const auto& cpuTexels = cpuRenderer.pixels();
+    const auto* gpuValues = static_cast<const float4*>(gpuTexels.bytes);
+    NSAssert(gpuTexels.length == cpuTexels.size() * sizeof(float4), @"The fields of the GPU and the CPU need the same size.");
+    
+    float distanceError = 0.f;
+    float gradientError = 0.f;
+    for (size_t i = 0; i < cpuTexels.size(); ++i)
+    {
+        const float4 difference = abs(gpuValues[i] - cpuTexels[i]);
+        distanceError = std::max(distanceError, difference.x);
+        gradientError = std::max(gradientError, std::max(difference.y, difference.z));
+    }
+    
+    return @{
+        @"scene" : @(benchmarkSceneName(scene)),
+        @"bubbles" : @(nbBubbles),
+        @"distance" : @(distanceError),
+        @"gradient" : @(gradientError),
+    };
+}
+
+/// Splits the records of a stream, or returns `nil` if one of them is invalid or partial.
++ (NSArray<NSData*>*)recordsOfBubbleStream:(NSData*)stream contentSize:(CGSize)contentSize
+{
+    NSMutableArray *records = [NSMutableArray new];
+    
+    size_t offset = 0;
+    while (offset < stream.length)
+    {
+        const auto record = readBubbleRecord(static_cast<const uint8_t*>(stream.bytes) + offset,
+                                             stream.length - offset,
+                                             float2 { float(contentSize.width), float(contentSize.height) });
+        if (!record.has_value())
+        {
+            return nil;
+        }
+        
+        [records addObject:[stream subdataWithRange:NSMakeRange(offset, record->size)]];
+        offset += record->size;
+    }
+    
+    return records;
+}
+
+/// Draws a frame of the case of a stream, which applies the record of the frame.
+- (void)drawFrameWithRenderer:(Metal4Renderer*)renderer
+                      records:(NSArray<NSData*>*)records
+                        frame:(uint32_t)frame
+                  intoTexture:(id<MTLTexture>)texture
+{
+    // The frames after the last record recompute the whole field, like the static scenes.
+    if (frame < records.count)
+    {
+        [renderer enqueueBubbleRecords:records[frame]];
+    }
+    else
+    {
+        [renderer invalidateField];
+    }
+    
+    while (![renderer drawIntoTexture:texture])
+    {
+        [renderer waitUntilFramesCompleted];
+    }
+}
+
+/// Runs the case of a stream, whose frames each apply one of its records, from the first warm-up frame on.
+- (NSDictionary*)runBubbleStream:(NSArray<NSData*>*)records
+                        renderer:(Metal4Renderer*)renderer
+                     intoTexture:(id<MTLTexture>)texture
+{
+    const float2 contentSize { float(renderer.contentSize.width), float(renderer.contentSize.height) };
+    
+    // A stream that starts with deltas applies them to an empty set.
+    [renderer bubbleSet].removeAll();
+    
+    uint32_t frame = 0;
+    for (uint32_t i = 0; i < kNbWarmUpFrames; ++i)
+    {
+        [self drawFrameWithRenderer:renderer records:records frame:frame++ intoTexture:texture];
+    }
+    
+    [renderer waitUntilFramesCompleted];
+    [renderer resetFrameStats];
+    
+    for (uint32_t i = 0; i < kNbMeasuredFrames; ++i)
+    {
+        [self drawFrameWithRenderer:renderer records:records frame:frame++ intoTexture:texture];
+    }
+    
+    [renderer waitUntilFramesCompleted];
+    const SDFFrameStats stats = renderer.frameStats;
+    
+    // Check the pruning on the bubbles of the last measured frame.
+    BubbleSet bubbleSet;
+    BubbleStream stream;
+    for (NSUInteger i = 0; i < std::min<NSUInteger>(frame, records.count); ++i)
+    {
+        stream.apply(bubbleSet, records[i].bytes, records[i].length, contentSize);
+    }
+    
+    NSMutableDictionary *report = [caseReport(@"bubbleStream", stats.nbBubbles, stats, pruningError(bubbleSet, contentSize)) mutableCopy];
+    report[@"bubbleStream"] = self.bubbleStreamURL.lastPathComponent;
+    report[@"records"] = @(records.count);
+    
+    return report;
+}
+
+/// Runs the case of the batches of scenes, and returns their throughput.
+///
+/// The batches are all in flight at once, like the jobs of a server, and the wall-clock
+/// throughput covers them from the first submission to the last completion.
+- (NSDictionary*)runSceneBatchesWithRenderer:(Metal4Renderer*)renderer
+{
+    const float2 contentSize { float(renderer.contentSize.width), float(renderer.contentSize.height) };
+    
+    // Random scenes of different seeds, so that each slice shows other bubbles.
+    NSMutableArray<NSData*> *sceneRecords = [NSMutableArray new];
+    for (uint32_t i = 0; i < kNbBatchScenes; ++i)
+    {
+        BubbleSet bubbleSet;
+        BenchmarkSceneScript script { BenchmarkScene::RandomBubbles, kNbBatchSceneBubbles, contentSize, i + 1 };
+        script.build(bubbleSet);
+        
+        std::vector<uint8_t> record;
+        appendBubbleScene(record, bubbleSet.origins(), bubbleSet.radii(), contentSize);
+        [sceneRecords addObject:[NSData dataWithBytes:record.data() length:record.size()]];
+    }
+    
+    __block uint32_t nbCompletedBatches = 0;
+    __block uint32_t nbFailedBatches = 0;
+    __block CFTimeInterval gpuDuration = 0.0;
+    
+    // The completions come on the main queue.
+    auto drawBatches = [&](uint32_t nbBatches) {
+        nbCompletedBatches = 0;
+        
+        for (uint32_t i = 0; i < nbBatches; ++i)
+        {
+            id<MTLTexture> slices = [renderer drawSceneBatch:sceneRecords
+                                                       width:kBatchSliceSize
+                                                      height:kBatchSliceSize
+                                           completionHandler:^(NSData *pixels, CFTimeInterval batchGPUDuration) {
+                ++nbCompletedBatches;
+                nbFailedBatches += (nil == pixels) ? 1 : 0;
+                gpuDuration += batchGPUDuration;
+            }];
+            
+            if (nil == slices)
+            {
+                ++nbCompletedBatches;
+                ++nbFailedBatches;
+            }
+        }
+        
+        while (nbCompletedBatches < nbBatches)
+        {
+            [[NSRunLoop mainRunLoop] runMode:NSDefaultRunLoopMode
+                                  beforeDate:[NSDate dateWithTimeIntervalSinceNow:0.001]];
+        }
+    };
+    
+    [renderer waitUntilFramesCompleted];
+    drawBatches(1);
+    
+    nbFailedBatches = 0;
+    gpuDuration = 0.0;
+    
+    const CFTimeInterval start = CACurrentMediaTime();
+    drawBatches(kNbMeasuredBatches);
+    const CFTimeInterval duration = CACurrentMediaTime() - start;
+    
+    const double nbScenes = double(kNbMeasuredBatches * kNbBatchScenes);
+    
+    return @{
+        @"scene" : @"sceneBatch",
+        @"nbScenes" : @(kNbBatchScenes),
+        @"nbBubbles" : @(kNbBatchSceneBubbles),
+        @"sliceSize" : @[ @(kBatchSliceSize), @(kBatchSliceSize) ],
+        @"batches" : @(kNbMeasuredBatches),
+        @"failedBatches" : @(nbFailedBatches),
+        @"scenesPerSecond" : @(nbScenes / duration),
+        @"gpuScenesPerSecond" : @((gpuDuration > 0.0) ? nbScenes / gpuDuration : 0.0),
+    };
+}
+
+- (nonnull NSDictionary<NSString*, id>*)run
+{
+    // Map the stream once for all the configurations.
+    NSData *bubbleStream = nil;
+    if (nil != self.bubbleStreamURL)
+    {
+        NSError *error = NULL;
+        bubbleStream = [NSData dataWithContentsOfURL:self.bubbleStreamURL options:NSDataReadingMappedIfSafe error:&error];
+        
+        if (nil == bubbleStream)
+        {
+            NSLog(@"The benchmark skips the bubble stream %@, which it can't read: %@", self.bubbleStreamURL.path, error);
+        }
+    }
+    
+    NSMutableArray *configurations = [NSMutableArray new];
+    
+    for (const CGSize drawableSize : kBenchmarkDrawableSizes)
+    {
+        MTLTextureDescriptor *textureDescriptor = [MTLTextureDescriptor new];
+        textureDescriptor.width = (NSUInteger)drawableSize.width;
+        textureDescriptor.height = (NSUInteger)drawableSize.height;
+        textureDescriptor.usage = MTLTextureUsageRenderTarget;
+        textureDescriptor.storageMode = MTLStorageModePrivate;
+        
+        for (const BOOL fusedSDFPass : { YES, NO })
+        {
+            @autoreleasepool
+            {
+                Metal4Renderer *renderer = [self newRendererWithDrawableSize:drawableSize fusedSDFPass:fusedSDFPass];
+                
+                textureDescriptor.pixelFormat = renderer.colorPixelFormat;
+                id<MTLTexture> texture = [device newTextureWithDescriptor:textureDescriptor];
+                NSAssert(nil != texture, @"The device can't create the benchmark's render target.");
+                texture.label = @"Benchmark Render Target";
+                
+                NSMutableArray *cases = [NSMutableArray new];
+                for (const BenchmarkScene scene : kBenchmarkScenes)
+                {
+                    for (const size_t nbBubbles : kBenchmarkBubbleCounts)
+                    {
+                        [cases addObject:[self runScene:scene nbBubbles:nbBubbles renderer:renderer intoTexture:texture]];
+                    }
+                }
+                
+                NSArray<NSData*> *streamRecords = (nil != bubbleStream)
+                    ? [Benchmark recordsOfBubbleStream:bubbleStream contentSize:renderer.contentSize]
+                    : nil;
+                
+                if (nil != streamRecords)
+                {
+                    [cases addObject:[self runBubbleStream:streamRecords renderer:renderer intoTexture:texture]];
+                }
+                else if (nil != bubbleStream)
+                {
+                    NSLog(@"The benchmark skips the bubble stream %@, whose records are invalid or partial.", self.bubbleStreamURL.path);
+                }
+                
+                [cases addObject:[self runSceneBatchesWithRenderer:renderer]];
+                
+                NSMutableArray *cpuFieldErrors = [NSMutableArray new];
+                for (const size_t nbBubbles : kFieldComparisonBubbleCounts)
+                {
+                    [cpuFieldErrors addObject:[self fieldErrorOfScene:kFieldComparisonScene
+                                                            nbBubbles:nbBubbles
+                                                             renderer:renderer
+                                                          intoTexture:texture]];
+                }
+                
+                [configurations addObject:@{
+                    @"drawableSize" : @[ @(drawableSize.width), @(drawableSize.height) ],
+                    @"fieldSize" : @[ @(renderer.contentSize.width), @(renderer.contentSize.height) ],
+                    @"fusedSDFPass" : @(fusedSDFPass),
+                    @"texelFormat" : (renderer.texelFormat == SDFTexelFormatPacked) ? @"packed" : @"rgba16Float",
+                    @"groupingModelMismatches" : @(groupingModelMismatches(float2 { float(renderer.contentSize.width),
+                                                                                    float(renderer.contentSize.height) })),
+                    @"acceptedInvalidBubbleRecords" : @(acceptedInvalidBubbleRecords(renderer)),
+                    @"cpuFieldErrors" : cpuFieldErrors,
+                    @"cases" : cases,
+                }];
+            }
+        }
+    }
+    
+    return @{
+        @"device" : device.name,
+        @"warmUpFrames" : @(kNbWarmUpFrames),
+        @"measuredFrames" : @(kNbMeasuredFrames),
+        @"specializationError" : @(specializationError()),
+        @"configurations" : configurations,
+    };
+}
+
+@end
@@ -0,0 +1,333 @@
+#pragma once
+
+#import <simd/simd.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#import "BubbleSet.h"
+
+/// A sequential model of the kernels of `Shaders.metal` that group the bubbles on the GPU.
+///
+/// Each pass runs its threads one after the other, in the order of their indices, and
+/// `rankGroupMembers` walks its chunks as the single threadgroup of the kernel does.
+/// The model checks the logic of the passes against the grouping of ``BubbleSet``,
+/// which the GPU grouping needs to reproduce, rather than the scheduling of the GPU.
+class BenchmarkGroupingModel final
+{
+public:
+    /// Groups the bubbles of a set like the passes do, without the capacities of their buffers.
+    void group(const BubbleSet& bubbleSet, uint2 nbTiles, float2 fieldTexelSize)
+    {
+        const auto& origins = bubbleSet.origins();
+        const auto& radii = bubbleSet.radii();
+        const auto& slots = bubbleSet.bubbleSlots();
+        
+        const uint32_t n = (uint32_t)origins.size();
+        
+        uint32_t nbCells = 1;
+        while (nbCells < 2 * n)
+        {
+            nbCells <<= 1;
+        }
+        
+        // countGridCells, exclusiveScan and fillGridCells
+        std::vector<uint32_t> labels(n);
+        std::vector<float> minDistances(n, std::numeric_limits<float>::max());
+        std::vector<uint32_t> cellCounts(nbCells, 0);
+        
+        for (uint32_t index = 0; index < n; ++index)
+        {
+            labels[index] = index;
+            forEachCell(origins[index], radii[index], nbCells, [&](uint32_t cell) { ++cellCounts[cell]; });
+        }
+        
+        const std::vector<uint32_t> cellOffsets = exclusiveScan(cellCounts);
+        std::vector<uint32_t> cellEntries(cellOffsets.empty() ? 0 : cellOffsets.back() + cellCounts.back());
+        
+        for (uint32_t index = 0; index < n; ++index)
+        {
+            forEachCell(origins[index], radii[index], nbCells, [&](uint32_t cell) {
+                cellEntries[cellOffsets[cell] + --cellCounts[cell]] = index;
+            });
+        }
+        
+        // uniteOverlappingBubbles
+        for (uint32_t index = 0; index < n; ++index)
+        {
+            forEachCell(origins[index], radii[index], nbCells, [&](uint32_t cell) {
+                const uint32_t end = (cell + 1 < nbCells) ? cellOffsets[cell + 1] : (uint32_t)cellEntries.size();
+                
+                for (uint32_t entry = cellOffsets[cell]; entry < end; ++entry)
+                {
+                    const uint32_t otherIndex = cellEntries[entry];
+                    if (otherIndex <= index)
+                    {
+                        continue;
+                    }
+                    
+                    const float distance = length(origins[index] - origins[otherIndex]);
+                    if (distance <= radii[index] + radii[otherIndex])
+                    {
+                        uniteBubbles(labels, index, otherIndex);
+                        
+                        minDistances[index] = std::min(minDistances[index], distance);
+                        minDistances[otherIndex] = std::min(minDistances[otherIndex], distance);
+                    }
+                }
+            });
+        }
+        
+        // resolveBubbleRoots
+        std::vector<uint32_t> roots(n);
+        std::vector<uint32_t> rootFlags(n);
+        std::vector<uint32_t> rootSizes(n, 0);
+        
+        for (uint32_t index = 0; index < n; ++index)
+        {
+            const uint32_t root = findRoot(labels, index);
+            roots[index] = root;
+            rootFlags[index] = (root == index) ? 1 : 0;
+            
+            ++rootSizes[root];
+            minDistances[root] = std::min(minDistances[root], minDistances[index]);
+        }
+        
+        // exclusiveScan, sizeBubbleGroups and exclusiveScan
+        const std::vector<uint32_t> groupIndicesOfRoots = exclusiveScan(rootFlags);
+        const uint32_t nbGroups = (n > 0) ? groupIndicesOfRoots.back() + rootFlags.back() : 0;
+        
+        std::vector<uint32_t> groupSizes(nbGroups);
+        for (uint32_t index = 0; index < n; ++index)
+        {
+            if (roots[index] == index)
+            {
+                groupSizes[groupIndicesOfRoots[index]] = rootSizes[index];
+            }
+        }
+        
+        const std::vector<uint32_t> groupOffsets = exclusiveScan(groupSizes);
+        
+        // rankGroupMembers
+        std::vector<uint32_t> memberRanks(n);
+        for (uint32_t first = 0; first < n; first += GroupingScanThreadgroupSize)
+        {
+            const uint32_t chunkSize = std::min<uint32_t>(GroupingScanThreadgroupSize, n - first);
+            std::vector<uint32_t> rankedSizes(chunkSize);
+            
+            for (uint32_t thread = 0; thread < chunkSize; ++thread)
+            {
+                const uint32_t root = roots[first + thread];
+                
+                uint32_t chunkRank = 0;
+                bool isLastOfRoot = true;
+                for (uint32_t i = 0; i < chunkSize; ++i)
+                {
+                    const bool sameRoot = roots[first + i] == root;
+                    chunkRank += (sameRoot && i < thread) ? 1 : 0;
+                    isLastOfRoot = isLastOfRoot && !(sameRoot && i > thread);
+                }
+                
+                memberRanks[first + thread] = groupSizes[groupIndicesOfRoots[root]] - rootSizes[root] + chunkRank;
+                rankedSizes[thread] = isLastOfRoot ? chunkRank + 1 : 0;
+            }
+            
+            // the kernel updates the sizes after a barrier
+            for (uint32_t thread = 0; thread < chunkSize; ++thread)
+            {
+                rootSizes[roots[first + thread]] -= rankedSizes[thread];
+            }
+        }
+        
+        // sortGroupMembers
+        _groups.assign(nbGroups, BubbleGroup {});
+        _bubbles.assign(n, Bubble { float2 { 0.f, 0.f }, 0.f });
+        
+        for (uint32_t index = 0; index < n; ++index)
+        {
+            const uint32_t root = roots[index];
+            const uint32_t groupIndex = groupIndicesOfRoots[root];
+            const uint32_t size = groupSizes[groupIndex];
+            
+            Bubble& bubble = _bubbles[groupOffsets[groupIndex] + memberRanks[index]];
+            bubble = Bubble { origins[index], radii[index] };
+            bubble.id = slots[index];
+            
+            if (root == index)
+            {
+                BubbleGroup& group = _groups[groupIndex];
+                group.nbBubbles = size;
+                group.firstBubble = groupOffsets[groupIndex];
+                group.smoothFactor = (size > 1) ? groupSmoothFactor(minDistances[root]) : BubbleGroup {}.smoothFactor;
+            }
+        }
+        
+        // countTileGroups, exclusiveScan and fillTileGroups
+        const uint32_t nbTilesOfField = nbTiles.x * nbTiles.y;
+        std::vector<uint32_t> tileCounts(nbTilesOfField, 0);
+        std::vector<float3> groupCircles(nbGroups);
+        
+        for (uint32_t groupIndex = 0; groupIndex < nbGroups; ++groupIndex)
+        {
+            BubbleGroup& group = _groups[groupIndex];
+            
+            const float3 bounds = boundingCircle(group, _bubbles.data());
+            group.prunesBubbles = groupPrunesBubbles(bounds.z, group.smoothFactor);
+            
+            groupCircles[groupIndex] = circleInSDFTexels(groupCircle(group, bounds, outsideBandDistance(fieldTexelSize)),
+                                                         fieldTexelSize);
+            
+            forEachTile(groupCircles[groupIndex], nbTiles, [&](uint32_t tileIndex) { ++tileCounts[tileIndex]; });
+        }
+        
+        const std::vector<uint32_t> tileOffsets = exclusiveScan(tileCounts);
+        _tileGroupIndices.assign(tileOffsets.empty() ? 0 : tileOffsets.back() + tileCounts.back(), 0);
+        
+        for (uint32_t groupIndex = 0; groupIndex < nbGroups; ++groupIndex)
+        {
+            forEachTile(groupCircles[groupIndex], nbTiles, [&](uint32_t tileIndex) {
+                _tileGroupIndices[tileOffsets[tileIndex] + --tileCounts[tileIndex]] = groupIndex;
+            });
+        }
+        
+        // writeTileBins
+        _tileBins.assign(nbTilesOfField, TileBin {});
+        for (uint32_t tileIndex = 0; tileIndex < nbTilesOfField; ++tileIndex)
+        {
+            const uint32_t first = tileOffsets[tileIndex];
+            const uint32_t end = (tileIndex + 1 < nbTilesOfField) ? tileOffsets[tileIndex + 1] : (uint32_t)_tileGroupIndices.size();
+            
+            std::sort(_tileGroupIndices.begin() + first, _tileGroupIndices.begin() + end);
+            
+            _tileBins[tileIndex].firstGroupIndex = first;
+            _tileBins[tileIndex].nbGroups = end - first;
+        }
+    }
+    
+    /// Returns the number of groups, bubbles, bins and group indices of the model that differ from the ones of a set.
+    size_t mismatches(const BubbleSet& bubbleSet) const
+    {
+        const auto& groups = bubbleSet.groups();
+        const auto& bubbles = bubbleSet.groupedBubbles();
+        const auto& tileBins = bubbleSet.tileBins();
+        const auto& tileGroupIndices = bubbleSet.tileGroupIndices();
+        
+        // The entries one side misses don't match.
+        size_t count = sizeDifference(groups, _groups) + sizeDifference(bubbles, _bubbles) +
+                       sizeDifference(tileBins, _tileBins) + sizeDifference(tileGroupIndices, _tileGroupIndices);
+        
+        for (size_t i = 0; i < std::min(groups.size(), _groups.size()); ++i)
+        {
+            const BubbleGroup& a = groups[i];
+            const BubbleGroup& b = _groups[i];
+            count += (a.nbBubbles != b.nbBubbles || a.firstBubble != b.firstBubble ||
+                      a.smoothFactor != b.smoothFactor || a.prunesBubbles != b.prunesBubbles) ? 1 : 0;
+        }
+        
+        for (size_t i = 0; i < std::min(bubbles.size(), _bubbles.size()); ++i)
+        {
+            const Bubble& a = bubbles[i];
+            const Bubble& b = _bubbles[i];
+            count += (any(a.origin != b.origin) || a.radius != b.radius || a.id != b.id) ? 1 : 0;
+        }
+        
+        for (size_t i = 0; i < std::min(tileBins.size(), _tileBins.size()); ++i)
+        {
+            count += (tileBins[i].firstGroupIndex != _tileBins[i].firstGroupIndex ||
+                      tileBins[i].nbGroups != _tileBins[i].nbGroups) ? 1 : 0;
+        }
+        
+        for (size_t i = 0; i < std::min(tileGroupIndices.size(), _tileGroupIndices.size()); ++i)
+        {
+            count += (tileGroupIndices[i] != _tileGroupIndices[i]) ? 1 : 0;
+        }
+        
+        return count;
+    }
+    
+private:
+    std::vector<BubbleGroup> _groups;
+    std::vector<Bubble> _bubbles;
+    std::vector<TileBin> _tileBins;
+    std::vector<uint32_t> _tileGroupIndices;
+    
+    template <typename T>
+    static size_t sizeDifference(const std::vector<T>& a, const std::vector<T>& b)
+    {
+        return std::max(a.size(), b.size()) - std::min(a.size(), b.size());
+    }
+    
+    static std::vector<uint32_t> exclusiveScan(const std::vector<uint32_t>& values)
+    {
+        std::vector<uint32_t> offsets(values.size());
+        
+        uint32_t total = 0;
+        for (size_t i = 0; i < values.size(); ++i)
+        {
+            offsets[i] = total;
+            total += values[i];
+        }
+        
+        return offsets;
+    }
+    
+    template <typename F>
+    static void forEachCell(float2 origin, float radius, uint32_t nbCells, F&& f)
+    {
+        int2 minCell, maxCell;
+        gridCellRange(origin, radius, minCell, maxCell);
+        
+        for (int y = minCell.y; y <= maxCell.y; ++y)
+        {
+            for (int x = minCell.x; x <= maxCell.x; ++x)
+            {
+                f(hashGridCell(int2 { x, y }, nbCells));
+            }
+        }
+    }
+    
+    template <typename F>
+    static void forEachTile(float3 circle, uint2 nbTiles, F&& f)
+    {
+        TileRange range;
+        if (!tileRangeOfCircle(circle, nbTiles, range))
+        {
+            return;
+        }
+        
+        for (uint32_t y = range.min.y; y <= range.max.y; ++y)
+        {
+            for (uint32_t x = range.min.x; x <= range.max.x; ++x)
+            {
+                if (circleOverlapsTile(circle, uint2 { x, y }))
+                {
+                    f(y * nbTiles.x + x);
+                }
+            }
+        }
+    }
+    
+    static uint32_t findRoot(const std::vector<uint32_t>& labels, uint32_t index)
+    {
+        while (labels[index] != index)
+        {
+            index = labels[index];
+        }
+        
+        return index;
+    }
+    
+    /// Hooks the larger root under the smaller one, as `uniteBubbles` does once its exchange succeeds.
+    static void uniteBubbles(std::vector<uint32_t>& labels, uint32_t a, uint32_t b)
+    {
+        a = findRoot(labels, a);
+        b = findRoot(labels, b);
+        
+        if (a != b)
+        {
+            labels[std::max(a, b)] = std::min(a, b);
+        }
+    }
+};
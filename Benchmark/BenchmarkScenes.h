@@ -0,0 +1,224 @@
+#pragma once
+
+#import <simd/simd.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <optional>
+#include <random>
+#include <vector>
+
+#import "BubbleSet.h"
+
+/// The scripted scenes of the benchmark.
+enum class BenchmarkScene : uint32_t
+{
+    /// Bubbles at random positions, which mostly form small groups.
+    RandomBubbles,
+    
+    /// Blobs of bubbles around a few centers, which form a few large groups.
+    ClusteredBlobs,
+    
+    /// A grid of overlapping bubbles, which form a single group.
+    SingleGroup,
+    
+    /// Random bubbles, one of which a drag moves around a circle every frame.
+    ContinuousDrag,
+    
+    /// Random bubbles that the GPU simulation moves every frame.
+    Simulation,
+};
+
+constexpr BenchmarkScene kBenchmarkScenes[] = {
+    BenchmarkScene::RandomBubbles,
+    BenchmarkScene::ClusteredBlobs,
+    BenchmarkScene::SingleGroup,
+    BenchmarkScene::ContinuousDrag,
+    BenchmarkScene::Simulation,
+};
+
+inline const char* benchmarkSceneName(BenchmarkScene scene)
+{
+    switch (scene)
+    {
+        case BenchmarkScene::RandomBubbles: return "randomBubbles";
+        case BenchmarkScene::ClusteredBlobs: return "clusteredBlobs";
+        case BenchmarkScene::SingleGroup: return "singleGroup";
+        case BenchmarkScene::ContinuousDrag: return "continuousDrag";
+        case BenchmarkScene::Simulation: return "simulation";
+    }
+    
+    return "unknown";
+}
+
+/// A scene of the benchmark, which fills a bubble set and animates it frame after frame.
+///
+/// A script with the same seed always builds the same bubbles.
+class BenchmarkSceneScript final
+{
+public:
+    /// The number of frames of a turn of the drag around its circle.
+    static constexpr uint32_t kDragPeriod = 120;
+    
+    /// The touch that drags the bubble.
+    static constexpr TouchID kDragTouch = 1;
+    
+    /// Creates the script of a scene.
+    ///
+    /// - Parameters:
+    ///   - contentSize: The size of the background image, which the bubbles cover.
+    BenchmarkSceneScript(BenchmarkScene scene, size_t nbBubbles, float2 contentSize, uint32_t seed = 1)
+    : _scene(scene),
+    _nbBubbles(nbBubbles),
+    _contentSize(contentSize),
+    _seed(seed)
+    {}
+    
+    /// Replaces the bubbles of a set with the ones of the scene.
+    void build(BubbleSet& bubbleSet)
+    {
+        bubbleSet.removeAll();
+        _draggedBubble.reset();
+        
+        std::mt19937 generator(_seed);
+        
+        switch (_scene)
+        {
+            case BenchmarkScene::RandomBubbles:
+            case BenchmarkScene::Simulation:
+            {
+                addRandomBubbles(bubbleSet, generator, _nbBubbles);
+                break;
+            }
+            
+            case BenchmarkScene::ClusteredBlobs:
+            {
+                addClusteredBlobs(bubbleSet, generator);
+                break;
+            }
+            
+            case BenchmarkScene::SingleGroup:
+            {
+                addSingleGroup(bubbleSet);
+                break;
+            }
+            
+            case BenchmarkScene::ContinuousDrag:
+            {
+                _draggedBubble = bubbleSet.add(dragPosition(0), baseRadius());
+                addRandomBubbles(bubbleSet, generator, _nbBubbles - 1);
+                break;
+            }
+        }
+    }
+    
+    /// Returns `true` if the renderer simulates the bubbles of the scene.
+    bool simulatesBubbles() const
+    {
+        return _scene == BenchmarkScene::Simulation;
+    }
+    
+    /// Advances the scene to a frame.
+    ///
+    /// - Returns: `true` if the frame changes the bubbles. The static scenes don't change them,
+    ///   and the simulation changes them on the GPU.
+    bool animate(BubbleSet& bubbleSet, uint32_t frame)
+    {
+        if (simulatesBubbles())
+        {
+            return true;
+        }
+        
+        if (!_draggedBubble.has_value())
+        {
+            return false;
+        }
+        
+        if (frame == 0)
+        {
+            bubbleSet.setSelection(kDragTouch, *_draggedBubble, dragPosition(0));
+        }
+        
+        bubbleSet.moveSelection(kDragTouch, dragPosition(frame));
+        return true;
+    }
+
+private:
+    /// The radius of the bubbles, which shrinks as their number grows so that they don't cover the whole image.
+    float baseRadius() const
+    {
+        const float minSize = std::min(_contentSize.x, _contentSize.y);
+        const float scale = std::min(1.f, std::sqrt(32.f / float(std::max<size_t>(_nbBubbles, 1))));
+        
+        return std::max(0.04f * minSize * scale, 2.f);
+    }
+    
+    float2 dragPosition(uint32_t frame) const
+    {
+        const float angle = 2.f * float(M_PI) * float(frame % kDragPeriod) / float(kDragPeriod);
+        const float radius = 0.25f * std::min(_contentSize.x, _contentSize.y);
+        
+        return _contentSize * 0.5f + radius * float2 { std::cos(angle), std::sin(angle) };
+    }
+    
+    void addRandomBubbles(BubbleSet& bubbleSet, std::mt19937& generator, size_t nbBubbles) const
+    {
+        const float r = baseRadius();
+        std::uniform_real_distribution<float> x(0.f, _contentSize.x);
+        std::uniform_real_distribution<float> y(0.f, _contentSize.y);
+        std::uniform_real_distribution<float> radius(0.5f * r, 1.5f * r);
+        
+        for (size_t i = 0; i < nbBubbles; ++i)
+        {
+            bubbleSet.add(float2 { x(generator), y(generator) }, radius(generator));
+        }
+    }
+    
+    void addClusteredBlobs(BubbleSet& bubbleSet, std::mt19937& generator) const
+    {
+        const float r = baseRadius();
+        const size_t nbClusters = std::max<size_t>(_nbBubbles / 64, 1);
+        
+        std::uniform_real_distribution<float> x(0.1f * _contentSize.x, 0.9f * _contentSize.x);
+        std::uniform_real_distribution<float> y(0.1f * _contentSize.y, 0.9f * _contentSize.y);
+        std::normal_distribution<float> offset(0.f, 3.f * r);
+        std::uniform_real_distribution<float> radius(0.5f * r, r);
+        
+        std::vector<float2> centers(nbClusters);
+        for (auto& center : centers)
+        {
+            center = float2 { x(generator), y(generator) };
+        }
+        
+        for (size_t i = 0; i < _nbBubbles; ++i)
+        {
+            const float2 center = centers[i % nbClusters];
+            bubbleSet.add(center + float2 { offset(generator), offset(generator) }, radius(generator));
+        }
+    }
+    
+    void addSingleGroup(BubbleSet& bubbleSet) const
+    {
+        // Neighbors closer than twice their radius overlap, which connects the whole grid.
+        const uint32_t nbColumns = (uint32_t)std::ceil(std::sqrt(double(_nbBubbles)));
+        const float minSize = std::min(_contentSize.x, _contentSize.y);
+        const float r = std::min(baseRadius(), minSize / (1.5f * float(nbColumns) + 2.f));
+        const float spacing = 1.5f * r;
+        
+        const float2 origin = _contentSize * 0.5f - 0.5f * spacing * float(nbColumns - 1);
+        
+        for (size_t i = 0; i < _nbBubbles; ++i)
+        {
+            const float2 cell { float(i % nbColumns), float(i / nbColumns) };
+            bubbleSet.add(origin + cell * spacing, r);
+        }
+    }
+    
+    BenchmarkScene _scene;
+    size_t _nbBubbles;
+    float2 _contentSize;
+    uint32_t _seed;
+    
+    std::optional<BubbleHandle> _draggedBubble;
+};
@@ -0,0 +1,75 @@
+#import <UIKit/UIKit.h>
+
+#import "Benchmark.h"
+
+/// An app delegate that runs the benchmark once the app finishes launching, writes its report, and quits.
+///
+/// The app prints the report as JSON, and writes it to the path of the `BenchmarkOutput`
+/// argument, or to `benchmark.json` in the app's documents. The `BenchmarkStreamPath` argument
+/// adds the case of a scene file or a recorded bubble stream.
+@interface BenchmarkAppDelegate : UIResponder <UIApplicationDelegate>
+@end
+
+@implementation BenchmarkAppDelegate
+
+- (BOOL)application:(UIApplication *)application didFinishLaunchingWithOptions:(NSDictionary *)launchOptions
+{
+    // Run from a timer rather than a block of the main queue, which the renderers
+    // finish their pipelines on while the benchmark runs the run loop.
+    [self performSelector:@selector(runBenchmark) withObject:nil afterDelay:0];
+    return YES;
+}
+
+- (void)runBenchmark
+{
+    id<MTLDevice> device = MTLCreateSystemDefaultDevice();
+    if (nil == device || ![device supportsFamily:MTLGPUFamilyMetal4])
+    {
+        NSLog(@"The benchmark needs a GPU that supports Metal 4.");
+        exit(EXIT_FAILURE);
+    }
+    
+    Benchmark *benchmark = [[Benchmark alloc] initWithDevice:device];
+    
+    NSString *streamPath = [[NSUserDefaults standardUserDefaults] stringForKey:@"BenchmarkStreamPath"];
+    if (nil != streamPath)
+    {
+        benchmark.bubbleStreamURL = [NSURL fileURLWithPath:streamPath];
+    }
+    
+    NSDictionary *report = [benchmark run];
+    
+    NSError *error = NULL;
+    NSData *json = [NSJSONSerialization dataWithJSONObject:report
+                                                   options:NSJSONWritingPrettyPrinted | NSJSONWritingSortedKeys
+                                                     error:&error];
+    NSAssert(nil != json, @"The benchmark can't write its report due to: %@", error);
+    
+    fwrite(json.bytes, 1, json.length, stdout);
+    fputc('\n', stdout);
+    fflush(stdout);
+    
+    NSString *outputPath = [[NSUserDefaults standardUserDefaults] stringForKey:@"BenchmarkOutput"];
+    NSURL *outputURL = outputPath
+        ? [NSURL fileURLWithPath:outputPath]
+        : [[[NSFileManager defaultManager] URLsForDirectory:NSDocumentDirectory
+                                                  inDomains:NSUserDomainMask].firstObject
+           URLByAppendingPathComponent:@"benchmark.json"];
+    
+    if (![json writeToURL:outputURL options:NSDataWritingAtomic error:&error])
+    {
+        NSLog(@"The benchmark can't write its report to %@ due to: %@", outputURL.path, error);
+        exit(EXIT_FAILURE);
+    }
+    
+    exit(EXIT_SUCCESS);
+}
+
+@end
+
+int main(int argc, char * argv[]) {
+    
+    @autoreleasepool {
+        return UIApplicationMain(argc, argv, nil, NSStringFromClass([BenchmarkAppDelegate class]));
+    }
+}
@@ -0,0 +1,1239 @@
+#pragma once
+
+#import <simd/simd.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+
+#import "ShaderTypes.h"
+
+/// A uniform grid over the bounding boxes of bubbles, in SDF space.
+///
+/// The grid registers a bubble in every cell its bounding box overlaps,
+/// so two overlapping bubbles always share at least one cell.
+/// Cells are hashed, which lets bubbles move outside of the texture.
+class BubbleGrid final
+{
+public:
+    /// The width and height of a cell, in SDF space.
+    static constexpr float kCellSize = float(BubbleGridCellSize);
+    
+    /// An inclusive range of cells.
+    struct CellRange final
+    {
+        int2 min;
+        int2 max;
+        
+        bool operator==(const CellRange& other) const
+        {
+            return all(min == other.min) && all(max == other.max);
+        }
+    };
+    
+    static CellRange cellRange(const float2& lo, const float2& hi)
+    {
+        const float2 minCell = simd::floor(lo / kCellSize);
+        const float2 maxCell = simd::floor(hi / kCellSize);
+        
+        return {
+            .min = { int32_t(minCell.x), int32_t(minCell.y) },
+            .max = { int32_t(maxCell.x), int32_t(maxCell.y) }
+        };
+    }
+    
+    /// Returns the cells the bounding box of a circle overlaps.
+    static CellRange cellRange(const float2& center, float radius)
+    {
+        return cellRange(center - radius, center + radius);
+    }
+    
+    void insert(uint32_t index, const CellRange& range)
+    {
+        forEachCell(range, [&](uint64_t key)
+        {
+            _cells[key].push_back(index);
+        });
+    }
+    
+    void remove(uint32_t index, const CellRange& range)
+    {
+        forEachCell(range, [&](uint64_t key)
+        {
+            const auto it = _cells.find(key);
+            if (it == _cells.end())
+            {
+                return;
+            }
+            
+            auto& indices = it->second;
+            const auto found = std::find(indices.begin(), indices.end(), index);
+            if (found != indices.end())
+            {
+                *found = indices.back();
+                indices.pop_back();
+            }
+            
+            if (indices.empty())
+            {
+                _cells.erase(it);
+            }
+        });
+    }
+    
+    void clear()
+    {
+        _cells.clear();
+    }
+    
+    /// Calls `f` with the index of every bubble registered in the cells of `range`.
+    ///
+    /// A bubble that spans several of those cells is visited once per cell.
+    template <typename F>
+    void forEachCandidate(const CellRange& range, F&& f) const
+    {
+        forEachCell(range, [&](uint64_t key)
+        {
+            const auto it = _cells.find(key);
+            if (it != _cells.end())
+            {
+                for (const uint32_t index : it->second)
+                {
+                    f(index);
+                }
+            }
+        });
+    }
+    
+private:
+    template <typename F>
+    static void forEachCell(const CellRange& range, F&& f)
+    {
+        for (int32_t y = range.min.y; y <= range.max.y; ++y)
+        {
+            for (int32_t x = range.min.x; x <= range.max.x; ++x)
+            {
+                f((uint64_t(uint32_t(x)) << 32) | uint64_t(uint32_t(y)));
+            }
+        }
+    }
+    
+    std::unordered_map<uint64_t, std::vector<uint32_t>> _cells;
+};
+
+/// A stable reference to a bubble of a ``BubbleSet``.
+///
+/// A handle stays valid until the set removes its bubble, and never refers
+/// to another bubble afterwards, even when the set reuses its slot.
+struct BubbleHandle final
+{
+    uint32_t slot = std::numeric_limits<uint32_t>::max();
+    uint32_t generation = 0;
+    
+    bool operator==(const BubbleHandle& other) const
+    {
+        return (slot == other.slot) && (generation == other.generation);
+    }
+};
+
+/// An identifier of the touch that drives a selection of a ``BubbleSet``, like the address of a `UITouch`.
+///
+/// The renderers get the identifiers of their touches and gesture recognizers with `touchIDOf` of `RendererSupport.h`.
+using TouchID = uint64_t;
+
+/// The point of SDF space a touch moved to, for ``BubbleSet/moveSelections``.
+struct SelectionMove final
+{
+    TouchID touch;
+    float2 point;
+};
+
+/// The bubbles of the scene, and the groups of overlapping bubbles the SDF kernels evaluate.
+///
+/// The set keeps its grouping between frames and only regroups the connected
+/// components of the bubbles that were added, moved or rescaled since the last `update`.
+///
+/// The set stores its bubbles densely, with their origins and radii in separate
+/// arrays, and hands out ``BubbleHandle`` values that a slot map resolves to them.
+class BubbleSet final
+{
+public:
+    
+    BubbleHandle add(const float2& origin, float radius)
+    {
+        const uint32_t index = (uint32_t) _origins.size();
+        
+        uint32_t slot;
+        if (_freeSlots.empty())
+        {
+            slot = (uint32_t) _slots.size();
+            _slots.push_back(Slot { index, 0 });
+        }
+        else
+        {
+            slot = _freeSlots.back();
+            _freeSlots.pop_back();
+            _slots[slot].index = index;
+        }
+        
+        _origins.push_back(origin);
+        _radii.push_back(radius);
+        _bubbleSlots.push_back(slot);
+        _cellRanges.push_back(BubbleGrid::cellRange(origin, radius));
+        _grid.insert(index, _cellRanges.back());
+        
+        _parents.push_back(index);
+        _componentSizes.push_back(1);
+        _minDistances.push_back(std::numeric_limits<float>::max());
+        _bubbleGroupIndices.push_back(kNoGroup);
+        
+        _changedBubbles.push_back(index);
+        _hasChanges = true;
+        
+        return BubbleHandle { slot, _slots[slot].generation };
+    }
+    
+    /// Removes a bubble, moving the last bubble of the set into its place.
+    ///
+    /// Removing a bubble that was already removed does nothing.
+    void remove(const BubbleHandle& handle)
+    {
+        const auto found = indexOf(handle);
+        if (!found.has_value())
+        {
+            return;
+        }
+        
+        const uint32_t index = *found;
+        const uint32_t last = (uint32_t) _origins.size() - 1;
+        
+        // the touches that drag the bubble let it go
+        std::erase_if(_selections, [&](const Selection& selection) { return selection.bubble == handle; });
+        
+        _grid.remove(index, _cellRanges[index]);
+        
+        if (index != last)
+        {
+            _grid.remove(last, _cellRanges[last]);
+            _grid.insert(index, _cellRanges[last]);
+            
+            _origins[index] = _origins[last];
+            _radii[index] = _radii[last];
+            _bubbleSlots[index] = _bubbleSlots[last];
+            _cellRanges[index] = _cellRanges[last];
+            
+            _slots[_bubbleSlots[index]].index = index;
+        }
+        
+        _origins.pop_back();
+        _radii.pop_back();
+        _bubbleSlots.pop_back();
+        _cellRanges.pop_back();
+        
+        _parents.pop_back();
+        _componentSizes.pop_back();
+        _minDistances.pop_back();
+        _bubbleGroupIndices.pop_back();
+        
+        // invalidate the handles of the removed bubble
+        ++_slots[handle.slot].generation;
+        _freeSlots.push_back(handle.slot);
+        
+        // the groups index the moved bubble
+        _needsRebuild = true;
+        _hasChanges = true;
+    }
+    
+    /// Removes every bubble of the set, which invalidates all their handles.
+    ///
+    /// The next `update` marks the tiles the bubbles occupied dirty.
+    void removeAll()
+    {
+        for (const uint32_t slot : _bubbleSlots)
+        {
+            ++_slots[slot].generation;
+            _freeSlots.push_back(slot);
+        }
+        
+        _origins.clear();
+        _radii.clear();
+        _bubbleSlots.clear();
+        _cellRanges.clear();
+        _grid.clear();
+        
+        _parents.clear();
+        _componentSizes.clear();
+        _minDistances.clear();
+        _bubbleGroupIndices.clear();
+        _changedBubbles.clear();
+        
+        _selections.clear();
+        
+        _needsRebuild = true;
+        _hasChanges = true;
+    }
+    
+    /// Returns `true` if the handle refers to a bubble of the set.
+    bool contains(const BubbleHandle& handle) const
+    {
+        return indexOf(handle).has_value();
+    }
+    
+    /// Returns a copy of the bubble a handle refers to, if it's still in the set.
+    std::optional<Bubble> bubble(const BubbleHandle& handle) const
+    {
+        const auto index = indexOf(handle);
+        if (!index.has_value())
+        {
+            return std::nullopt;
+        }
+        
+        Bubble bubble { _origins[*index], _radii[*index] };
+        bubble.id = handle.slot;
+        
+        return bubble;
+    }
+    
+    /// Returns the handle of the bubble at an index of `origins()`.
+    BubbleHandle handleOf(uint32_t index) const
+    {
+        const uint32_t slot = _bubbleSlots[index];
+        return BubbleHandle { slot, _slots[slot].generation };
+    }
+    
+    /// Returns the handle of the bubble that occupies a slot, if any.
+    std::optional<BubbleHandle> handleOfSlot(uint32_t slot) const
+    {
+        if (slot >= _slots.size())
+        {
+            return std::nullopt;
+        }
+        
+        // a free slot keeps the index of its last bubble, which another bubble took since
+        const uint32_t index = _slots[slot].index;
+        if (index >= _bubbleSlots.size() || _bubbleSlots[index] != slot)
+        {
+            return std::nullopt;
+        }
+        
+        return BubbleHandle { slot, _slots[slot].generation };
+    }
+    
+    /// Moves a bubble to an origin, like a selection does.
+    void setOrigin(const BubbleHandle& handle, const float2& origin)
+    {
+        if (const auto index = indexOf(handle))
+        {
+            _origins[*index] = origin;
+            onBubbleChanged(*index);
+        }
+    }
+    
+    /// Resizes a bubble, like a pinch does.
+    void setRadius(const BubbleHandle& handle, float radius)
+    {
+        if (const auto index = indexOf(handle))
+        {
+            _radii[*index] = radius;
+            onBubbleChanged(*index);
+        }
+    }
+    
+    /// Reserves the storage of a number of bubbles, ahead of adding many at once.
+    void reserve(size_t nbBubbles)
+    {
+        _origins.reserve(nbBubbles);
+        _radii.reserve(nbBubbles);
+        _bubbleSlots.reserve(nbBubbles);
+        _slots.reserve(nbBubbles);
+        _cellRanges.reserve(nbBubbles);
+    
+        _parents.reserve(nbBubbles);
+        _componentSizes.reserve(nbBubbles);
+        _minDistances.reserve(nbBubbles);
+        _bubbleGroupIndices.reserve(nbBubbles);
+        _changedBubbles.reserve(nbBubbles);
+    }
+    
+    /// The number of bubbles of the set.
+    size_t size() const
+    {
+        return _origins.size();
+    }
+    
+    /// Returns `true` if a bubble was added, removed, moved or rescaled since the last `update` or `commitChanges`.
+    bool hasChanges() const
+    {
+        return _hasChanges;
+    }
+    
+    /// Returns the bubble under a point of SDF space, if any.
+    ///
+    /// The bubble with the smallest index wins when several of them overlap the point.
+    std::optional<BubbleHandle> pick(const float2& pos) const
+    {
+        uint32_t picked = std::numeric_limits<uint32_t>::max();
+        
+        _grid.forEachCandidate(BubbleGrid::cellRange(pos, pos), [&](uint32_t index)
+        {
+            if (index < picked && length(pos - _origins[index]) <= _radii[index])
+            {
+                picked = index;
+            }
+        });
+        
+        if (picked >= _origins.size())
+        {
+            return std::nullopt;
+        }
+        
+        return handleOf(picked);
+    }
+    
+    /// Returns the bubbles that overlap a rectangle of SDF space, sorted by index.
+    ///
+    /// - Parameters:
+    ///   - lo: The corner of the rectangle with the smallest coordinates.
+    ///   - hi: The corner of the rectangle with the largest coordinates.
+    std::vector<BubbleHandle> pickAll(const float2& lo, const float2& hi)
+    {
+        _pickedIndices.clear();
+        
+        _grid.forEachCandidate(BubbleGrid::cellRange(lo, hi), [&](uint32_t index)
+        {
+            // the distance from the center to the closest point of the rectangle
+            const float2 origin = _origins[index];
+            const float2 closest = simd::clamp(origin, lo, hi);
+            if (length(closest - origin) <= _radii[index])
+            {
+                _pickedIndices.push_back(index);
+            }
+        });
+        
+        // a bubble is a candidate of every cell it spans
+        std::sort(_pickedIndices.begin(), _pickedIndices.end());
+        _pickedIndices.erase(std::unique(_pickedIndices.begin(), _pickedIndices.end()), _pickedIndices.end());
+        
+        std::vector<BubbleHandle> handles;
+        handles.reserve(_pickedIndices.size());
+        
+        for (const uint32_t index : _pickedIndices)
+        {
+            handles.push_back(handleOf(index));
+        }
+        
+        return handles;
+    }
+    
+    /// Selects a bubble for a touch, which then moves or rescales it relative to its current origin and radius.
+    ///
+    /// Each touch has its own selection, which replaces the previous one of the touch.
+    /// Selecting a bubble that isn't in the set clears the selection of the touch.
+    void setSelection(TouchID touch, const BubbleHandle& handle, const float2& initialHitInSDFSpace)
+    {
+        clearSelection(touch);
+        
+        const auto index = indexOf(handle);
+        if (!index.has_value())
+        {
+            return;
+        }
+        
+        _selections.push_back(Selection { touch, handle, _origins[*index], _radii[*index], initialHitInSDFSpace });
+    }
+    
+    void clearSelection(TouchID touch)
+    {
+        std::erase_if(_selections, [&](const Selection& selection) { return selection.touch == touch; });
+    }
+    
+    /// Clears the selections of all the touches that drag a bubble.
+    void clearSelections(const BubbleHandle& handle)
+    {
+        std::erase_if(_selections, [&](const Selection& selection) { return selection.bubble == handle; });
+    }
+    
+    /// Returns the bubble a touch selected, if it's still in the set.
+    std::optional<BubbleHandle> selection(TouchID touch) const
+    {
+        const Selection* selection = findSelection(touch);
+        if (selection == nullptr || !contains(selection->bubble))
+        {
+            return std::nullopt;
+        }
+        
+        return selection->bubble;
+    }
+    
+    size_t nbSelections() const
+    {
+        return _selections.size();
+    }
+    
+    /// Returns the bubbles the touches select, which can repeat.
+    std::vector<BubbleHandle> selectedBubbles() const
+    {
+        std::vector<BubbleHandle> bubbles;
+        bubbles.reserve(_selections.size());
+        
+        for (const Selection& selection : _selections)
+        {
+            bubbles.push_back(selection.bubble);
+        }
+        
+        return bubbles;
+    }
+    
+    void moveSelection(TouchID touch, const float2& pt)
+    {
+        moveSelections({ SelectionMove { touch, pt } });
+    }
+    
+    /// Moves the selections of several touches at once.
+    ///
+    /// The set only schedules the regrouping of each bubble once, whatever the
+    /// number of moves of the batch that reach it.
+    void moveSelections(const std::vector<SelectionMove>& moves)
+    {
+        _movedIndices.clear();
+        
+        for (const SelectionMove& move : moves)
+        {
+            const Selection* selection = findSelection(move.touch);
+            if (selection == nullptr)
+            {
+                continue;
+            }
+            
+            if (const auto index = indexOf(selection->bubble))
+            {
+                const auto delta = move.point - selection->initialHitInSDFSpace;
+                _origins[*index] = selection->initialOrigin + delta;
+                
+                _movedIndices.push_back(*index);
+            }
+        }
+        
+        std::sort(_movedIndices.begin(), _movedIndices.end());
+        _movedIndices.erase(std::unique(_movedIndices.begin(), _movedIndices.end()), _movedIndices.end());
+        
+        for (const uint32_t index : _movedIndices)
+        {
+            onBubbleChanged(index);
+        }
+    }
+    
+    void rescaleSelection(TouchID touch, float scale)
+    {
+        const Selection* selection = findSelection(touch);
+        if (selection == nullptr)
+        {
+            return;
+        }
+        
+        if (const auto index = indexOf(selection->bubble))
+        {
+            _radii[*index] = selection->initialRadius * scale;
+            
+            onBubbleChanged(*index);
+        }
+    }
+    
+    /// Updates the groups and their tile bins after changes to the bubbles.
+    ///
+    /// - Parameters:
+    ///   - nbTiles: The number of `SDFTileSize` tiles in each dimension of the SDF textures.
+    ///   - fieldTexelSize: The size of an SDF texel in SDF space.
+    /// - Returns: `false` when nothing changed since the last update,
+    ///   in which case `version()` stays the same.
+    bool update(uint2 nbTiles, float2 fieldTexelSize = float2 { 1.f, 1.f })
+    {
+        const bool tilesChanged = any(nbTiles != _nbTiles) || any(fieldTexelSize != _fieldTexelSize);
+        const bool bubblesChanged = _needsRebuild || !_changedBubbles.empty();
+        
+        if (!tilesChanged && !bubblesChanged)
+        {
+            return false;
+        }
+        
+        // The SDF textures don't store anything valid yet after a resize.
+        const bool allDirty = tilesChanged;
+        const bool rebuild = _needsRebuild;
+        _dirtyCircles.clear();
+        
+        if (!allDirty)
+        {
+            recordTileOccupancy();
+        }
+        
+        if (bubblesChanged)
+        {
+            regroup();
+        }
+        
+        _nbTiles = nbTiles;
+        _fieldTexelSize = fieldTexelSize;
+        binGroups();
+        
+        if (allDirty)
+        {
+            markAllTilesDirty();
+        }
+        else if (rebuild)
+        {
+            markOccupiedTilesDirty();
+        }
+        else
+        {
+            markRegroupedGroupsDirty();
+            collectDirtyTiles();
+        }
+        
+        _hasChanges = false;
+        ++_version;
+        return true;
+    }
+    
+    /// Accepts the changes to the bubbles without regrouping them, for a renderer that groups them on the GPU.
+    ///
+    /// The groups, their bins and the dirty tiles then go stale, and the next `update`
+    /// regroups every bubble.
+    ///
+    /// - Returns: `false` when nothing changed since the last update,
+    ///   in which case `version()` stays the same.
+    bool commitChanges()
+    {
+        if (!_hasChanges)
+        {
+            return false;
+        }
+        
+        _changedBubbles.clear();
+        _needsRebuild = true;
+        _hasChanges = false;
+        
+        ++_version;
+        return true;
+    }
+    
+    /// Makes the next `update` mark every tile dirty, after something else wrote the SDF textures.
+    void invalidateTiles()
+    {
+        _nbTiles = uint2 { 0, 0 };
+    }
+    
+    /// The origin of each bubble, in the dense order that `pick` favors.
+    const std::vector<float2>& origins() const
+    {
+        return _origins;
+    }
+    
+    /// The radius of each bubble, in the order of `origins()`.
+    const std::vector<float>& radii() const
+    {
+        return _radii;
+    }
+    
+    /// The slot of each bubble, in the order of `origins()`, which the grouped bubbles store as their id.
+    const std::vector<uint32_t>& bubbleSlots() const
+    {
+        return _bubbleSlots;
+    }
+    
+    /// The number of slots of the set, which bounds the slots of its bubbles.
+    size_t nbSlots() const
+    {
+        return _slots.size();
+    }
+    
+    /// The packed coordinates of the tiles whose SDF changed since the last `clearDirtyTiles`.
+    ///
+    /// The list only covers the narrow band: the tiles that the previous and current
+    /// circles of the changed groups overlap, and that a group occupies or occupied.
+    /// The other tiles keep the width of the outside band. It covers every tile
+    /// after a resize.
+    const std::vector<uint32_t>& dirtyTiles() const
+    {
+        return _dirtyTiles;
+    }
+    
+    /// Empties the list of dirty tiles once the caller recomputed them.
+    void clearDirtyTiles()
+    {
+        for (const uint32_t packedTile : _dirtyTiles)
+        {
+            const uint2 tile = unpackTileCoordinates(packedTile);
+            _isTileDirty[size_t(tile.y) * _nbTiles.x + tile.x] = false;
+        }
+        
+        _dirtyTiles.clear();
+    }
+    
+    /// A number that changes every time `update` changes the groups or their bins.
+    uint64_t version() const
+    {
+        return _version;
+    }
+    
+    /// The groups that the last `update` computed.
+    const std::vector<BubbleGroup>& groups() const
+    {
+        return _groups;
+    }
+    
+    /// The number of bubbles of the largest group that the last `update` computed.
+    size_t maxGroupSize() const
+    {
+        return _maxGroupSize;
+    }
+    
+    /// The bubbles sorted by group, which the groups of `groups()` index.
+    const std::vector<Bubble>& groupedBubbles() const
+    {
+        return _groupedBubbles;
+    }
+    
+    /// The per-tile ranges in `tileGroupIndices()` that the last `update` computed.
+    const std::vector<TileBin>& tileBins() const
+    {
+        return _tileBins;
+    }
+    
+    /// The group indices of every tile, stored contiguously tile after tile.
+    const std::vector<uint32_t>& tileGroupIndices() const
+    {
+        return _tileGroupIndices;
+    }
+    
+private:
+    static constexpr uint32_t kNoGroup = std::numeric_limits<uint32_t>::max();
+    
+    /// The bubble a touch drags, with its origin and radius when the touch began.
+    struct Selection final
+    {
+        Selection(TouchID touch, const BubbleHandle& bubble, const float2& initialOrigin, float initialRadius, const float2& initialHitInSDFSpace)
+        : touch(touch),
+        bubble(bubble),
+        initialOrigin(initialOrigin),
+        initialRadius(initialRadius),
+        initialHitInSDFSpace(initialHitInSDFSpace)
+        {}
+        
+        TouchID touch;
+        BubbleHandle bubble;
+        float2 initialOrigin;
+        float initialRadius;
+        
+        float2 initialHitInSDFSpace;
+    };
+    
+    /// A bubble's index in the dense arrays, and the generation of the handles of the slot.
+    struct Slot final
+    {
+        uint32_t index;
+        uint32_t generation;
+    };
+    
+    std::optional<uint32_t> indexOf(const BubbleHandle& handle) const
+    {
+        if (handle.slot >= _slots.size() || _slots[handle.slot].generation != handle.generation)
+        {
+            return std::nullopt;
+        }
+        
+        return _slots[handle.slot].index;
+    }
+    
+    /// Returns the selection of a touch, if any.
+    ///
+    /// The touches on screen are few, so the set looks them up linearly.
+    const Selection* findSelection(TouchID touch) const
+    {
+        const auto found = std::find_if(_selections.begin(), _selections.end(),
+                                        [&](const Selection& selection) { return selection.touch == touch; });
+        
+        return (found != _selections.end()) ? &*found : nullptr;
+    }
+    
+    /// Moves a bubble within the grid, and schedules the regrouping of its component.
+    ///
+    /// The grid stays up to date even when a rebuild is pending, so `pick` keeps working.
+    void onBubbleChanged(uint32_t index)
+    {
+        const auto range = BubbleGrid::cellRange(_origins[index], _radii[index]);
+        if (!(range == _cellRanges[index]))
+        {
+            _grid.remove(index, _cellRanges[index]);
+            _grid.insert(index, range);
+            _cellRanges[index] = range;
+        }
+        
+        if (!_needsRebuild)
+        {
+            _changedBubbles.push_back(index);
+        }
+        
+        _hasChanges = true;
+    }
+    
+    uint32_t findComponent(uint32_t index)
+    {
+        // path halving
+        while (_parents[index] != index)
+        {
+            _parents[index] = _parents[_parents[index]];
+            index = _parents[index];
+        }
+        
+        return index;
+    }
+    
+    void uniteComponents(uint32_t a, uint32_t b, float distance)
+    {
+        a = findComponent(a);
+        b = findComponent(b);
+        
+        if (a != b)
+        {
+            // union by size
+            if (_componentSizes[a] < _componentSizes[b])
+            {
+                std::swap(a, b);
+            }
+            
+            _parents[b] = a;
+            _componentSizes[a] += _componentSizes[b];
+            _minDistances[a] = std::min(_minDistances[a], _minDistances[b]);
+        }
+        
+        _minDistances[a] = std::min(_minDistances[a], distance);
+    }
+    
+    /// Rebuilds the components of every bubble.
+    ///
+    /// The grid is already up to date, since every change to the bubbles updates it.
+    void resetAllComponents()
+    {
+        const uint32_t n = (uint32_t) _origins.size();
+        
+        _parents.resize(n);
+        _componentSizes.resize(n);
+        _minDistances.resize(n);
+        _bubbleGroupIndices.assign(n, kNoGroup);
+        _seeds.resize(n);
+        
+        for (uint32_t i=0; i < n; ++i)
+        {
+            _seeds[i] = i;
+        }
+        
+        _needsRebuild = false;
+    }
+    
+    /// Collects the bubbles of the components that contain a changed bubble.
+    ///
+    /// Only these components can split or merge, the others keep their links.
+    void collectChangedComponents()
+    {
+        _seeds.clear();
+        
+        for (const uint32_t index : _changedBubbles)
+        {
+            const uint32_t groupIndex = _bubbleGroupIndices[index];
+            if (groupIndex == kNoGroup)
+            {
+                // a new bubble, or one already collected
+                _seeds.push_back(index);
+                continue;
+            }
+            
+            markPreviousGroupDirty(groupIndex);
+            
+            const auto& group = _groups[groupIndex];
+            const uint32_t* members = &_groupedIndices[group.firstBubble];
+            for (size_t i=0; i < group.nbBubbles; ++i)
+            {
+                _seeds.push_back(members[i]);
+                _bubbleGroupIndices[members[i]] = kNoGroup;
+            }
+        }
+        
+        std::sort(_seeds.begin(), _seeds.end());
+        _seeds.erase(std::unique(_seeds.begin(), _seeds.end()), _seeds.end());
+    }
+    
+    /// Computes the connected components of overlapping bubbles and sorts the bubbles by group.
+    void regroup()
+    {
+        _isPreviousGroupDirty.assign(_groups.size(), false);
+        
+        if (_needsRebuild)
+        {
+            resetAllComponents();
+        }
+        else
+        {
+            collectChangedComponents();
+        }
+        
+        _changedBubbles.clear();
+        
+        // dissolve the changed components
+        for (const uint32_t index : _seeds)
+        {
+            _parents[index] = index;
+            _componentSizes[index] = 1;
+            _minDistances[index] = std::numeric_limits<float>::max();
+        }
+        
+        // link every changed bubble with the bubbles it overlaps
+        for (const uint32_t index : _seeds)
+        {
+            const float2 origin = _origins[index];
+            const float radius = _radii[index];
+            
+            _grid.forEachCandidate(_cellRanges[index], [&](uint32_t otherIndex)
+            {
+                if (otherIndex == index)
+                {
+                    return;
+                }
+                
+                const float distance = length(origin - _origins[otherIndex]);
+                
+                if (distance <= radius + _radii[otherIndex])
+                {
+                    // a group that merges with the changed ones changes too
+                    const uint32_t otherGroupIndex = _bubbleGroupIndices[otherIndex];
+                    if (otherGroupIndex != kNoGroup)
+                    {
+                        markPreviousGroupDirty(otherGroupIndex);
+                    }
+                    
+                    uniteComponents(index, otherIndex, distance);
+                }
+            });
+        }
+        
+        // sort the bubbles by group, ordering the groups by their first bubble
+        const uint32_t n = (uint32_t) _origins.size();
+        
+        _componentGroupIndices.assign(n, kNoGroup);
+        _groups.clear();
+        
+        for (uint32_t i=0; i < n; ++i)
+        {
+            const uint32_t root = findComponent(i);
+            uint32_t& groupIndex = _componentGroupIndices[root];
+            
+            if (groupIndex == kNoGroup)
+            {
+                groupIndex = (uint32_t) _groups.size();
+                
+                BubbleGroup group;
+                group.nbBubbles = 0;
+                
+                if (_componentSizes[root] > 1)
+                {
+                    group.smoothFactor = groupSmoothFactor(_minDistances[root]);
+                }
+                
+                _groups.push_back(group);
+            }
+            
+            _bubbleGroupIndices[i] = groupIndex;
+            ++_groups[groupIndex].nbBubbles;
+        }
+        
+        size_t offset = 0;
+        _maxGroupSize = 0;
+        for (auto& group : _groups)
+        {
+            _maxGroupSize = std::max(_maxGroupSize, group.nbBubbles);
+            group.firstBubble = offset;
+            offset += group.nbBubbles;
+            group.nbBubbles = 0;
+        }
+        
+        _groupedIndices.resize(n);
+        _groupedBubbles.clear();
+        _groupedBubbles.reserve(n);
+        
+        for (uint32_t i=0; i < n; ++i)
+        {
+            auto& group = _groups[_bubbleGroupIndices[i]];
+            _groupedIndices[group.firstBubble + group.nbBubbles++] = i;
+        }
+        
+        for (const uint32_t index : _groupedIndices)
+        {
+            // the slot identifies a bubble for as long as it lives
+            Bubble bubble { _origins[index], _radii[index] };
+            bubble.id = _bubbleSlots[index];
+            
+            _groupedBubbles.push_back(bubble);
+        }
+    }
+    
+    /// A circle, in SDF space, outside of which a group's SDF is positive.
+    struct GroupCircle final
+    {
+        float2 center;
+        float radius;
+    };
+    
+    /// Computes the circle of each group.
+    void computeGroupCircles()
+    {
+        _groupCircles.resize(_groups.size());
+        const float outsideBand = outsideBandDistance(_fieldTexelSize);
+        
+        for (size_t i=0; i < _groups.size(); ++i)
+        {
+            BubbleGroup& group = _groups[i];
+            
+            const float3 bounds = boundingCircle(group, _groupedBubbles.data());
+            group.prunesBubbles = groupPrunesBubbles(bounds.z, group.smoothFactor);
+            
+            const float3 circle = groupCircle(group, bounds, outsideBand);
+            
+            _groupCircles[i] = {
+                .center = float2 { circle.x, circle.y },
+                .radius = circle.z
+            };
+        }
+    }
+    
+    /// Calls `f` with the index of every `SDFTileSize` tile a circle of SDF space overlaps.
+    template <typename F>
+    void forEachOverlappedTile(const GroupCircle& circleInSDFSpace, F&& f) const
+    {
+        // The tiles are made of SDF texels.
+        const float3 circle = circleInSDFTexels(float3 { circleInSDFSpace.center.x, circleInSDFSpace.center.y, circleInSDFSpace.radius },
+                                                _fieldTexelSize);
+        
+        TileRange range;
+        if (!tileRangeOfCircle(circle, _nbTiles, range))
+        {
+            // entirely outside the texture
+            return;
+        }
+        
+        for (uint32_t y = range.min.y; y <= range.max.y; ++y)
+        {
+            for (uint32_t x = range.min.x; x <= range.max.x; ++x)
+            {
+                if (circleOverlapsTile(circle, uint2 { x, y }))
+                {
+                    f(size_t(y) * _nbTiles.x + x);
+                }
+            }
+        }
+    }
+    
+    /// Builds the list of groups that can produce a distance below the outside band in each `SDFTileSize` tile.
+    ///
+    /// The method bins each group into the tiles its circle overlaps,
+    /// preserving the order of the groups within each tile.
+    void binGroups()
+    {
+        computeGroupCircles();
+        
+        const size_t nbAllTiles = size_t(_nbTiles.x) * size_t(_nbTiles.y);
+        _tileBins.assign(nbAllTiles, TileBin {});
+        _tileGroupIndices.clear();
+        
+        // count the groups of each tile
+        for (const auto& circle : _groupCircles)
+        {
+            forEachOverlappedTile(circle, [&](size_t tileIndex) { ++_tileBins[tileIndex].nbGroups; });
+        }
+        
+        uint32_t offset = 0;
+        for (auto& bin : _tileBins)
+        {
+            bin.firstGroupIndex = offset;
+            offset += bin.nbGroups;
+            bin.nbGroups = 0;
+        }
+        
+        // fill the lists, in group order
+        _tileGroupIndices.resize(offset);
+        for (uint32_t groupIndex = 0; groupIndex < _groupCircles.size(); ++groupIndex)
+        {
+            forEachOverlappedTile(_groupCircles[groupIndex], [&](size_t tileIndex)
+            {
+                auto& bin = _tileBins[tileIndex];
+                _tileGroupIndices[bin.firstGroupIndex + bin.nbGroups++] = groupIndex;
+            });
+        }
+    }
+    
+    /// Records the circle of a group before regrouping changes it.
+    void markPreviousGroupDirty(uint32_t groupIndex)
+    {
+        if (groupIndex < _isPreviousGroupDirty.size() && !_isPreviousGroupDirty[groupIndex])
+        {
+            _isPreviousGroupDirty[groupIndex] = true;
+            _dirtyCircles.push_back(_groupCircles[groupIndex]);
+        }
+    }
+    
+    /// Records the circles of the groups that contain a regrouped bubble.
+    void markRegroupedGroupsDirty()
+    {
+        _isGroupDirty.assign(_groups.size(), false);
+        
+        for (const uint32_t index : _seeds)
+        {
+            const uint32_t groupIndex = _bubbleGroupIndices[index];
+            if (!_isGroupDirty[groupIndex])
+            {
+                _isGroupDirty[groupIndex] = true;
+                _dirtyCircles.push_back(_groupCircles[groupIndex]);
+            }
+        }
+    }
+    
+    /// Returns whether any group can reach below the outside band in a tile.
+    bool isTileOccupied(size_t tileIndex) const
+    {
+        return _tileBins[tileIndex].nbGroups > 0;
+    }
+    
+    /// Saves which tiles the current bins occupy, before they change.
+    void recordTileOccupancy()
+    {
+        _wasTileOccupied.resize(_tileBins.size());
+        
+        for (size_t i=0; i < _tileBins.size(); ++i)
+        {
+            _wasTileOccupied[i] = isTileOccupied(i);
+        }
+    }
+    
+    void markTileDirty(size_t tileIndex)
+    {
+        if (!_isTileDirty[tileIndex])
+        {
+            _isTileDirty[tileIndex] = true;
+            
+            const uint2 tile { uint32_t(tileIndex % _nbTiles.x), uint32_t(tileIndex / _nbTiles.x) };
+            _dirtyTiles.push_back(packTileCoordinates(tile));
+        }
+    }
+    
+    void markAllTilesDirty()
+    {
+        const size_t nbAllTiles = size_t(_nbTiles.x) * size_t(_nbTiles.y);
+        
+        _isTileDirty.assign(nbAllTiles, false);
+        _dirtyTiles.clear();
+        
+        for (size_t i=0; i < nbAllTiles; ++i)
+        {
+            markTileDirty(i);
+        }
+    }
+    
+    /// Marks the tiles that a group occupies or occupied as dirty.
+    void markOccupiedTilesDirty()
+    {
+        for (size_t i=0; i < _tileBins.size(); ++i)
+        {
+            if (isTileOccupied(i) || _wasTileOccupied[i])
+            {
+                markTileDirty(i);
+            }
+        }
+    }
+    
+    /// Marks the tiles of the narrow band that the dirty circles overlap as dirty.
+    void collectDirtyTiles()
+    {
+        for (auto circle : _dirtyCircles)
+        {
+            // the gradient of the texels next to the circle reads into it
+            circle.radius += std::max(_fieldTexelSize.x, _fieldTexelSize.y);
+            
+            forEachOverlappedTile(circle, [&](size_t tileIndex)
+            {
+                // The tiles out of the band keep storing the band's width,
+                // which the render pass doesn't even sample.
+                if (isTileOccupied(tileIndex) || _wasTileOccupied[tileIndex])
+                {
+                    markTileDirty(tileIndex);
+                }
+            });
+        }
+    }
+    
+    /// The bubbles, stored densely.
+    std::vector<float2> _origins;
+    std::vector<float> _radii;
+    
+    /// The slot of each bubble, and the slots that handles resolve through.
+    std::vector<uint32_t> _bubbleSlots;
+    std::vector<Slot> _slots;
+    std::vector<uint32_t> _freeSlots;
+    
+    /// The cells of `_grid` each bubble is registered in.
+    std::vector<BubbleGrid::CellRange> _cellRanges;
+    BubbleGrid _grid;
+    
+    /// The scratch storage of `pickAll` and `moveSelections`.
+    std::vector<uint32_t> _pickedIndices;
+    std::vector<uint32_t> _movedIndices;
+    
+    /// A union-find forest of the bubbles, whose trees are the groups.
+    std::vector<uint32_t> _parents;
+    std::vector<uint32_t> _componentSizes;
+    
+    /// The smallest distance between the centers of two overlapping bubbles of
+    /// each component, stored at its root.
+    std::vector<float> _minDistances;
+    
+    /// The bubbles that changed since the last regrouping.
+    std::vector<uint32_t> _changedBubbles;
+    std::vector<uint32_t> _seeds;
+    bool _needsRebuild = false;
+    
+    /// Whether a bubble changed since the last `update` or `commitChanges`.
+    bool _hasChanges = false;
+    
+    std::vector<BubbleGroup> _groups;
+    std::vector<Bubble> _groupedBubbles;
+    size_t _maxGroupSize = 0;
+    
+    /// The dense index of each bubble of `_groupedBubbles`.
+    std::vector<uint32_t> _groupedIndices;
+    
+    /// The group of each bubble, and of each component root.
+    std::vector<uint32_t> _bubbleGroupIndices;
+    std::vector<uint32_t> _componentGroupIndices;
+    
+    std::vector<GroupCircle> _groupCircles;
+    
+    std::vector<TileBin> _tileBins;
+    std::vector<uint32_t> _tileGroupIndices;
+    uint2 _nbTiles { 0, 0 };
+    float2 _fieldTexelSize { 1.f, 1.f };
+    
+    /// The previous and current circles of the groups that changed during the last `update`.
+    std::vector<GroupCircle> _dirtyCircles;
+    std::vector<bool> _isPreviousGroupDirty;
+    std::vector<bool> _isGroupDirty;
+    
+    std::vector<uint32_t> _dirtyTiles;
+    std::vector<bool> _isTileDirty;
+    std::vector<bool> _wasTileOccupied;
+    
+    uint64_t _version = 0;
+    
+    /// The selections of the touches on screen, which refer to their bubbles by handle
+    /// so that the other touches can add and remove bubbles meanwhile.
+    std::vector<Selection> _selections;
+};
@@ -0,0 +1,496 @@
+#pragma once
+
+#import <simd/simd.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <span>
+#include <vector>
+
+#import "BubbleSet.h"
+
+/// The identifier of a bubble in a ``BubbleStream``, which the records of the stream choose.
+using StreamBubbleID = uint32_t;
+
+/// The kinds of records of a bubble stream, whose values are the first bytes of the records.
+enum class BubbleRecordType : uint32_t
+{
+    /// A scene, which replaces all the bubbles: `BBLS` in ASCII.
+    Scene = 0x534c4242,
+    
+    /// A batch of deltas, which removes, moves, resizes and adds bubbles: `BBLD` in ASCII.
+    Deltas = 0x444c4242,
+};
+
+/// The version of the records this build reads and writes.
+constexpr uint32_t kBubbleStreamVersion = 1;
+
+/// The alignment of the records of a stream, and of the arrays of `float2` they start with.
+constexpr size_t kBubbleRecordAlignment = alignof(float2);
+
+/// The number of identifiers a stream can give its bubbles, which keeps the table of their handles bounded.
+constexpr StreamBubbleID kMaxStreamBubbles = 1u << 24;
+
+/// How far the bubbles of a stream can reach from the center of the content, in multiples of its largest side.
+///
+/// The bound keeps the cells of ``BubbleGrid`` that a bubble covers in range, and their number small.
+constexpr float kMaxStreamBubbleExtent = 2.f;
+
+/// The header of a scene record, which the origins and then the radii of its bubbles follow.
+///
+/// A scene file is a stream of a single scene record, so mapping the file gives
+/// the arrays of a ``BubbleSet`` as they are.
+struct BubbleSceneHeader final
+{
+    BubbleRecordType type = BubbleRecordType::Scene;
+    uint32_t version = kBubbleStreamVersion;
+    uint32_t nbBubbles = 0;
+    uint32_t reserved = 0;
+    
+    /// The size of the background image the bubbles lie on, in SDF space.
+    float2 contentSize { 0.f, 0.f };
+};
+
+/// The header of a record of deltas, which the arrays of the deltas follow.
+///
+/// The arrays of 8-byte values come first: the origins of the moves, then the
+/// origins and the radii of the additions, the radii of the resizes, and at last
+/// the identifiers of the removals, the moves, the resizes and the additions.
+struct BubbleDeltasHeader final
+{
+    BubbleRecordType type = BubbleRecordType::Deltas;
+    uint32_t version = kBubbleStreamVersion;
+    uint32_t nbRemoved = 0;
+    uint32_t nbMoved = 0;
+    uint32_t nbResized = 0;
+    uint32_t nbAdded = 0;
+};
+
+static_assert(sizeof(BubbleSceneHeader) % kBubbleRecordAlignment == 0);
+static_assert(sizeof(BubbleDeltasHeader) % kBubbleRecordAlignment == 0);
+
+/// The bubbles of a scene record, whose arrays point into the bytes of the record.
+struct BubbleScene final
+{
+    float2 contentSize;
+    std::span<const float2> origins;
+    std::span<const float> radii;
+};
+
+/// The deltas of a record, whose arrays point into the bytes of the record.
+struct BubbleDeltas final
+{
+    std::span<const StreamBubbleID> removed;
+    
+    std::span<const StreamBubbleID> moved;
+    std::span<const float2> movedOrigins;
+    
+    std::span<const StreamBubbleID> resized;
+    std::span<const float> resizedRadii;
+    
+    std::span<const StreamBubbleID> added;
+    std::span<const float2> addedOrigins;
+    std::span<const float> addedRadii;
+};
+
+/// A record of a bubble stream.
+struct BubbleRecord final
+{
+    BubbleRecordType type;
+    
+    /// The number of bytes of the record, padding included, which is where the next record starts.
+    size_t size;
+    
+    /// The bubbles of a ``BubbleRecordType/Scene`` record.
+    BubbleScene scene;
+    
+    /// The deltas of a ``BubbleRecordType/Deltas`` record.
+    BubbleDeltas deltas;
+};
+
+/// Returns the size of a record of a number of bytes, which the padding rounds up to the alignment of the records.
+constexpr size_t alignedBubbleRecordSize(size_t nbBytes)
+{
+    return (nbBytes + kBubbleRecordAlignment - 1) & ~(kBubbleRecordAlignment - 1);
+}
+
+inline size_t bubbleSceneRecordSize(const BubbleSceneHeader& header)
+{
+    return alignedBubbleRecordSize(sizeof(BubbleSceneHeader) + size_t(header.nbBubbles) * (sizeof(float2) + sizeof(float)));
+}
+
+inline size_t bubbleDeltasRecordSize(const BubbleDeltasHeader& header)
+{
+    const size_t nbOrigins = size_t(header.nbMoved) + header.nbAdded;
+    const size_t nbRadii = size_t(header.nbAdded) + header.nbResized;
+    const size_t nbIDs = size_t(header.nbRemoved) + header.nbMoved + header.nbResized + header.nbAdded;
+    
+    return alignedBubbleRecordSize(sizeof(BubbleDeltasHeader)
+                                   + nbOrigins * sizeof(float2)
+                                   + nbRadii * sizeof(float)
+                                   + nbIDs * sizeof(StreamBubbleID));
+}
+
+/// Returns whether an origin of a stream is finite and within ``kMaxStreamBubbleExtent`` of the content.
+inline bool isValidStreamOrigin(float2 origin, float2 contentSize)
+{
+    const float extent = kMaxStreamBubbleExtent * std::max(contentSize.x, contentSize.y);
+    const float2 offset = simd::abs(origin - contentSize * 0.5f);
+    
+    // The comparisons are false for NaN.
+    return offset.x <= extent && offset.y <= extent;
+}
+
+/// Returns whether a radius of a stream is positive and within ``kMaxStreamBubbleExtent`` of the content.
+inline bool isValidStreamRadius(float radius, float2 contentSize)
+{
+    return radius > 0.f && radius <= kMaxStreamBubbleExtent * std::max(contentSize.x, contentSize.y);
+}
+
+/// Returns whether all the origins and radii of a record pass ``isValidStreamOrigin`` and ``isValidStreamRadius``.
+inline bool areValidStreamBubbles(std::span<const float2> origins, std::span<const float> radii, float2 contentSize)
+{
+    return std::all_of(origins.begin(), origins.end(), [&](float2 origin) { return isValidStreamOrigin(origin, contentSize); })
+        && std::all_of(radii.begin(), radii.end(), [&](float radius) { return isValidStreamRadius(radius, contentSize); });
+}
+
+/// Returns the array of values at the current position of the bytes of a record, and moves past it.
+template <typename T>
+std::span<const T> takeBubbleRecordArray(const uint8_t*& bytes, uint32_t count)
+{
+    const std::span<const T> array { reinterpret_cast<const T*>(bytes), count };
+    bytes += array.size_bytes();
+    return array;
+}
+
+/// Reads the record that starts a number of bytes, without copying its arrays.
+///
+/// - Parameters:
+///   - bytes: The start of the record, aligned on ``kBubbleRecordAlignment``, like the bytes of a mapped file.
+///   - length: The number of bytes from `bytes` on, which can hold more records.
+///   - contentSize: The size of the background image the bubbles lie on, which bounds their origins and radii.
+/// - Returns: `std::nullopt` if the bytes are misaligned, don't start with a whole record of ``kBubbleStreamVersion``,
+///   or the record has an origin or a radius that ``areValidStreamBubbles`` rejects. The bubble set then stays as it is.
+inline std::optional<BubbleRecord> readBubbleRecord(const void* bytes, size_t length, float2 contentSize)
+{
+    if ((reinterpret_cast<uintptr_t>(bytes) % kBubbleRecordAlignment) != 0 || length < sizeof(BubbleDeltasHeader))
+    {
+        return std::nullopt;
+    }
+    
+    const auto* start = static_cast<const uint8_t*>(bytes);
+    
+    BubbleRecordType type;
+    uint32_t version;
+    std::memcpy(&type, start, sizeof(type));
+    std::memcpy(&version, start + sizeof(type), sizeof(version));
+    
+    if (version != kBubbleStreamVersion)
+    {
+        return std::nullopt;
+    }
+    
+    // Each array takes the bytes that follow the previous one.
+    const uint8_t* next = start;
+    
+    BubbleRecord record {};
+    record.type = type;
+    
+    switch (type)
+    {
+        case BubbleRecordType::Scene:
+        {
+            if (length < sizeof(BubbleSceneHeader))
+            {
+                return std::nullopt;
+            }
+            
+            BubbleSceneHeader header;
+            std::memcpy(&header, start, sizeof(header));
+            
+            record.size = bubbleSceneRecordSize(header);
+            if (length < record.size)
+            {
+                return std::nullopt;
+            }
+            
+            next += sizeof(header);
+            record.scene.contentSize = header.contentSize;
+            record.scene.origins = takeBubbleRecordArray<float2>(next, header.nbBubbles);
+            record.scene.radii = takeBubbleRecordArray<float>(next, header.nbBubbles);
+            
+            if (!areValidStreamBubbles(record.scene.origins, record.scene.radii, contentSize))
+            {
+                return std::nullopt;
+            }
+            
+            return record;
+        }
+        
+        case BubbleRecordType::Deltas:
+        {
+            BubbleDeltasHeader header;
+            std::memcpy(&header, start, sizeof(header));
+            
+            record.size = bubbleDeltasRecordSize(header);
+            if (length < record.size)
+            {
+                return std::nullopt;
+            }
+            
+            next += sizeof(header);
+            
+            BubbleDeltas& deltas = record.deltas;
+            deltas.movedOrigins = takeBubbleRecordArray<float2>(next, header.nbMoved);
+            deltas.addedOrigins = takeBubbleRecordArray<float2>(next, header.nbAdded);
+            deltas.addedRadii = takeBubbleRecordArray<float>(next, header.nbAdded);
+            deltas.resizedRadii = takeBubbleRecordArray<float>(next, header.nbResized);
+            deltas.removed = takeBubbleRecordArray<StreamBubbleID>(next, header.nbRemoved);
+            deltas.moved = takeBubbleRecordArray<StreamBubbleID>(next, header.nbMoved);
+            deltas.resized = takeBubbleRecordArray<StreamBubbleID>(next, header.nbResized);
+            deltas.added = takeBubbleRecordArray<StreamBubbleID>(next, header.nbAdded);
+            
+            if (!areValidStreamBubbles(deltas.movedOrigins, deltas.resizedRadii, contentSize)
+                || !areValidStreamBubbles(deltas.addedOrigins, deltas.addedRadii, contentSize))
+            {
+                return std::nullopt;
+            }
+            
+            return record;
+        }
+    }
+    
+    return std::nullopt;
+}
+
+/// Appends the bytes of values to a stream.
+template <typename T>
+void appendBubbleRecordBytes(std::vector<uint8_t>& stream, const T* values, size_t count)
+{
+    const auto* bytes = reinterpret_cast<const uint8_t*>(values);
+    stream.insert(stream.end(), bytes, bytes + count * sizeof(T));
+}
+
+/// Pads a stream to the start of its next record.
+inline void padBubbleRecord(std::vector<uint8_t>& stream)
+{
+    stream.resize(alignedBubbleRecordSize(stream.size()), 0);
+}
+
+/// Appends a scene record to a stream, which is the whole of a scene file.
+inline void appendBubbleScene(std::vector<uint8_t>& stream,
+                              std::span<const float2> origins,
+                              std::span<const float> radii,
+                              float2 contentSize)
+{
+    BubbleSceneHeader header;
+    header.nbBubbles = (uint32_t)std::min(origins.size(), radii.size());
+    header.contentSize = contentSize;
+    
+    stream.reserve(stream.size() + bubbleSceneRecordSize(header));
+    
+    appendBubbleRecordBytes(stream, &header, 1);
+    appendBubbleRecordBytes(stream, origins.data(), header.nbBubbles);
+    appendBubbleRecordBytes(stream, radii.data(), header.nbBubbles);
+    padBubbleRecord(stream);
+}
+
+/// The deltas a producer of a stream collects before it appends them as a record.
+class BubbleDeltaBatch final
+{
+public:
+    void remove(StreamBubbleID bubble)
+    {
+        _removed.push_back(bubble);
+    }
+    
+    void move(StreamBubbleID bubble, const float2& origin)
+    {
+        _moved.push_back(bubble);
+        _movedOrigins.push_back(origin);
+    }
+    
+    void resize(StreamBubbleID bubble, float radius)
+    {
+        _resized.push_back(bubble);
+        _resizedRadii.push_back(radius);
+    }
+    
+    void add(StreamBubbleID bubble, const float2& origin, float radius)
+    {
+        _added.push_back(bubble);
+        _addedOrigins.push_back(origin);
+        _addedRadii.push_back(radius);
+    }
+    
+    bool empty() const
+    {
+        return _removed.empty() && _moved.empty() && _resized.empty() && _added.empty();
+    }
+    
+    void clear()
+    {
+        _removed.clear();
+        _moved.clear();
+        _movedOrigins.clear();
+        _resized.clear();
+        _resizedRadii.clear();
+        _added.clear();
+        _addedOrigins.clear();
+        _addedRadii.clear();
+    }
+    
+    /// Appends the deltas to a stream as a single record.
+    void appendTo(std::vector<uint8_t>& stream) const
+    {
+        BubbleDeltasHeader header;
+        header.nbRemoved = (uint32_t)_removed.size();
+        header.nbMoved = (uint32_t)_moved.size();
+        header.nbResized = (uint32_t)_resized.size();
+        header.nbAdded = (uint32_t)_added.size();
+        
+        stream.reserve(stream.size() + bubbleDeltasRecordSize(header));
+        
+        appendBubbleRecordBytes(stream, &header, 1);
+        appendBubbleRecordBytes(stream, _movedOrigins.data(), _movedOrigins.size());
+        appendBubbleRecordBytes(stream, _addedOrigins.data(), _addedOrigins.size());
+        appendBubbleRecordBytes(stream, _addedRadii.data(), _addedRadii.size());
+        appendBubbleRecordBytes(stream, _resizedRadii.data(), _resizedRadii.size());
+        appendBubbleRecordBytes(stream, _removed.data(), _removed.size());
+        appendBubbleRecordBytes(stream, _moved.data(), _moved.size());
+        appendBubbleRecordBytes(stream, _resized.data(), _resized.size());
+        appendBubbleRecordBytes(stream, _added.data(), _added.size());
+        padBubbleRecord(stream);
+    }
+    
+private:
+    std::vector<StreamBubbleID> _removed;
+    std::vector<StreamBubbleID> _moved;
+    std::vector<float2> _movedOrigins;
+    std::vector<StreamBubbleID> _resized;
+    std::vector<float> _resizedRadii;
+    std::vector<StreamBubbleID> _added;
+    std::vector<float2> _addedOrigins;
+    std::vector<float> _addedRadii;
+};
+
+/// Applies the records of a stream to a ``BubbleSet``, and resolves the identifiers
+/// of the stream to the handles of the set.
+///
+/// The bubbles of a scene take the indices of its arrays as identifiers. A batch of deltas
+/// removes bubbles first, then moves and resizes them, and at last adds the new ones,
+/// and ignores the identifiers that don't refer to a bubble. Adding an identifier that
+/// refers to a bubble replaces it. The bubbles the set loses otherwise, like the ones
+/// a double tap removes, just stop answering to their identifiers.
+class BubbleStream final
+{
+public:
+    /// Applies the whole records of a number of bytes, in order.
+    ///
+    /// - Parameter contentSize: The size of the background image the bubbles lie on, for ``readBubbleRecord``.
+    /// - Returns: The number of bytes of the records it applied, which is less than
+    ///   `length` when the bytes end with a partial or an invalid record.
+    size_t apply(BubbleSet& bubbleSet, const void* bytes, size_t length, float2 contentSize)
+    {
+        size_t offset = 0;
+        while (offset < length)
+        {
+            const auto record = readBubbleRecord(static_cast<const uint8_t*>(bytes) + offset, length - offset, contentSize);
+            if (!record.has_value())
+            {
+                break;
+            }
+            
+            if (record->type == BubbleRecordType::Scene)
+            {
+                load(bubbleSet, record->scene);
+            }
+            else
+            {
+                apply(bubbleSet, record->deltas);
+            }
+            
+            offset += record->size;
+        }
+        
+        return offset;
+    }
+    
+    /// Replaces the bubbles of a set with the ones of a scene, which ``readBubbleRecord`` has checked.
+    void load(BubbleSet& bubbleSet, const BubbleScene& scene)
+    {
+        const size_t nbBubbles = std::min(scene.origins.size(), size_t(kMaxStreamBubbles));
+        
+        bubbleSet.removeAll();
+        bubbleSet.reserve(nbBubbles);
+        
+        _handles.resize(nbBubbles);
+        for (size_t i = 0; i < nbBubbles; ++i)
+        {
+            _handles[i] = bubbleSet.add(scene.origins[i], scene.radii[i]);
+        }
+    }
+    
+    /// Applies a batch of deltas to the bubbles of a set, which ``readBubbleRecord`` has checked.
+    void apply(BubbleSet& bubbleSet, const BubbleDeltas& deltas)
+    {
+        for (const StreamBubbleID bubble : deltas.removed)
+        {
+            if (bubble < _handles.size())
+            {
+                bubbleSet.remove(_handles[bubble]);
+                _handles[bubble] = BubbleHandle {};
+            }
+        }
+        
+        for (size_t i = 0; i < deltas.moved.size(); ++i)
+        {
+            if (deltas.moved[i] < _handles.size())
+            {
+                bubbleSet.setOrigin(_handles[deltas.moved[i]], deltas.movedOrigins[i]);
+            }
+        }
+        
+        for (size_t i = 0; i < deltas.resized.size(); ++i)
+        {
+            if (deltas.resized[i] < _handles.size())
+            {
+                bubbleSet.setRadius(_handles[deltas.resized[i]], deltas.resizedRadii[i]);
+            }
+        }
+        
+        for (size_t i = 0; i < deltas.added.size(); ++i)
+        {
+            const StreamBubbleID bubble = deltas.added[i];
+            if (bubble >= kMaxStreamBubbles)
+            {
+                continue;
+            }
+            
+            if (bubble >= _handles.size())
+            {
+                _handles.resize(bubble + 1);
+            }
+            
+            bubbleSet.remove(_handles[bubble]);
+            _handles[bubble] = bubbleSet.add(deltas.addedOrigins[i], deltas.addedRadii[i]);
+        }
+    }
+    
+    /// Returns the handle of the bubble an identifier of the stream refers to, if the set still has it.
+    std::optional<BubbleHandle> handleOf(const BubbleSet& bubbleSet, StreamBubbleID bubble) const
+    {
+        if (bubble >= _handles.size() || !bubbleSet.contains(_handles[bubble]))
+        {
+            return std::nullopt;
+        }
+        
+        return _handles[bubble];
+    }
+    
+private:
+    /// The handle of each identifier, which is a default handle for the identifiers without a bubble.
+    std::vector<BubbleHandle> _handles;
+};
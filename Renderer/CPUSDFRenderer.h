@@ -0,0 +1,388 @@
+#pragma once
+
+#import <simd/simd.h>
+#import <dispatch/dispatch.h>
+
+#include <cstdint>
+#include <type_traits>
+#include <vector>
+
+#import "ShaderTypes.h"
+#import "BubbleSet.h"
+
+/// Several texels of a row, one per lane of `TLane`, in SDF space.
+template <typename TLane>
+struct TexelLanes final
+{
+    TLane x;
+    TLane y;
+};
+
+/// The distances of the texels of a ``TexelLanes``.
+template <typename TLane>
+struct DistanceLanes final
+{
+    TLane d;
+};
+
+/// The distances of the texels of a ``TexelLanes``, along with their gradients.
+template <typename TLane>
+struct DistanceAndGradientLanes final
+{
+    TLane d;
+    TLane dx;
+    TLane dy;
+};
+
+template <typename TLane>
+struct SDFPointTraits<TexelLanes<TLane>> final
+{
+    using Distance = DistanceLanes<TLane>;
+    using DistanceAndGradient = DistanceAndGradientLanes<TLane>;
+    
+    static Distance outside(float band)
+    {
+        return { TLane {} + band };
+    }
+    
+    static DistanceAndGradient outsideWithGradient(float band)
+    {
+        return { TLane {} + band, TLane {}, TLane {} };
+    }
+};
+
+template <typename TLane>
+struct BubbleEvaluator<DistanceLanes<TLane>> final
+{
+    static DistanceLanes<TLane> evaluate(const Bubble* bubble, const TexelLanes<TLane>& pt)
+    {
+        const TLane x = pt.x - bubble->origin.x;
+        const TLane y = pt.y - bubble->origin.y;
+        
+        return { simd::sqrt(x * x + y * y) - bubble->radius };
+    }
+};
+
+template <typename TLane>
+struct BubbleEvaluator<DistanceAndGradientLanes<TLane>> final
+{
+    static DistanceAndGradientLanes<TLane> evaluate(const Bubble* bubble, const TexelLanes<TLane>& pt)
+    {
+        const TLane x = pt.x - bubble->origin.x;
+        const TLane y = pt.y - bubble->origin.y;
+        const TLane l = simd::sqrt(x * x + y * y);
+        
+        // The gradient is zero at the center, as `Bubble::computeSDFAndGradient` returns.
+        const TLane inverseLength = simd_select(TLane {}, 1.f / l, l > 0.f);
+        
+        return { l - bubble->radius, x * inverseLength, y * inverseLength };
+    }
+};
+
+template <typename TLane>
+DistanceLanes<TLane> opSmoothUnion(DistanceLanes<TLane> d1, DistanceLanes<TLane> d2, float k)
+{
+    k *= 4.0;
+    const TLane h = simd::max(k - simd::abs(d1.d - d2.d), TLane {});
+    return { simd::min(d1.d, d2.d) - h*h*0.25f/k };
+}
+
+template <typename TLane>
+DistanceAndGradientLanes<TLane> opSmoothUnion(DistanceAndGradientLanes<TLane> d1,
+                                              DistanceAndGradientLanes<TLane> d2,
+                                              float k)
+{
+    k *= 4.0;
+    const TLane h = simd::max(k - simd::abs(d1.d - d2.d), TLane {});
+    const TLane m = h*0.5f/k;
+    
+    const auto isFirstCloser = d1.d < d2.d;
+    const TLane closest = simd_select(d2.d, d1.d, isFirstCloser);
+    const TLane closestDx = simd_select(d2.dx, d1.dx, isFirstCloser);
+    const TLane closestDy = simd_select(d2.dy, d1.dy, isFirstCloser);
+    const TLane otherDx = simd_select(d1.dx, d2.dx, isFirstCloser);
+    const TLane otherDy = simd_select(d1.dy, d2.dy, isFirstCloser);
+    
+    return {
+        closest - h*h*0.25f/k,
+        closestDx * (1.f - m) + otherDx * m,
+        closestDy * (1.f - m) + otherDy * m
+    };
+}
+
+/// Folds the distances of a group into the distances of texels, as the scalar
+/// `foldGroupDistance` does for each lane.
+///
+/// The lanes already inside keep their distance.
+template <typename TLane>
+bool foldGroupDistance(DistanceLanes<TLane>& distance, const DistanceLanes<TLane>& d)
+{
+    distance.d = simd_select(distance.d, simd::min(distance.d, d.d), distance.d > 0.f);
+    return simd_all(distance.d <= 0.f);
+}
+
+template <typename TLane>
+bool foldGroupDistance(DistanceAndGradientLanes<TLane>& distance, const DistanceAndGradientLanes<TLane>& d)
+{
+    const auto isCloser = (d.d < distance.d) & (distance.d > 0.f);
+    
+    distance.d = simd_select(distance.d, d.d, isCloser);
+    distance.dx = simd_select(distance.dx, d.dx, isCloser);
+    distance.dy = simd_select(distance.dy, d.dy, isCloser);
+    
+    return simd_all(distance.d <= 0.f);
+}
+
+template <typename TLane>
+DistanceAndGradientLanes<TLane> packDistanceAndGradient(const DistanceAndGradientLanes<TLane>& d)
+{
+    const TLane l = simd::sqrt(d.dx * d.dx + d.dy * d.dy);
+    const TLane inverseLength = simd_select(TLane {}, 1.f / l, l > 0.f);
+    
+    return { d.d, d.dx * inverseLength, d.dy * inverseLength };
+}
+
+/// An accessor that lets the SDF templates evaluate a single texel on the CPU.
+///
+/// The accessor writes into storage the caller owns, so the templates can copy
+/// it by value without any allocation.
+class CPUTexelAccessor final
+{
+public:
+    /// Creates an accessor for the texel at `gridId` of an image of `size` texels.
+    ///
+    /// - Parameter texel: The storage of the texel, which needs to outlive the accessor.
+    CPUTexelAccessor(float4* texel, uint2 size, uint2 gridId, float2 texelSize)
+    : _texel(texel), _size(size), _gridId(gridId), _texelSize(texelSize)
+    {}
+    
+    bool isValid() const
+    {
+        return (_gridId.x < _size.x) && (_gridId.y < _size.y);
+    }
+    
+    uint2 gridId() const
+    {
+        return _gridId;
+    }
+    
+    float2 position() const
+    {
+        return texelPositionInSDFSpace(_gridId, _texelSize);
+    }
+    
+    /// Writes the distance into the first channel of the texel.
+    void write(float distance) const
+    {
+        _texel->x = distance;
+    }
+    
+    void writeFloat4(float4 distanceAndGradient) const
+    {
+        *_texel = distanceAndGradient;
+    }
+    
+private:
+    float4* _texel;
+    uint2 _size;
+    uint2 _gridId;
+    float2 _texelSize;
+};
+
+/// An accessor that lets the SDF templates evaluate consecutive texels of a row at once.
+///
+/// The texels stay within one `SDFTileSize` tile, and the accessor drops the
+/// lanes past the right edge of the image. Like ``CPUTexelAccessor``, it writes
+/// into storage the caller owns.
+template <typename TLane>
+class CPULaneAccessor final
+{
+public:
+    static constexpr uint32_t kNbLanes = sizeof(TLane) / sizeof(float);
+    
+    /// Creates an accessor for the texels from `gridId` on, in a row of an image of `size` texels.
+    ///
+    /// - Parameter texels: The storage of the first texel, followed by the others of the row.
+    CPULaneAccessor(float4* texels, uint2 size, uint2 gridId, float2 texelSize)
+    : _texels(texels), _size(size), _gridId(gridId), _texelSize(texelSize)
+    {}
+    
+    bool isValid() const
+    {
+        return (_gridId.x < _size.x) && (_gridId.y < _size.y);
+    }
+    
+    uint2 gridId() const
+    {
+        return _gridId;
+    }
+    
+    TexelLanes<TLane> position() const
+    {
+        const float2 first = texelPositionInSDFSpace(_gridId, _texelSize);
+        
+        TexelLanes<TLane> pt { TLane {} + first.x, TLane {} + first.y };
+        for (uint32_t i=0; i < kNbLanes; ++i)
+        {
+            pt.x[i] += float(i) * _texelSize.x;
+        }
+        
+        return pt;
+    }
+    
+    /// Writes the distances into the first channel of the pixels.
+    void write(const DistanceLanes<TLane>& distance) const
+    {
+        for (uint32_t i=0; i < nbValidLanes(); ++i)
+        {
+            _texels[i].x = distance.d[i];
+        }
+    }
+    
+    void writeFloat4(const DistanceAndGradientLanes<TLane>& distance) const
+    {
+        for (uint32_t i=0; i < nbValidLanes(); ++i)
+        {
+            _texels[i] = float4 { distance.d[i], distance.dx[i], distance.dy[i], 0.f };
+        }
+    }
+
+private:
+    uint32_t nbValidLanes() const
+    {
+        return std::min(kNbLanes, _size.x - _gridId.x);
+    }
+    
+    float4* _texels;
+    uint2 _size;
+    uint2 _gridId;
+    float2 _texelSize;
+};
+
+/// A backend that fills SDF images on the CPU with the templates the compute kernels run.
+///
+/// The renderer evaluates `kNbLanes` texels per call, and spreads the tiles across
+/// the cores. Its image stores the distance and gradient of each texel as the fused
+/// compute pass does, which makes it a reference for the GPU passes, and a fallback
+/// for GPUs that don't support Metal 4.
+class CPUSDFRenderer final
+{
+public:
+    using Lane = simd::float8;
+    using Accessor = CPULaneAccessor<Lane>;
+    
+    static constexpr uint32_t kNbLanes = Accessor::kNbLanes;
+    static_assert(SDFTileSize % kNbLanes == 0, "The lanes of an accessor need to stay within a tile.");
+    
+    /// Creates a renderer for an image of `size` texels, each covering `fieldTexelSize` in SDF space.
+    CPUSDFRenderer(uint2 size, float2 fieldTexelSize)
+    : _size(size), _fieldTexelSize(fieldTexelSize), _pixels(size_t(size.x) * size.y, float4 { 0.f, 0.f, 0.f, 0.f })
+    {}
+    
+    uint2 size() const
+    {
+        return _size;
+    }
+    
+    /// The number of `SDFTileSize` tiles in each dimension of the image.
+    uint2 nbTiles() const
+    {
+        return (_size + uint32_t(SDFTileSize) - 1) / uint32_t(SDFTileSize);
+    }
+    
+    float2 fieldTexelSize() const
+    {
+        return _fieldTexelSize;
+    }
+    
+    /// The distance and gradient of each texel, row by row.
+    const std::vector<float4>& pixels() const
+    {
+        return _pixels;
+    }
+    
+    /// Computes the distances and gradients of a list of packed tiles.
+    ///
+    /// `bubbleSet` needs to be up to date for the tiles of the image,
+    /// for example with the tiles of `dirtyTiles()`.
+    void render(const BubbleSet& bubbleSet, const std::vector<uint32_t>& tiles)
+    {
+        const Uniforms uniforms = makeUniforms(bubbleSet);
+        
+        forEachTile(tiles.size(), [&](size_t i)
+        {
+            renderTile(bubbleSet, uniforms, unpackTileCoordinates(tiles[i]));
+        });
+    }
+    
+    /// Computes the distances and gradients of the whole image.
+    void renderAll(const BubbleSet& bubbleSet)
+    {
+        const Uniforms uniforms = makeUniforms(bubbleSet);
+        const uint2 tiles = nbTiles();
+        
+        forEachTile(size_t(tiles.x) * tiles.y, [&](size_t i)
+        {
+            renderTile(bubbleSet, uniforms, uint2 { uint32_t(i % tiles.x), uint32_t(i / tiles.x) });
+        });
+    }
+
+private:
+    Uniforms makeUniforms(const BubbleSet& bubbleSet) const
+    {
+        Uniforms uniforms {};
+        uniforms.nbBubbleGroups = bubbleSet.groups().size();
+        uniforms.nbTilesPerRow = nbTiles().x;
+        uniforms.fieldTexelSize = _fieldTexelSize;
+        
+        return uniforms;
+    }
+    
+    void renderTile(const BubbleSet& bubbleSet, const Uniforms& uniforms, uint2 tile)
+    {
+        const auto& groups = bubbleSet.groups();
+        const auto& bubbles = bubbleSet.groupedBubbles();
+        const auto& tileBins = bubbleSet.tileBins();
+        const auto& tileGroupIndices = bubbleSet.tileGroupIndices();
+        
+        const uint2 tileOrigin = tile * uint32_t(SDFTileSize);
+        
+        for (uint32_t y=0; y < SDFTileSize; ++y)
+        {
+            for (uint32_t x=0; x < SDFTileSize; x += kNbLanes)
+            {
+                const uint2 gridId = tileOrigin + uint2 { x, y };
+                if (gridId.x >= _size.x || gridId.y >= _size.y)
+                {
+                    continue;
+                }
+                
+                float4* texels = &_pixels[size_t(gridId.y) * _size.x + gridId.x];
+                const Accessor accessor { texels, _size, gridId, _fieldTexelSize };
+                
+                computeAndDrawSDFAndGradient(accessor,
+                                             &uniforms,
+                                             groups.data(),
+                                             bubbles.data(),
+                                             tileBins.data(),
+                                             tileGroupIndices.data());
+            }
+        }
+    }
+    
+    /// Calls `f` with each index in `[0, count)`, concurrently.
+    template <typename F>
+    static void forEachTile(size_t count, F&& f)
+    {
+        using Function = std::remove_reference_t<F>;
+        
+        dispatch_apply_f(count, DISPATCH_APPLY_AUTO, &f, [](void* context, size_t i)
+        {
+            (*static_cast<Function*>(context))(i);
+        });
+    }
+    
+    uint2 _size;
+    float2 _fieldTexelSize;
+    std::vector<float4> _pixels;
+};
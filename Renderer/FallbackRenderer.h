@@ -0,0 +1,36 @@
+#import <MetalKit/MetalKit.h>
+
+#import "Metal4Renderer.h"
+
+/// A renderer for systems whose GPUs don't support Metal 4.
+///
+/// The renderer computes the SDF and its gradient on the CPU, and only draws
+/// the composite on the GPU with the same shaders as ``Metal4Renderer``.
+@interface FallbackRenderer : NSObject<MTKViewDelegate>
+
+/// Creates a renderer that computes a half-resolution field.
+- (nonnull instancetype)initWithView:(nonnull MTKView *)mtkView;
+
+/// Creates a renderer for a view.
+///
+/// - Parameter fieldScale: The resolution of the SDF texture relative to the background image.
+- (nonnull instancetype)initWithView:(nonnull MTKView *)mtkView
+                          fieldScale:(SDFFieldScale)fieldScale;
+
+/// Creates a renderer for a view.
+///
+/// - Parameters:
+///   - fieldScale: The resolution of the SDF texture relative to the background image.
+///   - texelFormat: The layout of the texels the renderer uploads, which halves
+///     the uploads with ``SDFTexelFormatPacked``.
+- (nonnull instancetype)initWithView:(nonnull MTKView *)mtkView
+                          fieldScale:(SDFFieldScale)fieldScale
+                         texelFormat:(SDFTexelFormat)texelFormat;
+
+/// The resolution of the SDF texture relative to the background image.
+@property (nonatomic, readonly) SDFFieldScale fieldScale;
+
+/// The layout of the texels of the SDF texture.
+@property (nonatomic, readonly) SDFTexelFormat texelFormat;
+
+@end
@@ -0,0 +1,374 @@
+#import <simd/simd.h>
+#import <MetalKit/MetalKit.h>
+
+#import "UIKit/UIKit.h"
+
+#import "FallbackRenderer.h"
+#import "TextureLoader.h"
+
+#include <algorithm>
+#include <optional>
+
+#import "ShaderTypes.h"
+#import "BubbleSet.h"
+#import "CPUSDFRenderer.h"
+#import "RendererSupport.h"
+
+using namespace simd;
+
+/// A class that renders each of the app's video frames without Metal 4.
+@implementation FallbackRenderer
+{
+    UIView* view;
+    
+    id<MTLDevice> device;
+    id<MTLCommandQueue> commandQueue;
+    id<MTLLibrary> defaultLibrary;
+    id<MTLRenderPipelineState> renderPipelineState;
+    
+    /// The command buffer of the previous frame.
+    ///
+    /// The renderer waits for it before it writes the resources the GPU reads.
+    id<MTLCommandBuffer> previousCommandBuffer;
+    
+    id<MTLTexture> backgroundImageTexture;
+    
+    /// A texture that stores the distance and gradient the CPU computes for each texel.
+    id<MTLTexture> sdfGradientTexture;
+    
+    /// The size of an SDF texel in the pixels of the background image.
+    float2 fieldTexelSize;
+    
+    id<MTLBuffer> vertexDataBuffer;
+    id<MTLBuffer> uniformsBuffer;
+    id<MTLBuffer> tileBinsBuffer;
+    
+    float2 viewportSize;
+    float2 lightDirection;
+    
+    BubbleSet _bubbleSet;
+    std::optional<CPUSDFRenderer> _sdfRenderer;
+}
+
+- (nonnull instancetype)initWithView:(nonnull MTKView *)mtkView
+{
+    return [self initWithView:mtkView fieldScale:SDFFieldScaleHalf];
+}
+
+- (nonnull instancetype)initWithView:(nonnull MTKView *)mtkView
+                          fieldScale:(SDFFieldScale)fieldScale
+{
+    return [self initWithView:mtkView fieldScale:fieldScale texelFormat:SDFTexelFormatRGBA16Float];
+}
+
+- (nonnull instancetype)initWithView:(nonnull MTKView *)mtkView
+                          fieldScale:(SDFFieldScale)fieldScale
+                         texelFormat:(SDFTexelFormat)texelFormat
+{
+    self = [super init];
+    if (nil == self) { return nil; }
+    
+    _fieldScale = fieldScale;
+    _texelFormat = texelFormat;
+    
+    view = mtkView;
+    device = mtkView.device;
+    viewportSize.x = (simd_uint1)mtkView.drawableSize.width;
+    viewportSize.y = (simd_uint1)mtkView.drawableSize.height;
+    lightDirection = normalize(float2{1.f, -1.f});
+    
+    commandQueue = [device newCommandQueue];
+    defaultLibrary = [device newDefaultLibrary];
+    
+    [self createTextures];
+    [self createBuffers];
+    
+    const MTLPixelFormat pixelFormat = MTLPixelFormatBGRA8Unorm_sRGB;
+    mtkView.colorPixelFormat = pixelFormat;
+    
+    [self createRenderPipelineFor:pixelFormat];
+    
+    auto panGestureRecognizer = [[UIPanGestureRecognizer alloc] initWithTarget:self action:@selector(onPan:)];
+    [mtkView addGestureRecognizer:panGestureRecognizer];
+    
+    auto doubleTapGestureRecognizer = [[UITapGestureRecognizer alloc] initWithTarget:self action:@selector(onDoubleTap:)];
+    doubleTapGestureRecognizer.numberOfTapsRequired = 2;
+    [mtkView addGestureRecognizer:doubleTapGestureRecognizer];
+    
+    auto scaleRecognizer = [[UIPinchGestureRecognizer alloc] initWithTarget:self action:@selector(onPinch:)];
+    [mtkView addGestureRecognizer:scaleRecognizer];
+    
+    return self;
+}
+
+- (void) createTextures
+{
+    NSBundle *bundle = [NSBundle mainBundle];
+    NSURL *backgroundImageFile = [bundle URLForResource:@"water" withExtension:@"ktx"]
+                              ?: [bundle URLForResource:@"water" withExtension:@"tga"];
+    
+    TextureLoader *textureLoader = [[TextureLoader alloc] initWithDevice:device];
+    backgroundImageTexture = [textureLoader newTextureWithContentsOfURL:backgroundImageFile];
+    NSAssert(nil != backgroundImageTexture, @"The app can't load the background image: %@", backgroundImageFile);
+    backgroundImageTexture.label = @"BackgroundImageTexture";
+    
+    const NSUInteger imageWidth = backgroundImageTexture.width;
+    const NSUInteger imageHeight = backgroundImageTexture.height;
+    
+    MTLTextureDescriptor *textureDescriptor = [[MTLTextureDescriptor alloc] init];
+    textureDescriptor.textureType = MTLTextureType2D;
+    textureDescriptor.usage = MTLTextureUsageShaderRead;
+    
+    // The SDF texture covers the background image at the field scale.
+    textureDescriptor.pixelFormat = (_texelFormat == SDFTexelFormatPacked) ? MTLPixelFormatR32Uint : MTLPixelFormatRGBA16Float;
+    textureDescriptor.width = (imageWidth + _fieldScale - 1) / _fieldScale;
+    textureDescriptor.height = (imageHeight + _fieldScale - 1) / _fieldScale;
+    
+    fieldTexelSize = float2 {
+        float(imageWidth) / float(textureDescriptor.width),
+        float(imageHeight) / float(textureDescriptor.height)
+    };
+    
+    sdfGradientTexture = [device newTextureWithDescriptor:textureDescriptor];
+    NSAssert(nil != sdfGradientTexture, @"The device can't create a texture for the gradient.");
+    sdfGradientTexture.label = @"SDF Gradient Texture";
+    
+    _sdfRenderer.emplace(uint2 { uint32_t(textureDescriptor.width), uint32_t(textureDescriptor.height) },
+                         fieldTexelSize);
+}
+
+- (void) createBuffers
+{
+    const float2 contentSize { float(backgroundImageTexture.width), float(backgroundImageTexture.height) };
+    const float2 vSize { float(viewportSize.x), float(viewportSize.y) };
+    
+    vertexDataBuffer = [device newBufferWithLength:kNbRectangleVertices * sizeof(VertexData)
+                                           options:MTLResourceStorageModeShared];
+    
+    getRectangleVertexData(reinterpret_cast<VertexData*>(vertexDataBuffer.contents), vSize, contentSize);
+    
+    uniformsBuffer = [device newBufferWithLength:sizeof(Uniforms) options:MTLResourceStorageModeShared];
+    uniformsBuffer.label = @"Uniforms";
+    
+    const uint2 nbTiles = _sdfRenderer->nbTiles();
+    tileBinsBuffer = [device newBufferWithLength:size_t(nbTiles.x) * nbTiles.y * sizeof(TileBin)
+                                         options:MTLResourceStorageModeShared];
+    tileBinsBuffer.label = @"Tile Bins";
+}
+
+- (void) createRenderPipelineFor:(MTLPixelFormat)pixelFormat
+{
+    MTLRenderPipelineDescriptor *pipelineDescriptor = [MTLRenderPipelineDescriptor new];
+    pipelineDescriptor.label = @"Fallback Render Pipeline";
+    pipelineDescriptor.vertexFunction = [defaultLibrary newFunctionWithName:@"vertexShader"];
+    
+    // The CPU SDF doesn't build the pyramid of the SDF.
+    const bool usesSDFPyramid = false;
+    
+    MTLFunctionConstantValues *constantValues = [MTLFunctionConstantValues new];
+    [constantValues setConstantValue:&usesSDFPyramid
+                                type:MTLDataTypeBool
+                             atIndex:FunctionConstantIndexUsesSDFPyramid];
+    
+    NSError *error = NULL;
+    pipelineDescriptor.fragmentFunction = [defaultLibrary newFunctionWithName:(_texelFormat == SDFTexelFormatPacked)
+                                                                              ? @"samplingPackedShader" : @"samplingShader"
+                                                               constantValues:constantValues
+                                                                        error:&error];
+    NSAssert(nil != pipelineDescriptor.fragmentFunction,
+             @"The library can't specialize the fragment shader due to: %@",
+             error);
+    pipelineDescriptor.colorAttachments[0].pixelFormat = pixelFormat;
+    
+    renderPipelineState = [device newRenderPipelineStateWithDescriptor:pipelineDescriptor error:&error];
+    NSAssert(nil != renderPipelineState,
+             @"The device can't create a render pipeline due to: %@",
+             error);
+}
+
+/// Computes the tiles of the SDF that changed on the CPU, and uploads them.
+- (void)updateScene
+{
+    const uint2 nbTiles = _sdfRenderer->nbTiles();
+    const bool sceneChanged = _bubbleSet.update(nbTiles, fieldTexelSize);
+    
+    const auto& dirtyTiles = _bubbleSet.dirtyTiles();
+    if (!dirtyTiles.empty())
+    {
+        _sdfRenderer->render(_bubbleSet, dirtyTiles);
+        
+        for (const uint32_t packedTile : dirtyTiles)
+        {
+            [self uploadTile:unpackTileCoordinates(packedTile)];
+        }
+        
+        _bubbleSet.clearDirtyTiles();
+    }
+    
+    if (sceneChanged)
+    {
+        const auto& tileBins = _bubbleSet.tileBins();
+        memcpy(tileBinsBuffer.contents, tileBins.data(), tileBins.size() * sizeof(TileBin));
+    }
+    
+    auto uniforms = reinterpret_cast<Uniforms*>(uniformsBuffer.contents);
+    
+    constexpr float s = 3e1f;
+    uniforms->viewportSize = viewportSize;
+    uniforms->gradientScale = float2 { s / float(backgroundImageTexture.width), s / float(backgroundImageTexture.height) };
+    uniforms->lightDirection = lightDirection;
+    uniforms->nbBubbleGroups = _bubbleSet.groups().size();
+    uniforms->nbTilesPerRow = nbTiles.x;
+    uniforms->fieldTexelSize = fieldTexelSize;
+}
+
+/// Converts a tile of the CPU image to the texel format, and copies it into the SDF texture.
+- (void)uploadTile:(uint2)tile
+{
+    const uint2 size = _sdfRenderer->size();
+    const uint2 origin = tile * uint32_t(SDFTileSize);
+    const uint2 extent = simd::min(origin + uint32_t(SDFTileSize), size) - origin;
+    
+    const auto& pixels = _sdfRenderer->pixels();
+    
+    if (_texelFormat == SDFTexelFormatPacked)
+    {
+        // The GPU kernels pack their texels with the same function.
+        uint32_t packedTexels[SDFTileSize * SDFTileSize];
+        
+        for (uint32_t y = 0; y < extent.y; ++y)
+        {
+            const float4* row = &pixels[size_t(origin.y + y) * size.x + origin.x];
+            for (uint32_t x = 0; x < extent.x; ++x)
+            {
+                packedTexels[y * extent.x + x] = packSDFTexel(row[x]);
+            }
+        }
+        
+        [sdfGradientTexture replaceRegion:MTLRegionMake2D(origin.x, origin.y, extent.x, extent.y)
+                              mipmapLevel:0
+                                withBytes:packedTexels
+                              bytesPerRow:extent.x * sizeof(uint32_t)];
+        return;
+    }
+    
+    simd_half4 texels[SDFTileSize * SDFTileSize];
+    
+    for (uint32_t y = 0; y < extent.y; ++y)
+    {
+        const float4* row = &pixels[size_t(origin.y + y) * size.x + origin.x];
+        for (uint32_t x = 0; x < extent.x; ++x)
+        {
+            const float4 p = row[x];
+            texels[y * extent.x + x] = simd_half4 { _Float16(p.x), _Float16(p.y), _Float16(p.z), _Float16(p.w) };
+        }
+    }
+    
+    [sdfGradientTexture replaceRegion:MTLRegionMake2D(origin.x, origin.y, extent.x, extent.y)
+                          mipmapLevel:0
+                            withBytes:texels
+                          bytesPerRow:extent.x * sizeof(simd_half4)];
+}
+
+- (void)mtkView:(nonnull MTKView *)view drawableSizeWillChange:(CGSize)size
+{
+    viewportSize.x = (simd_uint1)size.width;
+    viewportSize.y = (simd_uint1)size.height;
+}
+
+- (void)drawInMTKView:(nonnull MTKView *)view
+{
+    MTLRenderPassDescriptor *renderPassDescriptor = view.currentRenderPassDescriptor;
+    id<CAMetalDrawable> drawable = view.currentDrawable;
+    
+    if (nil == renderPassDescriptor || nil == drawable)
+    {
+        return;
+    }
+    
+    // The GPU reads the SDF texture and the buffers until the previous frame completes.
+    [previousCommandBuffer waitUntilCompleted];
+    
+    [self updateScene];
+    
+    id<MTLCommandBuffer> commandBuffer = [commandQueue commandBuffer];
+    commandBuffer.label = @"Fallback command buffer";
+    
+    id<MTLRenderCommandEncoder> renderEncoder = [commandBuffer renderCommandEncoderWithDescriptor:renderPassDescriptor];
+    
+    MTLViewport viewPort;
+    viewPort.originX = 0.0;
+    viewPort.originY = 0.0;
+    viewPort.width = (double)viewportSize.x;
+    viewPort.height = (double)viewportSize.y;
+    viewPort.znear = 0.0;
+    viewPort.zfar = 1.0;
+    
+    [renderEncoder setViewport:viewPort];
+    [renderEncoder setRenderPipelineState:renderPipelineState];
+    
+    [renderEncoder setVertexBuffer:vertexDataBuffer offset:0 atIndex:BufferBindingIndexForVertexData];
+    [renderEncoder setVertexBuffer:uniformsBuffer offset:0 atIndex:BufferBindingIndexForUniforms];
+    [renderEncoder setFragmentBuffer:uniformsBuffer offset:0 atIndex:BufferBindingIndexForUniforms];
+    [renderEncoder setFragmentBuffer:tileBinsBuffer offset:0 atIndex:BufferBindingIndexForTileBins];
+    [renderEncoder setFragmentTexture:backgroundImageTexture atIndex:RenderTextureBindingIndex];
+    [renderEncoder setFragmentTexture:sdfGradientTexture atIndex:SDFGradientTextureBindingIndex];
+    
+    [renderEncoder drawPrimitives:MTLPrimitiveTypeTriangle vertexStart:0 vertexCount:kNbRectangleVertices];
+    [renderEncoder endEncoding];
+    
+    [commandBuffer presentDrawable:drawable];
+    [commandBuffer commit];
+    
+    previousCommandBuffer = commandBuffer;
+}
+
+- (float2)pointInSDFSpace:(float2)pos
+{
+    const CGSize viewSize = view.bounds.size;
+    
+    return ::pointInSDFSpace(pos,
+                             float2 { float(viewSize.width), float(viewSize.height) },
+                             float2 { float(backgroundImageTexture.width), float(backgroundImageTexture.height) });
+}
+
+- (void)onPan:(UIPanGestureRecognizer*)recognizer
+{
+    const auto p = [recognizer locationInView:view];
+    const auto ptInSDFSpace = [self pointInSDFSpace:float2 { float(p.x), float(p.y) }];
+    
+    const TouchID touch = touchIDOf(recognizer);
+    const auto pick = [&](float2 point) { return _bubbleSet.pick(point); };
+    
+    updateGestureSelection(_bubbleSet, touch, recognizer.state, ptInSDFSpace, pick, [&]
+    {
+        _bubbleSet.moveSelection(touch, ptInSDFSpace);
+    });
+}
+
+- (void)onDoubleTap:(UITapGestureRecognizer*)recognizer
+{
+    if (recognizer.state == UIGestureRecognizerStateRecognized)
+    {
+        const CGPoint ptView = [recognizer locationInView:view];
+        const float2 ptSDF = [self pointInSDFSpace: float2{ float(ptView.x), float(ptView.y) }];
+        
+        addOrRemoveBubble(_bubbleSet, ptSDF, [&](float2 point) { return _bubbleSet.pick(point); });
+    }
+}
+
+- (void)onPinch:(UIPinchGestureRecognizer*)recognizer
+{
+    const auto p = [recognizer locationInView:view];
+    const auto posInSDFSpace = [self pointInSDFSpace:float2 { float(p.x), float(p.y) }];
+    
+    const TouchID touch = touchIDOf(recognizer);
+    const auto pick = [&](float2 point) { return _bubbleSet.pick(point); };
+    
+    updateGestureSelection(_bubbleSet, touch, recognizer.state, posInSDFSpace, pick, [&]
+    {
+        _bubbleSet.rescaleSelection(touch, recognizer.scale);
+    });
+}
+
+@end
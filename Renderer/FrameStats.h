@@ -0,0 +1,149 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <vector>
+
+#import "Metal4Renderer.h"
+
+/// The parts of a frame whose durations ``FrameStats`` tracks.
+enum FramePhase : uint32_t
+{
+    /// The GPU pass that moves the bubbles, while the renderer simulates them.
+    FramePhaseSimulation,
+    
+    /// The GPU passes that group the bubbles.
+    FramePhaseGrouping,
+    
+    /// The GPU pass that computes the SDF, and its gradient when the pass is fused.
+    FramePhaseSDF,
+    
+    /// The GPU pass that differentiates the SDF texture.
+    FramePhaseGradient,
+    
+    /// The GPU passes that reduce the SDF into its pyramid.
+    FramePhasePyramid,
+    
+    /// The GPU pass that draws the composite.
+    FramePhaseRender,
+    
+    /// The CPU work that applies the bubble records of a frame and fills its buffers, which includes ``FramePhaseSceneUpdate``.
+    FramePhaseUniformsUpdate,
+    
+    /// The CPU work that updates the groups and dirty tiles of the bubble set.
+    FramePhaseSceneUpdate,
+    
+    /// The CPU work that encodes the command buffer of a frame.
+    FramePhaseEncoding,
+    
+    FramePhaseCount
+};
+
+/// The most recent values of a per-frame quantity, and their percentiles.
+class RollingSamples final
+{
+public:
+    /// The number of values the samples keep, about two seconds at 120 Hz.
+    static constexpr size_t kCapacity = 256;
+    
+    void add(double value)
+    {
+        _values[_next] = value;
+        _next = (_next + 1) % kCapacity;
+        _count = std::min(_count + 1, kCapacity);
+    }
+    
+    size_t count() const { return _count; }
+    
+    /// Returns the median and the 99th percentile of the values, or zeros without values.
+    SDFPercentiles percentiles() const
+    {
+        if (_count == 0)
+        {
+            return {};
+        }
+        
+        _scratch.assign(_values.begin(), _values.begin() + _count);
+        
+        return {
+            .p50 = nthValue(0.5),
+            .p99 = nthValue(0.99)
+        };
+    }
+
+private:
+    /// Returns the value of a rank of the scratch values, which it partially sorts.
+    double nthValue(double rank) const
+    {
+        const auto nth = _scratch.begin() + size_t(rank * double(_scratch.size() - 1) + 0.5);
+        std::nth_element(_scratch.begin(), nth, _scratch.end());
+        return *nth;
+    }
+    
+    std::array<double, kCapacity> _values {};
+    size_t _next = 0;
+    size_t _count = 0;
+    
+    mutable std::vector<double> _scratch;
+};
+
+/// The statistics of the recent frames of a renderer.
+///
+/// Each phase only records the frames that run it, so the passes the renderer
+/// skips while no bubble changes don't hide the cost of the ones it runs.
+class FrameStats final
+{
+public:
+    /// Records the duration of a phase of a frame, in seconds.
+    void addDuration(FramePhase phase, double seconds)
+    {
+        _durations[phase].add(seconds * 1e3);
+    }
+    
+    /// Records the counts of the scene of a frame.
+    void addFrame(size_t nbBubbles, size_t nbBubbleGroups, size_t nbDirtyTiles)
+    {
+        _nbBubbles = nbBubbles;
+        _nbBubbleGroups = nbBubbleGroups;
+        _dirtyTiles.add(double(nbDirtyTiles));
+    }
+    
+    /// Records the average number of bubbles the SDF pass of a frame evaluates for each texel it recomputes,
+    /// and the average number of bubbles of the groups of their bins.
+    void addBubblesPerTexel(double nbEvaluatedBubbles, double nbBinnedBubbles)
+    {
+        _bubblesPerTexel.add(nbEvaluatedBubbles);
+        _binnedBubblesPerTexel.add(nbBinnedBubbles);
+    }
+    
+    SDFFrameStats summary() const
+    {
+        return {
+            .simulationPass = _durations[FramePhaseSimulation].percentiles(),
+            .groupingPass = _durations[FramePhaseGrouping].percentiles(),
+            .sdfPass = _durations[FramePhaseSDF].percentiles(),
+            .gradientPass = _durations[FramePhaseGradient].percentiles(),
+            .pyramidPass = _durations[FramePhasePyramid].percentiles(),
+            .renderPass = _durations[FramePhaseRender].percentiles(),
+            .uniformsUpdate = _durations[FramePhaseUniformsUpdate].percentiles(),
+            .sceneUpdate = _durations[FramePhaseSceneUpdate].percentiles(),
+            .encoding = _durations[FramePhaseEncoding].percentiles(),
+            .dirtyTiles = _dirtyTiles.percentiles(),
+            .bubblesPerTexel = _bubblesPerTexel.percentiles(),
+            .binnedBubblesPerTexel = _binnedBubblesPerTexel.percentiles(),
+            .nbBubbles = _nbBubbles,
+            .nbBubbleGroups = _nbBubbleGroups,
+            .nbFrames = _dirtyTiles.count()
+        };
+    }
+
+private:
+    std::array<RollingSamples, FramePhaseCount> _durations;
+    RollingSamples _dirtyTiles;
+    RollingSamples _bubblesPerTexel;
+    RollingSamples _binnedBubblesPerTexel;
+    
+    size_t _nbBubbles = 0;
+    size_t _nbBubbleGroups = 0;
+};
@@ -1,9 +1,299 @@
 
 #import <MetalKit/MetalKit.h>
 
+#ifdef __cplusplus
+#import "BubbleSet.h"
+#endif
+
+/// The resolution of the SDF field relative to the background image.
+///
+/// The value divides the size of the SDF textures. The render pass upsamples
+/// the field with its linear sampler.
+typedef NS_ENUM(NSUInteger, SDFFieldScale)
+{
+    SDFFieldScaleFull = 1,
+    SDFFieldScaleHalf = 2,
+    SDFFieldScaleQuarter = 4,
+};
+
+/// The layout of the texels of the texture that stores the SDF and its gradient for the render pass.
+typedef NS_ENUM(NSUInteger, SDFTexelFormat)
+{
+    /// Four half-precision channels: the distance, the gradient, and an unused one.
+    SDFTexelFormatRGBA16Float,
+    
+    /// 32 bits per texel: the half-precision distance and the gradient in two 8-bit signed components.
+    ///
+    /// The format halves the memory and the bandwidth of the texture, but the render
+    /// pass filters its texels itself instead of with the sampler.
+    SDFTexelFormatPacked,
+};
+
+/// The median and the 99th percentile of a quantity over the recent frames.
+typedef struct
+{
+    double p50;
+    double p99;
+} SDFPercentiles;
+
+/// The statistics of the recent frames of a renderer.
+///
+/// The durations are in milliseconds. Each one only covers the frames that run its
+/// part of the frame, and stays zero until one does.
+typedef struct
+{
+    /// The GPU durations of the passes.
+    SDFPercentiles simulationPass;
+    SDFPercentiles groupingPass;
+    SDFPercentiles sdfPass;
+    SDFPercentiles gradientPass;
+    SDFPercentiles pyramidPass;
+    SDFPercentiles renderPass;
+    
+    /// The CPU duration of the update of the buffers of a frame, which includes the bubble records it applies and the scene update.
+    SDFPercentiles uniformsUpdate;
+    
+    /// The CPU duration of the update of the groups and the dirty tiles of the bubbles.
+    SDFPercentiles sceneUpdate;
+    
+    /// The CPU duration of the encoding of the command buffer of a frame.
+    SDFPercentiles encoding;
+    
+    /// The number of tiles the frames recompute.
+    SDFPercentiles dirtyTiles;
+    
+    /// The average number of bubbles the SDF pass evaluates for each texel it recomputes.
+    ///
+    /// The count leaves out the bubbles that the SDF templates skip in each tile. The frames
+    /// that group the bubbles on the GPU don't record it, the CPU doesn't know their bins.
+    SDFPercentiles bubblesPerTexel;
+    
+    /// The average number of bubbles of the groups of the bins of the texels the SDF pass recomputes,
+    /// which it would evaluate without skipping any bubble.
+    SDFPercentiles binnedBubblesPerTexel;
+    
+    /// The number of bubbles and groups of the last frame.
+    NSUInteger nbBubbles;
+    NSUInteger nbBubbleGroups;
+    
+    /// The number of frames the statistics cover.
+    NSUInteger nbFrames;
+} SDFFrameStats;
+
 /// A renderer for systems that support Metal 4 GPUs.
 @interface Metal4Renderer : NSObject<MTKViewDelegate>
 
+/// Returns the field scale that keeps the compute pass within the frame budget of a view's display.
+///
+/// Displays that refresh at 120 Hz get a reduced field unless the GPU family is
+/// recent enough to compute it at full resolution.
++ (SDFFieldScale)preferredFieldScaleForView:(nonnull MTKView *)mtkView;
+
+/// Creates a renderer that computes the SDF and its gradient in a single, fused pass,
+/// at the preferred field scale of the view.
 - (nonnull instancetype)initWithView:(nonnull MTKView *)mtkView;
 
+/// Creates a renderer for a view at its preferred field scale.
+///
+/// - Parameter fusedSDFPass: Whether a single compute pass computes the SDF
+///   and its analytic gradient, instead of differentiating an intermediate
+///   SDF texture in a second pass.
+- (nonnull instancetype)initWithView:(nonnull MTKView *)mtkView
+                        fusedSDFPass:(BOOL)fusedSDFPass;
+
+/// Creates a renderer for a view.
+///
+/// - Parameters:
+///   - fusedSDFPass: Whether a single compute pass computes the SDF and its gradient.
+///   - fieldScale: The resolution of the SDF textures relative to the background image.
+- (nonnull instancetype)initWithView:(nonnull MTKView *)mtkView
+                        fusedSDFPass:(BOOL)fusedSDFPass
+                          fieldScale:(SDFFieldScale)fieldScale;
+
+/// Creates a renderer for a view.
+///
+/// - Parameters:
+///   - fusedSDFPass: Whether a single compute pass computes the SDF and its gradient.
+///   - fieldScale: The resolution of the SDF textures relative to the background image.
+///   - transientSDFTexture: Whether the intermediate SDF texture of the two passes
+///     lives in a purgeable heap, which the system reclaims while no bubble changes.
+///     The SDF pass then also recomputes the neighbors of the dirty tiles, whose
+///     texels the gradient reads across the edges of the tiles.
+- (nonnull instancetype)initWithView:(nonnull MTKView *)mtkView
+                        fusedSDFPass:(BOOL)fusedSDFPass
+                          fieldScale:(SDFFieldScale)fieldScale
+                 transientSDFTexture:(BOOL)transientSDFTexture;
+
+/// Creates a renderer for a view.
+///
+/// - Parameters:
+///   - fusedSDFPass: Whether a single compute pass computes the SDF and its gradient.
+///   - fieldScale: The resolution of the SDF textures relative to the background image.
+///   - transientSDFTexture: Whether the intermediate SDF texture lives in a purgeable heap.
+///   - texelFormat: The layout of the texels of the texture the render pass samples.
+- (nonnull instancetype)initWithView:(nonnull MTKView *)mtkView
+                        fusedSDFPass:(BOOL)fusedSDFPass
+                          fieldScale:(SDFFieldScale)fieldScale
+                 transientSDFTexture:(BOOL)transientSDFTexture
+                         texelFormat:(SDFTexelFormat)texelFormat;
+
+/// Creates a renderer without a view, which draws batches of scenes offscreen
+/// with ``drawSceneBatch:width:height:completionHandler:``.
+///
+/// The renderer runs the fused pass at full resolution, and draws into the
+/// ``colorPixelFormat`` of the other initializers. It has no touches or motion to handle,
+/// and its scenes lie on the background image, whose size is ``contentSize``.
+/// The renderer still uses UIKit, so it runs on iOS.
+- (nonnull instancetype)initWithDevice:(nonnull id<MTLDevice>)device;
+
+/// A Boolean value that indicates whether the renderer runs the fused SDF and gradient pass.
+@property (nonatomic, readonly) BOOL usesFusedSDFPass;
+
+/// The resolution of the SDF textures relative to the background image.
+@property (nonatomic, readonly) SDFFieldScale fieldScale;
+
+/// A Boolean value that indicates whether the intermediate SDF texture lives in a purgeable heap.
+///
+/// The value is always `NO` for the fused pass, which doesn't have an intermediate texture.
+@property (nonatomic, readonly) BOOL usesTransientSDFTexture;
+
+/// The layout of the texels of the texture the render pass samples.
+@property (nonatomic, readonly) SDFTexelFormat texelFormat;
+
+/// The statistics of the recent frames, which root-cause the frames that miss the display's deadline.
+///
+/// The GPU durations of a frame join the statistics once the GPU finishes it.
+@property (nonatomic, readonly) SDFFrameStats frameStats;
+
+/// A Boolean value that indicates whether the view shows the statistics over the bubbles.
+@property (nonatomic) BOOL showsStatsOverlay;
+
+/// Empties the statistics, so that they only cover the frames the renderer draws next.
+- (void)resetFrameStats;
+
+/// A Boolean value that indicates whether the view pauses while nothing changes on screen.
+///
+/// The default is `YES`. The view draws at the highest rate of the display while the bubbles
+/// or the light change, then pauses a few frames after the last change.
+@property (nonatomic) BOOL rendersOnDemand;
+
+/// Resumes the drawing of the view for the next frames.
+///
+/// The renderer calls it for the changes it makes itself, like the gestures and the motion of the device.
+- (void)setNeedsRedraw;
+
+/// A Boolean value that indicates whether the GPU moves the bubbles with a physics simulation.
+///
+/// The default is `NO`. While it's `YES`, a pass before the grouping moves the bubbles
+/// of the GPU grouping every frame: they drift, push apart where they overlap, pull
+/// together when they're close, and bounce off the edges of the background image.
+/// The bubble set keeps the origins the caller gave them, except for the ones that the
+/// touches pick, which the renderer moves to where the GPU shows them. Turning the
+/// simulation off moves every bubble of the set to where the GPU left it.
+@property (nonatomic) BOOL simulatesBubbles;
+
+/// The location of a `.metallib` or `.metal` file whose shaders replace the app's ones, or `nil`.
+///
+/// The default is `nil`. This development mode speeds up the iterations on the kernels:
+/// the renderer watches the file, and after each change compiles the SDF, gradient and
+/// sampling pipelines from it in the background. Once they're all ready, it swaps them
+/// in between two frames, recomputes the whole field, and resets the frame statistics,
+/// which then time the new shaders. A source file can include the headers next to it with
+/// quotes. The frames keep their pipelines when the shaders don't compile.
+@property (nonatomic, copy, nullable) NSURL *shaderReloadURL;
+
+/// The size of the background image, which is the extent of the space the bubbles live in.
+@property (nonatomic, readonly) CGSize contentSize;
+
+/// The number of texels of the field in each dimension, which cover the background image at the field scale.
+@property (nonatomic, readonly) CGSize fieldSize;
+
+/// The pixel format of the textures the render pass draws into.
+@property (nonatomic, readonly) MTLPixelFormat colorPixelFormat;
+
+/// A Boolean value that indicates whether the renderer still compiles pipelines in the background.
+///
+/// The compilations finish on the main queue, whose run loop needs to run for them to complete.
+@property (nonatomic, readonly) BOOL compilesPipelines;
+
+/// Draws a frame into a texture instead of the view's drawable.
+///
+/// The method doesn't wait for the GPU to finish the frame.
+///
+/// - Parameter texture: A render target with the ``colorPixelFormat`` pixel format,
+///   and the size of the view's drawable.
+/// - Returns: `NO` if the GPU didn't finish an earlier frame in time, in which case
+///   the renderer skips this one.
+- (BOOL)drawIntoTexture:(nonnull id<MTLTexture>)texture;
+
+/// Returns the field of the last frame, as the image of `CPUSDFRenderer` stores it.
+///
+/// The distance and the normalized gradient of each texel of ``fieldSize`` are the first
+/// three components of a `simd_float4`, row by row. The method waits for the GPU to finish
+/// the frames in flight, copies the field into a shared buffer, and waits for the copy.
+/// It unpacks the texels of ``SDFTexelFormatPacked``.
+///
+/// - Returns: `nil` if the GPU didn't finish in time, or failed.
+- (nullable NSData *)fieldTexels;
+
+/// Waits for the GPU to finish the frames the renderer submitted, and records their GPU durations.
+///
+/// - Returns: `NO` if the GPU didn't finish them within a second, in which case the durations
+///   of the frames it hasn't finished wait for a later call.
+- (BOOL)waitUntilFramesCompleted;
+
+/// Makes the next frame recompute every tile of the field, even if no bubble changed.
+- (void)invalidateField;
+
+/// Queues records of a bubble stream, which the next frame applies to the bubbles in order.
+///
+/// A stream is the way for another system to drive the bubbles, with one call for a batch
+/// of changes rather than one per bubble. A scene record replaces all the bubbles, and a record
+/// of deltas removes, moves, resizes and adds some of them by the identifiers that the stream
+/// gives them. The records hold the origins and the radii in separate arrays, like the
+/// bubble set does, and `BubbleStream.h` describes their layout. Any thread can call the method.
+///
+/// - Parameter records: One or more whole records, which the renderer keeps until it applies them.
+/// - Returns: `NO` if a record is invalid or partial, or has an origin or a radius that isn't finite,
+///   a radius that isn't positive, or a bubble that reaches too far past the background image.
+///   The renderer then ignores them all.
+- (BOOL)enqueueBubbleRecords:(nonnull NSData *)records;
+
+/// Queues the records of a file, like a scene file, which the renderer maps to memory.
+///
+/// - Returns: `NO` if the file can't be read or a record is invalid.
+- (BOOL)enqueueBubbleRecordsWithContentsOfURL:(nonnull NSURL *)url;
+
+/// Returns a scene record of the bubbles, which is the content of a scene file.
+///
+/// The stream that loads the scene gives its bubbles their order in the record as identifiers.
+/// While the GPU simulates the bubbles, the record has the origins of the bubble set rather
+/// than the ones on screen.
+- (nonnull NSData *)bubbleSceneRecord;
+
+/// Draws a batch of scenes offscreen, each one into a slice of an array texture, with a single command buffer.
+///
+/// The scenes share the background image, the light and the pipelines of the renderer, and
+/// each one gets its own range of a buffer for its bubbles, which the CPU groups. They run one
+/// after the other on the field textures of the frames, so the next frame recomputes the whole field.
+/// A renderer of ``initWithDevice:`` draws them without a view. The method doesn't wait for the GPU.
+///
+/// - Parameters:
+///   - sceneRecords: The scene records of `BubbleStream.h`, one per slice.
+///   - width: The width of the slices, in pixels.
+///   - height: The height of the slices, in pixels.
+///   - completionHandler: The block that the main queue calls once the GPU finishes the batch,
+///     with the pixels of the slices one after the other, in the ``colorPixelFormat`` pixel format,
+///     or `nil` if the GPU failed, and the GPU duration of the batch in seconds.
+/// - Returns: The array texture, or `nil` if a record isn't a valid scene or the pipelines aren't ready.
+- (nullable id<MTLTexture>)drawSceneBatch:(nonnull NSArray<NSData *> *)sceneRecords
+                                    width:(NSUInteger)width
+                                   height:(NSUInteger)height
+                        completionHandler:(nonnull void (^)(NSData * _Nullable pixels, CFTimeInterval gpuDuration))completionHandler;
+
+#ifdef __cplusplus
+/// The bubbles the renderer draws, which the caller can change between two frames.
+- (BubbleSet&)bubbleSet;
+#endif
+
 @end
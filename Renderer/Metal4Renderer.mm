@@ -3,196 +3,224 @@
 
 #import <Metal/MTL4RenderPass.h>
 #import "UIKit/UIKit.h"
+#import <UIKit/UIGestureRecognizerSubclass.h>
 #import <CoreMotion/CoreMotion.h>
 
 #import "Metal4Renderer.h"
-#import "TGAImage.h"
+#import "TextureLoader.h"
 
 #include <algorithm>
 #include <vector>
-#include <set>
 #include <optional>
+#include <limits>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <os/lock.h>
 
 #import "ShaderTypes.h"
+#import "BubbleSet.h"
+#import "BubbleStream.h"
+#import "FrameStats.h"
+#import "RendererSupport.h"
 
 using namespace simd;
 
-static const MTLOrigin zeroOrigin = { 0, 0, 0 };
-
 constexpr uint32_t kMaxFramesInFlight = 3;
 
-class BubbleSet final
+/// How long `waitUntilFramesCompleted` waits for the GPU, in milliseconds, before it gives up.
+constexpr uint64_t kFrameCompletionTimeoutMS = 1000;
+
+/// The number of bubbles from which the renderer groups them on the GPU.
+///
+/// Below it, the incremental grouping of ``BubbleSet`` costs less than the passes.
+constexpr size_t kMinBubblesForGPUGrouping = 4096;
+
+/// The group sizes the renderer specializes the SDF pipeline for, in increasing order.
+///
+/// The scenes with larger groups run the generic pipeline.
+static const uint32_t kSpecializedGroupSizes[] = { 1, 2, 4, 8, 16 };
+constexpr size_t kNbSpecializedGroupSizes = sizeof(kSpecializedGroupSizes) / sizeof(kSpecializedGroupSizes[0]);
+
+/// The number of threads of each threadgroup of the grouping kernels that run one thread per item.
+constexpr NSUInteger kGroupingThreadgroupSize = 256;
+
+/// The alignment of the ranges of the scenes of a batch in its buffer, which the passes bind at their offsets.
+constexpr size_t kSceneBatchBufferAlignment = 256;
+
+/// The delay before the renderer watches the shaders of ``Metal4Renderer/shaderReloadURL`` again
+/// after an editor replaced the file, which can be missing in between.
+constexpr double kShaderRewatchDelay = 0.1;
+
+/// The pipelines a reload of the shaders replaces.
+///
+/// ``Metal4Renderer/shaderReloadURL`` compiles them all in the background, and the renderer
+/// swaps them in together between two frames.
+struct ReloadablePipelineStates final
 {
-public:
+    /// The SDF pipeline of the pass, fused or not.
+    id<MTLComputePipelineState> sdf;
     
-    void add(const float2& origin, float radius)
-    {
-        Bubble b { origin, radius };
-        b.id = (uint32_t) _bubbles.size();
-        
-        _bubbles.push_back(b);
-    }
+    /// The pipeline that differentiates the SDF, or `nil` for the fused pass.
+    id<MTLComputePipelineState> gradient;
     
-    void remove(Bubble& bubble)
-    {
-        const auto end = _bubbles.end();
-        for (auto it = _bubbles.begin(); it != end; ++it)
-        {
-            auto& b = *it;
-            if (&b == &bubble)
-            {
-                _bubbles.erase(it);
-                break;
-            }
-        }
-    }
+    id<MTLComputePipelineState> specializedSDF[kNbSpecializedGroupSizes];
+    id<MTLRenderPipelineState> render;
+};
+
+/// The buffers the passes of a scene bind, and the tiles they recompute.
+///
+/// The frames bind their per-frame buffers, and the scenes of a batch their ranges of the batch's buffer.
+struct SceneBindings final
+{
+    uint64_t uniforms;
+    uint64_t bubbleGroups;
+    uint64_t bubbles;
+    uint64_t tileBins;
+    uint64_t tileGroupIndices;
+    uint64_t vertexData;
     
-    Bubble* pick(const float2& pos)
-    {
-        const size_t n = _bubbles.size();
-        for (size_t i=0; i < n; ++i)
-        {
-            Bubble& bubble = _bubbles[i];
-            const float d = bubble.computeSDF(pos);
-            if (d <= 0.f)
-            {
-                return &bubble;
-            }
-        }
-        
-        return nullptr;
-    }
+    /// The tiles whose gradient and pyramid the passes update.
+    uint64_t dirtyTiles;
+    NSUInteger nbDirtyTiles;
     
-    void setSelection(Bubble& bubble, const float2& initialHitInSDFSpace)
-    {
-        _selection = Selection { bubble, initialHitInSDFSpace };
-    }
+    /// The tiles the SDF pass recomputes, which also has the neighbors of the dirty tiles
+    /// for a transient SDF texture, and is the dirty tiles otherwise.
+    uint64_t sdfTiles;
+    NSUInteger nbSDFTiles;
     
-    void clearSelection()
-    {
-        _selection.reset();
-    }
+    id<MTLComputePipelineState> sdfPipelineState;
+    float2 viewportSize;
+};
+
+/// The GPU timestamps each frame writes around its passes, in its slice of the counter heap.
+enum FrameTimestamp : uint32_t
+{
+    FrameTimestampComputeStart,
+    FrameTimestampSimulationEnd,
+    FrameTimestampGroupingEnd,
+    FrameTimestampSDFEnd,
+    FrameTimestampGradientEnd,
+    FrameTimestampPyramidEnd,
+    FrameTimestampRenderStart,
+    FrameTimestampRenderEnd,
+    FrameTimestampCount
+};
+
+/// The parameters of the simulation of the bubbles, in SDF space and seconds.
+///
+/// See ``SimulationUniforms``.
+constexpr float kSimulationAttractionRange = 32.f;
+constexpr float kSimulationRepulsionStiffness = 60.f;
+constexpr float kSimulationAttractionStiffness = 4.f;
+constexpr float kSimulationDriftAcceleration = 20.f;
+constexpr float kSimulationDamping = 0.8f;
+constexpr float kSimulationRestitution = 0.6f;
+
+/// The longest step of the simulation, which keeps it stable after a late frame.
+constexpr CFTimeInterval kMaxSimulationTimeStep = 1.0 / 30.0;
+
+/// The number of frames between two refreshes of the statistics overlay.
+constexpr uint64_t kStatsOverlayRefreshInterval = 30;
+
+/// The number of frames the view keeps drawing after the last change before it pauses.
+///
+/// The frames give the GPU grouping time to check its counters, and a transient
+/// SDF texture time to become purgeable.
+constexpr uint32_t kNbFramesBeforeIdle = kMaxFramesInFlight + 1;
+
+/// The distance between two light directions from which a motion update redraws the bubbles.
+constexpr float kLightDirectionThreshold = 0.01f;
+
+/// The interval between two motion updates while the view is paused.
+constexpr NSTimeInterval kIdleMotionUpdateInterval = 1.0 / 10.0;
+
+/// A gesture recognizer that reports the touches of a view, so that each finger drags its own bubble.
+///
+/// The recognizer never recognizes a gesture, which leaves the touches to the
+/// other recognizers of the view, and the other recognizers can't stop it.
+@interface TouchTrackingGestureRecognizer : UIGestureRecognizer
+
+/// A block the recognizer calls with the touches of an event that are in the same phase.
+@property (nonatomic, copy) void (^touchesHandler)(NSSet<UITouch*>* touches, UITouchPhase phase);
+
+@end
+
+@implementation TouchTrackingGestureRecognizer
+{
+    /// The touches the recognizer reported the beginning of, and not the end yet.
+    NSMutableSet<UITouch*>* activeTouches;
+}
+
+- (instancetype)initWithTarget:(id)target action:(SEL)action
+{
+    self = [super initWithTarget:target action:action];
+    if (nil == self) { return nil; }
     
-    void moveSelection(const float2& pt)
-    {
-        if (_selection.has_value())
-        {
-            const auto delta = pt - _selection->initialHitInSDFSpace;
-            _selection->bubble->origin = _selection->initialOrigin + delta;
-        }
-    }
+    activeTouches = [NSMutableSet new];
+    self.cancelsTouchesInView = NO;
+    self.delaysTouchesEnded = NO;
     
-    void rescaleSelection(float scale)
-    {
-        if (_selection.has_value())
-        {
-            _selection->bubble->radius = _selection->initialRadius * scale;
-        }
-    }
+    return self;
+}
+
+- (void)touchesBegan:(NSSet<UITouch*>*)touches withEvent:(UIEvent*)event
+{
+    [activeTouches unionSet:touches];
+    _touchesHandler(touches, UITouchPhaseBegan);
+}
+
+- (void)touchesMoved:(NSSet<UITouch*>*)touches withEvent:(UIEvent*)event
+{
+    _touchesHandler(touches, UITouchPhaseMoved);
+}
+
+- (void)touchesEnded:(NSSet<UITouch*>*)touches withEvent:(UIEvent*)event
+{
+    [self endTouches:touches phase:UITouchPhaseEnded];
+}
+
+- (void)touchesCancelled:(NSSet<UITouch*>*)touches withEvent:(UIEvent*)event
+{
+    [self endTouches:touches phase:UITouchPhaseCancelled];
+}
+
+- (void)endTouches:(NSSet<UITouch*>*)touches phase:(UITouchPhase)phase
+{
+    [activeTouches minusSet:touches];
+    _touchesHandler(touches, phase);
     
-    void update(Uniforms& uniforms)
+    // Fail once the last finger lifts, so that UIKit resets the recognizer for the next touches.
+    if (activeTouches.count == 0)
     {
-        std::vector<BubbleGroup> groups;
-        
-        // brute force N square comparison
-        std::set<const Bubble*> bubblesSet;
-        for (const auto& b : _bubbles)
-        {
-            bubblesSet.insert(&b);
-        }
-        
-        std::vector<Bubble> bubbles;
-        
-        while (!bubblesSet.empty())
-        {
-            auto it = bubblesSet.begin();
-            
-            const auto* bubble = *it;
-            bubblesSet.erase(it);
-            
-            const size_t startIndex = bubbles.size();
-            bubbles.push_back(*bubble);
-            
-            BubbleGroup group;
-            group.nbBubbles = 1;
-            
-            float minD = std::numeric_limits<float>::max();
-            
-            // find all other bubbles interacting with the main bubble
-            for (auto it = bubblesSet.begin(); it != bubblesSet.end();)
-            {
-                const auto* otherBubble = *it;
-                bool coalesced = false;
-                
-                for (size_t i=0; i < group.nbBubbles; ++i)
-                {
-                    const auto& b = bubbles[startIndex + i];
-                    const float distance = length(b.origin - otherBubble->origin);
-                    
-                    const float minDist = b.radius + otherBubble->radius;
-                    
-                    minD = std::min(minD, distance);
-                    
-                    if (distance <= minDist)
-                    {
-                        ++group.nbBubbles;
-                        bubbles.push_back(*otherBubble);
-                        it = bubblesSet.erase(it);
-                        coalesced = true;
-                        break;
-                    }
-                }
-                
-                if (!coalesced)
-                {
-                    ++it;
-                }
-            }
-            
-            if (group.nbBubbles > 1)
-            {
-                group.smoothFactor = 3e3f / (1.f + minD);
-            }
-            
-            groups.push_back(group);
-        }
-        
-        const size_t nbGroups = groups.size();
-        uniforms.nbBubbleGroups = nbGroups;
-        
-        for (size_t i=0; i < nbGroups; ++i)
-        {
-            uniforms.groups[i] = groups[i];
-        }
-        
-        const size_t nbBubbles = bubbles.size();
-        for (size_t i=0; i < nbBubbles; ++i)
-        {
-            uniforms.bubbles[i] = bubbles[i];
-        }
+        self.state = UIGestureRecognizerStateFailed;
     }
+}
+
+- (void)reset
+{
+    [super reset];
     
-private:
-    std::vector<Bubble> _bubbles;
-    
-    struct Selection final
+    // End the touches UIKit stopped sending.
+    if (activeTouches.count > 0)
     {
-        Selection(Bubble& bubble, const float2& initialHitInSDFSpace)
-        : bubble(&bubble),
-        initialOrigin(bubble.origin),
-        initialRadius(bubble.radius),
-        initialHitInSDFSpace(initialHitInSDFSpace)
-        {}
-        
-        Bubble* bubble;
-        float2 initialOrigin;
-        float initialRadius;
-        
-        float2 initialHitInSDFSpace;
-    };
-    
-    std::optional<Selection> _selection;
-};
+        NSSet<UITouch*>* touches = [activeTouches copy];
+        [activeTouches removeAllObjects];
+        _touchesHandler(touches, UITouchPhaseCancelled);
+    }
+}
+
+- (BOOL)canBePreventedByGestureRecognizer:(UIGestureRecognizer*)preventingGestureRecognizer
+{
+    return NO;
+}
+
+- (BOOL)canPreventGestureRecognizer:(UIGestureRecognizer*)preventedGestureRecognizer
+{
+    return NO;
+}
+
+@end
 
 @interface Metal4Renderer()
 @end
@@ -200,13 +228,62 @@ private:
 /// A class that renders each of the app's video frames.
 @implementation Metal4Renderer
 {
-    UIView* view;
+    MTKView* view;
+    
+    /// The number of frames the view draws before it pauses, when it renders on demand.
+    ///
+    /// Any change to the scene resets it.
+    uint32_t nbFramesUntilIdle;
     
     /// A Metal device the renderer draws with by sending commands to it.
     id<MTLDevice> device;
     
     /// A Metal compiler that compiles the app's shaders into pipelines.
     id<MTL4Compiler> compiler;
+    
+    /// An archive of the pipelines a previous launch compiled, or `nil` until one exists.
+    ///
+    /// The renderer creates its pipelines from the binaries of the archive without compiling them.
+    id<MTL4Archive> pipelineArchive;
+    
+    /// The location of `pipelineArchive` in the app's caches.
+    NSURL* pipelineArchiveURL;
+    
+    /// A serializer that captures the pipelines the compiler compiles, which the renderer
+    /// writes to `pipelineArchiveURL` when there's no archive yet.
+    id<MTL4PipelineDataSetSerializer> pipelineSerializer;
+    
+    /// Whether the archive lacks a pipeline, which means the app's shaders changed since a launch wrote it.
+    BOOL pipelineArchiveMissed;
+    
+    /// The number of pipeline compilations that run in the background.
+    NSUInteger nbPendingPipelineCompilations;
+    
+    /// Whether the renderer created the pipelines it needs to draw the bubbles.
+    ///
+    /// The frames only draw the background until then.
+    BOOL pipelinesReady;
+    
+    /// A compiler for the shaders of `shaderReloadURL`, which doesn't capture them into the archive.
+    id<MTL4Compiler> shaderReloadCompiler;
+    
+    /// A serial queue that loads and compiles the shaders of `shaderReloadURL`, one change after the other.
+    dispatch_queue_t shaderReloadQueue;
+    
+    /// A source that reports the writes to the file of `shaderReloadURL` on `shaderReloadQueue`.
+    dispatch_source_t shaderReloadSource;
+    
+    /// The number of reloads of the shaders, which drops the compilations that a later change supersedes.
+    uint64_t shaderReloadGeneration;
+    
+    /// The number of reloads the frames draw with, or `0` with the app's shaders.
+    uint64_t swappedShaderReloadGeneration;
+    
+    /// The pipelines the reloads replaced, which the frames in flight at the swap still use.
+    ///
+    /// Metal 4 command buffers don't retain them.
+    NSArray* retiredPipelineStates;
+    uint64_t lastFrameUsingRetiredPipelineStates;
 
     /// A default library that stores the app's shaders and compute kernels.
     ///
@@ -221,6 +298,40 @@ private:
     id<MTLComputePipelineState> drawSDFPipelineState;
     id<MTLComputePipelineState> drawSDFGradientPipelineState;
     
+    /// A compute pipeline that computes the SDF and its analytic gradient in a single pass.
+    id<MTLComputePipelineState> drawSDFAndGradientPipelineState;
+    
+    /// The compute pipelines that reduce the dirty tiles into the pyramid up to its tile level,
+    /// and a level of the pyramid into the next one.
+    id<MTLComputePipelineState> reduceSDFTilesPipelineState;
+    id<MTLComputePipelineState> reduceSDFPyramidLevelPipelineState;
+    
+    /// The SDF pipelines specialized for the group sizes of `kSpecializedGroupSizes`.
+    ///
+    /// Each one stays `nil` until the compiler finishes it in the background.
+    id<MTLComputePipelineState> specializedSDFPipelineStates[kNbSpecializedGroupSizes];
+    
+    /// The SDF pipeline the compute pass of the current frame runs.
+    id<MTLComputePipelineState> frameSDFPipelineState;
+    
+    /// The compute pipelines that group the bubbles on the GPU, in the order they run.
+    id<MTLComputePipelineState> exclusiveScanPipelineState;
+    id<MTLComputePipelineState> countGridCellsPipelineState;
+    id<MTLComputePipelineState> fillGridCellsPipelineState;
+    id<MTLComputePipelineState> uniteOverlappingBubblesPipelineState;
+    id<MTLComputePipelineState> resolveBubbleRootsPipelineState;
+    id<MTLComputePipelineState> sizeBubbleGroupsPipelineState;
+    id<MTLComputePipelineState> rankGroupMembersPipelineState;
+    id<MTLComputePipelineState> sortGroupMembersPipelineState;
+    id<MTLComputePipelineState> countTileGroupsPipelineState;
+    id<MTLComputePipelineState> fillTileGroupsPipelineState;
+    id<MTLComputePipelineState> writeTileBinsPipelineState;
+    
+    /// The compute pipelines of the simulation of the bubbles.
+    id<MTLComputePipelineState> applySimulationEditsPipelineState;
+    id<MTLComputePipelineState> gatherSimulatedOriginsPipelineState;
+    id<MTLComputePipelineState> simulateBubblesPipelineState;
+    
     /// A render pipeline the app creates at runtime.
     ///
     /// The app compiles the pipeline with the vertex and fragment shaders in the
@@ -242,6 +353,10 @@ private:
     /// An argument table that stores the resource bindings for both
     /// render and compute encoders.
     id<MTL4ArgumentTable> argumentTable;
+    
+    /// An argument table that stores the buffers of the grouping kernels,
+    /// at their ``GroupingBufferBindingIndex``.
+    id<MTL4ArgumentTable> groupingArgumentTable;
 
     /// A residency set that keeps resources in memory for the app's lifetime.
     id<MTLResidencySet> residencySet;
@@ -250,16 +365,87 @@ private:
     /// finished work.
     id<MTLSharedEvent> sharedEvent;
 
+    /// A counter heap that stores the GPU timestamps of the frames in flight, or `nil` if the device can't create one.
+    ///
+    /// Each frame writes ``FrameTimestamp`` timestamps into its own slice of the heap.
+    id<MTL4CounterHeap> timestampHeap;
+    
+    /// The number of ticks per second of the timestamps.
+    double timestampFrequency;
+    
+    /// The timestamps each frame wrote, one bit per ``FrameTimestamp``.
+    ///
+    /// The passes a frame skips don't write theirs.
+    uint32_t writtenTimestamps[kMaxFramesInFlight];
+    
+    /// The durations and the counts of the recent frames.
+    FrameStats stats;
+    
+    /// A label that shows `stats` over the view, or `nil` while the overlay is hidden.
+    UILabel* statsOverlayLabel;
+    
+    /// The number of groups the last GPU grouping the CPU checked found.
+    uint32_t nbGPUBubbleGroups;
+
     /// An integer that tracks the current frame number.
     uint64_t frameNumber;
     
+    /// The array index of the per-frame resources of the frame the renderer is encoding.
+    uint32_t frameIndex;
+    
     /// A texture that stores the original background image.
     ///
     /// The app build a color image by combines this texture with
     /// `chyronTexture`, which becomes the input texture for the grayscale conversion.
     id<MTLTexture> backgroundImageTexture;
+    
+    /// A texture that stores the distances the gradient pass differentiates.
+    ///
+    /// The renderer doesn't create it when it runs the fused SDF pass.
     id<MTLTexture> sdfTexture;
     id<MTLTexture> sdfGradientTexture;
+    
+    /// A mipmapped texture that stores the smallest and largest distances of the blocks of the SDF.
+    ///
+    /// The fragment shader samples its levels for the queries that cover a wide radius,
+    /// and reads its tile level to skip the tiles past the outside band.
+    id<MTLTexture> sdfPyramidTexture;
+    
+    /// A view of each level of `sdfPyramidTexture`, for the reductions past the tile level.
+    NSArray<id<MTLTexture>>* sdfPyramidLevels;
+    
+    /// A purgeable heap that stores `sdfTexture` when it's transient.
+    ///
+    /// The SDF pass writes all the texels the gradient pass reads, so the
+    /// contents of the texture don't outlive the compute pass of a frame.
+    id<MTLHeap> sdfTextureHeap;
+    
+    /// Whether the system can reclaim the memory of `sdfTextureHeap`.
+    BOOL sdfTextureHeapIsVolatile;
+    
+    /// The last frame whose compute pass uses `sdfTextureHeap`.
+    uint64_t lastFrameUsingSDFTextureHeap;
+    
+    /// The number of batches of scenes the GPU hasn't finished, which keep `sdfTextureHeap` resident.
+    NSUInteger nbSceneBatchesInFlight;
+    
+    /// Whether the next compute pass waits for a batch of scenes, whose passes reuse the field textures.
+    BOOL followsSceneBatch;
+    
+    /// An array of buffers, each of which stores the packed coordinates of the tiles
+    /// the SDF pass of a frame recomputes for a transient SDF texture.
+    ///
+    /// The list adds the neighbors of the dirty tiles to them.
+    id<MTLBuffer> sdfTilesBuffers[kMaxFramesInFlight];
+    
+    /// The number of tiles the SDF pass of the current frame recomputes for a transient SDF texture.
+    NSUInteger nbSDFTiles;
+    
+    /// Whether each tile is in the list of `sdfTilesBuffers`, while the renderer fills it.
+    std::vector<bool> isSDFTile;
+    
+    /// The size of an SDF texel in the pixels of the background image.
+    float2 fieldTexelSize;
 
     /// A two-dimensional size that represents the number of threads for each
     /// grid dimension of a threadgroup for a compute kernel dispatch.
@@ -278,95 +464,160 @@ private:
     /// vertex shader.
     float2 viewportSize;
 
-    /// A buffer that stores the viewport's size data.
+    /// An array of buffers, each of which stores the uniforms of a frame in flight.
+    ///
+    /// The CPU only writes the buffer of the frame it's encoding, which the GPU
+    /// is done reading, while the GPU reads the buffers of the previous frames.
+    id<MTLBuffer> uniformsBuffers[kMaxFramesInFlight];
+    
+    /// An array of buffers, each of which stores the ``BubbleGroup`` instances of a frame.
+    ///
+    /// The renderer grows each of them whenever the scene needs more room.
+    id<MTLBuffer> bubbleGroupsBuffers[kMaxFramesInFlight];
+    
+    /// An array of buffers, each of which stores the ``Bubble`` instances of a frame, sorted by group.
+    ///
+    /// The renderer grows each of them whenever the scene needs more room.
+    id<MTLBuffer> bubblesBuffers[kMaxFramesInFlight];
+    
+    /// An array of buffers, each of which stores a ``TileBin`` for each tile of the SDF texture.
+    id<MTLBuffer> tileBinsBuffers[kMaxFramesInFlight];
+    
+    /// An array of buffers that store the group indices that `tileBinsBuffers` refer to.
+    ///
+    /// The renderer grows each of them whenever the bins need more room.
+    id<MTLBuffer> tileGroupIndicesBuffers[kMaxFramesInFlight];
+    
+    /// The ``BubbleSet`` version the per-frame bubble and tile buffers of each frame store.
+    uint64_t uploadedSceneVersions[kMaxFramesInFlight];
+    
+    /// An array of buffers, each of which stores the packed coordinates of the tiles a frame recomputes.
+    ///
+    /// The renderer grows each of them whenever the list needs more room.
+    id<MTLBuffer> dirtyTilesBuffers[kMaxFramesInFlight];
+    
+    /// The number of tiles the compute pass of the current frame recomputes.
+    ///
+    /// The SDF textures keep their contents between frames, so the renderer
+    /// skips the compute pass when no bubble changed.
+    NSUInteger nbDirtyTiles;
+    
+    /// The buffers the GPU grouping of each frame allocates, at their ``GroupingBufferBindingIndex``.
+    ///
+    /// The grouping writes its results into the bubble and tile buffers of the frame.
+    id<MTLBuffer> groupingBuffers[kMaxFramesInFlight][GroupingBufferBindingIndexForGroups];
+    
+    /// Whether each frame grouped the bubbles on the GPU, with counters the CPU didn't check yet.
+    BOOL groupedOnGPU[kMaxFramesInFlight];
+    
+    /// Whether the last update left the grouping to the GPU.
+    BOOL groupsBubblesOnGPU;
+    
+    /// Whether the compute pass of the current frame groups the bubbles.
+    BOOL encodesGPUGrouping;
+    
+    /// The position and velocity of each slot of the bubble set, which the simulation
+    /// moves in place from frame to frame.
+    ///
+    /// The CPU only writes them through the edits of the frames.
+    id<MTLBuffer> simulationPositionsBuffer;
+    id<MTLBuffer> simulationVelocitiesBuffer;
+    
+    /// An array of buffers, each of which stores the ``SimulationUniforms`` of a frame,
+    /// and an array of buffers that store its ``SimulationEdit`` instances.
+    id<MTLBuffer> simulationUniformsBuffers[kMaxFramesInFlight];
+    id<MTLBuffer> simulationEditsBuffers[kMaxFramesInFlight];
+    
+    /// The edits of the current frame, while the renderer collects them.
+    std::vector<SimulationEdit> simulationEdits;
+    
+    /// The bubble and origin of each slot the last edits gave the simulation,
+    /// which find the bubbles the caller added or moved since.
+    std::vector<BubbleHandle> simulatedHandles;
+    std::vector<float2> simulatedOrigins;
+    
+    /// The ``BubbleSet`` version of the last changes the edits gave the simulation.
+    uint64_t simulatedSceneVersion;
+    
+    /// The number of bubbles each frame simulated, or `0` for the frames that didn't.
     ///
-    id<MTLBuffer> uniformsBuffer;
+    /// The origins buffer of the grouping of a frame the GPU finished stores their positions.
+    uint32_t nbSimulatedBubbles[kMaxFramesInFlight];
+    
+    /// The time of the last step of the simulation, and the time the steps add up to.
+    CFTimeInterval lastSimulationStepTime;
+    float simulationTime;
+    
+    /// Whether the compute pass of the current frame moves the bubbles.
+    BOOL encodesSimulation;
     
     BubbleSet _bubbleSet;
     
-    UIPanGestureRecognizer* panGestureRecognizer;
-    UITapGestureRecognizer* tapGestureRecognizer;
+    /// The identifiers of the bubbles of the stream the caller feeds the set with.
+    BubbleStream bubbleStream;
+    
+    /// The records of the stream the caller enqueued since the last frame, which `bubbleStreamLock` guards.
+    NSMutableArray<NSData*>* pendingBubbleRecords;
+    os_unfair_lock bubbleStreamLock;
+    
+    /// A recognizer that reports each touch, with the moves of an event batched into `touchMoves`.
+    TouchTrackingGestureRecognizer* touchTrackingRecognizer;
+    std::vector<SelectionMove> touchMoves;
+    
     UITapGestureRecognizer* doubleTapGestureRecognizer;
     
     CMMotionManager* motionManager;
     float2 lightDirection;
 }
 
-/// Creates a texture instance from an image file.
-///
-/// The method configures the texture with a pixel format with 4 color channels:
-/// - blue
-/// - green
-/// - red
-/// - alpha
-///
-/// Each channel is an 8-bit unnormalized value.
-///
-/// For example:
-/// - `0` maps to `0.0`,
-/// - `255` maps to `1.0`.
+/// Returns the location of the pipeline archive of this build of the app.
 ///
-/// - Returns: A texture instance if the method succeeds; otherwise `nil`.
-- (id<MTLTexture>)loadImageToTexture:(NSURL *)imageFileLocation
+/// The file name includes the app's version so that an update doesn't look up stale binaries.
++ (NSURL*)pipelineArchiveURL
 {
-    // Load an image from a URL.
-    TGAImage *image;
-    image = [[TGAImage alloc] initWithTGAFileAtLocation:imageFileLocation];
-
-    if (!image)
-    {
-        return nil;
-    }
-
-    // Create and configure the texture descriptor to make a texture that's the
-    // same size as the image.
-    MTLTextureDescriptor *textureDescriptor = [[MTLTextureDescriptor alloc] init];
-
-    textureDescriptor.pixelFormat = MTLPixelFormatBGRA8Unorm;
-    textureDescriptor.textureType = MTLTextureType2D;
-    textureDescriptor.usage = MTLTextureUsageShaderRead;
-    textureDescriptor.width = image.width;
-    textureDescriptor.height = image.height;
-
-    // Create the texture instance.
-    id<MTLTexture> texture;
-    texture = [device newTextureWithDescriptor:textureDescriptor];
-
-    if (nil == texture)
-    {
-        NSLog(@"The device can't create a texture for the image at: %@",
-              imageFileLocation);
-        return nil;
-    }
-
-    // Define a region that's the size of the texture, which is the same as the image.
-    const MTLSize size = {
-        textureDescriptor.width,
-        textureDescriptor.height,
-        1
-    };
-    const MTLRegion region = { zeroOrigin, size };
-
-    /// The number of bytes in each of the texture's rows.
-    NSUInteger bytesPerRow = 4 * textureDescriptor.width;
-
-    // Copy the bytes from the image into the texture.
-    [texture replaceRegion:region
-               mipmapLevel:0
-                 withBytes:image.data.bytes
-               bytesPerRow:bytesPerRow];
-
-    return texture;
+    NSBundle *bundle = [NSBundle mainBundle];
+    NSString *version = [bundle objectForInfoDictionaryKey:@"CFBundleVersion"] ?: @"0";
+    NSString *name = [NSString stringWithFormat:@"%@-%@.mtl4archive",
+                      bundle.bundleIdentifier ?: @"Bubbles", version];
+    
+    NSURL *cachesURL = [[NSFileManager defaultManager] URLsForDirectory:NSCachesDirectory
+                                                              inDomains:NSUserDomainMask].firstObject;
+    
+    return [cachesURL URLByAppendingPathComponent:name];
 }
 
-/// Creates a compiler to create pipelines from shaders.
+/// Creates a compiler to create pipelines from shaders, and loads the archive of a previous launch.
 - (void) createCompiler
 {
     MTL4CompilerDescriptor *compilerDescriptor;
     compilerDescriptor = [[MTL4CompilerDescriptor alloc] init];
     
-    // Create a compiler with the descriptor.
+    // Load the pipelines a previous launch archived, if any.
     NSError *error = NULL;
+    pipelineArchiveURL = [Metal4Renderer pipelineArchiveURL];
+    
+    if ([pipelineArchiveURL checkResourceIsReachableAndReturnError:nil])
+    {
+        pipelineArchive = [device newArchiveWithURL:pipelineArchiveURL error:&error];
+        
+        if (nil == pipelineArchive)
+        {
+            NSLog(@"The device can't load the pipeline archive due to: %@", error);
+        }
+    }
+    
+    // Capture the pipelines the compiler compiles to archive them.
+    if (nil == pipelineArchive)
+    {
+        MTL4PipelineDataSetSerializerDescriptor *serializerDescriptor;
+        serializerDescriptor = [MTL4PipelineDataSetSerializerDescriptor new];
+        serializerDescriptor.configuration = MTL4PipelineDataSetSerializerConfigurationCaptureBinaries;
+        
+        pipelineSerializer = [device newPipelineDataSetSerializerWithDescriptor:serializerDescriptor];
+        compilerDescriptor.pipelineDataSetSerializer = pipelineSerializer;
+    }
+    
+    // Create a compiler with the descriptor.
     compiler = [device newCompilerWithDescriptor:compilerDescriptor
                                             error:&error];
     
@@ -376,25 +627,82 @@ private:
              error);
 }
 
-- (id<MTLComputePipelineState>)createComputePipelineStateWithFunctionName:(NSString*)name
+/// Returns the descriptor of a compute pipeline with a kernel function of the default library.
+///
+/// - Parameter constantValues: The function constants that specialize the kernel, or `nil`.
+- (MTL4ComputePipelineDescriptor*)computePipelineDescriptorWithFunctionName:(NSString*)name
+                                                             constantValues:(MTLFunctionConstantValues*)constantValues
 {
-    NSError *error = NULL;
+    return [self computePipelineDescriptorWithFunctionName:name constantValues:constantValues library:defaultLibrary];
+}
 
-    // Get the kernel function from the default library.
+/// Returns the descriptor of a compute pipeline with a kernel function of a library.
+- (MTL4ComputePipelineDescriptor*)computePipelineDescriptorWithFunctionName:(NSString*)name
+                                                             constantValues:(MTLFunctionConstantValues*)constantValues
+                                                                    library:(id<MTLLibrary>)library
+{
+    // Get the kernel function from the library.
     MTL4LibraryFunctionDescriptor *kernelFunction;
     kernelFunction = [MTL4LibraryFunctionDescriptor new];
-    kernelFunction.library = defaultLibrary;
+    kernelFunction.library = library;
     kernelFunction.name = name;
     
     // Configure a compute pipeline with the compute function.
     MTL4ComputePipelineDescriptor *pipelineDescriptor;
     pipelineDescriptor = [MTL4ComputePipelineDescriptor new];
-    pipelineDescriptor.computeFunctionDescriptor = kernelFunction;
-
+    
+    if (nil != constantValues)
+    {
+        MTL4SpecializedFunctionDescriptor *specializedFunction;
+        specializedFunction = [MTL4SpecializedFunctionDescriptor new];
+        specializedFunction.functionDescriptor = kernelFunction;
+        specializedFunction.constantValues = constantValues;
+        
+        pipelineDescriptor.computeFunctionDescriptor = specializedFunction;
+    }
+    else
+    {
+        pipelineDescriptor.computeFunctionDescriptor = kernelFunction;
+    }
+    
+    return pipelineDescriptor;
+}
+
+/// Returns a compute pipeline from the binaries of the archive, or `nil` when the archive lacks it.
+- (id<MTLComputePipelineState>)archivedComputePipelineStateWithDescriptor:(MTL4ComputePipelineDescriptor*)pipelineDescriptor
+{
+    if (nil == pipelineArchive)
+    {
+        return nil;
+    }
+    
+    id<MTLComputePipelineState> state = [pipelineArchive newComputePipelineStateWithDescriptor:pipelineDescriptor
+                                                                                         error:nil];
+    if (nil == state)
+    {
+        pipelineArchiveMissed = YES;
+    }
+    
+    return state;
+}
+
+- (id<MTLComputePipelineState>)createComputePipelineStateWithFunctionName:(NSString*)name
+{
+    NSError *error = NULL;
+    
+    MTL4ComputePipelineDescriptor *pipelineDescriptor = [self computePipelineDescriptorWithFunctionName:name
+                                                                                        constantValues:nil];
+    
+    id<MTLComputePipelineState> state = [self archivedComputePipelineStateWithDescriptor:pipelineDescriptor];
+    if (nil != state)
+    {
+        return state;
+    }
+
     // Create a compute pipeline with the image processing kernel in the library.
-    id<MTLComputePipelineState> state = [compiler newComputePipelineStateWithDescriptor:pipelineDescriptor
-                                                       compilerTaskOptions:nil
-                                                                     error:&error];
+    state = [compiler newComputePipelineStateWithDescriptor:pipelineDescriptor
+                                        compilerTaskOptions:nil
+                                                      error:&error];
     
     // Verify the compiler created the pipeline state successfully.
     // Debug builds in Xcode turn on Metal API Validation by default.
@@ -405,469 +713,3236 @@ private:
     return state;
 }
 
-/// Creates a compute pipeline with a kernel function.
+/// Compiles the SDF pipelines specialized for each group size of `kSpecializedGroupSizes` in the background.
+///
+/// The frames keep running the generic pipeline until the one for the scene is ready.
+/// The method creates the variants of the archive right away.
+- (void)compileSpecializedSDFPipelineStates
+{
+    NSString *name = [self sdfKernelName];
+    __weak Metal4Renderer* wSelf = self;
+    
+    for (size_t i = 0; i < kNbSpecializedGroupSizes; ++i)
+    {
+        const uint32_t maxBubblesPerGroup = kSpecializedGroupSizes[i];
+        MTL4ComputePipelineDescriptor *pipelineDescriptor = [self specializedSDFPipelineDescriptorAtIndex:i
+                                                                                                 library:defaultLibrary];
+        
+        specializedSDFPipelineStates[i] = [self archivedComputePipelineStateWithDescriptor:pipelineDescriptor];
+        if (nil != specializedSDFPipelineStates[i])
+        {
+            continue;
+        }
+        
+        ++nbPendingPipelineCompilations;
+        
+        [compiler newComputePipelineStateWithDescriptor:pipelineDescriptor
+                                    compilerTaskOptions:nil
+                                      completionHandler:^(id<MTLComputePipelineState> state, NSError *error) {
+            // The frames pick their pipeline on the main thread.
+            dispatch_async(dispatch_get_main_queue(), ^{
+                Metal4Renderer* self = wSelf;
+                if (self == nil)
+                {
+                    return;
+                }
+                
+                if (nil == state)
+                {
+                    NSLog(@"The compiler can't specialize %@ for groups of %u bubbles due to: %@",
+                          name, maxBubblesPerGroup, error);
+                }
+                
+                // A reload already swapped in the variants of its shaders.
+                if (self->swappedShaderReloadGeneration == 0)
+                {
+                    self->specializedSDFPipelineStates[i] = state;
+                }
+                
+                [self didFinishPipelineCompilation];
+            });
+        }];
+    }
+}
+
+/// Returns the descriptor of the SDF pipeline specialized for the group size at an index of `kSpecializedGroupSizes`.
+- (MTL4ComputePipelineDescriptor*)specializedSDFPipelineDescriptorAtIndex:(size_t)index library:(id<MTLLibrary>)library
+{
+    const uint32_t maxBubblesPerGroup = kSpecializedGroupSizes[index];
+    
+    MTLFunctionConstantValues *constantValues = [MTLFunctionConstantValues new];
+    [constantValues setConstantValue:&maxBubblesPerGroup
+                                type:MTLDataTypeUInt
+                             atIndex:FunctionConstantIndexMaxBubblesPerGroup];
+    
+    return [self computePipelineDescriptorWithFunctionName:[self sdfKernelName]
+                                            constantValues:constantValues
+                                                   library:library];
+}
 
-- (void) createRenderPipelineFor:(MTLPixelFormat)pixelFormat
+/// Returns the SDF pipeline for a scene whose largest group has `maxGroupSize` bubbles.
+///
+/// The method falls back to the generic pipeline while the specialized ones compile.
+- (id<MTLComputePipelineState>)sdfPipelineStateForMaxGroupSize:(size_t)maxGroupSize
 {
-    NSError *error = NULL;
+    for (size_t i = 0; i < kNbSpecializedGroupSizes; ++i)
+    {
+        if (maxGroupSize <= kSpecializedGroupSizes[i] && nil != specializedSDFPipelineStates[i])
+        {
+            return specializedSDFPipelineStates[i];
+        }
+    }
+    
+    return _usesFusedSDFPass ? drawSDFAndGradientPipelineState : drawSDFPipelineState;
+}
 
-    // Get the vertex function from the default library.
+/// Returns the descriptor of the render pipeline with the shaders of a library.
+- (MTL4RenderPipelineDescriptor*)renderPipelineDescriptorFor:(MTLPixelFormat)pixelFormat library:(id<MTLLibrary>)library
+{
+    // Get the vertex function from the library.
     MTL4LibraryFunctionDescriptor *vertexFunction;
     vertexFunction = [MTL4LibraryFunctionDescriptor new];
-    vertexFunction.library = defaultLibrary;
+    vertexFunction.library = library;
     vertexFunction.name = @"vertexShader";
 
-    // Get the fragment function from the default library.
+    // Get the fragment function from the library.
     MTL4LibraryFunctionDescriptor *fragmentFunction;
     fragmentFunction = [MTL4LibraryFunctionDescriptor new];
-    fragmentFunction.library = defaultLibrary;
-    fragmentFunction.name = @"samplingShader";
+    fragmentFunction.library = library;
+    fragmentFunction.name = (_texelFormat == SDFTexelFormatPacked) ? @"samplingPackedShader" : @"samplingShader";
+    
+    // Skip the tiles the pyramid of the SDF puts past the outside band.
+    const bool usesSDFPyramid = true;
+    
+    MTLFunctionConstantValues *constantValues = [MTLFunctionConstantValues new];
+    [constantValues setConstantValue:&usesSDFPyramid
+                                type:MTLDataTypeBool
+                             atIndex:FunctionConstantIndexUsesSDFPyramid];
+    
+    MTL4SpecializedFunctionDescriptor *specializedFragmentFunction;
+    specializedFragmentFunction = [MTL4SpecializedFunctionDescriptor new];
+    specializedFragmentFunction.functionDescriptor = fragmentFunction;
+    specializedFragmentFunction.constantValues = constantValues;
 
     // Configure a render pipeline with the vertex and fragment shaders.
     MTL4RenderPipelineDescriptor *pipelineDescriptor;
     pipelineDescriptor = [MTL4RenderPipelineDescriptor new];
     pipelineDescriptor.label = @"Simple Render Pipeline";
     pipelineDescriptor.vertexFunctionDescriptor = vertexFunction;
-    pipelineDescriptor.fragmentFunctionDescriptor = fragmentFunction;
+    pipelineDescriptor.fragmentFunctionDescriptor = specializedFragmentFunction;
     pipelineDescriptor.colorAttachments[0].pixelFormat = pixelFormat;
-
-    renderPipelineState = [compiler newRenderPipelineStateWithDescriptor:pipelineDescriptor
-                                                     compilerTaskOptions:nil
-                                                                   error:&error];
-
-    NSAssert(nil != renderPipelineState,
-             @"The compiler can't create a render pipeline due to: %@",
-             error);
+    
+    return pipelineDescriptor;
 }
 
-- (void) createBuffers
+- (id<MTLRenderPipelineState>)createRenderPipelineStateFor:(MTLPixelFormat)pixelFormat
 {
-    const float2 contentSize { float(backgroundImageTexture.width), float(backgroundImageTexture.height) };
-    const float2 vSize { float(viewportSize.x), float(viewportSize.y) };
-    
-    const float2 s = vSize / contentSize;
-    const float minS = std::min(s.x, s.y);
-    float rescaledContentSizeX = contentSize.x * minS;
-    const float offsetX = (vSize.x - rescaledContentSizeX) * 0.5f;
+    NSError *error = NULL;
+    MTL4RenderPipelineDescriptor *pipelineDescriptor = [self renderPipelineDescriptorFor:pixelFormat library:defaultLibrary];
     
-    const float w = (vSize.x - offsetX) * 0.5f;
-    const float h = w * contentSize.y / contentSize.x;
+    id<MTLRenderPipelineState> state = nil;
+    if (nil != pipelineArchive)
+    {
+        state = [pipelineArchive newRenderPipelineStateWithDescriptor:pipelineDescriptor error:nil];
+        pipelineArchiveMissed |= (nil == state);
+    }
     
-    const VertexData triangleVertexData[] =
+    if (nil == state)
     {
-        { {  w,  -h },  { 1.f, 1.f } },
-        { { -w,  -h },  { 0.f, 1.f } },
-        { { -w,  h },  { 0.f, 0.f } },
-
-        // The 2nd triangle of the rectangle for the composite color texture.
-        { {  w,  -h },  { 1.f, 1.f } },
-        { { -w,  h },  { 0.f, 0.f } },
-        { {  w,  h },  { 1.f, 0.f } },
+        state = [compiler newRenderPipelineStateWithDescriptor:pipelineDescriptor
+                                           compilerTaskOptions:nil
+                                                         error:&error];
+    }
 
-    };
+    NSAssert(nil != state,
+             @"The compiler can't create a render pipeline due to: %@",
+             error);
     
-    // Create the buffer that stores the vertex data.
-    vertexDataBuffer = [device newBufferWithLength:sizeof(triangleVertexData)
-                                             options:MTLResourceStorageModeShared];
-
-    memcpy(vertexDataBuffer.contents, triangleVertexData, sizeof(triangleVertexData));
-
-    // Create the buffer that stores the app's viewport data.
-    uniformsBuffer = [device newBufferWithLength:sizeof(Uniforms) options:MTLResourceStorageModeShared];
+    return state;
+}
 
-    [self updateUniformsBuffer];
+/// Returns the name of the kernel that computes the SDF and its gradient in the texel format.
+- (NSString*)fusedSDFKernelName
+{
+    return (_texelFormat == SDFTexelFormatPacked) ? @"computeAndDrawPackedSDFAndGradient" : @"computeAndDrawSDFAndGradient";
 }
 
-/// Loads two textures the app combines into the source color texture.
-- (void) createTextures
+/// Returns the name of the kernel of the SDF pass, fused or not.
+- (NSString*)sdfKernelName
 {
-    //NSString *backgroundImageFileName = @"Hawaii-coastline";
-    NSString *backgroundImageFileName = @"water";
-    // Create a texture from the background image file.
-    NSURL *backgroundImageFile = [[NSBundle mainBundle]
-                                URLForResource:backgroundImageFileName
-                                withExtension:@"tga"];
-    backgroundImageTexture = [self loadImageToTexture:backgroundImageFile];
-    NSAssert(nil != backgroundImageTexture,
-             @"The app can't create a texture for the background image: %@",
-             backgroundImageFileName);
-    backgroundImageTexture.label = @"BackgroundImageTexture";
-    
-    // Create the source color texture that stores the combined texture data.
-    MTLTextureDescriptor *textureDescriptor = [[MTLTextureDescriptor alloc] init];
-    textureDescriptor.textureType = MTLTextureType2D;
+    return _usesFusedSDFPass ? [self fusedSDFKernelName] : @"computeAndDrawSDF";
+}
 
-    // Configure the pixel format with 4 channels: blue, green, red, and alpha.
-    // Each is an 8-bit, unnormalized value; `0` maps to `0.0` and `255` maps to `1.0`.
-    textureDescriptor.pixelFormat = MTLPixelFormatBGRA8Unorm;
-    textureDescriptor.width = backgroundImageTexture.width;
-    textureDescriptor.height = backgroundImageTexture.height;
+/// Returns the name of the kernel that differentiates the SDF texture in the texel format.
+- (NSString*)gradientKernelName
+{
+    return (_texelFormat == SDFTexelFormatPacked) ? @"drawPackedSDFGradient" : @"drawSDFGradient";
+}
 
-    // Configure the input texture to read-only because `convertToGrayscale` kernel
-    // doesn't modify it.
-    textureDescriptor.usage = MTLTextureUsageShaderWrite | MTLTextureUsageShaderRead;
-    
-    textureDescriptor.pixelFormat = MTLPixelFormatR16Float;
-    sdfTexture = [device newTextureWithDescriptor:textureDescriptor];
-    NSAssert(nil != sdfTexture,
-             @"The device can't create a texture for the SDF.");
-    sdfTexture.label = @"SDF Texture";
-    
-    textureDescriptor.pixelFormat = MTLPixelFormatRGBA16Float;
-    sdfGradientTexture = [device newTextureWithDescriptor:textureDescriptor];
-    NSAssert(nil != sdfGradientTexture,
-             @"The device can't create a texture for the gradient.");
-    sdfGradientTexture.label = @"SDF Gradient Texture";
+/// Creates the compute pipelines of the frames.
+- (void)createComputePipelineStates
+{
+    if (_usesFusedSDFPass)
+    {
+        drawSDFAndGradientPipelineState = [self createComputePipelineStateWithFunctionName:[self fusedSDFKernelName]];
+    }
+    else
+    {
+        drawSDFPipelineState = [self createComputePipelineStateWithFunctionName:@"computeAndDrawSDF"];
+        drawSDFGradientPipelineState = [self createComputePipelineStateWithFunctionName:[self gradientKernelName]];
+    }
     
+    reduceSDFTilesPipelineState = [self createComputePipelineStateWithFunctionName:(_texelFormat == SDFTexelFormatPacked)
+                                   ? @"reducePackedSDFTiles" : @"reduceSDFTiles"];
+    reduceSDFPyramidLevelPipelineState = [self createComputePipelineStateWithFunctionName:@"reduceSDFPyramidLevel"];
     
+    [self createGroupingPipelineStates];
 }
 
-/// Configures the number of rows and columns in the threadgroups based on the input image's size.
+/// Creates the pipelines of the renderer.
 ///
-/// The method ensures the grid covers an area that's at least as big as the
-/// entire image.
-- (void) configureThreadgroupForComputePasses
-{
-    NSAssert(backgroundImageTexture, @"Create the composite color texture before configuring the threadgroup");
-
-    // Set the compute kernel's threadgroup size to 16 x 16.
-    threadgroupSize = MTLSizeMake(16, 16, 1);
-
-    // Find the number of threadgroup widths the app needs to span the texture's full width.
-    threadgroupCount.width  = backgroundImageTexture.width  + threadgroupSize.width -  1;
-    threadgroupCount.width /= threadgroupSize.width;
-
-    // Find the number of threadgroup heights the app needs to span the texture's full width.
-    threadgroupCount.height = backgroundImageTexture.height + threadgroupSize.height - 1;
-    threadgroupCount.height /= threadgroupSize.height;
-
-    // Set depth to one because the image data is two-dimensional.
-    threadgroupCount.depth = 1;
-}
-
-- (void) createArgumentTable
+/// With an archive, the renderer creates them right away from its binaries. Otherwise it
+/// compiles them in the background, where a first launch would stall, and archives them
+/// for the next launches. The frames draw the background once the render pipeline is
+/// ready, and the bubbles once the compute pipelines are.
+- (void)createPipelineStatesFor:(MTLPixelFormat)pixelFormat
 {
-    // Create an argument table that stores 2 buffers and 2 textures.
-    MTL4ArgumentTableDescriptor *argumentTableDescriptor;
-    argumentTableDescriptor = [[MTL4ArgumentTableDescriptor alloc] init];
-
-    // Configure the descriptor to store 2 buffers:
-    // - A vertex buffer
-    // - A viewport size buffer.
-    argumentTableDescriptor.maxTextureBindCount = 4;
-    argumentTableDescriptor.maxBufferBindCount = 2;
-
-    // Create an argument table with the descriptor.
-    NSError *error = NULL;
-    argumentTable = [device newArgumentTableWithDescriptor:argumentTableDescriptor
-                                                     error:&error];
-    NSAssert(nil != argumentTable,
-             @"The device can't create an argument table due to: %@", error);
+    if (nil != pipelineArchive)
+    {
+        renderPipelineState = [self createRenderPipelineStateFor:pixelFormat];
+        [self createComputePipelineStates];
+        
+        pipelinesReady = YES;
+        
+        [self compileSpecializedSDFPipelineStates];
+        
+        if (nbPendingPipelineCompilations == 0)
+        {
+            [self updatePipelineArchive];
+        }
+        
+        return;
+    }
+    
+    ++nbPendingPipelineCompilations;
+    __weak Metal4Renderer* wSelf = self;
+    
+    dispatch_async(dispatch_get_global_queue(QOS_CLASS_USER_INITIATED, 0), ^{
+        Metal4Renderer* self = wSelf;
+        if (self == nil)
+        {
+            return;
+        }
+        
+        // Draw the background as soon as possible.
+        id<MTLRenderPipelineState> state = [self createRenderPipelineStateFor:pixelFormat];
+        dispatch_async(dispatch_get_main_queue(), ^{
+            Metal4Renderer* self = wSelf;
+            if (self != nil)
+            {
+                self->renderPipelineState = state;
+                [self setNeedsRedraw];
+            }
+        });
+        
+        // The frames don't read the compute pipelines until they're ready.
+        [self createComputePipelineStates];
+        
+        dispatch_async(dispatch_get_main_queue(), ^{
+            Metal4Renderer* self = wSelf;
+            if (self == nil)
+            {
+                return;
+            }
+            
+            self->pipelinesReady = YES;
+            
+            [self compileSpecializedSDFPipelineStates];
+            [self didFinishPipelineCompilation];
+            
+            // Draw the bubbles the frames skipped until now.
+            [self setNeedsRedraw];
+        });
+    });
 }
 
-- (void)createSharedEvent
+/// Updates the archive once a background compilation finishes.
+- (void)didFinishPipelineCompilation
 {
-    // Initialize the shared event to permit the renderer to start on the first frame.
-    sharedEvent = [device newSharedEvent];
-    sharedEvent.signaledValue = frameNumber;
+    NSAssert(nbPendingPipelineCompilations > 0, @"No pipeline compilation is running");
+    
+    --nbPendingPipelineCompilations;
+    if (nbPendingPipelineCompilations == 0)
+    {
+        [self updatePipelineArchive];
+    }
 }
 
-
-- (void) createResidencySets
+/// Writes the pipelines the compiler compiled to the archive when there's none yet,
+/// or deletes an archive that lacks pipelines so that the next launch rebuilds it.
+- (void)updatePipelineArchive
 {
-    NSError *error = NULL;
-
-    // Create a communal residency set for resources the app needs for every frame.
-    MTLResidencySetDescriptor *residencySetDescriptor;
-    residencySetDescriptor = [MTLResidencySetDescriptor new];
-    residencySet = [device newResidencySetWithDescriptor:residencySetDescriptor
-                                                     error:&error];
-
-    NSAssert(nil != residencySet,
-             @"The device can't create a residency set due to: %@", error);
-
-    // Add the communal residency set to the command queue.
-    [commandQueue addResidencySet:residencySet];
-
-    // Add the communal resources to the residency set.
-    [residencySet addAllocation:backgroundImageTexture];
-    [residencySet addAllocation:sdfTexture];
-    [residencySet addAllocation:sdfGradientTexture];
-    [residencySet addAllocation:vertexDataBuffer];
-    [residencySet addAllocation:uniformsBuffer];
-    [residencySet commit];
+    if (nil == pipelineArchive)
+    {
+        NSError *error = NULL;
+        if (![pipelineSerializer serializeAsArchiveAndFlushToURL:pipelineArchiveURL error:&error])
+        {
+            NSLog(@"The renderer can't archive its pipelines due to: %@", error);
+        }
+        
+        return;
+    }
     
-    // Create per-frame allocators and residency sets.
-    for (uint32_t i = 0; i < kMaxFramesInFlight; i++)
+    if (pipelineArchiveMissed)
     {
-        commandAllocators[i] = [device newCommandAllocator];
-        NSAssert(nil != commandAllocators[i],
-                 @"The device can't create an allocator set due to: %@", error);
+        // The pipelines the compiler compiled since aren't in the serializer of this launch.
+        [[NSFileManager defaultManager] removeItemAtURL:pipelineArchiveURL error:nil];
     }
 }
 
-- (nonnull instancetype)initWithView:(nonnull MTKView *)mtkView
+- (void)dealloc
 {
-    self = [super init];
-    if (nil == self) { return nil; }
+    [self stopWatchingShaderFile];
+}
 
-    frameNumber = 0;
-    viewportSize.x = (simd_uint1)mtkView.drawableSize.width;
-    viewportSize.y = (simd_uint1)mtkView.drawableSize.height;
+- (void)setShaderReloadURL:(NSURL*)shaderReloadURL
+{
+    _shaderReloadURL = [shaderReloadURL copy];
+    [self stopWatchingShaderFile];
     
-    view = mtkView;
-    device = mtkView.device;
+    if (nil == _shaderReloadURL)
+    {
+        return;
+    }
     
-    commandQueue = [device newMTL4CommandQueue];
-    commandBuffer = [device newCommandBuffer];
-    defaultLibrary = [device newDefaultLibrary];
+    if (nil == shaderReloadCompiler)
+    {
+        // Keep the pipelines of the reloads out of the archive of the app's shaders.
+        NSError *error = NULL;
+        shaderReloadCompiler = [device newCompilerWithDescriptor:[MTL4CompilerDescriptor new] error:&error];
+        if (nil == shaderReloadCompiler)
+        {
+            NSLog(@"The device can't create a compiler for the shader reloads due to: %@", error);
+            return;
+        }
+        
+        dispatch_queue_attr_t attributes = dispatch_queue_attr_make_with_qos_class(DISPATCH_QUEUE_SERIAL, QOS_CLASS_UTILITY, 0);
+        shaderReloadQueue = dispatch_queue_create("Shader Reload", attributes);
+    }
+    
+    [self watchShaderFile];
+    [self reloadShaders];
+}
 
-    // Create the app's resources.
-    [self createTextures];
+/// Watches the file of `shaderReloadURL` for the changes that reload the shaders.
+- (void)watchShaderFile
+{
+    const int fileDescriptor = open(_shaderReloadURL.fileSystemRepresentation, O_EVTONLY);
+    if (fileDescriptor < 0)
+    {
+        NSLog(@"The renderer can't watch the shaders of %@.", _shaderReloadURL.path);
+        return;
+    }
     
-    /*
-    const float2 size { float(offscreenTexture.width), float(offscreenTexture.height) };
+    dispatch_source_t source = dispatch_source_create(DISPATCH_SOURCE_TYPE_VNODE, fileDescriptor,
+                                                      DISPATCH_VNODE_WRITE | DISPATCH_VNODE_EXTEND
+                                                      | DISPATCH_VNODE_DELETE | DISPATCH_VNODE_RENAME,
+                                                      shaderReloadQueue);
     
-    _bubbles.push_back({
-        .origin = size * 0.5f,
-        .radius = 200.f
-    });
+    __weak Metal4Renderer* wSelf = self;
+    __weak dispatch_source_t wSource = source;
     
-    _bubbles.push_back({
-        .origin = size * 0.75f,
-        .radius = 100.f
+    dispatch_source_set_event_handler(source, ^{
+        const unsigned long changes = dispatch_source_get_data(wSource);
+        
+        // The renderer swaps its pipelines and watches the file on the main thread.
+        dispatch_async(dispatch_get_main_queue(), ^{
+            Metal4Renderer* self = wSelf;
+            if (self != nil && self->shaderReloadSource == wSource)
+            {
+                [self didChangeShaderFile:changes];
+            }
+        });
     });
     
-    _bubbles.push_back({
-        .origin = size * 0.25f,
-        .radius = 150.f
+    dispatch_source_set_cancel_handler(source, ^{
+        close(fileDescriptor);
     });
     
-    Bubble b1 {
-        .origin = float2 { size.x * 0.7f, size.y * 0.2f },
-        .radius = 100.f
-    };
-    
-    _bubbles.push_back(b1);
-    
-    _bubbles.push_back( {
-        .origin = b1.origin + float2{ 120.f, 120.f },
-        .radius = 80.f
-    });*/
-    
-    [self createBuffers];
+    shaderReloadSource = source;
+    dispatch_resume(source);
+}
 
-    // Create the types that manage the resources.
+- (void)stopWatchingShaderFile
+{
+    if (nil != shaderReloadSource)
+    {
+        dispatch_source_cancel(shaderReloadSource);
+        shaderReloadSource = nil;
+    }
+}
+
+/// Reloads the shaders after a change to their file.
+///
+/// Editors often save a file by replacing it, after which the renderer watches the new one.
+- (void)didChangeShaderFile:(unsigned long)changes
+{
+    if (0 != (changes & (DISPATCH_VNODE_DELETE | DISPATCH_VNODE_RENAME)))
+    {
+        [self stopWatchingShaderFile];
+        
+        NSURL *url = _shaderReloadURL;
+        __weak Metal4Renderer* wSelf = self;
+        
+        dispatch_after(dispatch_time(DISPATCH_TIME_NOW, int64_t(kShaderRewatchDelay * NSEC_PER_SEC)), dispatch_get_main_queue(), ^{
+            Metal4Renderer* self = wSelf;
+            if (self != nil && [self->_shaderReloadURL isEqual:url] && nil == self->shaderReloadSource)
+            {
+                [self watchShaderFile];
+                [self reloadShaders];
+            }
+        });
+        
+        return;
+    }
+    
+    [self reloadShaders];
+}
+
+/// Compiles the pipelines of `shaderReloadURL` in the background, and swaps them in between two frames.
+///
+/// The frames keep their pipelines when the shaders don't compile.
+- (void)reloadShaders
+{
+    const uint64_t generation = ++shaderReloadGeneration;
+    NSURL *url = _shaderReloadURL;
+    __weak Metal4Renderer* wSelf = self;
+    
+    dispatch_async(shaderReloadQueue, ^{
+        Metal4Renderer* self = wSelf;
+        if (self == nil)
+        {
+            return;
+        }
+        
+        NSError *error = NULL;
+        const CFTimeInterval start = CACurrentMediaTime();
+        
+        id<MTLLibrary> library = [self newShaderLibraryWithContentsOfURL:url error:&error];
+        if (nil == library)
+        {
+            NSLog(@"The renderer can't load the shaders of %@ due to: %@", url.path, error);
+            return;
+        }
+        
+        ReloadablePipelineStates states;
+        if (![self compileReloadablePipelineStates:states library:library error:&error])
+        {
+            NSLog(@"The renderer can't compile the pipelines of %@ due to: %@", url.path, error);
+            return;
+        }
+        
+        const CFTimeInterval duration = CACurrentMediaTime() - start;
+        
+        dispatch_async(dispatch_get_main_queue(), ^{
+            Metal4Renderer* self = wSelf;
+            if (self == nil || generation != self->shaderReloadGeneration)
+            {
+                return;
+            }
+            
+            if (!self->pipelinesReady)
+            {
+                NSLog(@"The renderer still compiles the app's shaders, and drops the ones of %@.", url.path);
+                return;
+            }
+            
+            [self swapInReloadedPipelineStates:states generation:generation];
+            NSLog(@"The renderer swapped in the shaders of %@ (reload %llu), compiled in %.0f ms.",
+                  url.path, generation, duration * 1e3);
+        });
+    });
+}
+
+/// Returns the library of the shaders of a file, which is either a `.metallib` or a `.metal` source.
+- (id<MTLLibrary>)newShaderLibraryWithContentsOfURL:(NSURL*)url error:(NSError**)error
+{
+    if ([url.pathExtension isEqualToString:@"metallib"])
+    {
+        return [device newLibraryWithURL:url error:error];
+    }
+    
+    NSString *source = [Metal4Renderer shaderSourceWithContentsOfURL:url includedURLs:[NSMutableSet new] error:error];
+    if (nil == source)
+    {
+        return nil;
+    }
+    
+    MTL4LibraryDescriptor *libraryDescriptor = [MTL4LibraryDescriptor new];
+    libraryDescriptor.source = source;
+    libraryDescriptor.name = url.lastPathComponent;
+    
+    return [shaderReloadCompiler newLibraryWithDescriptor:libraryDescriptor error:error];
+}
+
+/// Returns the source of a shader file, with the files of its quoted includes inlined once each.
+///
+/// A library compiled from a string can't look up the headers next to its file, like `ShaderTypes.h`.
++ (NSString*)shaderSourceWithContentsOfURL:(NSURL*)url
+                              includedURLs:(NSMutableSet<NSURL*>*)includedURLs
+                                     error:(NSError**)error
+{
+    NSString *source = [NSString stringWithContentsOfURL:url encoding:NSUTF8StringEncoding error:error];
+    if (nil == source)
+    {
+        return nil;
+    }
+    
+    [includedURLs addObject:url.URLByStandardizingPath];
+    
+    NSMutableString *result = [NSMutableString stringWithFormat:@"#line 1 \"%@\"\n", url.lastPathComponent];
+    __block NSUInteger lineNumber = 0;
+    __block NSError *includeError = nil;
+    
+    [source enumerateLinesUsingBlock:^(NSString *line, BOOL *stop) {
+        ++lineNumber;
+        
+        NSString *trimmedLine = [line stringByTrimmingCharactersInSet:NSCharacterSet.whitespaceCharacterSet];
+        NSArray<NSString*> *parts = [trimmedLine componentsSeparatedByString:@"\""];
+        
+        const BOOL isQuotedInclude = parts.count >= 3
+            && ([trimmedLine hasPrefix:@"#include"] || [trimmedLine hasPrefix:@"#import"]);
+        if (!isQuotedInclude)
+        {
+            [result appendFormat:@"%@\n", line];
+            return;
+        }
+        
+        NSURL *includeURL = [url.URLByDeletingLastPathComponent URLByAppendingPathComponent:parts[1]].URLByStandardizingPath;
+        if (![includedURLs containsObject:includeURL])
+        {
+            NSError *nestedError = nil;
+            NSString *included = [self shaderSourceWithContentsOfURL:includeURL includedURLs:includedURLs error:&nestedError];
+            if (nil == included)
+            {
+                includeError = nestedError;
+                *stop = YES;
+                return;
+            }
+            
+            [result appendString:included];
+        }
+        
+        [result appendFormat:@"#line %lu \"%@\"\n", (unsigned long)(lineNumber + 1), url.lastPathComponent];
+    }];
+    
+    if (nil != includeError)
+    {
+        if (error != NULL)
+        {
+            *error = includeError;
+        }
+        
+        return nil;
+    }
+    
+    return result;
+}
+
+/// Compiles the pipelines a reload replaces with the shaders of a library, on the calling thread.
+///
+/// - Returns: `NO` if a pipeline doesn't compile, in which case `error` describes why.
+- (BOOL)compileReloadablePipelineStates:(ReloadablePipelineStates&)states
+                                library:(id<MTLLibrary>)library
+                                  error:(NSError**)error
+{
+    states.sdf = [shaderReloadCompiler newComputePipelineStateWithDescriptor:[self computePipelineDescriptorWithFunctionName:[self sdfKernelName]
+                                                                                                             constantValues:nil
+                                                                                                                    library:library]
+                                                         compilerTaskOptions:nil
+                                                                       error:error];
+    if (nil == states.sdf)
+    {
+        return NO;
+    }
+    
+    if (!_usesFusedSDFPass)
+    {
+        states.gradient = [shaderReloadCompiler newComputePipelineStateWithDescriptor:[self computePipelineDescriptorWithFunctionName:[self gradientKernelName]
+                                                                                                                      constantValues:nil
+                                                                                                                             library:library]
+                                                                  compilerTaskOptions:nil
+                                                                                error:error];
+        if (nil == states.gradient)
+        {
+            return NO;
+        }
+    }
+    
+    // Replace the specialized variants too, otherwise the small scenes keep the app's shaders.
+    for (size_t i = 0; i < kNbSpecializedGroupSizes; ++i)
+    {
+        states.specializedSDF[i] = [shaderReloadCompiler newComputePipelineStateWithDescriptor:[self specializedSDFPipelineDescriptorAtIndex:i library:library]
+                                                                           compilerTaskOptions:nil
+                                                                                         error:error];
+        if (nil == states.specializedSDF[i])
+        {
+            return NO;
+        }
+    }
+    
+    states.render = [shaderReloadCompiler newRenderPipelineStateWithDescriptor:[self renderPipelineDescriptorFor:_colorPixelFormat library:library]
+                                                           compilerTaskOptions:nil
+                                                                         error:error];
+    return nil != states.render;
+}
+
+/// Replaces the pipelines of the frames with the ones of a reload.
+///
+/// The next frame recomputes the whole field with them, and the statistics restart
+/// so that they time the shaders of the reload.
+- (void)swapInReloadedPipelineStates:(const ReloadablePipelineStates&)states generation:(uint64_t)generation
+{
+    NSMutableArray *retired = (nil != retiredPipelineStates) ? [retiredPipelineStates mutableCopy] : [NSMutableArray new];
+    
+    id<MTLComputePipelineState> __strong &sdfPipelineState = _usesFusedSDFPass ? drawSDFAndGradientPipelineState : drawSDFPipelineState;
+    [retired addObject:sdfPipelineState];
+    sdfPipelineState = states.sdf;
+    
+    if (!_usesFusedSDFPass)
+    {
+        [retired addObject:drawSDFGradientPipelineState];
+        drawSDFGradientPipelineState = states.gradient;
+    }
+    
+    for (size_t i = 0; i < kNbSpecializedGroupSizes; ++i)
+    {
+        if (nil != specializedSDFPipelineStates[i])
+        {
+            [retired addObject:specializedSDFPipelineStates[i]];
+        }
+        
+        specializedSDFPipelineStates[i] = states.specializedSDF[i];
+    }
+    
+    [retired addObject:renderPipelineState];
+    renderPipelineState = states.render;
+    
+    retiredPipelineStates = retired;
+    lastFrameUsingRetiredPipelineStates = frameNumber;
+    swappedShaderReloadGeneration = generation;
+    
+    [self invalidateField];
+    [self resetFrameStats];
+    [self setNeedsRedraw];
+}
+
+- (void) createBuffers
+{
+    const float2 contentSize { float(backgroundImageTexture.width), float(backgroundImageTexture.height) };
+    const float2 vSize { float(viewportSize.x), float(viewportSize.y) };
+    
+    // Create the buffer that stores the vertex data.
+    vertexDataBuffer = [device newBufferWithLength:kNbRectangleVertices * sizeof(VertexData)
+                                             options:MTLResourceStorageModeShared];
+
+    getRectangleVertexData(reinterpret_cast<VertexData*>(vertexDataBuffer.contents), vSize, contentSize);
+
+    const NSUInteger nbTiles = threadgroupCount.width * threadgroupCount.height;
+    
+    // Create the per-frame buffers.
+    for (uint32_t i = 0; i < kMaxFramesInFlight; i++)
+    {
+        // Create the buffer that stores the app's viewport data.
+        uniformsBuffers[i] = [device newBufferWithLength:sizeof(Uniforms) options:MTLResourceStorageModeShared];
+        uniformsBuffers[i].label = @"Uniforms";
+        uploadedSceneVersions[i] = 0;
+        
+        // Create the buffers that store the bubbles and their groups.
+        bubbleGroupsBuffers[i] = [self reserveBuffer:nil
+                                              length:sizeof(BubbleGroup)
+                                               label:@"Bubble Groups"];
+        
+        bubblesBuffers[i] = [self reserveBuffer:nil
+                                         length:sizeof(Bubble)
+                                          label:@"Bubbles"];
+        
+        // Create the buffers that store the bubble groups of each tile.
+        tileBinsBuffers[i] = [self reserveBuffer:nil
+                                          length:nbTiles * sizeof(TileBin)
+                                           label:@"Tile Bins"];
+        
+        tileGroupIndicesBuffers[i] = [self reserveBuffer:nil
+                                                  length:nbTiles * sizeof(uint32_t)
+                                                   label:@"Tile Group Indices"];
+        
+        dirtyTilesBuffers[i] = [self reserveBuffer:nil
+                                            length:nbTiles * sizeof(uint32_t)
+                                             label:@"Dirty Tiles"];
+        
+        // The list of the SDF pass has at most one entry per tile.
+        if (_usesTransientSDFTexture)
+        {
+            sdfTilesBuffers[i] = [self reserveBuffer:nil
+                                              length:nbTiles * sizeof(uint32_t)
+                                               label:@"SDF Tiles"];
+        }
+    }
+
+    [self updateUniformsBuffer];
+}
+
+/// Returns a shared buffer that stores at least `length` bytes.
+///
+/// The method returns `buffer` when it's large enough. Otherwise it creates a
+/// larger buffer and swaps it for `buffer` in the residency set.
+- (id<MTLBuffer>)reserveBuffer:(id<MTLBuffer>)buffer
+                        length:(NSUInteger)length
+                         label:(NSString*)label
+{
+    if (nil != buffer && buffer.length >= length)
+    {
+        return buffer;
+    }
+    
+    // Grow geometrically to amortize the reallocations.
+    const NSUInteger capacity = std::max<NSUInteger>({ length, 2 * buffer.length, 256 });
+    
+    id<MTLBuffer> newBuffer = [device newBufferWithLength:capacity
+                                                  options:MTLResourceStorageModeShared];
+    NSAssert(nil != newBuffer,
+             @"The device can't create a buffer of %lu bytes for: %@",
+             (unsigned long)capacity, label);
+    newBuffer.label = label;
+    
+    if (nil != residencySet)
+    {
+        if (nil != buffer)
+        {
+            [residencySet removeAllocation:buffer];
+        }
+        
+        [residencySet addAllocation:newBuffer];
+        [residencySet commit];
+    }
+    
+    return newBuffer;
+}
+
+/// Loads two textures the app combines into the source color texture.
+- (void) createTextures
+{
+    //NSString *backgroundImageFileName = @"Hawaii-coastline";
+    NSString *backgroundImageFileName = @"water";
+    // Create a texture from the background image file, preferring a precompressed
+    // KTX file with its mipmaps when the bundle has one.
+    NSBundle *bundle = [NSBundle mainBundle];
+    NSURL *backgroundImageFile = [bundle URLForResource:backgroundImageFileName withExtension:@"ktx"]
+                              ?: [bundle URLForResource:backgroundImageFileName withExtension:@"tga"];
+    
+    TextureLoader *textureLoader = [[TextureLoader alloc] initWithDevice:device];
+    backgroundImageTexture = [textureLoader newTextureWithContentsOfURL:backgroundImageFile];
+    NSAssert(nil != backgroundImageTexture,
+             @"The app can't create a texture for the background image: %@",
+             backgroundImageFileName);
+    backgroundImageTexture.label = @"BackgroundImageTexture";
+    
+    // Create the source color texture that stores the combined texture data.
+    MTLTextureDescriptor *textureDescriptor = [[MTLTextureDescriptor alloc] init];
+    textureDescriptor.textureType = MTLTextureType2D;
+
+    // Configure the pixel format with 4 channels: blue, green, red, and alpha.
+    // Each is an 8-bit, unnormalized value; `0` maps to `0.0` and `255` maps to `1.0`.
+    textureDescriptor.pixelFormat = MTLPixelFormatBGRA8Unorm;
+    // The SDF textures cover the background image at the field scale.
+    textureDescriptor.width = (backgroundImageTexture.width + _fieldScale - 1) / _fieldScale;
+    textureDescriptor.height = (backgroundImageTexture.height + _fieldScale - 1) / _fieldScale;
+    
+    fieldTexelSize = float2 {
+        float(backgroundImageTexture.width) / float(textureDescriptor.width),
+        float(backgroundImageTexture.height) / float(textureDescriptor.height)
+    };
+
+    // Only the compute passes write the SDF textures, which the GPU alone accesses.
+    // Without the pixel format view usage and with private storage, the GPU compresses
+    // them losslessly.
+    textureDescriptor.usage = MTLTextureUsageShaderWrite | MTLTextureUsageShaderRead;
+    textureDescriptor.storageMode = MTLStorageModePrivate;
+    textureDescriptor.compressionType = MTLTextureCompressionTypeLossless;
+    
+    if (!_usesFusedSDFPass)
+    {
+        textureDescriptor.pixelFormat = MTLPixelFormatR16Float;
+        
+        if (_usesTransientSDFTexture)
+        {
+            sdfTexture = [self newTransientTextureWithDescriptor:textureDescriptor];
+        }
+        else
+        {
+            sdfTexture = [device newTextureWithDescriptor:textureDescriptor];
+        }
+        
+        NSAssert(nil != sdfTexture,
+                 @"The device can't create a texture for the SDF.");
+        sdfTexture.label = @"SDF Texture";
+    }
+    
+    textureDescriptor.pixelFormat = (_texelFormat == SDFTexelFormatPacked) ? MTLPixelFormatR32Uint : MTLPixelFormatRGBA16Float;
+    sdfGradientTexture = [device newTextureWithDescriptor:textureDescriptor];
+    NSAssert(nil != sdfGradientTexture,
+             @"The device can't create a texture for the gradient.");
+    sdfGradientTexture.label = @"SDF Gradient Texture";
+    
+    [self createSDFPyramidTextureForSDFWidth:textureDescriptor.width height:textureDescriptor.height];
+}
+
+/// Creates the pyramid of the SDF, whose base covers the tiles of an SDF texture of a size.
+- (void)createSDFPyramidTextureForSDFWidth:(NSUInteger)width height:(NSUInteger)height
+{
+    // Each tile reduces to `SDFTileSize / 2` texels at the base, so the levels up to the tile level divide evenly.
+    const NSUInteger tileTexels = SDFTileSize / 2;
+    
+    MTLTextureDescriptor *textureDescriptor;
+    textureDescriptor = [MTLTextureDescriptor texture2DDescriptorWithPixelFormat:MTLPixelFormatRG16Float
+                                                                           width:(width + SDFTileSize - 1) / SDFTileSize * tileTexels
+                                                                          height:(height + SDFTileSize - 1) / SDFTileSize * tileTexels
+                                                                       mipmapped:YES];
+    
+    textureDescriptor.usage = MTLTextureUsageShaderWrite | MTLTextureUsageShaderRead;
+    textureDescriptor.storageMode = MTLStorageModePrivate;
+    
+    sdfPyramidTexture = [device newTextureWithDescriptor:textureDescriptor];
+    NSAssert(nil != sdfPyramidTexture,
+             @"The device can't create a texture for the pyramid of the SDF.");
+    sdfPyramidTexture.label = @"SDF Pyramid Texture";
+    
+    NSMutableArray<id<MTLTexture>>* levels = [NSMutableArray arrayWithCapacity:sdfPyramidTexture.mipmapLevelCount];
+    for (NSUInteger level = 0; level < sdfPyramidTexture.mipmapLevelCount; ++level)
+    {
+        [levels addObject:[sdfPyramidTexture newTextureViewWithPixelFormat:textureDescriptor.pixelFormat
+                                                               textureType:MTLTextureType2D
+                                                                    levels:NSMakeRange(level, 1)
+                                                                    slices:NSMakeRange(0, 1)]];
+    }
+    
+    sdfPyramidLevels = levels;
+}
+
+/// Creates a texture in a heap of its own, which the renderer marks as purgeable while it doesn't need its contents.
+- (id<MTLTexture>)newTransientTextureWithDescriptor:(MTLTextureDescriptor*)textureDescriptor
+{
+    const MTLSizeAndAlign sizeAndAlign = [device heapTextureSizeAndAlignWithDescriptor:textureDescriptor];
+    
+    MTLHeapDescriptor *heapDescriptor = [MTLHeapDescriptor new];
+    heapDescriptor.storageMode = textureDescriptor.storageMode;
+    heapDescriptor.hazardTrackingMode = MTLHazardTrackingModeUntracked;
+    heapDescriptor.size = sizeAndAlign.size;
+    
+    sdfTextureHeap = [device newHeapWithDescriptor:heapDescriptor];
+    NSAssert(nil != sdfTextureHeap,
+             @"The device can't create a heap for the SDF texture.");
+    sdfTextureHeap.label = @"SDF Texture Heap";
+    
+    textureDescriptor.hazardTrackingMode = MTLHazardTrackingModeUntracked;
+    return [sdfTextureHeap newTextureWithDescriptor:textureDescriptor];
+}
+
+/// Configures the number of rows and columns in the threadgroups based on the input image's size.
+///
+/// The method ensures the grid covers an area that's at least as big as the
+/// entire image.
+- (void) configureThreadgroupForComputePasses
+{
+    NSAssert(sdfGradientTexture, @"Create the SDF textures before configuring the threadgroup");
+
+    // Set the compute kernel's threadgroup size to 16 x 16,
+    // which is the size of the tiles the bubble groups are binned into.
+    threadgroupSize = MTLSizeMake(SDFTileSize, SDFTileSize, 1);
+
+    // Find the number of threadgroup widths the app needs to span the texture's full width.
+    threadgroupCount.width  = sdfGradientTexture.width  + threadgroupSize.width -  1;
+    threadgroupCount.width /= threadgroupSize.width;
+
+    // Find the number of threadgroup heights the app needs to span the texture's full width.
+    threadgroupCount.height = sdfGradientTexture.height + threadgroupSize.height - 1;
+    threadgroupCount.height /= threadgroupSize.height;
+
+    // Set depth to one because the image data is two-dimensional.
+    threadgroupCount.depth = 1;
+}
+
+- (void) createArgumentTable
+{
+    // Create an argument table that stores 7 buffers and 6 textures.
+    MTL4ArgumentTableDescriptor *argumentTableDescriptor;
+    argumentTableDescriptor = [[MTL4ArgumentTableDescriptor alloc] init];
+
+    // Configure the descriptor to store 6 buffers:
+    // - A vertex buffer
+    // - A viewport size buffer
+    // - The bubbles and their groups
+    // - The tile bins and their group indices.
+    argumentTableDescriptor.maxTextureBindCount = 6;
+    argumentTableDescriptor.maxBufferBindCount = 7;
+
+    // Create an argument table with the descriptor.
+    NSError *error = NULL;
+    argumentTable = [device newArgumentTableWithDescriptor:argumentTableDescriptor
+                                                     error:&error];
+    NSAssert(nil != argumentTable,
+             @"The device can't create an argument table due to: %@", error);
+    
+    // The grouping kernels only read and write buffers.
+    MTL4ArgumentTableDescriptor *groupingArgumentTableDescriptor;
+    groupingArgumentTableDescriptor = [[MTL4ArgumentTableDescriptor alloc] init];
+    groupingArgumentTableDescriptor.maxBufferBindCount = GroupingBufferBindingIndexCount;
+    
+    groupingArgumentTable = [device newArgumentTableWithDescriptor:groupingArgumentTableDescriptor
+                                                             error:&error];
+    NSAssert(nil != groupingArgumentTable,
+             @"The device can't create the argument table of the grouping due to: %@", error);
+}
+
+/// Creates the counter heap that stores the GPU timestamps of the frames in flight.
+- (void)createTimestampHeap
+{
+    MTL4CounterHeapDescriptor *heapDescriptor = [MTL4CounterHeapDescriptor new];
+    heapDescriptor.type = MTL4CounterHeapTypeTimestamp;
+    heapDescriptor.count = kMaxFramesInFlight * FrameTimestampCount;
+    
+    NSError *error = NULL;
+    timestampHeap = [device newCounterHeapWithDescriptor:heapDescriptor error:&error];
+    
+    if (nil == timestampHeap)
+    {
+        // The statistics then only have the CPU durations.
+        NSLog(@"The device can't create the timestamp heap due to: %@", error);
+        return;
+    }
+    
+    timestampHeap.label = @"Frame Timestamps";
+    timestampFrequency = double([device queryTimestampFrequency]);
+}
+
+- (void)createSharedEvent
+{
+    // Initialize the shared event to permit the renderer to start on the first frame.
+    sharedEvent = [device newSharedEvent];
+    sharedEvent.signaledValue = frameNumber;
+}
+
+
+- (void) createResidencySets
+{
+    NSError *error = NULL;
+
+    // Create a communal residency set for resources the app needs for every frame.
+    MTLResidencySetDescriptor *residencySetDescriptor;
+    residencySetDescriptor = [MTLResidencySetDescriptor new];
+    residencySet = [device newResidencySetWithDescriptor:residencySetDescriptor
+                                                     error:&error];
+
+    NSAssert(nil != residencySet,
+             @"The device can't create a residency set due to: %@", error);
+
+    // Add the communal residency set to the command queue.
+    [commandQueue addResidencySet:residencySet];
+
+    // Add the communal resources to the residency set.
+    [residencySet addAllocation:backgroundImageTexture];
+    if (nil != sdfTextureHeap)
+    {
+        [residencySet addAllocation:sdfTextureHeap];
+    }
+    else if (nil != sdfTexture)
+    {
+        [residencySet addAllocation:sdfTexture];
+    }
+    
+    [residencySet addAllocation:sdfGradientTexture];
+    [residencySet addAllocation:sdfPyramidTexture];
+    [residencySet addAllocation:vertexDataBuffer];
+    
+    for (uint32_t i = 0; i < kMaxFramesInFlight; i++)
+    {
+        [residencySet addAllocation:uniformsBuffers[i]];
+        [residencySet addAllocation:bubbleGroupsBuffers[i]];
+        [residencySet addAllocation:bubblesBuffers[i]];
+        [residencySet addAllocation:tileBinsBuffers[i]];
+        [residencySet addAllocation:tileGroupIndicesBuffers[i]];
+        [residencySet addAllocation:dirtyTilesBuffers[i]];
+        
+        if (nil != sdfTilesBuffers[i])
+        {
+            [residencySet addAllocation:sdfTilesBuffers[i]];
+        }
+    }
+    
+    [residencySet commit];
+    
+    // Create per-frame allocators and residency sets.
+    for (uint32_t i = 0; i < kMaxFramesInFlight; i++)
+    {
+        commandAllocators[i] = [device newCommandAllocator];
+        NSAssert(nil != commandAllocators[i],
+                 @"The device can't create an allocator set due to: %@", error);
+    }
+}
+
++ (SDFFieldScale)preferredFieldScaleForView:(nonnull MTKView *)mtkView
+{
+    // A 60 Hz display leaves enough time for the full field.
+    if (UIScreen.mainScreen.maximumFramesPerSecond < 120)
+    {
+        return SDFFieldScaleFull;
+    }
+    
+    // ProMotion halves the budget.
+    if ([mtkView.device supportsFamily:MTLGPUFamilyApple9])
+    {
+        return SDFFieldScaleHalf;
+    }
+    
+    return SDFFieldScaleQuarter;
+}
+
+- (nonnull instancetype)initWithView:(nonnull MTKView *)mtkView
+{
+    return [self initWithView:mtkView fusedSDFPass:YES];
+}
+
+- (nonnull instancetype)initWithView:(nonnull MTKView *)mtkView
+                        fusedSDFPass:(BOOL)fusedSDFPass
+{
+    return [self initWithView:mtkView
+                 fusedSDFPass:fusedSDFPass
+                   fieldScale:[Metal4Renderer preferredFieldScaleForView:mtkView]];
+}
+
+- (nonnull instancetype)initWithView:(nonnull MTKView *)mtkView
+                        fusedSDFPass:(BOOL)fusedSDFPass
+                          fieldScale:(SDFFieldScale)fieldScale
+{
+    return [self initWithView:mtkView
+                 fusedSDFPass:fusedSDFPass
+                   fieldScale:fieldScale
+          transientSDFTexture:NO];
+}
+
+- (nonnull instancetype)initWithView:(nonnull MTKView *)mtkView
+                        fusedSDFPass:(BOOL)fusedSDFPass
+                          fieldScale:(SDFFieldScale)fieldScale
+                 transientSDFTexture:(BOOL)transientSDFTexture
+{
+    return [self initWithView:mtkView
+                 fusedSDFPass:fusedSDFPass
+                   fieldScale:fieldScale
+          transientSDFTexture:transientSDFTexture
+                  texelFormat:SDFTexelFormatRGBA16Float];
+}
+
+- (nonnull instancetype)initWithDevice:(nonnull id<MTLDevice>)aDevice
+{
+    return [self initWithDevice:aDevice
+                   drawableSize:CGSizeZero
+                   fusedSDFPass:YES
+                     fieldScale:SDFFieldScaleFull
+            transientSDFTexture:NO
+                    texelFormat:SDFTexelFormatRGBA16Float];
+}
+
+/// Creates the resources and the pipelines of a renderer, which the initializers of a view then attach to it.
+///
+/// - Parameter drawableSize: The size of the view's drawable, which is empty without a view.
+- (nonnull instancetype)initWithDevice:(nonnull id<MTLDevice>)aDevice
+                          drawableSize:(CGSize)drawableSize
+                          fusedSDFPass:(BOOL)fusedSDFPass
+                            fieldScale:(SDFFieldScale)fieldScale
+                   transientSDFTexture:(BOOL)transientSDFTexture
+                           texelFormat:(SDFTexelFormat)texelFormat
+{
+    self = [super init];
+    if (nil == self) { return nil; }
+    
+    _usesFusedSDFPass = fusedSDFPass;
+    _fieldScale = fieldScale;
+    _usesTransientSDFTexture = transientSDFTexture && !fusedSDFPass;
+    _texelFormat = texelFormat;
+
+    frameNumber = 0;
+    frameIndex = 0;
+    viewportSize.x = (simd_uint1)drawableSize.width;
+    viewportSize.y = (simd_uint1)drawableSize.height;
+    
+    device = aDevice;
+    
+    pendingBubbleRecords = [NSMutableArray new];
+    bubbleStreamLock = OS_UNFAIR_LOCK_INIT;
+    
+    commandQueue = [device newMTL4CommandQueue];
+    commandBuffer = [device newCommandBuffer];
+    defaultLibrary = [device newDefaultLibrary];
+
+    // Create the app's resources.
+    [self createTextures];
+    
+    // The tiles of the SDF match the threadgroups of the compute passes.
+    [self configureThreadgroupForComputePasses];
+    
+    [self createBuffers];
+
+    // Create the types that manage the resources.
     [self createArgumentTable];
+    [self createTimestampHeap];
     [self createSharedEvent];
     [self createResidencySets];
     
-    // Add the Metal layer's residency set to the queue.
-    [commandQueue addResidencySet:((CAMetalLayer *)mtkView.layer).residencySet];
+    // The color format of the views and of the offscreen targets.
+    _colorPixelFormat = MTLPixelFormatBGRA8Unorm_sRGB;
+
+    // Create the compute and render pipelines.
+    [self createCompiler];
+    [self createPipelineStatesFor:_colorPixelFormat];
+    
+    lightDirection = normalize(float2{1.f, -1.f});
+    
+    return self;
+}
+
+- (nonnull instancetype)initWithView:(nonnull MTKView *)mtkView
+                        fusedSDFPass:(BOOL)fusedSDFPass
+                          fieldScale:(SDFFieldScale)fieldScale
+                 transientSDFTexture:(BOOL)transientSDFTexture
+                         texelFormat:(SDFTexelFormat)texelFormat
+{
+    self = [self initWithDevice:mtkView.device
+                   drawableSize:mtkView.drawableSize
+                   fusedSDFPass:fusedSDFPass
+                     fieldScale:fieldScale
+            transientSDFTexture:transientSDFTexture
+                    texelFormat:texelFormat];
+    if (nil == self) { return nil; }
+    
+    view = mtkView;
+    
+    // Add the Metal layer's residency set to the queue.
+    [commandQueue addResidencySet:((CAMetalLayer *)mtkView.layer).residencySet];
+
+    // Configure the view's color format.
+    mtkView.colorPixelFormat = _colorPixelFormat;
+    
+    // Let several fingers drag bubbles at the same time.
+    __weak Metal4Renderer* wSelf = self;
+    touchTrackingRecognizer = [[TouchTrackingGestureRecognizer alloc] initWithTarget:nil action:nil];
+    touchTrackingRecognizer.touchesHandler = ^(NSSet<UITouch*>* touches, UITouchPhase phase) {
+        [wSelf onTouches:touches phase:phase];
+    };
+    [mtkView addGestureRecognizer:touchTrackingRecognizer];
+    mtkView.multipleTouchEnabled = YES;
+    
+    doubleTapGestureRecognizer = [[UITapGestureRecognizer alloc] initWithTarget:self action:@selector(onDoubleTap:)];
+    doubleTapGestureRecognizer.numberOfTapsRequired = 2;
+    [mtkView addGestureRecognizer:doubleTapGestureRecognizer];
+    
+    auto scaleRecognizer = [[UIPinchGestureRecognizer alloc] initWithTarget:self action:@selector(onPinch:)];
+    [mtkView addGestureRecognizer:scaleRecognizer];
+    
+    motionManager = [CMMotionManager new];
+    
+    // Draw the first frames, then only the ones that change the scene.
+    _rendersOnDemand = YES;
+    [self setNeedsRedraw];
+    
+    if ([motionManager isDeviceMotionAvailable])
+    {
+        // Start getting updates
+        [motionManager startDeviceMotionUpdatesToQueue:[NSOperationQueue mainQueue]
+                                          withHandler:^(CMDeviceMotion *motion, NSError *error) {
+            if (error != nil)
+            {
+                return;
+            }
+
+            Metal4Renderer* self = wSelf;
+            if (self == nil)
+            {
+                return;
+            }
+             
+            float angle;
+            
+            const auto orientation = [UIDevice currentDevice].orientation;
+            if (UIDeviceOrientationIsPortrait(orientation))
+            {
+                angle = motion.attitude.roll;
+            }
+            else
+            {
+                angle = motion.attitude.yaw;
+            }
+            
+            // Ignore the noise of the sensors, which would keep an idle view drawing.
+            const float2 direction { cosf(angle), sinf(angle) };
+            if (distance(direction, self->lightDirection) < kLightDirectionThreshold)
+            {
+                return;
+            }
+            
+            self->lightDirection = direction;
+            [self setNeedsRedraw];
+            
+        }];
+    }
+    return self;
+}
+
+- (Uniforms*)uniforms
+{
+    return reinterpret_cast<Uniforms*>(uniformsBuffers[frameIndex].contents);
+}
+
+- (void)updateUniformsBuffer
+{
+    auto buf = [self uniforms];
+    
+    buf->viewportSize = viewportSize;
+    
+    // The refraction offsets are in background pixels, whatever the field scale.
+    constexpr float s = 3e1f;
+    const float2 gradientScale { s / float(backgroundImageTexture.width), s / float(backgroundImageTexture.height) };
+    
+    buf->gradientScale = gradientScale;
+    
+    buf->lightDirection = lightDirection;
+    buf->nbTilesPerRow = (uint32_t)threadgroupCount.width;
+    buf->fieldTexelSize = fieldTexelSize;
+    
+    // Only the GPU grouping simulates the bubbles.
+    encodesSimulation = NO;
+    nbSimulatedBubbles[frameIndex] = 0;
+    
+    // Leave the tile bins empty, so the frames only draw the background, until the
+    // compute pipelines are ready. The first update then computes all the tiles.
+    if (!pipelinesReady)
+    {
+        nbDirtyTiles = 0;
+        encodesGPUGrouping = NO;
+        return;
+    }
+    
+    // The simulation moves the bubbles of the GPU grouping.
+    if (_bubbleSet.size() >= kMinBubblesForGPUGrouping || (_simulatesBubbles && _bubbleSet.size() > 0))
+    {
+        // The CPU doesn't know the size of the groups.
+        frameSDFPipelineState = [self sdfPipelineStateForMaxGroupSize:std::numeric_limits<size_t>::max()];
+        
+        [self prepareGPUGrouping];
+        return;
+    }
+    
+    encodesGPUGrouping = NO;
+    if (groupsBubblesOnGPU)
+    {
+        // The groups of the set are stale, and so are its dirty tiles.
+        groupsBubblesOnGPU = NO;
+        _bubbleSet.invalidateTiles();
+    }
+    
+    const CFTimeInterval sceneUpdateStart = CACurrentMediaTime();
+    _bubbleSet.update(uint2 { (uint32_t)threadgroupCount.width, (uint32_t)threadgroupCount.height }, fieldTexelSize);
+    stats.addDuration(FramePhaseSceneUpdate, CACurrentMediaTime() - sceneUpdateStart);
+    
+    // Specialize the SDF pass for the largest group of the scene.
+    frameSDFPipelineState = [self sdfPipelineStateForMaxGroupSize:_bubbleSet.maxGroupSize()];
+    
+    buf->nbBubbleGroups = _bubbleSet.groups().size();
+    
+    // Only recompute the tiles the changes reach.
+    const auto& dirtyTiles = _bubbleSet.dirtyTiles();
+    nbDirtyTiles = dirtyTiles.size();
+    
+    if (nbDirtyTiles > 0)
+    {
+        dirtyTilesBuffers[frameIndex] = [self reserveBuffer:dirtyTilesBuffers[frameIndex]
+                                                     length:nbDirtyTiles * sizeof(uint32_t)
+                                                      label:@"Dirty Tiles"];
+        
+        memcpy(dirtyTilesBuffers[frameIndex].contents, dirtyTiles.data(), nbDirtyTiles * sizeof(uint32_t));
+        
+        [self recordBubblesPerTexel];
+    }
+    
+    // Skip the upload when this frame's buffers already store the current groups.
+    const uint64_t sceneVersion = _bubbleSet.version();
+    if (uploadedSceneVersions[frameIndex] == sceneVersion)
+    {
+        return;
+    }
+    
+    uploadedSceneVersions[frameIndex] = sceneVersion;
+    
+    // Upload the groups and their bins.
+    const auto& groups = _bubbleSet.groups();
+    const auto& bubbles = _bubbleSet.groupedBubbles();
+    const auto& tileBins = _bubbleSet.tileBins();
+    const auto& tileGroupIndices = _bubbleSet.tileGroupIndices();
+    
+    // The GPU is done with this frame's buffers, so they can grow in place.
+    bubbleGroupsBuffers[frameIndex] = [self reserveBuffer:bubbleGroupsBuffers[frameIndex]
+                                                   length:groups.size() * sizeof(BubbleGroup)
+                                                    label:@"Bubble Groups"];
+    
+    bubblesBuffers[frameIndex] = [self reserveBuffer:bubblesBuffers[frameIndex]
+                                              length:bubbles.size() * sizeof(Bubble)
+                                               label:@"Bubbles"];
+    
+    tileGroupIndicesBuffers[frameIndex] = [self reserveBuffer:tileGroupIndicesBuffers[frameIndex]
+                                                       length:tileGroupIndices.size() * sizeof(uint32_t)
+                                                        label:@"Tile Group Indices"];
+    
+    memcpy(bubbleGroupsBuffers[frameIndex].contents, groups.data(), groups.size() * sizeof(BubbleGroup));
+    memcpy(bubblesBuffers[frameIndex].contents, bubbles.data(), bubbles.size() * sizeof(Bubble));
+    memcpy(tileBinsBuffers[frameIndex].contents, tileBins.data(), tileBins.size() * sizeof(TileBin));
+    memcpy(tileGroupIndicesBuffers[frameIndex].contents, tileGroupIndices.data(), tileGroupIndices.size() * sizeof(uint32_t));
+}
+
+/// Records the average number of bubbles the SDF pass evaluates for the texels of the dirty tiles.
+///
+/// The texels of a tile evaluate the bubbles that the SDF templates don't skip in the tile,
+/// out of the bubbles of the groups of its bin, which the method records too.
+- (void)recordBubblesPerTexel
+{
+    const auto& groups = _bubbleSet.groups();
+    const auto& bubbles = _bubbleSet.groupedBubbles();
+    const auto& tileBins = _bubbleSet.tileBins();
+    const auto& tileGroupIndices = _bubbleSet.tileGroupIndices();
+    
+    size_t nbEvaluatedBubbles = 0;
+    size_t nbBinnedBubbles = 0;
+    for (const uint32_t packedTile : _bubbleSet.dirtyTiles())
+    {
+        const uint2 tile = unpackTileCoordinates(packedTile);
+        const TileBin& bin = tileBins[size_t(tile.y) * threadgroupCount.width + tile.x];
+        const TileBounds bounds = tileBoundsOfTexel(tile * uint32_t(SDFTileSize), fieldTexelSize);
+        
+        for (uint32_t i = 0; i < bin.nbGroups; ++i)
+        {
+            const BubbleGroup& group = groups[tileGroupIndices[bin.firstGroupIndex + i]];
+            
+            nbEvaluatedBubbles += countEvaluatedBubbles(group, &bubbles[group.firstBubble], bounds);
+            nbBinnedBubbles += group.nbBubbles;
+        }
+    }
+    
+    stats.addBubblesPerTexel(double(nbEvaluatedBubbles) / double(nbDirtyTiles),
+                             double(nbBinnedBubbles) / double(nbDirtyTiles));
+}
+
+/// Creates the compute pipelines that group the bubbles on the GPU.
+- (void)createGroupingPipelineStates
+{
+    exclusiveScanPipelineState = [self createComputePipelineStateWithFunctionName:@"exclusiveScan"];
+    NSAssert(exclusiveScanPipelineState.maxTotalThreadsPerThreadgroup >= GroupingScanThreadgroupSize,
+             @"The prefix sum needs threadgroups of %d threads", GroupingScanThreadgroupSize);
+    
+    countGridCellsPipelineState = [self createComputePipelineStateWithFunctionName:@"countGridCells"];
+    fillGridCellsPipelineState = [self createComputePipelineStateWithFunctionName:@"fillGridCells"];
+    uniteOverlappingBubblesPipelineState = [self createComputePipelineStateWithFunctionName:@"uniteOverlappingBubbles"];
+    resolveBubbleRootsPipelineState = [self createComputePipelineStateWithFunctionName:@"resolveBubbleRoots"];
+    sizeBubbleGroupsPipelineState = [self createComputePipelineStateWithFunctionName:@"sizeBubbleGroups"];
+    rankGroupMembersPipelineState = [self createComputePipelineStateWithFunctionName:@"rankGroupMembers"];
+    NSAssert(rankGroupMembersPipelineState.maxTotalThreadsPerThreadgroup >= GroupingScanThreadgroupSize,
+             @"The ranking needs threadgroups of %d threads", GroupingScanThreadgroupSize);
+    
+    sortGroupMembersPipelineState = [self createComputePipelineStateWithFunctionName:@"sortGroupMembers"];
+    countTileGroupsPipelineState = [self createComputePipelineStateWithFunctionName:@"countTileGroups"];
+    fillTileGroupsPipelineState = [self createComputePipelineStateWithFunctionName:@"fillTileGroups"];
+    writeTileBinsPipelineState = [self createComputePipelineStateWithFunctionName:@"writeTileBins"];
+    
+    applySimulationEditsPipelineState = [self createComputePipelineStateWithFunctionName:@"applySimulationEdits"];
+    gatherSimulatedOriginsPipelineState = [self createComputePipelineStateWithFunctionName:@"gatherSimulatedOrigins"];
+    simulateBubblesPipelineState = [self createComputePipelineStateWithFunctionName:@"simulateBubbles"];
+}
+
+/// Returns the number of cells of the hashed grid of the GPU grouping, a power of two.
+static uint32_t gridCellCountForBubbles(uint32_t nbBubbles)
+{
+    // Twice the bubbles keeps the collisions rare.
+    uint32_t nbCells = 1;
+    while (nbCells < 2 * nbBubbles)
+    {
+        nbCells <<= 1;
+    }
+    
+    return nbCells;
+}
+
+/// Uploads the bubbles for the GPU grouping, and sizes the buffers of the frame.
+///
+/// The CPU only reads back the counters of a previous grouping of the frame,
+/// to grow the buffers it overflowed and group again.
+- (void)prepareGPUGrouping
+{
+    const uint32_t nbBubbles = (uint32_t)_bubbleSet.size();
+    const uint32_t nbCells = gridCellCountForBubbles(nbBubbles);
+    const uint32_t nbTiles = (uint32_t)(threadgroupCount.width * threadgroupCount.height);
+    
+    id<MTLBuffer> __strong * buffers = groupingBuffers[frameIndex];
+    
+    NSUInteger cellEntriesLength = 4 * nbBubbles * sizeof(uint32_t);
+    NSUInteger tileGroupIndicesLength = std::max(nbBubbles, nbTiles) * sizeof(uint32_t);
+    
+    BOOL overflowed = NO;
+    if (groupedOnGPU[frameIndex])
+    {
+        // The GPU is done with this frame's buffers.
+        const auto* counters = reinterpret_cast<const GroupingCounters*>(buffers[GroupingBufferBindingIndexForCounters].contents);
+        const auto* uniforms = reinterpret_cast<const GroupingUniforms*>(buffers[GroupingBufferBindingIndexForUniforms].contents);
+        
+        nbGPUBubbleGroups = counters->nbGroups;
+        
+        overflowed = (counters->nbCellEntries > uniforms->cellEntriesCapacity) ||
+                     (counters->nbTileGroupIndices > uniforms->tileGroupIndicesCapacity);
+        
+        cellEntriesLength = std::max<NSUInteger>(cellEntriesLength, counters->nbCellEntries * sizeof(uint32_t));
+        tileGroupIndicesLength = std::max<NSUInteger>(tileGroupIndicesLength, counters->nbTileGroupIndices * sizeof(uint32_t));
+    }
+    
+    // The field of a frame that overflowed misses groups.
+    const CFTimeInterval sceneUpdateStart = CACurrentMediaTime();
+    const BOOL bubblesChanged = _bubbleSet.commitChanges();
+    stats.addDuration(FramePhaseSceneUpdate, CACurrentMediaTime() - sceneUpdateStart);
+    
+    // The bubbles of a simulation move every frame.
+    encodesSimulation = _simulatesBubbles;
+    if (encodesSimulation)
+    {
+        nbSimulatedBubbles[frameIndex] = nbBubbles;
+    }
+    
+    const BOOL fieldChanged = bubblesChanged || overflowed || !groupsBubblesOnGPU || encodesSimulation;
+    groupsBubblesOnGPU = YES;
+    
+    const uint64_t sceneVersion = _bubbleSet.version();
+    encodesGPUGrouping = overflowed || (uploadedSceneVersions[frameIndex] != sceneVersion) || encodesSimulation;
+    groupedOnGPU[frameIndex] = encodesGPUGrouping;
+    
+    if (fieldChanged)
+    {
+        // Recompute every tile, the CPU doesn't know which ones the groups reach.
+        nbDirtyTiles = nbTiles;
+        dirtyTilesBuffers[frameIndex] = [self reserveBuffer:dirtyTilesBuffers[frameIndex]
+                                                     length:nbTiles * sizeof(uint32_t)
+                                                      label:@"Dirty Tiles"];
+        
+        auto* dirtyTiles = reinterpret_cast<uint32_t*>(dirtyTilesBuffers[frameIndex].contents);
+        for (uint32_t y = 0; y < threadgroupCount.height; ++y)
+        {
+            for (uint32_t x = 0; x < threadgroupCount.width; ++x)
+            {
+                *dirtyTiles++ = packTileCoordinates(uint2 { x, y });
+            }
+        }
+    }
+    else
+    {
+        nbDirtyTiles = 0;
+    }
+    
+    if (!encodesGPUGrouping)
+    {
+        return;
+    }
+    
+    uploadedSceneVersions[frameIndex] = sceneVersion;
+    
+    // Size this frame's buffers, which the GPU is done with.
+    const NSUInteger perBubbleLength = nbBubbles * sizeof(uint32_t);
+    NSUInteger lengths[GroupingBufferBindingIndexForGroups] = {};
+    lengths[GroupingBufferBindingIndexForUniforms] = sizeof(GroupingUniforms);
+    lengths[GroupingBufferBindingIndexForCounters] = sizeof(GroupingCounters);
+    lengths[GroupingBufferBindingIndexForOrigins] = nbBubbles * sizeof(float2);
+    lengths[GroupingBufferBindingIndexForRadii] = nbBubbles * sizeof(float);
+    lengths[GroupingBufferBindingIndexForSlots] = perBubbleLength;
+    lengths[GroupingBufferBindingIndexForCellCounts] = nbCells * sizeof(uint32_t);
+    lengths[GroupingBufferBindingIndexForCellOffsets] = nbCells * sizeof(uint32_t);
+    lengths[GroupingBufferBindingIndexForCellEntries] = cellEntriesLength;
+    lengths[GroupingBufferBindingIndexForLabels] = perBubbleLength;
+    lengths[GroupingBufferBindingIndexForRoots] = perBubbleLength;
+    lengths[GroupingBufferBindingIndexForMinDistances] = perBubbleLength;
+    lengths[GroupingBufferBindingIndexForRootFlags] = perBubbleLength;
+    lengths[GroupingBufferBindingIndexForGroupIndicesOfRoots] = perBubbleLength;
+    lengths[GroupingBufferBindingIndexForRootSizes] = perBubbleLength;
+    lengths[GroupingBufferBindingIndexForGroupSizes] = perBubbleLength;
+    lengths[GroupingBufferBindingIndexForGroupOffsets] = perBubbleLength;
+    lengths[GroupingBufferBindingIndexForMemberRanks] = perBubbleLength;
+    lengths[GroupingBufferBindingIndexForGroupCircles] = nbBubbles * sizeof(float4);
+    lengths[GroupingBufferBindingIndexForTileCounts] = nbTiles * sizeof(uint32_t);
+    lengths[GroupingBufferBindingIndexForTileOffsets] = nbTiles * sizeof(uint32_t);
+    
+    for (uint32_t i = 0; i < GroupingBufferBindingIndexForGroups; ++i)
+    {
+        buffers[i] = [self reserveBuffer:buffers[i] length:lengths[i] label:@"Bubble Grouping"];
+    }
+    
+    // There can be as many groups as bubbles.
+    bubbleGroupsBuffers[frameIndex] = [self reserveBuffer:bubbleGroupsBuffers[frameIndex]
+                                                   length:nbBubbles * sizeof(BubbleGroup)
+                                                    label:@"Bubble Groups"];
+    
+    bubblesBuffers[frameIndex] = [self reserveBuffer:bubblesBuffers[frameIndex]
+                                              length:nbBubbles * sizeof(Bubble)
+                                               label:@"Bubbles"];
+    
+    tileGroupIndicesBuffers[frameIndex] = [self reserveBuffer:tileGroupIndicesBuffers[frameIndex]
+                                                       length:tileGroupIndicesLength
+                                                        label:@"Tile Group Indices"];
+    
+    auto* uniforms = reinterpret_cast<GroupingUniforms*>(buffers[GroupingBufferBindingIndexForUniforms].contents);
+    uniforms->nbBubbles = nbBubbles;
+    uniforms->nbCells = nbCells;
+    uniforms->nbTiles = nbTiles;
+    uniforms->tileGridSize = uint2 { (uint32_t)threadgroupCount.width, (uint32_t)threadgroupCount.height };
+    uniforms->fieldTexelSize = fieldTexelSize;
+    uniforms->cellEntriesCapacity = (uint32_t)(buffers[GroupingBufferBindingIndexForCellEntries].length / sizeof(uint32_t));
+    uniforms->tileGroupIndicesCapacity = (uint32_t)(tileGroupIndicesBuffers[frameIndex].length / sizeof(uint32_t));
+    
+    // The arrays of the set are already the buffers' layout.
+    memcpy(buffers[GroupingBufferBindingIndexForRadii].contents, _bubbleSet.radii().data(), nbBubbles * sizeof(float));
+    memcpy(buffers[GroupingBufferBindingIndexForSlots].contents, _bubbleSet.bubbleSlots().data(), nbBubbles * sizeof(uint32_t));
+    
+    if (encodesSimulation)
+    {
+        // The simulation writes the origins from the positions it keeps.
+        [self prepareSimulation];
+    }
+    else
+    {
+        memcpy(buffers[GroupingBufferBindingIndexForOrigins].contents, _bubbleSet.origins().data(), nbBubbles * sizeof(float2));
+    }
+}
+
+/// Returns a shared buffer that stores at least `length` bytes, with the contents of `buffer`.
+///
+/// The method waits for the frames in flight before it copies the contents of a buffer it replaces.
+///
+/// - Returns: `nil` if the GPU didn't finish them within 10 ms, like the wait of
+///   `encodeFrameWithRenderPassDescriptor:`, in which case `buffer` stays as it is.
+- (id<MTLBuffer>)reservePersistentBuffer:(id<MTLBuffer>)buffer
+                                  length:(NSUInteger)length
+                                   label:(NSString*)label
+{
+    if (nil != buffer && buffer.length >= length)
+    {
+        return buffer;
+    }
+    
+    // The frame the renderer encodes isn't in flight yet.
+    if (![sharedEvent waitUntilSignaledValue:frameNumber - 1 timeoutMS:10])
+    {
+        return nil;
+    }
+    
+    id<MTLBuffer> newBuffer = [self reserveBuffer:buffer length:length label:label];
+    if (nil != buffer)
+    {
+        memcpy(newBuffer.contents, buffer.contents, buffer.length);
+    }
+    
+    return newBuffer;
+}
+
+/// Grows the buffers the simulation keeps across the frames to the slots of the bubble set.
+///
+/// - Returns: `NO` if a buffer needs to grow while the GPU still runs the frames in flight,
+///   in which case the buffers stay as they are.
+- (BOOL)reserveSimulationBuffers
+{
+    const NSUInteger length = _bubbleSet.nbSlots() * sizeof(float2);
+    
+    id<MTLBuffer> positionsBuffer = [self reservePersistentBuffer:simulationPositionsBuffer
+                                                           length:length
+                                                            label:@"Simulation Positions"];
+    
+    id<MTLBuffer> velocitiesBuffer = [self reservePersistentBuffer:simulationVelocitiesBuffer
+                                                            length:length
+                                                             label:@"Simulation Velocities"];
+    
+    if (nil != positionsBuffer)
+    {
+        simulationPositionsBuffer = positionsBuffer;
+    }
+    
+    if (nil != velocitiesBuffer)
+    {
+        simulationVelocitiesBuffer = velocitiesBuffer;
+    }
+    
+    return nil != positionsBuffer && nil != velocitiesBuffer;
+}
+
+/// Collects the edits of the simulation of the current frame, and fills the uniforms of its step.
+///
+/// The edits only give the simulation the bubbles the caller added or moved since
+/// the last changes it saw, and the ones the touches hold, so that the GPU keeps
+/// moving the other ones from where it left them.
+- (void)prepareSimulation
+{
+    const uint32_t nbBubbles = (uint32_t)_bubbleSet.size();
+    const size_t nbSlots = _bubbleSet.nbSlots();
+    
+    simulationEdits.clear();
+    
+    const uint64_t sceneVersion = _bubbleSet.version();
+    if (simulatedSceneVersion != sceneVersion)
+    {
+        simulatedSceneVersion = sceneVersion;
+        simulatedHandles.resize(nbSlots);
+        simulatedOrigins.resize(nbSlots);
+        
+        const auto& origins = _bubbleSet.origins();
+        for (uint32_t i = 0; i < nbBubbles; ++i)
+        {
+            const BubbleHandle handle = _bubbleSet.handleOf(i);
+            if (simulatedHandles[handle.slot] == handle && all(simulatedOrigins[handle.slot] == origins[i]))
+            {
+                continue;
+            }
+            
+            simulatedHandles[handle.slot] = handle;
+            simulatedOrigins[handle.slot] = origins[i];
+            simulationEdits.push_back(SimulationEdit { handle.slot, origins[i] });
+        }
+    }
+    
+    // The touches hold the bubbles they drag or rescale.
+    for (const BubbleHandle& handle : _bubbleSet.selectedBubbles())
+    {
+        if (const auto bubble = _bubbleSet.bubble(handle))
+        {
+            simulationEdits.push_back(SimulationEdit { handle.slot, bubble->origin });
+        }
+    }
+    
+    simulationEditsBuffers[frameIndex] = [self reserveBuffer:simulationEditsBuffers[frameIndex]
+                                                      length:simulationEdits.size() * sizeof(SimulationEdit)
+                                                       label:@"Simulation Edits"];
+    
+    memcpy(simulationEditsBuffers[frameIndex].contents, simulationEdits.data(), simulationEdits.size() * sizeof(SimulationEdit));
+    
+    simulationUniformsBuffers[frameIndex] = [self reserveBuffer:simulationUniformsBuffers[frameIndex]
+                                                         length:sizeof(SimulationUniforms)
+                                                          label:@"Simulation Uniforms"];
+    
+    // The first step only places the bubbles.
+    const CFTimeInterval now = CACurrentMediaTime();
+    const float timeStep = (lastSimulationStepTime > 0) ? float(std::min(now - lastSimulationStepTime, kMaxSimulationTimeStep)) : 0.f;
+    lastSimulationStepTime = now;
+    simulationTime += timeStep;
+    
+    auto* simulation = reinterpret_cast<SimulationUniforms*>(simulationUniformsBuffers[frameIndex].contents);
+    simulation->nbEdits = (uint32_t)simulationEdits.size();
+    simulation->timeStep = timeStep;
+    simulation->time = simulationTime;
+    simulation->contentSize = float2 { float(backgroundImageTexture.width), float(backgroundImageTexture.height) };
+    simulation->attractionRange = kSimulationAttractionRange;
+    simulation->repulsionStiffness = kSimulationRepulsionStiffness;
+    simulation->attractionStiffness = kSimulationAttractionStiffness;
+    simulation->driftAcceleration = kSimulationDriftAcceleration;
+    simulation->damping = kSimulationDamping;
+    simulation->restitution = kSimulationRestitution;
+}
+
+/// The system calls this method whenever the view changes orientation or size.
+- (void)mtkView:(nonnull MTKView *)view drawableSizeWillChange:(CGSize)size
+{
+    // Update the viewport property to its new size,
+    // which the renderer passes to the vertex shader.
+    viewportSize.x = (simd_uint1)size.width;
+    viewportSize.y = (simd_uint1)size.height;
+    
+    // The next frame writes the new size into its own uniforms buffer.
+    [self setNeedsRedraw];
+}
+
+/// Binds this frame's uniforms, bubbles and tile bins in the argument table.
+/// Returns the per-frame buffers of the current frame, and the tiles it recomputes.
+- (SceneBindings)frameSceneBindings
+{
+    SceneBindings scene {
+        .uniforms = uniformsBuffers[frameIndex].gpuAddress,
+        .bubbleGroups = bubbleGroupsBuffers[frameIndex].gpuAddress,
+        .bubbles = bubblesBuffers[frameIndex].gpuAddress,
+        .tileBins = tileBinsBuffers[frameIndex].gpuAddress,
+        .tileGroupIndices = tileGroupIndicesBuffers[frameIndex].gpuAddress,
+        .vertexData = vertexDataBuffer.gpuAddress,
+        .dirtyTiles = dirtyTilesBuffers[frameIndex].gpuAddress,
+        .nbDirtyTiles = nbDirtyTiles,
+        .sdfTiles = dirtyTilesBuffers[frameIndex].gpuAddress,
+        .nbSDFTiles = nbDirtyTiles,
+        .sdfPipelineState = frameSDFPipelineState,
+        .viewportSize = viewportSize
+    };
+    
+    if (_usesTransientSDFTexture)
+    {
+        // Also recompute the texels around the dirty tiles, which the texture didn't keep.
+        scene.sdfTiles = sdfTilesBuffers[frameIndex].gpuAddress;
+        scene.nbSDFTiles = nbSDFTiles;
+    }
+    
+    return scene;
+}
+
+- (void)bindSceneBuffers:(const SceneBindings&)scene
+{
+    [argumentTable setAddress:scene.uniforms
+                      atIndex:BufferBindingIndexForUniforms];
+    
+    [argumentTable setAddress:scene.bubbleGroups
+                      atIndex:BufferBindingIndexForBubbleGroups];
+    
+    [argumentTable setAddress:scene.bubbles
+                      atIndex:BufferBindingIndexForBubbles];
+    
+    [argumentTable setAddress:scene.tileBins
+                      atIndex:BufferBindingIndexForTileBins];
+    
+    [argumentTable setAddress:scene.tileGroupIndices
+                      atIndex:BufferBindingIndexForTileGroupIndices];
+    
+    [argumentTable setAddress:scene.dirtyTiles
+                      atIndex:BufferBindingIndexForDirtyTiles];
+}
+
+- (void)drawSDFs:(id<MTL4ComputeCommandEncoder>)computeEncoder scene:(const SceneBindings&)scene
+{
+    [computeEncoder setComputePipelineState:scene.sdfPipelineState];
+    
+    // Configure the encoder's argument table for the dispatch call.
+    [computeEncoder setArgumentTable:argumentTable];
+
+    // Bind the composite color (input) texture in the argument table.
+    [argumentTable setTexture:sdfTexture.gpuResourceID
+                      atIndex:ComputeTextureBindingIndexForSDF];
+
+    [self bindSceneBuffers:scene];
+    
+    [argumentTable setAddress:scene.sdfTiles
+                      atIndex:BufferBindingIndexForDirtyTiles];
+    
+    // Run the dispatch with the pipeline state and current state of the argument table.
+    [computeEncoder dispatchThreadgroups:MTLSizeMake(scene.nbSDFTiles, 1, 1)
+                   threadsPerThreadgroup:threadgroupSize];
+}
+
+/// Computes the SDF and its gradient straight into the gradient texture.
+- (void)drawSDFsAndGradient:(id<MTL4ComputeCommandEncoder>)computeEncoder scene:(const SceneBindings&)scene
+{
+    [computeEncoder setComputePipelineState:scene.sdfPipelineState];
+    
+    // Configure the encoder's argument table for the dispatch call.
+    [computeEncoder setArgumentTable:argumentTable];
+    
+    [argumentTable setTexture:sdfGradientTexture.gpuResourceID
+                      atIndex:ComputeTextureBindingIndexForGradientSDF];
+    
+    [self bindSceneBuffers:scene];
+    
+    // Run the dispatch with the pipeline state and current state of the argument table.
+    [computeEncoder dispatchThreadgroups:MTLSizeMake(scene.nbDirtyTiles, 1, 1)
+                   threadsPerThreadgroup:threadgroupSize];
+}
+
+/// Differentiates the SDF of the dirty tiles.
+///
+/// Each `threadgroupSize` threadgroup loads a tile of the SDF texture and its apron
+/// into threadgroup memory, one texel per thread and a second round for the apron.
+- (void)drawSDFGradient:(id<MTL4ComputeCommandEncoder>)computeEncoder scene:(const SceneBindings&)scene
+{
+    [computeEncoder setComputePipelineState:drawSDFGradientPipelineState];
+    
+    // Configure the encoder's argument table for the dispatch call.
+    [computeEncoder setArgumentTable:argumentTable];
+
+    // Bind the composite color (input) texture in the argument table.
+    [argumentTable setTexture:sdfTexture.gpuResourceID
+                      atIndex:ComputeTextureBindingIndexForSDF];
+    
+    [argumentTable setTexture:sdfGradientTexture.gpuResourceID
+                      atIndex:ComputeTextureBindingIndexForGradientSDF];
+    
+    [argumentTable setAddress:scene.dirtyTiles
+                      atIndex:BufferBindingIndexForDirtyTiles];
+    
+    // Run the dispatch with the pipeline state and current state of the argument table.
+    [computeEncoder dispatchThreadgroups:MTLSizeMake(scene.nbDirtyTiles, 1, 1)
+                   threadsPerThreadgroup:threadgroupSize];
+}
+
+/// Updates the pyramid of the SDF for the dirty tiles.
+///
+/// The levels up to the tile level only change under the dirty tiles. The ones
+/// past it are small, so the passes reduce them whole.
+- (void)reduceSDFPyramid:(id<MTL4ComputeCommandEncoder>)computeEncoder scene:(const SceneBindings&)scene
+{
+    [computeEncoder setComputePipelineState:reduceSDFTilesPipelineState];
+    [computeEncoder setArgumentTable:argumentTable];
+    
+    [argumentTable setTexture:sdfGradientTexture.gpuResourceID
+                      atIndex:ComputeTextureBindingIndexForGradientSDF];
+    
+    [argumentTable setTexture:sdfPyramidTexture.gpuResourceID
+                      atIndex:ComputeTextureBindingIndexForSDFPyramid];
+    
+    [argumentTable setAddress:scene.dirtyTiles
+                      atIndex:BufferBindingIndexForDirtyTiles];
+    
+    [computeEncoder dispatchThreadgroups:MTLSizeMake(scene.nbDirtyTiles, 1, 1)
+                   threadsPerThreadgroup:threadgroupSize];
+    
+    [computeEncoder setComputePipelineState:reduceSDFPyramidLevelPipelineState];
+    
+    for (NSUInteger level = SDFPyramidTileLevel + 1; level < sdfPyramidLevels.count; ++level)
+    {
+        // Wait for the level below.
+        [computeEncoder barrierAfterEncoderStages:MTLStageDispatch
+                              beforeEncoderStages:MTLStageDispatch
+                                visibilityOptions:MTL4VisibilityOptionDevice];
+        
+        [argumentTable setTexture:sdfPyramidLevels[level - 1].gpuResourceID
+                          atIndex:ComputeTextureBindingIndexForSDFPyramid];
+        
+        [argumentTable setTexture:sdfPyramidLevels[level].gpuResourceID
+                          atIndex:ComputeTextureBindingIndexForSDFPyramidLevel];
+        
+        [computeEncoder dispatchThreads:MTLSizeMake(sdfPyramidLevels[level].width, sdfPyramidLevels[level].height, 1)
+                  threadsPerThreadgroup:threadgroupSize];
+    }
+}
+
+/// Runs a grouping kernel with one thread per item, and waits for it before the next dispatch.
+- (void)dispatchGroupingKernel:(id<MTLComputePipelineState>)pipelineState
+                       nbItems:(NSUInteger)nbItems
+                       encoder:(id<MTL4ComputeCommandEncoder>)computeEncoder
+{
+    [computeEncoder setComputePipelineState:pipelineState];
+    
+    const NSUInteger width = std::min(kGroupingThreadgroupSize, pipelineState.maxTotalThreadsPerThreadgroup);
+    [computeEncoder dispatchThreads:MTLSizeMake(nbItems, 1, 1)
+              threadsPerThreadgroup:MTLSizeMake(width, 1, 1)];
+    
+    [computeEncoder barrierAfterEncoderStages:MTLStageDispatch
+                          beforeEncoderStages:MTLStageDispatch
+                            visibilityOptions:MTL4VisibilityOptionDevice];
+}
+
+/// Computes the exclusive prefix sum of a grouping buffer into another one.
+///
+/// - Parameters:
+///   - countAddress: The GPU address of the number of values.
+///   - totalAddress: The GPU address where the kernel writes the sum of the values.
+- (void)encodeScanOf:(GroupingBufferBindingIndex)values
+                into:(GroupingBufferBindingIndex)offsets
+        countAddress:(MTLGPUAddress)countAddress
+        totalAddress:(MTLGPUAddress)totalAddress
+             encoder:(id<MTL4ComputeCommandEncoder>)computeEncoder
+{
+    id<MTLBuffer> __strong * buffers = groupingBuffers[frameIndex];
+    
+    [groupingArgumentTable setAddress:buffers[values].gpuAddress
+                              atIndex:GroupingBufferBindingIndexForScanValues];
+    
+    [groupingArgumentTable setAddress:buffers[offsets].gpuAddress
+                              atIndex:GroupingBufferBindingIndexForScanOffsets];
+    
+    [groupingArgumentTable setAddress:countAddress
+                              atIndex:GroupingBufferBindingIndexForScanCount];
+    
+    [groupingArgumentTable setAddress:totalAddress
+                              atIndex:GroupingBufferBindingIndexForScanTotal];
+    
+    [computeEncoder setComputePipelineState:exclusiveScanPipelineState];
+    [computeEncoder dispatchThreadgroups:MTLSizeMake(1, 1, 1)
+                   threadsPerThreadgroup:MTLSizeMake(GroupingScanThreadgroupSize, 1, 1)];
+    
+    [computeEncoder barrierAfterEncoderStages:MTLStageDispatch
+                          beforeEncoderStages:MTLStageDispatch
+                            visibilityOptions:MTL4VisibilityOptionDevice];
+}
+
+/// Binds this frame's grouping buffers, and the bubble and tile buffers it writes, in the grouping argument table.
+- (void)bindGroupingBuffers
+{
+    id<MTLBuffer> __strong * buffers = groupingBuffers[frameIndex];
+    
+    for (uint32_t i = 0; i < GroupingBufferBindingIndexForGroups; ++i)
+    {
+        [groupingArgumentTable setAddress:buffers[i].gpuAddress atIndex:i];
+    }
+    
+    [groupingArgumentTable setAddress:bubbleGroupsBuffers[frameIndex].gpuAddress
+                              atIndex:GroupingBufferBindingIndexForGroups];
+    
+    [groupingArgumentTable setAddress:bubblesBuffers[frameIndex].gpuAddress
+                              atIndex:GroupingBufferBindingIndexForBubbles];
+    
+    [groupingArgumentTable setAddress:tileBinsBuffers[frameIndex].gpuAddress
+                              atIndex:GroupingBufferBindingIndexForTileBins];
+    
+    [groupingArgumentTable setAddress:tileGroupIndicesBuffers[frameIndex].gpuAddress
+                              atIndex:GroupingBufferBindingIndexForTileGroupIndices];
+}
+
+/// Moves the bubbles by a step of the simulation, and writes their new origins for the grouping.
+///
+/// The step finds the neighbors of each bubble in a hashed grid of the origins
+/// of its start, which it builds with the kernels of the grouping.
+- (void)encodeSimulationWithEncoder:(id<MTL4ComputeCommandEncoder>)computeEncoder
+{
+    id<MTLBuffer> __strong * buffers = groupingBuffers[frameIndex];
+    const auto* uniforms = reinterpret_cast<const GroupingUniforms*>(buffers[GroupingBufferBindingIndexForUniforms].contents);
+    const auto* simulation = reinterpret_cast<const SimulationUniforms*>(simulationUniformsBuffers[frameIndex].contents);
+    
+    [computeEncoder fillBuffer:buffers[GroupingBufferBindingIndexForCounters]
+                         range:NSMakeRange(0, sizeof(GroupingCounters))
+                         value:0];
+    
+    [computeEncoder fillBuffer:buffers[GroupingBufferBindingIndexForCellCounts]
+                         range:NSMakeRange(0, uniforms->nbCells * sizeof(uint32_t))
+                         value:0];
+    
+    [computeEncoder barrierAfterEncoderStages:MTLStageBlit
+                          beforeEncoderStages:MTLStageDispatch
+                            visibilityOptions:MTL4VisibilityOptionDevice];
+    
+    // The previous frames move the bubbles in the same buffers.
+    [computeEncoder barrierAfterQueueStages:MTLStageDispatch
+                               beforeStages:MTLStageDispatch
+                          visibilityOptions:MTL4VisibilityOptionDevice];
+    
+    [computeEncoder setArgumentTable:groupingArgumentTable];
+    [self bindGroupingBuffers];
+    
+    [groupingArgumentTable setAddress:simulationUniformsBuffers[frameIndex].gpuAddress
+                              atIndex:GroupingBufferBindingIndexForSimulationUniforms];
+    
+    [groupingArgumentTable setAddress:simulationEditsBuffers[frameIndex].gpuAddress
+                              atIndex:GroupingBufferBindingIndexForSimulationEdits];
+    
+    [groupingArgumentTable setAddress:simulationPositionsBuffer.gpuAddress
+                              atIndex:GroupingBufferBindingIndexForSimulationPositions];
+    
+    [groupingArgumentTable setAddress:simulationVelocitiesBuffer.gpuAddress
+                              atIndex:GroupingBufferBindingIndexForSimulationVelocities];
+    
+    const NSUInteger nbBubbles = uniforms->nbBubbles;
+    const NSUInteger nbEdits = simulation->nbEdits;
+    
+    // Place the bubbles the CPU added or moved before the step reads them.
+    if (nbEdits > 0)
+    {
+        [self dispatchGroupingKernel:applySimulationEditsPipelineState nbItems:nbEdits encoder:computeEncoder];
+    }
+    
+    [self dispatchGroupingKernel:gatherSimulatedOriginsPipelineState nbItems:nbBubbles encoder:computeEncoder];
+    
+    // Register the bubbles in the hashed grid.
+    [self dispatchGroupingKernel:countGridCellsPipelineState nbItems:nbBubbles encoder:computeEncoder];
+    
+    [self encodeScanOf:GroupingBufferBindingIndexForCellCounts
+                  into:GroupingBufferBindingIndexForCellOffsets
+          countAddress:buffers[GroupingBufferBindingIndexForUniforms].gpuAddress + offsetof(GroupingUniforms, nbCells)
+          totalAddress:buffers[GroupingBufferBindingIndexForCounters].gpuAddress + offsetof(GroupingCounters, nbCellEntries)
+               encoder:computeEncoder];
+    
+    [self dispatchGroupingKernel:fillGridCellsPipelineState nbItems:nbBubbles encoder:computeEncoder];
+    
+    [self dispatchGroupingKernel:simulateBubblesPipelineState nbItems:nbBubbles encoder:computeEncoder];
+    
+    // Hold the bubbles of the touches where the CPU puts them.
+    if (nbEdits > 0)
+    {
+        [self dispatchGroupingKernel:applySimulationEditsPipelineState nbItems:nbEdits encoder:computeEncoder];
+    }
+    
+    [self dispatchGroupingKernel:gatherSimulatedOriginsPipelineState nbItems:nbBubbles encoder:computeEncoder];
+    
+    // The grouping clears the grid the step read.
+    [computeEncoder barrierAfterEncoderStages:MTLStageDispatch
+                          beforeEncoderStages:MTLStageBlit
+                            visibilityOptions:MTL4VisibilityOptionDevice];
+}
+
+/// Groups the bubbles, sorts them by group and bins the groups into the tiles,
+/// straight into the buffers the SDF kernels read.
+///
+/// The passes label the connected components of overlapping bubbles with a
+/// lock-free union-find over a hashed grid, and then compact them with prefix sums.
+- (void)encodeGPUGroupingWithEncoder:(id<MTL4ComputeCommandEncoder>)computeEncoder
+{
+    id<MTLBuffer> __strong * buffers = groupingBuffers[frameIndex];
+    const auto* uniforms = reinterpret_cast<const GroupingUniforms*>(buffers[GroupingBufferBindingIndexForUniforms].contents);
+    
+    // Clear the counts the kernels accumulate.
+    [computeEncoder fillBuffer:buffers[GroupingBufferBindingIndexForCounters]
+                         range:NSMakeRange(0, sizeof(GroupingCounters))
+                         value:0];
+    
+    [computeEncoder fillBuffer:buffers[GroupingBufferBindingIndexForCellCounts]
+                         range:NSMakeRange(0, uniforms->nbCells * sizeof(uint32_t))
+                         value:0];
+    
+    [computeEncoder fillBuffer:buffers[GroupingBufferBindingIndexForRootSizes]
+                         range:NSMakeRange(0, uniforms->nbBubbles * sizeof(uint32_t))
+                         value:0];
+    
+    [computeEncoder fillBuffer:buffers[GroupingBufferBindingIndexForTileCounts]
+                         range:NSMakeRange(0, uniforms->nbTiles * sizeof(uint32_t))
+                         value:0];
+    
+    [computeEncoder barrierAfterEncoderStages:MTLStageBlit
+                          beforeEncoderStages:MTLStageDispatch
+                            visibilityOptions:MTL4VisibilityOptionDevice];
+    
+    [computeEncoder setArgumentTable:groupingArgumentTable];
+    [self bindGroupingBuffers];
+    
+    const MTLGPUAddress uniformsAddress = buffers[GroupingBufferBindingIndexForUniforms].gpuAddress;
+    const MTLGPUAddress countersAddress = buffers[GroupingBufferBindingIndexForCounters].gpuAddress;
+    
+    const NSUInteger nbBubbles = uniforms->nbBubbles;
+    
+    // Register the bubbles in the hashed grid.
+    [self dispatchGroupingKernel:countGridCellsPipelineState nbItems:nbBubbles encoder:computeEncoder];
+    
+    [self encodeScanOf:GroupingBufferBindingIndexForCellCounts
+                  into:GroupingBufferBindingIndexForCellOffsets
+          countAddress:uniformsAddress + offsetof(GroupingUniforms, nbCells)
+          totalAddress:countersAddress + offsetof(GroupingCounters, nbCellEntries)
+               encoder:computeEncoder];
+    
+    [self dispatchGroupingKernel:fillGridCellsPipelineState nbItems:nbBubbles encoder:computeEncoder];
+    
+    // Label the connected components.
+    [self dispatchGroupingKernel:uniteOverlappingBubblesPipelineState nbItems:nbBubbles encoder:computeEncoder];
+    [self dispatchGroupingKernel:resolveBubbleRootsPipelineState nbItems:nbBubbles encoder:computeEncoder];
+    
+    // Number the groups in the order of their first bubble, as the CPU does.
+    [self encodeScanOf:GroupingBufferBindingIndexForRootFlags
+                  into:GroupingBufferBindingIndexForGroupIndicesOfRoots
+          countAddress:uniformsAddress + offsetof(GroupingUniforms, nbBubbles)
+          totalAddress:countersAddress + offsetof(GroupingCounters, nbGroups)
+               encoder:computeEncoder];
+    
+    [self dispatchGroupingKernel:sizeBubbleGroupsPipelineState nbItems:nbBubbles encoder:computeEncoder];
+    
+    [self encodeScanOf:GroupingBufferBindingIndexForGroupSizes
+                  into:GroupingBufferBindingIndexForGroupOffsets
+          countAddress:countersAddress + offsetof(GroupingCounters, nbGroups)
+          totalAddress:countersAddress + offsetof(GroupingCounters, nbGroupedBubbles)
+               encoder:computeEncoder];
+    
+    // Sort the bubbles by group, and by index within their group, with a single threadgroup like the scans.
+    [computeEncoder setComputePipelineState:rankGroupMembersPipelineState];
+    [computeEncoder dispatchThreadgroups:MTLSizeMake(1, 1, 1)
+                   threadsPerThreadgroup:MTLSizeMake(GroupingScanThreadgroupSize, 1, 1)];
+    
+    [computeEncoder barrierAfterEncoderStages:MTLStageDispatch
+                          beforeEncoderStages:MTLStageDispatch
+                            visibilityOptions:MTL4VisibilityOptionDevice];
+    
+    [self dispatchGroupingKernel:sortGroupMembersPipelineState nbItems:nbBubbles encoder:computeEncoder];
+    
+    // Bin the groups, of which there are at most as many as bubbles.
+    [self dispatchGroupingKernel:countTileGroupsPipelineState nbItems:nbBubbles encoder:computeEncoder];
+    
+    [self encodeScanOf:GroupingBufferBindingIndexForTileCounts
+                  into:GroupingBufferBindingIndexForTileOffsets
+          countAddress:uniformsAddress + offsetof(GroupingUniforms, nbTiles)
+          totalAddress:countersAddress + offsetof(GroupingCounters, nbTileGroupIndices)
+               encoder:computeEncoder];
+    
+    [self dispatchGroupingKernel:fillTileGroupsPipelineState nbItems:nbBubbles encoder:computeEncoder];
+    [self dispatchGroupingKernel:writeTileBinsPipelineState nbItems:uniforms->nbTiles encoder:computeEncoder];
+}
+
+- (void)encodeComputePassWithEncoder:(id<MTL4ComputeCommandEncoder>)computeEncoder
+{
+    // Add a barrier that pauses the dispatch stage of the compute pass
+    // from starting until the copy commands finish during their blit stage.
+    [computeEncoder barrierAfterEncoderStages:MTLStageBlit
+                          beforeEncoderStages:MTLStageDispatch
+                            visibilityOptions:MTL4VisibilityOptionDevice];
+    
+    if (followsSceneBatch)
+    {
+        // The last batch of scenes still reads the field textures this pass overwrites.
+        [computeEncoder barrierAfterQueueStages:MTLStageFragment | MTLStageBlit
+                                   beforeStages:MTLStageDispatch
+                              visibilityOptions:MTL4VisibilityOptionDevice];
+        followsSceneBatch = NO;
+    }
+    
+    if (encodesGPUGrouping)
+    {
+        if (encodesSimulation)
+        {
+            [self encodeSimulationWithEncoder:computeEncoder];
+            [self writeTimestamp:FrameTimestampSimulationEnd withComputeEncoder:computeEncoder];
+        }
+        
+        [self encodeGPUGroupingWithEncoder:computeEncoder];
+        [self writeTimestamp:FrameTimestampGroupingEnd withComputeEncoder:computeEncoder];
+    }
+    
+    if (nbDirtyTiles == 0)
+    {
+        return;
+    }
+    
+    const SceneBindings scene = [self frameSceneBindings];
+    
+    // The render pass of the previous frame still samples the field textures
+    // that the SDF, gradient and pyramid passes overwrite.
+    [computeEncoder barrierAfterQueueStages:MTLStageFragment
+                               beforeStages:MTLStageDispatch
+                          visibilityOptions:MTL4VisibilityOptionDevice];
+
+    if (_usesFusedSDFPass)
+    {
+        [self drawSDFsAndGradient:computeEncoder scene:scene];
+        [self writeTimestamp:FrameTimestampSDFEnd withComputeEncoder:computeEncoder];
+    }
+    else
+    {
+        [self drawSDFs:computeEncoder scene:scene];
+        [self writeTimestamp:FrameTimestampSDFEnd withComputeEncoder:computeEncoder];
+        
+        // Wait for the SDF texture before differentiating it.
+        [computeEncoder barrierAfterEncoderStages:MTLStageDispatch
+                              beforeEncoderStages:MTLStageDispatch
+                                visibilityOptions:MTL4VisibilityOptionDevice];
+        
+        [self drawSDFGradient:computeEncoder scene:scene];
+        [self writeTimestamp:FrameTimestampGradientEnd withComputeEncoder:computeEncoder];
+    }
+    
+    // Wait for the gradient texture before reducing it.
+    [computeEncoder barrierAfterEncoderStages:MTLStageDispatch
+                          beforeEncoderStages:MTLStageDispatch
+                            visibilityOptions:MTL4VisibilityOptionDevice];
+    
+    [self reduceSDFPyramid:computeEncoder scene:scene];
+    [self writeTimestamp:FrameTimestampPyramidEnd withComputeEncoder:computeEncoder];
+}
+
+- (void)encodeRenderPassWithEncoder:(id<MTL4RenderCommandEncoder>)renderEncoder scene:(const SceneBindings&)scene
+{
+    // Add a barrier that tells the GPU to wait for any previous dispatch kernels
+    // to finish before running any subsequent vertex stages.
+    [renderEncoder barrierAfterQueueStages:MTLStageDispatch
+                              beforeStages:MTLStageVertex
+                         visibilityOptions:MTL4VisibilityOptionDevice];
+
+    // Configure the view-port with the size of the drawable region.
+    MTLViewport viewPort;
+    viewPort.originX = 0.0;
+    viewPort.originY = 0.0;
+    viewPort.width = (double)scene.viewportSize.x;
+    viewPort.height = (double)scene.viewportSize.y;
+    viewPort.znear = 0.0;
+    viewPort.zfar = 1.0;
+
+    [renderEncoder setViewport:viewPort];
+    
+    // The pass only clears the drawable until the render pipeline is ready.
+    if (nil == renderPipelineState)
+    {
+        return;
+    }
+
+    // Configure the encoder with the renderer's main pipeline state.
+    [renderEncoder setRenderPipelineState:renderPipelineState];
+
+    // Set the encoder's argument table.
+    [renderEncoder setArgumentTable:argumentTable
+                           atStages:MTLRenderStageVertex | MTLRenderStageFragment];
+
+    // Bind the buffer with the triangle data to the argument table.
+    [argumentTable setAddress:scene.vertexData
+                      atIndex:BufferBindingIndexForVertexData];
+
+    // Bind the buffer with the viewport's size to the argument table.
+    [argumentTable setAddress:scene.uniforms
+                      atIndex:BufferBindingIndexForUniforms];
+    
+    // Bind the tile bins, which tell the fragment shader where the narrow band is.
+    [argumentTable setAddress:scene.tileBins
+                      atIndex:BufferBindingIndexForTileBins];
+
+    // Bind the color composite texture.
+    [argumentTable setTexture:backgroundImageTexture.gpuResourceID
+                      atIndex:RenderTextureBindingIndex];
+    
+    [argumentTable setTexture:sdfGradientTexture.gpuResourceID
+                      atIndex:SDFGradientTextureBindingIndex];
+    
+    [argumentTable setTexture:sdfPyramidTexture.gpuResourceID
+                      atIndex:SDFPyramidTextureBindingIndex];
+    
+    // Draw the first rectangle with the color composite texture.
+    const NSUInteger firstRectangleOffset = 0;
+    const NSUInteger rectangleVertexCount = kNbRectangleVertices;
+    [renderEncoder drawPrimitives:MTLPrimitiveTypeTriangle
+                      vertexStart:firstRectangleOffset
+                      vertexCount:rectangleVertexCount];
+}
+
+/// Returns the index in the counter heap of a timestamp of the current frame, which the frame then writes.
+- (NSUInteger)heapIndexOfTimestamp:(FrameTimestamp)timestamp
+{
+    writtenTimestamps[frameIndex] |= 1u << timestamp;
+    return frameIndex * FrameTimestampCount + timestamp;
+}
+
+/// Writes a timestamp of the current frame once the GPU finishes the commands the compute encoder encoded so far.
+- (void)writeTimestamp:(FrameTimestamp)timestamp withComputeEncoder:(id<MTL4ComputeCommandEncoder>)computeEncoder
+{
+    if (nil == timestampHeap)
+    {
+        return;
+    }
+    
+    [computeEncoder writeTimestampWithGranularity:MTL4TimestampGranularityPrecise
+                                         intoHeap:timestampHeap
+                                          atIndex:[self heapIndexOfTimestamp:timestamp]];
+}
+
+/// Writes a timestamp of the current frame between two passes of the command buffer.
+- (void)writeTimestampBetweenPasses:(FrameTimestamp)timestamp
+{
+    if (nil == timestampHeap)
+    {
+        return;
+    }
+    
+    [commandBuffer writeTimestampIntoHeap:timestampHeap atIndex:[self heapIndexOfTimestamp:timestamp]];
+}
+
+/// Adds the GPU durations of the passes of the last frame that used a slice of the counter heap.
+///
+/// - Parameter index: The array index of the per-frame resources of a frame the GPU finished.
+- (void)recordGPUDurationsOfFrameIndex:(uint32_t)index
+{
+    const uint32_t written = writtenTimestamps[index];
+    writtenTimestamps[index] = 0;
+    
+    if (written == 0)
+    {
+        return;
+    }
+    
+    NSData *data = [timestampHeap resolveCounterRange:NSMakeRange(index * FrameTimestampCount, FrameTimestampCount)];
+    if (nil == data)
+    {
+        return;
+    }
+    
+    const auto* entries = reinterpret_cast<const MTL4TimestampHeapEntry*>(data.bytes);
+    
+    auto addDuration = [&](FramePhase phase, FrameTimestamp start, FrameTimestamp end)
+    {
+        const uint32_t mask = (1u << start) | (1u << end);
+        if ((written & mask) != mask || entries[end].timestamp < entries[start].timestamp)
+        {
+            return;
+        }
+        
+        stats.addDuration(phase, double(entries[end].timestamp - entries[start].timestamp) / timestampFrequency);
+    };
+    
+    // The grouping starts after the simulation, and the SDF pass after the grouping, of the frames that run them.
+    const FrameTimestamp groupingStart = (written & (1u << FrameTimestampSimulationEnd)) ? FrameTimestampSimulationEnd : FrameTimestampComputeStart;
+    const FrameTimestamp sdfStart = (written & (1u << FrameTimestampGroupingEnd)) ? FrameTimestampGroupingEnd : FrameTimestampComputeStart;
+    
+    addDuration(FramePhaseSimulation, FrameTimestampComputeStart, FrameTimestampSimulationEnd);
+    addDuration(FramePhaseGrouping, groupingStart, FrameTimestampGroupingEnd);
+    addDuration(FramePhaseSDF, sdfStart, FrameTimestampSDFEnd);
+    addDuration(FramePhaseGradient, FrameTimestampSDFEnd, FrameTimestampGradientEnd);
+    
+    // The pyramid reduces the gradient texture, which the fused SDF pass writes.
+    const FrameTimestamp pyramidStart = (written & (1u << FrameTimestampGradientEnd)) ? FrameTimestampGradientEnd : FrameTimestampSDFEnd;
+    addDuration(FramePhasePyramid, pyramidStart, FrameTimestampPyramidEnd);
+    addDuration(FramePhaseRender, FrameTimestampRenderStart, FrameTimestampRenderEnd);
+}
+
+- (SDFFrameStats)frameStats
+{
+    return stats.summary();
+}
+
+- (void)resetFrameStats
+{
+    stats = FrameStats {};
+}
+
+- (void)setShowsStatsOverlay:(BOOL)showsStatsOverlay
+{
+    _showsStatsOverlay = showsStatsOverlay;
+    
+    if (!showsStatsOverlay)
+    {
+        [statsOverlayLabel removeFromSuperview];
+        statsOverlayLabel = nil;
+        return;
+    }
+    
+    if (nil != statsOverlayLabel)
+    {
+        return;
+    }
+    
+    statsOverlayLabel = [UILabel new];
+    statsOverlayLabel.font = [UIFont monospacedSystemFontOfSize:11 weight:UIFontWeightRegular];
+    statsOverlayLabel.textColor = [UIColor whiteColor];
+    statsOverlayLabel.backgroundColor = [UIColor colorWithWhite:0 alpha:0.6];
+    statsOverlayLabel.numberOfLines = 0;
+    statsOverlayLabel.userInteractionEnabled = NO;
+    statsOverlayLabel.translatesAutoresizingMaskIntoConstraints = NO;
+    
+    [view addSubview:statsOverlayLabel];
+    [NSLayoutConstraint activateConstraints:@[
+        [statsOverlayLabel.leadingAnchor constraintEqualToAnchor:view.safeAreaLayoutGuide.leadingAnchor constant:8],
+        [statsOverlayLabel.topAnchor constraintEqualToAnchor:view.safeAreaLayoutGuide.topAnchor constant:8]
+    ]];
+    
+    [self updateStatsOverlay];
+}
+
+/// Shows the current statistics in the overlay.
+- (void)updateStatsOverlay
+{
+    const SDFFrameStats summary = stats.summary();
+    
+    NSString* (^line)(const char*, SDFPercentiles) = ^(const char* name, SDFPercentiles percentiles) {
+        return [NSString stringWithFormat:@"%-9s %6.2f %6.2f", name, percentiles.p50, percentiles.p99];
+    };
+    
+    statsOverlayLabel.text = [@[
+        [NSString stringWithFormat:@"%-9s %6s %6s ms", "", "p50", "p99"],
+        line("Physics", summary.simulationPass),
+        line("Grouping", summary.groupingPass),
+        line("SDF", summary.sdfPass),
+        line("Gradient", summary.gradientPass),
+        line("Pyramid", summary.pyramidPass),
+        line("Render", summary.renderPass),
+        line("Uniforms", summary.uniformsUpdate),
+        line("Scene", summary.sceneUpdate),
+        line("Encoding", summary.encoding),
+        [NSString stringWithFormat:@"%-9s %6.0f %6.0f", "Tiles", summary.dirtyTiles.p50, summary.dirtyTiles.p99],
+        [NSString stringWithFormat:@"%-9s %6.1f %6.1f", "Bubbles", summary.bubblesPerTexel.p50, summary.bubblesPerTexel.p99],
+        [NSString stringWithFormat:@"%lu bubbles, %lu groups",
+         (unsigned long)summary.nbBubbles, (unsigned long)summary.nbBubbleGroups],
+        (swappedShaderReloadGeneration > 0)
+            ? [NSString stringWithFormat:@"Shaders of reload %llu", swappedShaderReloadGeneration]
+            : @"App shaders"
+    ] componentsJoinedByString:@"\n"];
+}
+
+/// Lists the dirty tiles and their neighbors for the SDF pass of a transient SDF texture.
+///
+/// The gradient of the texels at the edges of a dirty tile reads the texels of its neighbors.
+- (void)prepareSDFTiles
+{
+    const uint2 nbTiles { (uint32_t)threadgroupCount.width, (uint32_t)threadgroupCount.height };
+    const auto* dirtyTiles = reinterpret_cast<const uint32_t*>(dirtyTilesBuffers[frameIndex].contents);
+    
+    isSDFTile.assign(size_t(nbTiles.x) * nbTiles.y, false);
+    
+    for (NSUInteger i = 0; i < nbDirtyTiles; ++i)
+    {
+        const uint2 tile = unpackTileCoordinates(dirtyTiles[i]);
+        
+        const uint32_t minX = (tile.x > 0) ? tile.x - 1 : 0;
+        const uint32_t minY = (tile.y > 0) ? tile.y - 1 : 0;
+        const uint32_t maxX = std::min(tile.x + 1, nbTiles.x - 1);
+        const uint32_t maxY = std::min(tile.y + 1, nbTiles.y - 1);
+        
+        for (uint32_t y = minY; y <= maxY; ++y)
+        {
+            for (uint32_t x = minX; x <= maxX; ++x)
+            {
+                isSDFTile[size_t(y) * nbTiles.x + x] = true;
+            }
+        }
+    }
+    
+    auto* sdfTiles = reinterpret_cast<uint32_t*>(sdfTilesBuffers[frameIndex].contents);
+    nbSDFTiles = 0;
+    
+    for (uint32_t y = 0; y < nbTiles.y; ++y)
+    {
+        for (uint32_t x = 0; x < nbTiles.x; ++x)
+        {
+            if (isSDFTile[size_t(y) * nbTiles.x + x])
+            {
+                sdfTiles[nbSDFTiles++] = packTileCoordinates(uint2 { x, y });
+            }
+        }
+    }
+}
+
+/// Lets the system reclaim the memory of a transient SDF texture while no frame in flight uses it,
+/// and takes it back before a frame does.
+- (void)updateSDFTextureHeapPurgeability
+{
+    if (nbDirtyTiles > 0)
+    {
+        if (sdfTextureHeapIsVolatile)
+        {
+            // The SDF pass overwrites the texels the gradient reads, so the contents don't matter.
+            [sdfTextureHeap setPurgeableState:MTLPurgeableStateNonVolatile];
+            sdfTextureHeapIsVolatile = NO;
+        }
+        
+        lastFrameUsingSDFTextureHeap = frameNumber;
+        return;
+    }
+    
+    // The GPU finished the frames up to `kMaxFramesInFlight` before this one, and the batches of scenes.
+    if (!sdfTextureHeapIsVolatile && nbSceneBatchesInFlight == 0 && frameNumber >= lastFrameUsingSDFTextureHeap + kMaxFramesInFlight)
+    {
+        [sdfTextureHeap setPurgeableState:MTLPurgeableStateVolatile];
+        sdfTextureHeapIsVolatile = YES;
+    }
+}
+
+/// Waits for the resources of a frame, and encodes its passes into the command buffer.
+///
+/// - Parameter renderPassDescriptor: The render pass that draws the composite into its target.
+/// - Returns: `NO` if the GPU didn't finish the frame whose resources this one reuses in time,
+///   or the frames in flight before the buffers of the simulation grow.
+- (BOOL)encodeFrameWithRenderPassDescriptor:(MTL4RenderPassDescriptor*)renderPassDescriptor
+{
+    // Increment the frame number for this frame.
+    frameNumber += 1;
+
+    // Make a string with the current frame number,
+    NSString *forFrameString = [NSString stringWithFormat:@" for frame: %llu", frameNumber];
+
+    if (frameNumber >= kMaxFramesInFlight) {
+        // Wait for the GPU to finish rendering the frame that's
+        // `kMaxFramesInFlight` before this one, and then proceed to the next step.
+        uint64_t previousValueToWaitFor = frameNumber - kMaxFramesInFlight;
+        const BOOL signaled = [sharedEvent waitUntilSignaledValue:previousValueToWaitFor
+                                                        timeoutMS:10];
+        
+        if (!signaled)
+        {
+            // The GPU still reads the resources of that frame, so skip this one
+            // instead of overwriting them.
+            NSLog(@"The GPU didn't finish frame %llu within 10 ms, skipping frame %llu.",
+                  previousValueToWaitFor, frameNumber);
+            frameNumber -= 1;
+            return NO;
+        }
+    }
+
+    // Select the array index for this frame's resources.
+    frameIndex = frameNumber % kMaxFramesInFlight;
+    
+    // The GPU finished the frames that could use the pipelines a reload replaced.
+    if (nil != retiredPipelineStates && frameNumber >= lastFrameUsingRetiredPipelineStates + kMaxFramesInFlight)
+    {
+        retiredPipelineStates = nil;
+    }
+    
+    // Read the timestamps of the frame the GPU finished before this one overwrites them.
+    [self recordGPUDurationsOfFrameIndex:frameIndex];
+    
+    // Fill this frame's buffers now that the GPU no longer reads them.
+    const CFTimeInterval uniformsUpdateStart = CACurrentMediaTime();
+    [self applyPendingBubbleRecords];
+    
+    if (_simulatesBubbles && ![self reserveSimulationBuffers])
+    {
+        // The GPU still moves the bubbles of the frames in flight in the buffers
+        // the simulation needs to grow, so skip this frame instead of waiting.
+        NSLog(@"The GPU didn't finish frame %llu within 10 ms, skipping frame %llu to grow the simulation buffers.",
+              frameNumber - 1, frameNumber);
+        frameNumber -= 1;
+        return NO;
+    }
+    
+    [self updateUniformsBuffer];
+    stats.addDuration(FramePhaseUniformsUpdate, CACurrentMediaTime() - uniformsUpdateStart);
+    
+    // This frame's compute pass recomputes the dirty tiles it just uploaded.
+    _bubbleSet.clearDirtyTiles();
+    
+    if (nbDirtyTiles > 0 || encodesGPUGrouping)
+    {
+        nbFramesUntilIdle = kNbFramesBeforeIdle;
+    }
+    
+    if (_usesTransientSDFTexture)
+    {
+        if (nbDirtyTiles > 0)
+        {
+            [self prepareSDFTiles];
+        }
+        
+        [self updateSDFTextureHeapPurgeability];
+    }
+
+    /// An allocator that's next in the rotation for this frame.
+    id<MTL4CommandAllocator> frameAllocator = commandAllocators[frameIndex];
+
+    const CFTimeInterval encodingStart = CACurrentMediaTime();
+    
+    // Prepare to use or reuse the allocator by resetting it.
+    [frameAllocator reset];
+
+    // Reset the command buffer for the new frame.
+    [commandBuffer beginCommandBufferWithAllocator:frameAllocator];
+
+    // Assign the command buffer a unique label for this frame.
+    commandBuffer.label = [@"Command buffer" stringByAppendingString:forFrameString];
+
+    // === Compute pass ===
+    // The SDF textures still store the field of the previous frames
+    // when no bubble changed.
+    if (nbDirtyTiles > 0 || encodesGPUGrouping)
+    {
+        [self writeTimestampBetweenPasses:FrameTimestampComputeStart];
+        
+        // Create a compute encoder from the command buffer.
+        id<MTL4ComputeCommandEncoder> computeEncoder;
+        computeEncoder = [commandBuffer computeCommandEncoder];
+
+        // Assign the compute encoder a unique label for this frame.
+        computeEncoder.label = [@"Compute encoder" stringByAppendingString:forFrameString];
+
+        // Encode a compute pass that recomputes the SDF of the dirty tiles.
+        [self encodeComputePassWithEncoder:computeEncoder];
+
+        // Mark the end of the compute pass.
+        [computeEncoder endEncoding];
+    }
+
+    // === Render pass ===
+    [self writeTimestampBetweenPasses:FrameTimestampRenderStart];
+    
+    // Create a render encoder from the command buffer.
+    id<MTL4RenderCommandEncoder> renderEncoder =
+    [commandBuffer renderCommandEncoderWithDescriptor:renderPassDescriptor];
+
+    // Assign the render encoder a unique label for this frame.
+    renderEncoder.label = [@"Render encoder" stringByAppendingString:forFrameString];
+
+    // Encode a render pass that draws a rectangle each of the composite textures.
+    [self encodeRenderPassWithEncoder:renderEncoder scene:[self frameSceneBindings]];
+    
+    if (nil != timestampHeap && nil != renderPipelineState)
+    {
+        [renderEncoder writeTimestampWithGranularity:MTL4TimestampGranularityPrecise
+                                          afterStage:MTLRenderStageFragment
+                                            intoHeap:timestampHeap
+                                             atIndex:[self heapIndexOfTimestamp:FrameTimestampRenderEnd]];
+    }
+
+    // Mark the end of the render pass.
+    [renderEncoder endEncoding];
+
+    // Finalize the command buffer.
+    [commandBuffer endCommandBuffer];
+    
+    stats.addDuration(FramePhaseEncoding, CACurrentMediaTime() - encodingStart);
+    stats.addFrame(_bubbleSet.size(),
+                   groupsBubblesOnGPU ? nbGPUBubbleGroups : _bubbleSet.groups().size(),
+                   nbDirtyTiles);
+    
+    if (nil != statsOverlayLabel && frameNumber % kStatsOverlayRefreshInterval == 0)
+    {
+        [self updateStatsOverlay];
+    }
+    
+    return YES;
+}
 
-    // Create the compute pipeline.
-    [self createCompiler];
+- (void)setRendersOnDemand:(BOOL)rendersOnDemand
+{
+    _rendersOnDemand = rendersOnDemand;
+    [self setNeedsRedraw];
+}
+
+- (void)setNeedsRedraw
+{
+    nbFramesUntilIdle = kNbFramesBeforeIdle;
     
-    drawSDFPipelineState = [self createComputePipelineStateWithFunctionName:@"computeAndDrawSDF"];
-    drawSDFGradientPipelineState = [self createComputePipelineStateWithFunctionName:@"drawSDFGradient"];
+    // A view that draws through another delegate, like the one of the benchmark, stays as it is.
+    if (view.paused && view.delegate == self)
+    {
+        view.paused = NO;
+    }
     
-    [self configureThreadgroupForComputePasses];
+    // Draw at the highest rate of the display, 120 Hz with ProMotion, while the scene changes.
+    view.preferredFramesPerSecond = UIScreen.mainScreen.maximumFramesPerSecond;
+    motionManager.deviceMotionUpdateInterval = 1.0 / double(view.preferredFramesPerSecond);
+}
 
-    // Configure the view's color format.
-    const MTLPixelFormat pixelFormat = MTLPixelFormatBGRA8Unorm_sRGB;
-    mtkView.colorPixelFormat = pixelFormat;
+/// Calls `setNeedsRedraw` if the bubbles changed since the last frame.
+- (void)setNeedsRedrawIfSceneChanged
+{
+    if (_bubbleSet.hasChanges())
+    {
+        [self setNeedsRedraw];
+    }
+}
 
-    // Create the render pipeline.
-    [self createRenderPipelineFor:pixelFormat];
+/// Pauses the view once it drew the last change to the scene, when it renders on demand.
+///
+/// The view never pauses while the GPU simulates bubbles, which move every frame, even
+/// the ones that don't encode the simulation because the pipelines or the GPU aren't ready.
+- (void)pauseViewIfIdle
+{
+    if (_simulatesBubbles && _bubbleSet.size() > 0)
+    {
+        nbFramesUntilIdle = kNbFramesBeforeIdle;
+        return;
+    }
     
-    panGestureRecognizer = [[UIPanGestureRecognizer alloc] initWithTarget:self action:@selector(onPan:)];
-    [mtkView addGestureRecognizer:panGestureRecognizer];
+    if (!_rendersOnDemand || nbFramesUntilIdle == 0)
+    {
+        return;
+    }
     
-    tapGestureRecognizer = [[UITapGestureRecognizer alloc] initWithTarget:self action:@selector(onTap:)];
-    tapGestureRecognizer.numberOfTapsRequired = 1;
-    [mtkView addGestureRecognizer:tapGestureRecognizer];
+    if (--nbFramesUntilIdle > 0)
+    {
+        return;
+    }
     
-    doubleTapGestureRecognizer = [[UITapGestureRecognizer alloc] initWithTarget:self action:@selector(onDoubleTap:)];
-    doubleTapGestureRecognizer.numberOfTapsRequired = 2;
-    [mtkView addGestureRecognizer:doubleTapGestureRecognizer];
+    view.paused = YES;
     
-    [tapGestureRecognizer requireGestureRecognizerToFail:doubleTapGestureRecognizer];
+    // Only a large enough change of the light wakes the view.
+    motionManager.deviceMotionUpdateInterval = kIdleMotionUpdateInterval;
+}
+
+- (BOOL)drawIntoTexture:(id<MTLTexture>)texture
+{
+    if (![residencySet containsAllocation:texture])
+    {
+        [residencySet addAllocation:texture];
+        [residencySet commit];
+    }
     
-    auto scaleRecognizer = [[UIPinchGestureRecognizer alloc] initWithTarget:self action:@selector(onPinch:)];
-    [mtkView addGestureRecognizer:scaleRecognizer];
+    viewportSize.x = (simd_uint1)texture.width;
+    viewportSize.y = (simd_uint1)texture.height;
     
-    lightDirection = normalize(float2{1.f, -1.f});
+    MTL4RenderPassDescriptor *renderPassDescriptor = [MTL4RenderPassDescriptor new];
+    renderPassDescriptor.colorAttachments[0].texture = texture;
+    renderPassDescriptor.colorAttachments[0].loadAction = MTLLoadActionClear;
+    renderPassDescriptor.colorAttachments[0].storeAction = MTLStoreActionStore;
+    renderPassDescriptor.colorAttachments[0].clearColor = MTLClearColorMake(0.0, 0.0, 0.0, 1.0);
     
-    motionManager = [CMMotionManager new];
-    motionManager.deviceMotionUpdateInterval = 1.0 / 60.0;
+    if (![self encodeFrameWithRenderPassDescriptor:renderPassDescriptor])
+    {
+        return NO;
+    }
     
-    if ([motionManager isDeviceMotionAvailable])
+    // Submit the command buffer to the GPU.
+    [commandQueue commit:&commandBuffer count:1];
+    
+    // Signal when the GPU finishes rendering this frame with a shared event.
+    [commandQueue signalEvent:sharedEvent value:frameNumber];
+    
+    return YES;
+}
+
+- (BOOL)waitUntilFramesCompleted
+{
+    if (![sharedEvent waitUntilSignaledValue:frameNumber timeoutMS:kFrameCompletionTimeoutMS])
     {
-        __weak Metal4Renderer* wSelf = self;
-        
-        // Start getting updates
-        [motionManager startDeviceMotionUpdatesToQueue:[NSOperationQueue mainQueue]
-                                          withHandler:^(CMDeviceMotion *motion, NSError *error) {
-            if (error != nil)
-            {
-                return;
-            }
+        NSLog(@"The GPU didn't finish frame %llu within %llu ms.", frameNumber, kFrameCompletionTimeoutMS);
+        return NO;
+    }
+    
+    for (uint32_t i = 0; i < kMaxFramesInFlight; ++i)
+    {
+        [self recordGPUDurationsOfFrameIndex:i];
+    }
+    
+    return YES;
+}
 
-            Metal4Renderer* self = wSelf;
-            if (self == nil)
-            {
-                return;
-            }
-             
-            float angle;
+- (NSData*)fieldTexels
+{
+    if (![self waitUntilFramesCompleted])
+    {
+        return nil;
+    }
+    
+    const NSUInteger width = sdfGradientTexture.width;
+    const NSUInteger height = sdfGradientTexture.height;
+    const BOOL isPacked = (_texelFormat == SDFTexelFormatPacked);
+    
+    // A packed texel has 32 bits, and the other format 4 half-precision components.
+    const NSUInteger bytesPerRow = width * (isPacked ? sizeof(uint32_t) : 4 * sizeof(uint16_t));
+    
+    id<MTLBuffer> texelsBuffer = [device newBufferWithLength:bytesPerRow * height options:MTLResourceStorageModeShared];
+    texelsBuffer.label = @"Field Texels";
+    
+    NSError *error = NULL;
+    MTLResidencySetDescriptor *residencySetDescriptor = [MTLResidencySetDescriptor new];
+    residencySetDescriptor.label = @"Field Readback";
+    id<MTLResidencySet> readbackResidencySet = [device newResidencySetWithDescriptor:residencySetDescriptor error:&error];
+    
+    if (nil == texelsBuffer || nil == readbackResidencySet)
+    {
+        NSLog(@"The device can't create the resources to read the field back due to: %@", error);
+        return nil;
+    }
+    
+    [readbackResidencySet addAllocation:texelsBuffer];
+    [readbackResidencySet commit];
+    
+    id<MTL4CommandAllocator> readbackAllocator = [device newCommandAllocator];
+    id<MTL4CommandBuffer> readbackCommandBuffer = [device newCommandBuffer];
+    
+    [readbackCommandBuffer beginCommandBufferWithAllocator:readbackAllocator];
+    [readbackCommandBuffer useResidencySet:readbackResidencySet];
+    readbackCommandBuffer.label = @"Command buffer for the field readback";
+    
+    id<MTL4ComputeCommandEncoder> readbackEncoder = [readbackCommandBuffer computeCommandEncoder];
+    readbackEncoder.label = @"Readback encoder for the field";
+    
+    [readbackEncoder copyFromTexture:sdfGradientTexture
+                         sourceSlice:0
+                         sourceLevel:0
+                        sourceOrigin:MTLOriginMake(0, 0, 0)
+                          sourceSize:MTLSizeMake(width, height, 1)
+                            toBuffer:texelsBuffer
+                   destinationOffset:0
+              destinationBytesPerRow:bytesPerRow
+            destinationBytesPerImage:bytesPerRow * height];
+    
+    [readbackEncoder endEncoding];
+    [readbackCommandBuffer endCommandBuffer];
+    
+    __block BOOL failed = NO;
+    dispatch_semaphore_t completion = dispatch_semaphore_create(0);
+    
+    MTL4CommitOptions *commitOptions = [MTL4CommitOptions new];
+    [commitOptions addFeedbackHandler:^(id<MTL4CommitFeedback> feedback) {
+        if (nil != feedback.error)
+        {
+            NSLog(@"The GPU failed to read the field back due to: %@", feedback.error);
+            failed = YES;
+        }
+        
+        dispatch_semaphore_signal(completion);
+    }];
+    
+    [commandQueue commit:&readbackCommandBuffer count:1 options:commitOptions];
+    
+    if (0 != dispatch_semaphore_wait(completion, dispatch_time(DISPATCH_TIME_NOW, int64_t(kFrameCompletionTimeoutMS) * NSEC_PER_MSEC)))
+    {
+        // The feedback handler keeps the semaphore until the GPU finishes.
+        NSLog(@"The GPU didn't read the field back within %llu ms.", kFrameCompletionTimeoutMS);
+        return nil;
+    }
+    
+    if (failed)
+    {
+        return nil;
+    }
+    
+    NSMutableData *texels = [NSMutableData dataWithLength:width * height * sizeof(float4)];
+    auto* values = static_cast<float4*>(texels.mutableBytes);
+    const auto* bytes = static_cast<const uint8_t*>(texelsBuffer.contents);
+    
+    for (NSUInteger y = 0; y < height; ++y)
+    {
+        for (NSUInteger x = 0; x < width; ++x)
+        {
+            float4& value = values[y * width + x];
             
-            const auto orientation = [UIDevice currentDevice].orientation;
-            if (UIDeviceOrientationIsPortrait(orientation))
+            if (isPacked)
             {
-                angle = motion.attitude.roll;
+                uint32_t texel;
+                memcpy(&texel, bytes + y * bytesPerRow + x * sizeof(uint32_t), sizeof(texel));
+                
+                const float3 d = unpackSDFTexel(texel);
+                value = float4 { d.x, d.y, d.z, 0.f };
             }
             else
             {
-                angle = motion.attitude.yaw;
+                uint16_t texel[4];
+                memcpy(texel, bytes + y * bytesPerRow + x * sizeof(texel), sizeof(texel));
+                
+                value = float4 { floatOfHalfBits(texel[0]), floatOfHalfBits(texel[1]), floatOfHalfBits(texel[2]), 0.f };
             }
-            
-            self->lightDirection = { cosf(angle), sinf(angle) };
-            
-        }];
+        }
     }
-    return self;
+    
+    return texels;
 }
 
-- (Uniforms*)uniforms
+- (void)invalidateField
+{
+    _bubbleSet.invalidateTiles();
+    
+    // The GPU grouping recomputes every tile when it takes over the frames.
+    groupsBubblesOnGPU = NO;
+}
+
+- (BubbleSet&)bubbleSet
 {
-    return reinterpret_cast<Uniforms*>(uniformsBuffer.contents);
+    return _bubbleSet;
 }
 
-- (void)updateUniformsBuffer
+- (BOOL)enqueueBubbleRecords:(NSData*)records
 {
-    auto buf = [self uniforms];
+    // The arrays of the records need their alignment, which a subrange of other bytes may lack.
+    if ((reinterpret_cast<uintptr_t>(records.bytes) % kBubbleRecordAlignment) != 0)
+    {
+        records = [NSData dataWithBytes:records.bytes length:records.length];
+    }
+    else
+    {
+        records = [records copy];
+    }
     
-    buf->viewportSize = viewportSize;
+    // Check the records now, so that the frames only apply whole, valid ones.
+    const float2 contentSize { float(backgroundImageTexture.width), float(backgroundImageTexture.height) };
     
-    constexpr float s = 3e1f;
-    const float2 gradientScale { s / float(sdfGradientTexture.width), s / float(sdfGradientTexture.height) };
+    size_t offset = 0;
+    while (offset < records.length)
+    {
+        const auto record = readBubbleRecord(static_cast<const uint8_t*>(records.bytes) + offset, records.length - offset, contentSize);
+        if (!record.has_value())
+        {
+            NSLog(@"The renderer ignores %lu bytes of bubbles whose record %lu bytes in is invalid or partial.",
+                  (unsigned long)records.length, (unsigned long)offset);
+            return NO;
+        }
+        
+        offset += record->size;
+    }
     
-    buf->gradientScale = gradientScale;
+    os_unfair_lock_lock(&bubbleStreamLock);
+    const BOOL wakesView = (pendingBubbleRecords.count == 0);
+    [pendingBubbleRecords addObject:records];
+    os_unfair_lock_unlock(&bubbleStreamLock);
+    
+    // The first records since the last frame resume the drawing of the view.
+    if (wakesView)
+    {
+        __weak Metal4Renderer* wSelf = self;
+        dispatch_async(dispatch_get_main_queue(), ^{
+            [wSelf setNeedsRedraw];
+        });
+    }
+    
+    return YES;
+}
+
+- (BOOL)enqueueBubbleRecordsWithContentsOfURL:(NSURL*)url
+{
+    NSError *error = NULL;
+    NSData *records = [NSData dataWithContentsOfURL:url options:NSDataReadingMappedIfSafe error:&error];
+    if (nil == records)
+    {
+        NSLog(@"The renderer can't read the bubbles of %@ due to: %@", url.path, error);
+        return NO;
+    }
+    
+    return [self enqueueBubbleRecords:records];
+}
+
+- (NSData*)bubbleSceneRecord
+{
+    std::vector<uint8_t> record;
+    appendBubbleScene(record, _bubbleSet.origins(), _bubbleSet.radii(),
+                      float2 { float(backgroundImageTexture.width), float(backgroundImageTexture.height) });
+    
+    return [NSData dataWithBytes:record.data() length:record.size()];
+}
+
+/// Applies the records of the stream the caller enqueued since the last frame, in order.
+- (void)applyPendingBubbleRecords
+{
+    NSArray<NSData*> *records = nil;
+    
+    os_unfair_lock_lock(&bubbleStreamLock);
+    if (pendingBubbleRecords.count > 0)
+    {
+        records = pendingBubbleRecords;
+        pendingBubbleRecords = [NSMutableArray new];
+    }
+    os_unfair_lock_unlock(&bubbleStreamLock);
+    
+    const float2 contentSize { float(backgroundImageTexture.width), float(backgroundImageTexture.height) };
+    for (NSData *data in records)
+    {
+        bubbleStream.apply(_bubbleSet, data.bytes, data.length, contentSize);
+    }
+}
+
+- (id<MTLTexture>)drawSceneBatch:(NSArray<NSData*>*)sceneRecords
+                           width:(NSUInteger)width
+                          height:(NSUInteger)height
+               completionHandler:(void (^)(NSData*, CFTimeInterval))completionHandler
+{
+    if (!pipelinesReady || nil == renderPipelineState || sceneRecords.count == 0)
+    {
+        NSLog(@"The renderer can't draw a batch of %lu scenes before its pipelines are ready.",
+              (unsigned long)sceneRecords.count);
+        return nil;
+    }
+    
+    const uint2 nbTiles { (uint32_t)threadgroupCount.width, (uint32_t)threadgroupCount.height };
+    const NSUInteger nbTilesOfField = threadgroupCount.width * threadgroupCount.height;
+    const float2 contentSize { float(backgroundImageTexture.width), float(backgroundImageTexture.height) };
+    const float2 sliceSize { float(width), float(height) };
+    
+    // Lay out the ranges of the scenes in a single buffer, which the passes bind at their offsets.
+    std::vector<uint8_t> bytes;
+    auto append = [&bytes](const void* data, size_t length) {
+        const size_t offset = (bytes.size() + kSceneBatchBufferAlignment - 1) & ~(kSceneBatchBufferAlignment - 1);
+        bytes.resize(offset + std::max<size_t>(length, 1));
+        if (length > 0)
+        {
+            memcpy(bytes.data() + offset, data, length);
+        }
+        
+        return uint64_t(offset);
+    };
+    
+    // The scenes share the rectangle of the slices, and recompute every tile of the field.
+    VertexData vertices[kNbRectangleVertices];
+    getRectangleVertexData(vertices, sliceSize, contentSize);
+    const uint64_t vertexDataOffset = append(vertices, sizeof(vertices));
+    
+    std::vector<uint32_t> allTiles(nbTilesOfField);
+    for (uint32_t i = 0; i < nbTilesOfField; ++i)
+    {
+        allTiles[i] = packTileCoordinates(uint2 { i % nbTiles.x, i / nbTiles.x });
+    }
+    const uint64_t allTilesOffset = append(allTiles.data(), allTiles.size() * sizeof(uint32_t));
+    
+    // The scenes take the light and the field of the frames.
+    Uniforms uniforms = *[self uniforms];
+    uniforms.viewportSize = sliceSize;
+    
+    // The bindings of each scene hold the offsets of its ranges until the buffer exists.
+    std::vector<SceneBindings> scenes;
+    scenes.reserve(sceneRecords.count);
+    
+    BubbleSet bubbleSet;
+    BubbleStream stream;
+    
+    for (NSUInteger i = 0; i < sceneRecords.count; ++i)
+    {
+        const auto record = readBubbleRecord(sceneRecords[i].bytes, sceneRecords[i].length, contentSize);
+        if (!record.has_value() || record->type != BubbleRecordType::Scene)
+        {
+            NSLog(@"The renderer skips a batch whose scene %lu isn't a valid scene record.", (unsigned long)i);
+            return nil;
+        }
+        
+        stream.load(bubbleSet, record->scene);
+        bubbleSet.update(nbTiles, fieldTexelSize);
+        
+        const auto& groups = bubbleSet.groups();
+        const auto& bubbles = bubbleSet.groupedBubbles();
+        const auto& tileBins = bubbleSet.tileBins();
+        const auto& tileGroupIndices = bubbleSet.tileGroupIndices();
+        
+        uniforms.nbBubbleGroups = groups.size();
+        
+        scenes.push_back(SceneBindings {
+            .uniforms = append(&uniforms, sizeof(uniforms)),
+            .bubbleGroups = append(groups.data(), groups.size() * sizeof(BubbleGroup)),
+            .bubbles = append(bubbles.data(), bubbles.size() * sizeof(Bubble)),
+            .tileBins = append(tileBins.data(), tileBins.size() * sizeof(TileBin)),
+            .tileGroupIndices = append(tileGroupIndices.data(), tileGroupIndices.size() * sizeof(uint32_t)),
+            .vertexData = vertexDataOffset,
+            .dirtyTiles = allTilesOffset,
+            .nbDirtyTiles = nbTilesOfField,
+            .sdfTiles = allTilesOffset,
+            .nbSDFTiles = nbTilesOfField,
+            .sdfPipelineState = [self sdfPipelineStateForMaxGroupSize:bubbleSet.maxGroupSize()],
+            .viewportSize = sliceSize
+        });
+    }
+    
+    // Create the resources of the batch, which the renderer keeps until the GPU finishes it.
+    id<MTLBuffer> sceneBuffer = [device newBufferWithBytes:bytes.data()
+                                                    length:bytes.size()
+                                                   options:MTLResourceStorageModeShared];
+    sceneBuffer.label = @"Scene Batch";
+    
+    MTLTextureDescriptor *textureDescriptor = [MTLTextureDescriptor texture2DDescriptorWithPixelFormat:_colorPixelFormat
+                                                                                                 width:width
+                                                                                                height:height
+                                                                                             mipmapped:NO];
+    textureDescriptor.textureType = MTLTextureType2DArray;
+    textureDescriptor.arrayLength = sceneRecords.count;
+    textureDescriptor.usage = MTLTextureUsageRenderTarget | MTLTextureUsageShaderRead;
+    textureDescriptor.storageMode = MTLStorageModePrivate;
+    
+    id<MTLTexture> slices = [device newTextureWithDescriptor:textureDescriptor];
+    slices.label = @"Scene Batch Slices";
+    
+    // The slices of the pixel format have 4 bytes per pixel.
+    const NSUInteger bytesPerRow = 4 * width;
+    const NSUInteger bytesPerImage = bytesPerRow * height;
+    
+    id<MTLBuffer> pixelsBuffer = [device newBufferWithLength:bytesPerImage * sceneRecords.count
+                                                     options:MTLResourceStorageModeShared];
+    pixelsBuffer.label = @"Scene Batch Pixels";
+    
+    NSError *error = NULL;
+    MTLResidencySetDescriptor *residencySetDescriptor = [MTLResidencySetDescriptor new];
+    residencySetDescriptor.label = @"Scene Batch";
+    id<MTLResidencySet> batchResidencySet = [device newResidencySetWithDescriptor:residencySetDescriptor error:&error];
+    
+    if (nil == sceneBuffer || nil == slices || nil == pixelsBuffer || nil == batchResidencySet)
+    {
+        NSLog(@"The device can't create the resources of a batch of %lu scenes of %lu x %lu pixels.",
+              (unsigned long)sceneRecords.count, (unsigned long)width, (unsigned long)height);
+        return nil;
+    }
+    
+    [batchResidencySet addAllocation:sceneBuffer];
+    [batchResidencySet addAllocation:slices];
+    [batchResidencySet addAllocation:pixelsBuffer];
+    [batchResidencySet commit];
+    
+    for (SceneBindings& scene : scenes)
+    {
+        scene.uniforms += sceneBuffer.gpuAddress;
+        scene.bubbleGroups += sceneBuffer.gpuAddress;
+        scene.bubbles += sceneBuffer.gpuAddress;
+        scene.tileBins += sceneBuffer.gpuAddress;
+        scene.tileGroupIndices += sceneBuffer.gpuAddress;
+        scene.vertexData += sceneBuffer.gpuAddress;
+        scene.dirtyTiles += sceneBuffer.gpuAddress;
+        scene.sdfTiles += sceneBuffer.gpuAddress;
+    }
+    
+    if (_usesTransientSDFTexture && sdfTextureHeapIsVolatile)
+    {
+        // The SDF pass overwrites the texels the gradient reads, so the contents don't matter.
+        [sdfTextureHeap setPurgeableState:MTLPurgeableStateNonVolatile];
+        sdfTextureHeapIsVolatile = NO;
+    }
+    
+    ++nbSceneBatchesInFlight;
+    
+    // The command buffer of the batch has its own allocator, which the frames don't reset.
+    id<MTL4CommandAllocator> batchAllocator = [device newCommandAllocator];
+    id<MTL4CommandBuffer> batchCommandBuffer = [device newCommandBuffer];
+    
+    [batchCommandBuffer beginCommandBufferWithAllocator:batchAllocator];
+    [batchCommandBuffer useResidencySet:batchResidencySet];
+    batchCommandBuffer.label = [NSString stringWithFormat:@"Command buffer for a batch of %lu scenes",
+                                (unsigned long)sceneRecords.count];
+    
+    for (NSUInteger i = 0; i < scenes.size(); ++i)
+    {
+        const SceneBindings& scene = scenes[i];
+        
+        id<MTL4ComputeCommandEncoder> computeEncoder = [batchCommandBuffer computeCommandEncoder];
+        computeEncoder.label = [NSString stringWithFormat:@"Compute encoder for scene %lu", (unsigned long)i];
+        
+        // Wait for the passes of the frames and of the previous scene, which read the field textures.
+        [computeEncoder barrierAfterQueueStages:MTLStageFragment
+                                   beforeStages:MTLStageDispatch
+                              visibilityOptions:MTL4VisibilityOptionDevice];
+        
+        if (_usesFusedSDFPass)
+        {
+            [self drawSDFsAndGradient:computeEncoder scene:scene];
+        }
+        else
+        {
+            [self drawSDFs:computeEncoder scene:scene];
+            
+            // Wait for the SDF texture before differentiating it.
+            [computeEncoder barrierAfterEncoderStages:MTLStageDispatch
+                                  beforeEncoderStages:MTLStageDispatch
+                                    visibilityOptions:MTL4VisibilityOptionDevice];
+            
+            [self drawSDFGradient:computeEncoder scene:scene];
+        }
+        
+        // Wait for the gradient texture before reducing it.
+        [computeEncoder barrierAfterEncoderStages:MTLStageDispatch
+                              beforeEncoderStages:MTLStageDispatch
+                                visibilityOptions:MTL4VisibilityOptionDevice];
+        
+        [self reduceSDFPyramid:computeEncoder scene:scene];
+        [computeEncoder endEncoding];
+        
+        MTL4RenderPassDescriptor *renderPassDescriptor = [MTL4RenderPassDescriptor new];
+        renderPassDescriptor.colorAttachments[0].texture = slices;
+        renderPassDescriptor.colorAttachments[0].slice = i;
+        renderPassDescriptor.colorAttachments[0].loadAction = MTLLoadActionClear;
+        renderPassDescriptor.colorAttachments[0].storeAction = MTLStoreActionStore;
+        renderPassDescriptor.colorAttachments[0].clearColor = MTLClearColorMake(0.0, 0.0, 0.0, 1.0);
+        
+        id<MTL4RenderCommandEncoder> renderEncoder = [batchCommandBuffer renderCommandEncoderWithDescriptor:renderPassDescriptor];
+        renderEncoder.label = [NSString stringWithFormat:@"Render encoder for scene %lu", (unsigned long)i];
+        
+        [self encodeRenderPassWithEncoder:renderEncoder scene:scene];
+        [renderEncoder endEncoding];
+    }
+    
+    // Copy the slices to the shared buffer once the GPU draws the last one.
+    id<MTL4ComputeCommandEncoder> readbackEncoder = [batchCommandBuffer computeCommandEncoder];
+    readbackEncoder.label = @"Readback encoder for the scene batch";
+    
+    [readbackEncoder barrierAfterQueueStages:MTLStageFragment
+                                beforeStages:MTLStageBlit
+                           visibilityOptions:MTL4VisibilityOptionDevice];
+    
+    for (NSUInteger i = 0; i < scenes.size(); ++i)
+    {
+        [readbackEncoder copyFromTexture:slices
+                             sourceSlice:i
+                             sourceLevel:0
+                            sourceOrigin:MTLOriginMake(0, 0, 0)
+                              sourceSize:MTLSizeMake(width, height, 1)
+                                toBuffer:pixelsBuffer
+                       destinationOffset:i * bytesPerImage
+                  destinationBytesPerRow:bytesPerRow
+                destinationBytesPerImage:bytesPerImage];
+    }
+    
+    [readbackEncoder endEncoding];
+    [batchCommandBuffer endCommandBuffer];
+    
+    // The command buffer doesn't retain its resources, so the feedback handler keeps them
+    // until the GPU finishes, and hands the pixels out without copying them.
+    NSArray *batchResources = @[ sceneBuffer, slices, batchResidencySet, batchAllocator, batchCommandBuffer ];
+    
+    __weak Metal4Renderer* wSelf = self;
+    MTL4CommitOptions *commitOptions = [MTL4CommitOptions new];
+    [commitOptions addFeedbackHandler:^(id<MTL4CommitFeedback> feedback) {
+        NSData *pixels = nil;
+        if (nil == feedback.error)
+        {
+            pixels = [NSData dataWithBytesNoCopy:pixelsBuffer.contents
+                                          length:pixelsBuffer.length
+                                     deallocator:^(void*, NSUInteger) { (void)pixelsBuffer; }];
+        }
+        else
+        {
+            NSLog(@"The GPU failed to draw a batch of scenes due to: %@", feedback.error);
+        }
+        
+        const CFTimeInterval gpuDuration = feedback.GPUEndTime - feedback.GPUStartTime;
+        
+        dispatch_async(dispatch_get_main_queue(), ^{
+            (void)batchResources;
+            
+            Metal4Renderer* self = wSelf;
+            if (self != nil)
+            {
+                --self->nbSceneBatchesInFlight;
+            }
+            
+            completionHandler(pixels, gpuDuration);
+        });
+    }];
     
-    buf->lightDirection = lightDirection;
+    [commandQueue commit:&batchCommandBuffer count:1 options:commitOptions];
     
-    _bubbleSet.update(*buf);
+    // The field textures now store the last scene of the batch.
+    followsSceneBatch = YES;
+    [self invalidateField];
+    [self setNeedsRedraw];
     
+    return slices;
 }
 
-/// The system calls this method whenever the view changes orientation or size.
-- (void)mtkView:(nonnull MTKView *)view drawableSizeWillChange:(CGSize)size
-{
-    // Update the viewport property to its new size,
-    // which the renderer passes to the vertex shader.
-    viewportSize.x = (simd_uint1)size.width;
-    viewportSize.y = (simd_uint1)size.height;
-
-    [self updateUniformsBuffer];
-}
-
-- (void)drawSDFs:(id<MTL4ComputeCommandEncoder>)computeEncoder
+- (void)setSimulatesBubbles:(BOOL)simulatesBubbles
 {
-    [computeEncoder setComputePipelineState:drawSDFPipelineState];
+    if (simulatesBubbles == _simulatesBubbles)
+    {
+        return;
+    }
     
-    // Configure the encoder's argument table for the dispatch call.
-    [computeEncoder setArgumentTable:argumentTable];
-
-    // Bind the composite color (input) texture in the argument table.
-    [argumentTable setTexture:sdfTexture.gpuResourceID
-                      atIndex:ComputeTextureBindingIndexForSDF];
-
-    [argumentTable setAddress:uniformsBuffer.gpuAddress
-                      atIndex:BufferBindingIndexForUniforms];
+    if (!simulatesBubbles)
+    {
+        // Leave the bubbles of the set where the GPU shows them.
+        const int index = [self lastCompletedFrameIndex];
+        const uint32_t nbBubbles = (index >= 0) ? nbSimulatedBubbles[index] : 0;
+        
+        if (nbBubbles > 0)
+        {
+            const auto* origins = reinterpret_cast<const float2*>(groupingBuffers[index][GroupingBufferBindingIndexForOrigins].contents);
+            const auto* slots = reinterpret_cast<const uint32_t*>(groupingBuffers[index][GroupingBufferBindingIndexForSlots].contents);
+            
+            for (uint32_t i = 0; i < nbBubbles; ++i)
+            {
+                if (const auto handle = _bubbleSet.handleOfSlot(slots[i]))
+                {
+                    _bubbleSet.setOrigin(*handle, origins[i]);
+                }
+            }
+        }
+    }
+    else
+    {
+        // Give the simulation every bubble again.
+        simulatedHandles.clear();
+        simulatedSceneVersion = std::numeric_limits<uint64_t>::max();
+        lastSimulationStepTime = 0;
+    }
     
-    // Run the dispatch with the pipeline state and current state of the argument table.
-    [computeEncoder dispatchThreadgroups:threadgroupCount
-                   threadsPerThreadgroup:threadgroupSize];
+    _simulatesBubbles = simulatesBubbles;
+    [self setNeedsRedraw];
 }
 
-- (void)drawSDFGradient:(id<MTL4ComputeCommandEncoder>)computeEncoder
+/// Returns the array index of the per-frame resources of the last frame the GPU finished, or `-1` before the first one.
+///
+/// The method waits for the GPU when the next frame would reuse the resources of that frame.
+- (int)lastCompletedFrameIndex
 {
-    [computeEncoder setComputePipelineState:drawSDFGradientPipelineState];
-    
-    // Configure the encoder's argument table for the dispatch call.
-    [computeEncoder setArgumentTable:argumentTable];
-
-    // Bind the composite color (input) texture in the argument table.
-    [argumentTable setTexture:sdfTexture.gpuResourceID
-                      atIndex:ComputeTextureBindingIndexForSDF];
+    uint64_t completedFrame = sharedEvent.signaledValue;
     
-    [argumentTable setTexture:sdfGradientTexture.gpuResourceID
-                      atIndex:ComputeTextureBindingIndexForGradientSDF];
+    if (completedFrame + kMaxFramesInFlight <= frameNumber)
+    {
+        [sharedEvent waitUntilSignaledValue:frameNumber - kMaxFramesInFlight + 1 timeoutMS:10];
+        completedFrame = sharedEvent.signaledValue;
+        
+        if (completedFrame + kMaxFramesInFlight <= frameNumber)
+        {
+            return -1;
+        }
+    }
     
-    // Run the dispatch with the pipeline state and current state of the argument table.
-    [computeEncoder dispatchThreadgroups:threadgroupCount
-                   threadsPerThreadgroup:threadgroupSize];
+    return (completedFrame > 0) ? int(completedFrame % kMaxFramesInFlight) : -1;
 }
 
-- (void)encodeComputePassWithEncoder:(id<MTL4ComputeCommandEncoder>)computeEncoder
+- (CGSize)contentSize
 {
-    // Add a barrier that pauses the dispatch stage of the compute pass
-    // from starting until the copy commands finish during their blit stage.
-    [computeEncoder barrierAfterEncoderStages:MTLStageBlit
-                          beforeEncoderStages:MTLStageDispatch
-                            visibilityOptions:MTL4VisibilityOptionDevice];
-
-    [self drawSDFs:computeEncoder];
-    [self drawSDFGradient:computeEncoder];
+    return CGSizeMake(backgroundImageTexture.width, backgroundImageTexture.height);
 }
 
-- (void)encodeRenderPassWithEncoder:(id<MTL4RenderCommandEncoder>)renderEncoder
+- (CGSize)fieldSize
 {
-    // Add a barrier that tells the GPU to wait for any previous dispatch kernels
-    // to finish before running any subsequent vertex stages.
-    [renderEncoder barrierAfterQueueStages:MTLStageDispatch
-                              beforeStages:MTLStageVertex
-                         visibilityOptions:MTL4VisibilityOptionDevice];
-
-    // Configure the view-port with the size of the drawable region.
-    MTLViewport viewPort;
-    viewPort.originX = 0.0;
-    viewPort.originY = 0.0;
-    viewPort.width = (double)viewportSize.x;
-    viewPort.height = (double)viewportSize.y;
-    viewPort.znear = 0.0;
-    viewPort.zfar = 1.0;
-
-    [renderEncoder setViewport:viewPort];
-
-    // Configure the encoder with the renderer's main pipeline state.
-    [renderEncoder setRenderPipelineState:renderPipelineState];
-
-    // Set the encoder's argument table.
-    [renderEncoder setArgumentTable:argumentTable
-                           atStages:MTLRenderStageVertex | MTLRenderStageFragment];
-
-    // Bind the buffer with the triangle data to the argument table.
-    [argumentTable setAddress:vertexDataBuffer.gpuAddress
-                      atIndex:BufferBindingIndexForVertexData];
-
-    // Bind the buffer with the viewport's size to the argument table.
-    [argumentTable setAddress:uniformsBuffer.gpuAddress
-                      atIndex:BufferBindingIndexForUniforms];
+    return CGSizeMake(sdfGradientTexture.width, sdfGradientTexture.height);
+}
 
-    // Bind the color composite texture.
-    [argumentTable setTexture:backgroundImageTexture.gpuResourceID
-                      atIndex:RenderTextureBindingIndex];
-    
-    [argumentTable setTexture:sdfGradientTexture.gpuResourceID
-                      atIndex:SDFGradientTextureBindingIndex];
-    
-    // Draw the first rectangle with the color composite texture.
-    const NSUInteger firstRectangleOffset = 0;
-    const NSUInteger rectangleVertexCount = 6;
-    [renderEncoder drawPrimitives:MTLPrimitiveTypeTriangle
-                      vertexStart:firstRectangleOffset
-                      vertexCount:rectangleVertexCount];
+- (BOOL)compilesPipelines
+{
+    return !pipelinesReady || nbPendingPipelineCompilations > 0;
 }
 
 /// Draws a frame of content to a view's drawable.
@@ -882,8 +3957,6 @@ private:
         NSLog(@"The view doesn't have an available drawable at this time.");
         return;
     }
-    
-    [self updateUniformsBuffer];
 
     // Get the render pass descriptor from the view's drawable instance.
     MTL4RenderPassDescriptor *renderPassDescriptor = view.currentMTL4RenderPassDescriptor;
@@ -894,66 +3967,11 @@ private:
         return;
     }
 
-    // Increment the frame number for this frame.
-    frameNumber += 1;
-
-    // Make a string with the current frame number,
-    NSString *forFrameString = [NSString stringWithFormat:@" for frame: %llu", frameNumber];
-
-    if (frameNumber >= kMaxFramesInFlight) {
-        // Wait for the GPU to finish rendering the frame that's
-        // `kMaxFramesInFlight` before this one, and then proceed to the next step.
-        uint64_t previousValueToWaitFor = frameNumber - kMaxFramesInFlight;
-        [sharedEvent waitUntilSignaledValue:previousValueToWaitFor
-                                  timeoutMS:10];
+    if (![self encodeFrameWithRenderPassDescriptor:renderPassDescriptor])
+    {
+        return;
     }
 
-    /// The array index for this frame's resources.
-    uint32_t frameIndex = frameNumber % kMaxFramesInFlight;
-
-    /// An allocator that's next in the rotation for this frame.
-    id<MTL4CommandAllocator> frameAllocator = commandAllocators[frameIndex];
-
-    // Prepare to use or reuse the allocator by resetting it.
-    [frameAllocator reset];
-
-    // Reset the command buffer for the new frame.
-    [commandBuffer beginCommandBufferWithAllocator:frameAllocator];
-
-    // Assign the command buffer a unique label for this frame.
-    commandBuffer.label = [@"Command buffer" stringByAppendingString:forFrameString];
-
-    // === Compute pass ===
-    // Create a compute encoder from the command buffer.
-    id<MTL4ComputeCommandEncoder> computeEncoder;
-    computeEncoder = [commandBuffer computeCommandEncoder];
-
-    // Assign the compute encoder a unique label for this frame.
-    computeEncoder.label = [@"Compute encoder" stringByAppendingString:forFrameString];
-
-    // Encode a compute pass that copies the color textures and creates the grayscale texture.
-    [self encodeComputePassWithEncoder:computeEncoder];
-
-    // Mark the end of the compute pass.
-    [computeEncoder endEncoding];
-
-    // === Render pass ===
-    // Create a render encoder from the command buffer.
-    id<MTL4RenderCommandEncoder> renderEncoder =
-    [commandBuffer renderCommandEncoderWithDescriptor:renderPassDescriptor];
-
-    // Assign the render encoder a unique label for this frame.
-    renderEncoder.label = [@"Render encoder" stringByAppendingString:forFrameString];
-
-    // Encode a render pass that draws a rectangle each of the composite textures.
-    [self encodeRenderPassWithEncoder:renderEncoder];
-
-    // Mark the end of the render pass.
-    [renderEncoder endEncoding];
-
-    // Finalize the command buffer.
-    [commandBuffer endCommandBuffer];
-
     // === Submit passes to the GPU ===
     // Wait until the drawable is ready for rendering.
     [commandQueue waitForDrawable:drawable];
@@ -969,68 +3987,110 @@ private:
 
     // Signal when the GPU finishes rendering this frame with a shared event.
     [commandQueue signalEvent:sharedEvent value:frameNumber];
+    
+    // The drawable keeps showing this frame while the view is paused.
+    [self pauseViewIfIdle];
 }
 
 
 - (float2)pointInSDFSpace:(float2)pos
 {
-    const CGSize viewSiz = view.bounds.size;
-    
-    const float2 viewSize { float(viewSiz.width), float(viewSiz.height) };
-    const float2 textureSize { float(backgroundImageTexture.width), float(backgroundImageTexture.height) };
-    
-    const float2 scale = viewSize / textureSize;
-    const float s = std::min(scale.x, scale.y);
-    
-    const float displayedTextureWidth = textureSize.x * s;
-    const float displayedTextureHeight = displayedTextureWidth * (textureSize.y / textureSize.x);
-    const float2 displayedTextureSize { displayedTextureWidth, displayedTextureHeight };
-    const float2 displayedTextureOrigin = (viewSize - displayedTextureSize) * 0.5f;
-    
-    float2 p = pos - displayedTextureOrigin;
-    p /= s;
+    const CGSize viewSize = view.bounds.size;
     
-    return p;
+    return ::pointInSDFSpace(pos,
+                             float2 { float(viewSize.width), float(viewSize.height) },
+                             float2 { float(backgroundImageTexture.width), float(backgroundImageTexture.height) });
 }
 
-- (Bubble*)pick:(float2)pos
+- (std::optional<BubbleHandle>)pick:(float2)pos
 {
-    const auto p = [self pointInSDFSpace:pos];
-    return _bubbleSet.pick(p);
+    return [self pickInSDFSpace:[self pointInSDFSpace:pos]];
 }
 
-- (void)onPan:(UIPanGestureRecognizer*)recognizer
+/// Returns the bubble under a point of SDF space, if any.
+///
+/// While the GPU simulates the bubbles, the method picks them where the last frame
+/// the GPU finished shows them, and moves the picked bubble of the set there, so that
+/// a selection drags it from where the user sees it.
+- (std::optional<BubbleHandle>)pickInSDFSpace:(float2)pos
 {
-    const auto p = [recognizer locationInView:view];
-    const float2 pos { float(p.x), float(p.y) };
-    const auto ptInSDFSpace = [self pointInSDFSpace:pos];
+    const int index = _simulatesBubbles ? [self lastCompletedFrameIndex] : -1;
+    const uint32_t nbBubbles = (index >= 0) ? nbSimulatedBubbles[index] : 0;
+    
+    if (nbBubbles == 0)
+    {
+        return _bubbleSet.pick(pos);
+    }
     
-    switch(recognizer.state)
+    id<MTLBuffer> __strong * buffers = groupingBuffers[index];
+    const auto* origins = reinterpret_cast<const float2*>(buffers[GroupingBufferBindingIndexForOrigins].contents);
+    const auto* radii = reinterpret_cast<const float*>(buffers[GroupingBufferBindingIndexForRadii].contents);
+    const auto* slots = reinterpret_cast<const uint32_t*>(buffers[GroupingBufferBindingIndexForSlots].contents);
+    
+    // The bubble with the smallest index wins, as in the set.
+    for (uint32_t i = 0; i < nbBubbles; ++i)
     {
-        case UIGestureRecognizerStateBegan:
+        if (length(pos - origins[i]) > radii[i])
         {
-            if (auto bubble = [self pick:pos])
-            {
-                _bubbleSet.setSelection(*bubble, ptInSDFSpace);
-            }
-            else
+            continue;
+        }
+        
+        const auto handle = _bubbleSet.handleOfSlot(slots[i]);
+        if (handle.has_value())
+        {
+            _bubbleSet.setOrigin(*handle, origins[i]);
+        }
+        
+        return handle;
+    }
+    
+    return std::nullopt;
+}
+
+/// Selects the bubbles under the touches that begin, and moves the selections of the touches that move.
+- (void)onTouches:(NSSet<UITouch*>*)touches phase:(UITouchPhase)phase
+{
+    switch(phase)
+    {
+        case UITouchPhaseBegan:
+        {
+            for (UITouch* touch in touches)
             {
-                _bubbleSet.clearSelection();
+                const auto p = [touch locationInView:view];
+                const float2 pos { float(p.x), float(p.y) };
+                
+                if (auto bubble = [self pick:pos])
+                {
+                    _bubbleSet.setSelection(touchIDOf(touch), *bubble, [self pointInSDFSpace:pos]);
+                }
             }
             
             break;
         }
             
-        case UIGestureRecognizerStateChanged:
+        case UITouchPhaseMoved:
         {
-            _bubbleSet.moveSelection(ptInSDFSpace);
+            // Move the bubbles of all the touches of the event together.
+            touchMoves.clear();
+            for (UITouch* touch in touches)
+            {
+                const auto p = [touch locationInView:view];
+                touchMoves.push_back(SelectionMove { touchIDOf(touch), [self pointInSDFSpace:float2 { float(p.x), float(p.y) }] });
+            }
+            
+            _bubbleSet.moveSelections(touchMoves);
+            [self setNeedsRedrawIfSceneChanged];
             break;
         }
             
-        case UIGestureRecognizerStateEnded:
-        case UIGestureRecognizerStateCancelled:
+        case UITouchPhaseEnded:
+        case UITouchPhaseCancelled:
         {
-            _bubbleSet.clearSelection();
+            for (UITouch* touch in touches)
+            {
+                _bubbleSet.clearSelection(touchIDOf(touch));
+            }
+            
             break;
         }
             
@@ -1038,61 +4098,6 @@ private:
     }
 }
 
-class CPUTextureAccessor final
-{
-public:
-    CPUTextureAccessor(id<MTLTexture> texture, uint2 gridId)
-    : _texture(texture), _gridId(gridId), _value(std::make_shared<float>(0.f))
-    {}
-    
-    CPUTextureAccessor(const CPUTextureAccessor&) = default;
-    
-    void write(float v)
-    {
-        *_value = v;
-    }
-    
-    bool isValid() const
-    {
-        return (_gridId.x < _texture.width) && (_gridId.y < _texture.height);
-    }
-    
-    float2 position() const
-    {
-        return { float(_gridId.x), float(_gridId.y) };
-    }
-    
-    float value() const
-    {
-        return *_value;
-    }
-    
-private:
-    id<MTLTexture> _texture;
-    uint2 _gridId;
-    
-    std::shared_ptr<float> _value;
-};
-
-- (void)onTap:(UITapGestureRecognizer*)recognizer
-{
-    if (recognizer.state == UIGestureRecognizerStateRecognized)
-    {
-        auto uniforms = [self uniforms];
-        
-        const CGPoint ptView = [recognizer locationInView:view];
-        const float2 ptSDF = [self pointInSDFSpace: float2{ float(ptView.x), float(ptView.y) }];
-        
-        const uint2 pos { uint32_t(ptSDF.x), uint32_t(ptSDF.y) };
-        
-        CPUTextureAccessor accessor { backgroundImageTexture, pos };
-        computeAndDrawSDF(accessor, uniforms);
-        
-        const auto value = accessor.value();
-        NSLog(@"value [%1.2f]", value);
-    }
-}
-
 - (void)onDoubleTap:(UITapGestureRecognizer*)recognizer
 {
     if (recognizer.state == UIGestureRecognizerStateRecognized)
@@ -1100,15 +4105,9 @@ private:
         const CGPoint ptView = [recognizer locationInView:view];
         const float2 ptSDF = [self pointInSDFSpace: float2{ float(ptView.x), float(ptView.y) }];
         
-        if (auto bubble = _bubbleSet.pick(ptSDF))
-        {
-            _bubbleSet.remove(*bubble);
-        }
-        else
-        {
-            // add
-            _bubbleSet.add(ptSDF, 100.f);
-        }
+        addOrRemoveBubble(_bubbleSet, ptSDF, [&](float2 point) { return [self pickInSDFSpace:point]; });
+        
+        [self setNeedsRedrawIfSceneChanged];
     }
 }
 
@@ -1118,36 +4117,16 @@ private:
     const float2 pos { float(p.x), float(p.y) };
     const auto posInSDFSpace = [self pointInSDFSpace:pos];
     
-    switch(recognizer.state)
+    // The pinch drives a selection of its own, apart from the ones of its fingers.
+    const TouchID touch = touchIDOf(recognizer);
+    const auto pick = [&](float2 point) { return [self pickInSDFSpace:point]; };
+    
+    // The fingers of the pinch stop dragging the bubble it rescales.
+    updateGestureSelection(_bubbleSet, touch, recognizer.state, posInSDFSpace, pick, [&]
     {
-        case UIGestureRecognizerStateBegan:
-        {
-            if (auto bubble = _bubbleSet.pick(posInSDFSpace))
-            {
-                _bubbleSet.setSelection(*bubble, posInSDFSpace);
-            }
-            else
-            {
-                _bubbleSet.clearSelection();
-            }
-            break;
-        }
-            
-        case UIGestureRecognizerStateChanged:
-        {
-            _bubbleSet.rescaleSelection(recognizer.scale);
-            break;
-        }
-            
-        case UIGestureRecognizerStateEnded:
-        case UIGestureRecognizerStateCancelled:
-        {
-            _bubbleSet.clearSelection();
-            break;
-        }
-            
-        default: break;
-    }
+        _bubbleSet.rescaleSelection(touch, recognizer.scale);
+        [self setNeedsRedrawIfSceneChanged];
+    });
 }
 
 @end
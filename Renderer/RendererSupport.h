@@ -0,0 +1,123 @@
+#pragma once
+
+#import <simd/simd.h>
+#import "UIKit/UIKit.h"
+
+#include <algorithm>
+#include <iterator>
+
+#import "ShaderTypes.h"
+#import "BubbleSet.h"
+
+/// The number of vertices of the rectangle the render pass draws the composite with.
+constexpr NSUInteger kNbRectangleVertices = 6;
+
+/// The radius of the bubble a double tap adds.
+constexpr float kAddedBubbleRadius = 100.f;
+
+/// Returns the identifier of a touch, or of a gesture recognizer, for the selections of ``BubbleSet``.
+///
+/// A gesture recognizer drives a single selection, apart from the ones of its touches.
+inline TouchID touchIDOf(id object)
+{
+    return TouchID(reinterpret_cast<uintptr_t>((__bridge void*)object));
+}
+
+/// Fills the vertices of the rectangle that fits the background image in a viewport.
+inline void getRectangleVertexData(VertexData* vertices, simd::float2 viewportSize, simd::float2 contentSize)
+{
+    const simd::float2 s = viewportSize / contentSize;
+    const float minS = std::min(s.x, s.y);
+    const float rescaledContentSizeX = contentSize.x * minS;
+    const float offsetX = (viewportSize.x - rescaledContentSizeX) * 0.5f;
+    
+    const float w = (viewportSize.x - offsetX) * 0.5f;
+    const float h = w * contentSize.y / contentSize.x;
+    
+    const VertexData triangleVertexData[kNbRectangleVertices] =
+    {
+        { {  w,  -h },  { 1.f, 1.f } },
+        { { -w,  -h },  { 0.f, 1.f } },
+        { { -w,  h },  { 0.f, 0.f } },
+        
+        // The 2nd triangle of the rectangle for the composite color texture.
+        { {  w,  -h },  { 1.f, 1.f } },
+        { { -w,  h },  { 0.f, 0.f } },
+        { {  w,  h },  { 1.f, 0.f } },
+    };
+    
+    std::copy(std::begin(triangleVertexData), std::end(triangleVertexData), vertices);
+}
+
+/// Converts a point of a view to SDF space, where the background image fits the view and is centered in it.
+inline simd::float2 pointInSDFSpace(simd::float2 pos, simd::float2 viewSize, simd::float2 contentSize)
+{
+    const simd::float2 scale = viewSize / contentSize;
+    const float s = std::min(scale.x, scale.y);
+    
+    const simd::float2 displayedContentSize = contentSize * s;
+    const simd::float2 displayedContentOrigin = (viewSize - displayedContentSize) * 0.5f;
+    
+    return (pos - displayedContentOrigin) / s;
+}
+
+/// Removes the bubble under a point of SDF space, or adds one there, which is what a double tap does.
+///
+/// `pick` returns the bubble under a point of SDF space, if any.
+template <typename TPick>
+void addOrRemoveBubble(BubbleSet& bubbleSet, simd::float2 pos, TPick&& pick)
+{
+    if (auto bubble = pick(pos))
+    {
+        bubbleSet.remove(*bubble);
+    }
+    else
+    {
+        bubbleSet.add(pos, kAddedBubbleRadius);
+    }
+}
+
+/// Updates the selection of a gesture that drags or rescales the bubble it begins on.
+///
+/// The gesture takes the bubble from the other touches that drag it, and `change`
+/// applies each change of the gesture to its selection until it ends.
+template <typename TPick, typename TChange>
+void updateGestureSelection(BubbleSet& bubbleSet,
+                            TouchID touch,
+                            UIGestureRecognizerState state,
+                            simd::float2 pos,
+                            TPick&& pick,
+                            TChange&& change)
+{
+    switch(state)
+    {
+        case UIGestureRecognizerStateBegan:
+        {
+            if (auto bubble = pick(pos))
+            {
+                bubbleSet.clearSelections(*bubble);
+                bubbleSet.setSelection(touch, *bubble, pos);
+            }
+            else
+            {
+                bubbleSet.clearSelection(touch);
+            }
+            break;
+        }
+        
+        case UIGestureRecognizerStateChanged:
+        {
+            change();
+            break;
+        }
+        
+        case UIGestureRecognizerStateEnded:
+        case UIGestureRecognizerStateCancelled:
+        {
+            bubbleSet.clearSelection(touch);
+            break;
+        }
+        
+        default: break;
+    }
+}
@@ -4,9 +4,13 @@
 
 #if defined(__METAL_VERSION__)
     #define SHADER_CONSTANT constant
+    #define SHADER_DEVICE device
+    #define SHADER_THREAD thread
     using namespace metal;
 #else
     #define SHADER_CONSTANT const
+    #define SHADER_DEVICE
+    #define SHADER_THREAD
     using namespace simd;
 #endif
 
@@ -30,6 +34,158 @@ enum BufferBindingIndex
     /// The vertex shader calculates the pixel coordinates of the triangle's vertices
     /// based on the size of the app's viewport.
     BufferBindingIndexForUniforms = 1,
+
+    /// The buffer binding index value that stores one ``TileBin`` per SDF tile.
+    BufferBindingIndexForTileBins = 2,
+
+    /// The buffer binding index value that stores the bubble group indices
+    /// the ``TileBin`` instances refer to.
+    BufferBindingIndexForTileGroupIndices = 3,
+
+    /// The buffer binding index value that stores the ``BubbleGroup`` instances.
+    BufferBindingIndexForBubbleGroups = 4,
+
+    /// The buffer binding index value that stores the ``Bubble`` instances,
+    /// sorted by group.
+    BufferBindingIndexForBubbles = 5,
+
+    /// The buffer binding index value that stores the packed coordinates of the
+    /// tiles a compute dispatch updates, one threadgroup per tile.
+    BufferBindingIndexForDirtyTiles = 6,
+};
+
+/// Defines the size, in texels, of the square tiles the app bins bubble groups into.
+///
+/// The value matches the threadgroup size of the compute passes so that
+/// all the threads of a threadgroup walk the same list of groups.
+enum SDFTiling
+{
+    SDFTileSize = 16,
+};
+
+/// Defines the width, in SDF texels, of the band outside the bubbles where the
+/// SDF textures store positive distances.
+///
+/// Past the band they store its width. The bilinear sampling of a reduced-resolution
+/// field then still finds the edges where they are, instead of blending the
+/// inside with a flat zero.
+enum SDFBand
+{
+    SDFOutsideBandInTexels = 2,
+};
+
+/// Defines the levels of the pyramid of the smallest and largest distances of the SDF.
+///
+/// Level `0` reduces blocks of 2 x 2 SDF texels, and each level then halves the previous one.
+/// The base covers the tiles of the SDF, so the texels of the tile level each cover one tile.
+enum SDFPyramidLevels
+{
+    /// The level whose texels cover one SDF tile each.
+    SDFPyramidTileLevel = 3,
+};
+
+static_assert((2 << SDFPyramidTileLevel) == SDFTileSize, "A texel of the tile level covers a tile");
+
+/// Defines the size, in SDF space, of the cells of the grids that find the overlapping bubbles.
+///
+/// The CPU and the GPU grouping register each bubble in every cell its bounding box overlaps.
+enum BubbleGridCells
+{
+    BubbleGridCellSize = 128,
+};
+
+/// Defines the number of threads of the single threadgroup of the prefix sums of the GPU grouping.
+enum GroupingScan
+{
+    GroupingScanThreadgroupSize = 1024,
+};
+
+/// Defines the binding index values of the buffers of the kernels that group the bubbles on the GPU.
+///
+/// The kernels use an argument table of their own, so the values overlap
+/// with the ones of ``BufferBindingIndex``. The buffers the renderer allocates
+/// for the grouping come first, up to `GroupingBufferBindingIndexForGroups`.
+enum GroupingBufferBindingIndex
+{
+    /// The ``GroupingUniforms`` of the pass.
+    GroupingBufferBindingIndexForUniforms = 0,
+    
+    /// The ``GroupingCounters`` the pass writes, which the CPU reads to grow the buffers.
+    GroupingBufferBindingIndexForCounters,
+    
+    /// The origin, radius and slot of each bubble, in the order of ``BubbleSet``.
+    GroupingBufferBindingIndexForOrigins,
+    GroupingBufferBindingIndexForRadii,
+    GroupingBufferBindingIndexForSlots,
+    
+    /// The number of entries of each cell of the hashed grid, their offsets, and the entries.
+    GroupingBufferBindingIndexForCellCounts,
+    GroupingBufferBindingIndexForCellOffsets,
+    GroupingBufferBindingIndexForCellEntries,
+    
+    /// The union-find forest of the bubbles, and the root each bubble resolves to.
+    GroupingBufferBindingIndexForLabels,
+    GroupingBufferBindingIndexForRoots,
+    
+    /// The smallest distance between the centers of two overlapping bubbles,
+    /// for each bubble first and then for each root.
+    GroupingBufferBindingIndexForMinDistances,
+    
+    /// `1` for the roots and `0` for the other bubbles, and their exclusive
+    /// prefix sum, which is the index of the group of each root.
+    GroupingBufferBindingIndexForRootFlags,
+    GroupingBufferBindingIndexForGroupIndicesOfRoots,
+    
+    /// The number of bubbles of each root, which the ranking consumes.
+    GroupingBufferBindingIndexForRootSizes,
+    
+    /// The number of bubbles of each group, and their offsets.
+    GroupingBufferBindingIndexForGroupSizes,
+    GroupingBufferBindingIndexForGroupOffsets,
+    
+    /// The rank of each bubble in its group, in the order of their indices.
+    GroupingBufferBindingIndexForMemberRanks,
+    
+    /// The circle of each group, in SDF texels.
+    GroupingBufferBindingIndexForGroupCircles,
+    
+    /// The number of groups of each tile, which the binning consumes, and their offsets.
+    GroupingBufferBindingIndexForTileCounts,
+    GroupingBufferBindingIndexForTileOffsets,
+    
+    /// The buffers the SDF kernels read, which the pass writes.
+    GroupingBufferBindingIndexForGroups,
+    GroupingBufferBindingIndexForBubbles,
+    GroupingBufferBindingIndexForTileBins,
+    GroupingBufferBindingIndexForTileGroupIndices,
+    
+    /// The values of an exclusive prefix sum, its results, the number of values and their sum.
+    GroupingBufferBindingIndexForScanValues,
+    GroupingBufferBindingIndexForScanOffsets,
+    GroupingBufferBindingIndexForScanCount,
+    GroupingBufferBindingIndexForScanTotal,
+    
+    /// The ``SimulationUniforms`` of the step that moves the bubbles, and the ``SimulationEdit`` instances it applies.
+    GroupingBufferBindingIndexForSimulationUniforms,
+    GroupingBufferBindingIndexForSimulationEdits,
+    
+    /// The position and velocity of each slot of ``BubbleSet``, which the simulation keeps between frames.
+    GroupingBufferBindingIndexForSimulationPositions,
+    GroupingBufferBindingIndexForSimulationVelocities,
+    
+    GroupingBufferBindingIndexCount
+};
+
+/// Defines the index values of the function constants that specialize the SDF kernels.
+enum FunctionConstantIndex
+{
+    /// The largest number of bubbles of the groups a specialized SDF pipeline evaluates.
+    ///
+    /// The kernels that don't define it evaluate groups of any size.
+    FunctionConstantIndexMaxBubblesPerGroup = 0,
+    
+    /// Whether the fragment shaders read the pyramid of the SDF, which the fallback renderer doesn't build.
+    FunctionConstantIndexUsesSDFPyramid = 1,
 };
 
 /// Defines the binding index values for passing texture arguments to GPU function parameters.
@@ -48,9 +204,14 @@ enum TextureBindingIndex
     // gradient
     ComputeTextureBindingIndexForGradientSDF = 3,
     
+    /// The indices of the pyramid of the SDF, and of the level a reduction writes.
+    ComputeTextureBindingIndexForSDFPyramid = 4,
+    ComputeTextureBindingIndexForSDFPyramidLevel = 5,
+    
     /// An index of a texture for a fragment shader in a render pass.
     RenderTextureBindingIndex = 0,
-    SDFGradientTextureBindingIndex = 1
+    SDFGradientTextureBindingIndex = 1,
+    SDFPyramidTextureBindingIndex = 2
 };
 
 /// A type that defines the data layout for a triangle vertex,
@@ -69,6 +230,22 @@ struct VertexData
     float2 textureCoordinate;
 };
 
+/// Returns the signed distance from a point to a circle.
+inline float circleSDF(float2 pt, float2 origin, float radius)
+{
+    return length(pt - origin) - radius;
+}
+
+/// Returns the signed distance from a point to a circle in `x`, and its gradient in `y` and `z`.
+inline float3 circleSDFAndGradient(float2 pt, float2 origin, float radius)
+{
+    const float2 v = pt - origin;
+    const float l = length(v);
+    const float2 gradient = (l > 0.f) ? v / l : float2 { 0.f, 0.f };
+    
+    return float3 { l - radius, gradient.x, gradient.y };
+}
+
 struct Bubble final
 {
     float2 origin;
@@ -79,109 +256,678 @@ struct Bubble final
     : origin(origin), radius(radius)
     {}
     
-    float computeSDF(float2 pt) SHADER_CONSTANT
+    float computeSDF(float2 pt) SHADER_DEVICE const
     {
-        const float d = length(pt - origin) - radius;
-        return d;
+        return circleSDF(pt, origin, radius);
+    }
+    
+    /// Returns the distance to the bubble in `x`, and its gradient in `y` and `z`.
+    float3 computeSDFAndGradient(float2 pt) SHADER_DEVICE const
+    {
+        return circleSDFAndGradient(pt, origin, radius);
     }
 };
 
 struct BubbleGroup final
 {
     size_t nbBubbles = 0;
+    size_t firstBubble = 0;
     float smoothFactor = 50.f;
+    
+    /// Whether the bubbles spread farther than the range of their smooth union,
+    /// in which case the SDF templates look for the bubbles they can skip in each tile.
+    bool prunesBubbles = false;
+};
+
+/// The range of bubble groups that can contribute to the texels of one SDF tile.
+struct TileBin final
+{
+    uint32_t firstGroupIndex = 0;
+    uint32_t nbGroups = 0;
 };
 
+/// The per-frame values the shaders share.
+///
+/// The bubbles and their groups don't fit a small constant block,
+/// so the app stores them in their own buffers.
 struct Uniforms final
 {
     float2 viewportSize;
     float2 gradientScale;
     float2 lightDirection;
     size_t nbBubbleGroups;
+    uint32_t nbTilesPerRow;
     
-    BubbleGroup groups[1024];
-    Bubble bubbles[1024];
+    /// The size of an SDF texel in SDF space, which is the space of the background image's pixels.
+    float2 fieldTexelSize;
 };
 
-float opUnion( float d1, float d2 )
+/// The sizes the CPU sets for the kernels that group the bubbles on the GPU.
+struct GroupingUniforms final
+{
+    uint32_t nbBubbles;
+    
+    /// The number of cells of the hashed grid, a power of two.
+    uint32_t nbCells;
+    
+    uint32_t nbTiles;
+    uint2 tileGridSize;
+    float2 fieldTexelSize;
+    
+    /// The number of entries the buffers of the grid and of the tile bins can store.
+    uint32_t cellEntriesCapacity;
+    uint32_t tileGroupIndicesCapacity;
+};
+
+/// Returns the cell of the hashed grid that a cell of SDF space maps to.
+///
+/// Two cells can share an entry, which only adds candidates that the overlap test rejects.
+inline uint32_t hashGridCell(int2 cell, uint32_t nbCells)
+{
+    return ((uint32_t(cell.x) * 73856093u) ^ (uint32_t(cell.y) * 19349663u)) & (nbCells - 1);
+}
+
+/// Returns the cells of SDF space the bounding box of a bubble overlaps.
+inline void gridCellRange(float2 origin, float radius, SHADER_THREAD int2& minCell, SHADER_THREAD int2& maxCell)
+{
+    const float cellSize = float(BubbleGridCellSize);
+    
+    const float2 lo = floor((origin - radius) / cellSize);
+    const float2 hi = floor((origin + radius) / cellSize);
+    
+    minCell = int2 { int(lo.x), int(lo.y) };
+    maxCell = int2 { int(hi.x), int(hi.y) };
+}
+
+/// The totals the kernels that group the bubbles on the GPU compute.
+///
+/// The entries past the capacities of ``GroupingUniforms`` are dropped,
+/// and the CPU grows the buffers before grouping again.
+struct GroupingCounters final
+{
+    uint32_t nbGroups;
+    uint32_t nbGroupedBubbles;
+    uint32_t nbCellEntries;
+    uint32_t nbTileGroupIndices;
+};
+
+/// The parameters of a step of the simulation that moves the bubbles on the GPU.
+///
+/// The accelerations are in SDF space per second squared.
+struct SimulationUniforms final
+{
+    uint32_t nbEdits;
+    
+    /// The duration of the step, and the time since the simulation started, in seconds.
+    float timeStep;
+    float time;
+    
+    /// The size of SDF space, whose edges the bubbles bounce off.
+    float2 contentSize;
+    
+    /// The distance past contact within which two bubbles attract each other.
+    float attractionRange;
+    
+    /// The accelerations per unit of overlap that push two bubbles apart,
+    /// and per unit of gap that pull them together.
+    float repulsionStiffness;
+    float attractionStiffness;
+    
+    /// The acceleration of the slow drift of each bubble.
+    float driftAcceleration;
+    
+    /// The fraction of its velocity a bubble loses each second.
+    float damping;
+    
+    /// The fraction of its velocity a bubble keeps when it bounces off an edge.
+    float restitution;
+};
+
+/// A position the CPU gives a bubble of the simulation, which stops it.
+///
+/// The CPU edits the bubbles it adds or moves, and the ones the touches hold.
+struct SimulationEdit final
+{
+    uint32_t slot;
+    float2 origin;
+};
+
+/// Returns the position in SDF space of the center of an SDF texel.
+///
+/// The SDF stores distances in SDF space at any resolution, so the
+/// anti-aliasing band of the composite stays one background pixel wide.
+inline float2 texelPositionInSDFSpace(uint2 gridId, float2 fieldTexelSize)
+{
+    return (float2 { float(gridId.x), float(gridId.y) } + 0.5f) * fieldTexelSize - 0.5f;
+}
+
+/// Returns the position of a point of SDF space in SDF texels.
+inline float2 positionInSDFTexels(float2 pt, float2 fieldTexelSize)
+{
+    return (pt + 0.5f) / fieldTexelSize - 0.5f;
+}
+
+/// Returns the width of the outside band in SDF space.
+inline float outsideBandDistance(float2 fieldTexelSize)
+{
+    return float(SDFOutsideBandInTexels) * max(fieldTexelSize.x, fieldTexelSize.y);
+}
+
+inline float opUnion( float d1, float d2 )
 {
     return min(d1,d2);
 }
 
-float opSmoothUnion( float d1, float d2, float k )
+inline float opSmoothUnion( float d1, float d2, float k )
 {
     k *= 4.0;
     float h = max(k-abs(d1-d2),0.0f);
     return min(d1, d2) - h*h*0.25f/k;
 }
 
-float computeSDF(SHADER_CONSTANT Bubble* bubble, size_t nbBubbles, float smoothFactor, float2 pt)
+/// Returns the smooth union of two distances stored in `x`, along with its gradient in `y` and `z`.
+///
+/// The derivative of `h*h*0.25f/k` weighs the gradient of the closest input by `1 - m`,
+/// and the gradient of the other one by `m`, where `m = h / (2k)`.
+inline float3 opSmoothUnion( float3 d1, float3 d2, float k )
+{
+    k *= 4.0;
+    const float h = max(k-abs(d1.x-d2.x),0.0f);
+    const float m = h*0.5f/k;
+    
+    const float3 closest = (d1.x < d2.x) ? d1 : d2;
+    const float3 other = (d1.x < d2.x) ? d2 : d1;
+    
+    const float d = closest.x - h*h*0.25f/k;
+    const float2 gradient = float2 { closest.y, closest.z } * (1.f - m) + float2 { other.y, other.z } * m;
+    
+    return float3 { d, gradient.x, gradient.y };
+}
+
+/// Returns how far outside of its bubbles a group's SDF can reach below zero.
+///
+/// Each `opSmoothUnion` lowers the smallest of its inputs by at most `smoothFactor`,
+/// so folding `nbBubbles` bubbles lowers the closest bubble's distance by at most
+/// `(nbBubbles - 1) * smoothFactor`.
+inline float smoothUnionMargin(size_t nbBubbles, float smoothFactor)
+{
+    return (nbBubbles > 1) ? float(nbBubbles - 1) * smoothFactor : 0.f;
+}
+
+/// Returns the smooth factor of a group of several bubbles, from the smallest
+/// distance between the centers of two of its overlapping bubbles.
+inline float groupSmoothFactor(float minDistance)
 {
-    SHADER_CONSTANT Bubble* const end = bubble + nbBubbles;
+    return 3e3f / (1.f + minDistance);
+}
+
+/// Returns the circle, in SDF space, around the bubbles of a group, with its center in `xy` and its radius in `z`.
+inline float3 boundingCircle(SHADER_DEVICE const BubbleGroup& group, SHADER_DEVICE const Bubble* bubbles)
+{
+    SHADER_DEVICE const Bubble* const first = &bubbles[group.firstBubble];
+    SHADER_DEVICE const Bubble* const end = first + group.nbBubbles;
     
-    float d = (bubble++)->computeSDF(pt);
+    float2 lo = first->origin - first->radius;
+    float2 hi = first->origin + first->radius;
+    for (SHADER_DEVICE const Bubble* b = first + 1; b < end; ++b)
+    {
+        lo = min(lo, b->origin - b->radius);
+        hi = max(hi, b->origin + b->radius);
+    }
     
-    while (bubble < end)
+    const float2 center = (lo + hi) * 0.5f;
+    float radius = 0.f;
+    for (SHADER_DEVICE const Bubble* b = first; b < end; ++b)
     {
-        d = opSmoothUnion(d, (bubble++)->computeSDF(pt), smoothFactor);
+        radius = max(radius, length(b->origin - center) + b->radius);
+    }
+    
+    return float3 { center.x, center.y, radius };
+}
+
+/// Returns the circle, in SDF space, outside of which a group's SDF is above `band`,
+/// with its center in `xy` and its radius in `z`.
+///
+/// A group can only reach below zero within its bubbles' bounding circle,
+/// inflated by the margin of the smooth union, and below the band within a band further.
+inline float3 groupCircle(SHADER_DEVICE const BubbleGroup& group, float3 boundingCircle, float band)
+{
+    boundingCircle.z += smoothUnionMargin(group.nbBubbles, group.smoothFactor) + band;
+    return boundingCircle;
+}
+
+/// Returns whether the SDF templates can skip some bubbles of a group, from the radius of its bounding circle.
+///
+/// At any point, the distances of two bubbles within the circle differ by less than
+/// its diameter, which needs to exceed the range of the smooth union, `4 * smoothFactor`,
+/// for `bubbleInfluencesTile` to rule any of them out.
+inline bool groupPrunesBubbles(float boundingRadius, float smoothFactor)
+{
+    return boundingRadius > 2.f * smoothFactor;
+}
+
+/// The positions, in SDF space, of the first and last texels of a tile,
+/// which bound the points the SDF templates evaluate in it.
+struct TileBounds final
+{
+    float2 lo;
+    float2 hi;
+};
+
+/// Returns the bounds of the `SDFTileSize` tile that contains a texel.
+inline TileBounds tileBoundsOfTexel(uint2 gridId, float2 fieldTexelSize)
+{
+    const uint2 firstTexel = (gridId / uint32_t(SDFTileSize)) * uint32_t(SDFTileSize);
+    
+    return TileBounds {
+        texelPositionInSDFSpace(firstTexel, fieldTexelSize),
+        texelPositionInSDFSpace(firstTexel + (uint32_t(SDFTileSize) - 1), fieldTexelSize)
+    };
+}
+
+/// Returns bounds that contain every point, with which the SDF templates don't skip any bubble.
+///
+/// Only the CPU references use them, the shaders assume finite values.
+inline TileBounds unboundedTile()
+{
+    return TileBounds { float2 { -INFINITY, -INFINITY }, float2 { INFINITY, INFINITY } };
+}
+
+/// Returns whether a bubble can change a smooth union whose distances over a tile are at most `maxDistance`.
+///
+/// `opSmoothUnion` is exactly `min` for distances `influenceRange`, `4 * smoothFactor`,
+/// apart, so a bubble whose closest distance to the tile is past `maxDistance` by that
+/// much leaves every texel of the tile unchanged.
+inline bool bubbleInfluencesTile(SHADER_DEVICE const Bubble* bubble, TileBounds bounds, float maxDistance, float influenceRange)
+{
+    // Compare the squared distance from the center to the tile, which needs no square root.
+    const float reach = maxDistance + influenceRange + bubble->radius;
+    const float2 offset = clamp(bubble->origin, bounds.lo, bounds.hi) - bubble->origin;
+    
+    return (reach > 0.f) && (dot(offset, offset) < reach * reach);
+}
+
+/// Returns the largest distance of a bubble over a tile.
+///
+/// `opSmoothUnion` never rises above its inputs, so the smallest farthest
+/// distance of the bubbles a fold took bounds the fold over the tile.
+inline float farthestBubbleDistance(SHADER_DEVICE const Bubble* bubble, TileBounds bounds)
+{
+    const float2 offset = max(abs(bubble->origin - bounds.lo), abs(bubble->origin - bounds.hi));
+    return length(offset) - bubble->radius;
+}
+
+/// Evaluates a single bubble for the SDF templates.
+///
+/// The `float` specialization only computes the distance, and the `float3`
+/// specialization computes the distance along with its gradient.
+template <typename TDistance>
+struct BubbleEvaluator;
+
+template <>
+struct BubbleEvaluator<float> final
+{
+    static float evaluate(SHADER_DEVICE const Bubble* bubble, float2 pt)
+    {
+        return bubble->computeSDF(pt);
+    }
+};
+
+template <>
+struct BubbleEvaluator<float3> final
+{
+    static float3 evaluate(SHADER_DEVICE const Bubble* bubble, float2 pt)
+    {
+        return bubble->computeSDFAndGradient(pt);
+    }
+};
+
+/// Returns the smooth union of bubbles at `pt`, folded from the first one.
+///
+/// With `prunesBubbles`, the fold tracks a bound of its distances over the tile of `pt`,
+/// and skips the bubbles that `bubbleInfluencesTile` rules out, which leaves the result unchanged.
+template <typename TDistance = float, typename TPoint = float2>
+TDistance computeSDF(SHADER_DEVICE const Bubble* bubble,
+                     size_t nbBubbles,
+                     float smoothFactor,
+                     TPoint pt,
+                     TileBounds bounds,
+                     bool prunesBubbles)
+{
+    SHADER_DEVICE const Bubble* const end = bubble + nbBubbles;
+    const float influenceRange = 4.f * smoothFactor;
+    
+    float maxDistance = prunesBubbles ? farthestBubbleDistance(bubble, bounds) : 0.f;
+    TDistance d = BubbleEvaluator<TDistance>::evaluate(bubble++, pt);
+    
+    for (; bubble < end; ++bubble)
+    {
+        if (!prunesBubbles)
+        {
+            d = opSmoothUnion(d, BubbleEvaluator<TDistance>::evaluate(bubble, pt), smoothFactor);
+        }
+        else if (bubbleInfluencesTile(bubble, bounds, maxDistance, influenceRange))
+        {
+            d = opSmoothUnion(d, BubbleEvaluator<TDistance>::evaluate(bubble, pt), smoothFactor);
+            maxDistance = min(maxDistance, farthestBubbleDistance(bubble, bounds));
+        }
     }
     
     return d;
 }
 
-template <int N>
-float computeSDF_N(SHADER_CONSTANT Bubble* bubble, float smoothFactor, float2 pt)
+/// Returns the smooth union of the first `nbBubbles` bubbles, which can't exceed `maxBubbles`.
+///
+/// When `maxBubbles` is a compile-time constant, the loop unrolls, and the threads
+/// of a SIMD group run the same instructions whatever the sizes of their groups.
+/// The bubbles it skips, as `computeSDF` does, only depend on the tile, so the
+/// threads of a tile take the same branches.
+///
+/// `opSmoothUnion` isn't associative, so the function folds from the first bubble like
+/// `computeSDF`, and the specialized pipelines compute the field of the generic one.
+template <typename TDistance = float, typename TPoint = float2>
+TDistance computeSDF_UpTo(SHADER_DEVICE const Bubble* bubble,
+                          size_t nbBubbles,
+                          uint32_t maxBubbles,
+                          float smoothFactor,
+                          TPoint pt,
+                          TileBounds bounds,
+                          bool prunesBubbles)
 {
-    float sdf = bubble->computeSDF(pt);
+    const float influenceRange = 4.f * smoothFactor;
+    
+    float maxDistance = prunesBubbles ? farthestBubbleDistance(bubble, bounds) : 0.f;
+    TDistance d = BubbleEvaluator<TDistance>::evaluate(bubble, pt);
     
-    if constexpr (N > 1)
+    for (uint32_t i = 1; i < maxBubbles; ++i)
     {
-        const float sdf2 = computeSDF_N<N - 1>(bubble + 1, smoothFactor, pt);
-        sdf = opSmoothUnion(sdf, sdf2, smoothFactor);
+        if (i >= nbBubbles)
+        {
+            continue;
+        }
+        
+        if (!prunesBubbles)
+        {
+            d = opSmoothUnion(d, BubbleEvaluator<TDistance>::evaluate(bubble + i, pt), smoothFactor);
+        }
+        else if (bubbleInfluencesTile(bubble + i, bounds, maxDistance, influenceRange))
+        {
+            d = opSmoothUnion(d, BubbleEvaluator<TDistance>::evaluate(bubble + i, pt), smoothFactor);
+            maxDistance = min(maxDistance, farthestBubbleDistance(bubble + i, bounds));
+        }
     }
     
-    return sdf;
+    return d;
 }
 
-template <typename TTextureAccessor>
-bool evaluateBubbleGroup(SHADER_CONSTANT BubbleGroup& group,
-                    SHADER_CONSTANT Bubble* bubbles,
-                    TTextureAccessor accessor)
+/// Returns the smooth union of `N` bubbles, in the order of `computeSDF`, with the loop unrolled.
+template <int N, typename TDistance = float, typename TPoint = float2>
+TDistance computeSDF_N(SHADER_DEVICE const Bubble* bubble, float smoothFactor, TPoint pt, TileBounds bounds, bool prunesBubbles)
+{
+    return computeSDF_UpTo<TDistance>(bubble, N, N, smoothFactor, pt, bounds, prunesBubbles);
+}
+
+/// Returns the number of bubbles of a group that the SDF templates evaluate at each texel of a tile.
+///
+/// The function walks the bubbles as `computeSDF` folds them, and counts the ones that
+/// `bubbleInfluencesTile` keeps, which only depend on the tile.
+inline uint32_t countEvaluatedBubbles(SHADER_DEVICE const BubbleGroup& group, SHADER_DEVICE const Bubble* bubbles, TileBounds bounds)
+{
+    if (!group.prunesBubbles)
+    {
+        return uint32_t(group.nbBubbles);
+    }
+    
+    const float influenceRange = 4.f * group.smoothFactor;
+    float maxDistance = farthestBubbleDistance(bubbles, bounds);
+    
+    uint32_t nbEvaluated = 1;
+    for (size_t i = 1; i < group.nbBubbles; ++i)
+    {
+        if (bubbleInfluencesTile(&bubbles[i], bounds, maxDistance, influenceRange))
+        {
+            ++nbEvaluated;
+            maxDistance = min(maxDistance, farthestBubbleDistance(&bubbles[i], bounds));
+        }
+    }
+    
+    return nbEvaluated;
+}
+
+/// Returns the smooth union of the bubbles of a group at `pt`.
+///
+/// `pt` is a `float2`, or several points that `TDistance` evaluates at once.
+///
+/// - Parameters:
+///   - bounds: The bounds of the tile of `pt`, with which the evaluation skips the
+///     bubbles that can't change the union in the tile.
+///   - maxBubblesPerGroup: The size of the largest group of the scene,
+///     or `0` to pick the evaluation from the size of each group.
+template <typename TDistance, typename TPoint = float2>
+TDistance computeGroupSDF(SHADER_DEVICE const BubbleGroup& group,
+                          SHADER_DEVICE const Bubble* bubbles,
+                          TPoint pt,
+                          TileBounds bounds,
+                          uint32_t maxBubblesPerGroup = 0)
 {
-    const auto pt = accessor.position();
+    if (maxBubblesPerGroup != 0)
+    {
+        return computeSDF_UpTo<TDistance>(bubbles, group.nbBubbles, maxBubblesPerGroup, group.smoothFactor, pt, bounds, group.prunesBubbles);
+    }
     
-    float d;
     switch(group.nbBubbles)
     {
-        case 1: d = computeSDF_N<1>(bubbles, group.smoothFactor, pt); break;
-        case 2: d = computeSDF_N<2>(bubbles, group.smoothFactor, pt); break;
-        case 3: d = computeSDF_N<3>(bubbles, group.smoothFactor, pt); break;
-        case 4: d = computeSDF_N<4>(bubbles, group.smoothFactor, pt); break;
-        case 5: d = computeSDF_N<5>(bubbles, group.smoothFactor, pt); break;
-        case 6: d = computeSDF_N<6>(bubbles, group.smoothFactor, pt); break;
-        case 7: d = computeSDF_N<7>(bubbles, group.smoothFactor, pt); break;
-        case 8: d = computeSDF_N<8>(bubbles, group.smoothFactor, pt); break;
+        case 1: return computeSDF_N<1, TDistance>(bubbles, group.smoothFactor, pt, bounds, group.prunesBubbles);
+        case 2: return computeSDF_N<2, TDistance>(bubbles, group.smoothFactor, pt, bounds, group.prunesBubbles);
+        case 3: return computeSDF_N<3, TDistance>(bubbles, group.smoothFactor, pt, bounds, group.prunesBubbles);
+        case 4: return computeSDF_N<4, TDistance>(bubbles, group.smoothFactor, pt, bounds, group.prunesBubbles);
+        case 5: return computeSDF_N<5, TDistance>(bubbles, group.smoothFactor, pt, bounds, group.prunesBubbles);
+        case 6: return computeSDF_N<6, TDistance>(bubbles, group.smoothFactor, pt, bounds, group.prunesBubbles);
+        case 7: return computeSDF_N<7, TDistance>(bubbles, group.smoothFactor, pt, bounds, group.prunesBubbles);
+        case 8: return computeSDF_N<8, TDistance>(bubbles, group.smoothFactor, pt, bounds, group.prunesBubbles);
             
         default:
         {
-            d = computeSDF(&bubbles[0], group.nbBubbles, group.smoothFactor, pt);
-            break;
+            return computeSDF<TDistance>(&bubbles[0], group.nbBubbles, group.smoothFactor, pt, bounds, group.prunesBubbles);
         }
     }
+}
+
+/// Defines the distance types the SDF templates evaluate at the points an accessor returns.
+///
+/// The specialization for `float2` evaluates a single texel. The CPU backend
+/// specializes it for several texels at once.
+template <typename TPoint>
+struct SDFPointTraits;
+
+template <>
+struct SDFPointTraits<float2> final
+{
+    using Distance = float;
+    using DistanceAndGradient = float3;
+    
+    static float outside(float band)
+    {
+        return band;
+    }
+    
+    static float3 outsideWithGradient(float band)
+    {
+        return float3 { band, 0.f, 0.f };
+    }
+};
+
+/// Folds the distance of a group into the distance of a texel.
+///
+/// A texel outside of the groups keeps the distance to the closest one, and a texel
+/// inside takes the distance of the first group that contains it.
+///
+/// - Returns: Whether the texel is inside, which ends the walk of its groups.
+inline bool foldGroupDistance(SHADER_THREAD float& distance, float d)
+{
+    distance = min(distance, d);
+    return distance <= 0.f;
+}
+
+inline bool foldGroupDistance(SHADER_THREAD float3& distance, float3 d)
+{
+    if (d.x < distance.x)
+    {
+        distance = d;
+    }
     
-    if (d <= 0.f)
+    return distance.x <= 0.f;
+}
+
+/// Normalizes the gradient of a distance, and packs them as `drawSDFGradient` does.
+inline float4 packDistanceAndGradient(float3 d)
+{
+    const float2 gradient { d.y, d.z };
+    const float l = length(gradient);
+    const float2 direction = (l > 0.f) ? gradient / l : float2 { 0.f, 0.f };
+    
+    return float4 { d.x, direction.x, direction.y, 0.f };
+}
+
+/// Packs the coordinates of a tile into 32 bits, 16 bits each.
+inline uint32_t packTileCoordinates(uint2 tile)
+{
+    return tile.x | (tile.y << 16);
+}
+
+inline uint2 unpackTileCoordinates(uint32_t packedTile)
+{
+    return uint2 { packedTile & 0xFFFF, packedTile >> 16 };
+}
+
+/// Returns the bits of the half-precision value nearest to `value`.
+inline uint32_t halfBits(float value)
+{
+#if defined(__METAL_VERSION__)
+    return as_type<ushort>(half(value));
+#else
+    return __builtin_bit_cast(uint16_t, _Float16(value));
+#endif
+}
+
+/// Returns the half-precision value of the low 16 bits of `bits`.
+inline float floatOfHalfBits(uint32_t bits)
+{
+#if defined(__METAL_VERSION__)
+    return float(as_type<half>(ushort(bits)));
+#else
+    return float(__builtin_bit_cast(_Float16, uint16_t(bits)));
+#endif
+}
+
+/// The steps of the 8-bit components of the gradient of a packed SDF texel.
+///
+/// A power of two keeps the products exact, so the CPU and the GPU round them alike.
+constexpr SHADER_CONSTANT float kPackedGradientScale = 128.f;
+
+/// Packs a component of a unit gradient into 8 signed bits.
+inline uint32_t packGradientComponent(float v)
+{
+    const float q = clamp(floor(v * kPackedGradientScale + 0.5f), -127.f, 127.f);
+    return uint32_t(int32_t(q)) & 0xFF;
+}
+
+/// Packs a distance and its normalized gradient, as `packDistanceAndGradient` returns them,
+/// into the 32 bits of a texel of `SDFTexelFormatPacked`.
+///
+/// The low 16 bits store the half-precision distance, and the high ones the 8-bit
+/// components of the gradient.
+inline uint32_t packSDFTexel(float4 distanceAndGradient)
+{
+    return halfBits(distanceAndGradient.x)
+         | (packGradientComponent(distanceAndGradient.y) << 16)
+         | (packGradientComponent(distanceAndGradient.z) << 24);
+}
+
+/// Returns the distance and the gradient of a texel `packSDFTexel` packed.
+inline float3 unpackSDFTexel(uint32_t texel)
+{
+    // Shift each 8-bit component to the top to extend its sign.
+    const float gx = float(int32_t(texel << 8) >> 24);
+    const float gy = float(int32_t(texel) >> 24);
+    
+    return float3 { floatOfHalfBits(texel & 0xFFFF), gx / kPackedGradientScale, gy / kPackedGradientScale };
+}
+
+/// An inclusive range of `SDFTileSize` tiles.
+struct TileRange final
+{
+    uint2 min;
+    uint2 max;
+};
+
+/// Returns a circle of SDF space, center in `xy` and radius in `z`, in SDF texels.
+inline float3 circleInSDFTexels(float3 circle, float2 fieldTexelSize)
+{
+    const float2 center = positionInSDFTexels(float2 { circle.x, circle.y }, fieldTexelSize);
+    return float3 { center.x, center.y, circle.z / min(fieldTexelSize.x, fieldTexelSize.y) };
+}
+
+/// Finds the tiles of a grid the bounding box of a circle of SDF texels overlaps.
+///
+/// - Returns: `false` when the circle is entirely outside of the grid.
+inline bool tileRangeOfCircle(float3 circleInTexels, uint2 nbTiles, SHADER_THREAD TileRange& range)
+{
+    if (nbTiles.x == 0 || nbTiles.y == 0)
+    {
+        return false;
+    }
+    
+    const float tileSize = float(SDFTileSize);
+    const float2 center { circleInTexels.x, circleInTexels.y };
+    const float2 maxTile { float(nbTiles.x - 1), float(nbTiles.y - 1) };
+    
+    const float2 minTile = floor((center - circleInTexels.z) / tileSize);
+    const float2 maxTileOfCircle = floor((center + circleInTexels.z) / tileSize);
+    if (any(maxTileOfCircle < 0.f) || any(minTile > maxTile))
     {
-        // inside
-        accessor.write(d);
-        return true;
+        return false;
     }
     
-    return false;
+    const float2 clampedMin = clamp(minTile, float2 { 0.f, 0.f }, maxTile);
+    const float2 clampedMax = clamp(maxTileOfCircle, float2 { 0.f, 0.f }, maxTile);
+    
+    range.min = uint2 { uint32_t(clampedMin.x), uint32_t(clampedMin.y) };
+    range.max = uint2 { uint32_t(clampedMax.x), uint32_t(clampedMax.y) };
+    return true;
+}
+
+/// Returns whether a circle of SDF texels overlaps the texels of a tile.
+inline bool circleOverlapsTile(float3 circleInTexels, uint2 tile)
+{
+    const float tileSize = float(SDFTileSize);
+    const float2 center { circleInTexels.x, circleInTexels.y };
+    
+    // closest texel of the tile to the center of the circle
+    const float2 tileMin { float(tile.x) * tileSize, float(tile.y) * tileSize };
+    const float2 closest = clamp(center, tileMin, tileMin + (tileSize - 1.f));
+    
+    return length(closest - center) <= circleInTexels.z;
+}
+
+/// Returns the bin of the `SDFTileSize` tile that contains a texel.
+inline TileBin tileBinForTexel(uint2 gridId,
+                        SHADER_CONSTANT Uniforms* uniforms,
+                        SHADER_DEVICE const TileBin* tileBins)
+{
+    const uint32_t tileIndex = (gridId.y / SDFTileSize) * uniforms->nbTilesPerRow + (gridId.x / SDFTileSize);
+    return tileBins[tileIndex];
 }
 
 template <typename TTextureAccessor>
 void
-computeAndDrawSDF(TTextureAccessor accessor, SHADER_CONSTANT Uniforms* uniforms)
+computeAndDrawSDF(TTextureAccessor accessor,
+                  SHADER_CONSTANT Uniforms* uniforms,
+                  SHADER_DEVICE const BubbleGroup* groups,
+                  SHADER_DEVICE const Bubble* bubbles,
+                  SHADER_DEVICE const TileBin* tileBins,
+                  SHADER_DEVICE const uint32_t* tileGroupIndices,
+                  uint32_t maxBubblesPerGroup = 0)
 {
 
     // Check that that this part of the grid is within the texture's bounds.
@@ -191,39 +937,80 @@ computeAndDrawSDF(TTextureAccessor accessor, SHADER_CONSTANT Uniforms* uniforms)
         return;
     }
 
-    SHADER_CONSTANT Bubble* bubbles = &uniforms->bubbles[0];
+    // Only walk the groups that overlap the tile of this texel.
+    // The texels of an accessor are all in the same tile.
+    const TileBin bin = tileBinForTexel(accessor.gridId(), uniforms, tileBins);
+    const TileBounds bounds = tileBoundsOfTexel(accessor.gridId(), uniforms->fieldTexelSize);
+    auto pt = accessor.position();
+    
+    using Traits = SDFPointTraits<decltype(pt)>;
     
-    accessor.write(0.f);
-    for (size_t i=0; i < uniforms->nbBubbleGroups; ++i)
+    // Outside, keep the distance to the closest group, up to the band.
+    auto distance = Traits::outside(outsideBandDistance(uniforms->fieldTexelSize));
+    for (uint32_t i=0; i < bin.nbGroups; ++i)
     {
-        SHADER_CONSTANT auto& group = uniforms->groups[i];
-        if (evaluateBubbleGroup(group, bubbles, accessor))
+        SHADER_DEVICE const auto& group = groups[tileGroupIndices[bin.firstGroupIndex + i]];
+        const auto d = computeGroupSDF<typename Traits::Distance>(group, &bubbles[group.firstBubble], pt, bounds, maxBubblesPerGroup);
+        
+        if (foldGroupDistance(distance, d))
         {
             break;
         }
-        
-        bubbles += group.nbBubbles;
     }
+    
+    accessor.write(distance);
 }
 
-template <typename TAccessorIn, typename TAccessorOut>
-void drawSDFGradient(TAccessorIn sdfAccessorIn, TAccessorOut gradientAccessorOut)
+/// Computes the distance and its analytic gradient in a single pass,
+/// and writes them packed as `drawSDFGradient` does.
+template <typename TTextureAccessor>
+void
+computeAndDrawSDFAndGradient(TTextureAccessor accessor,
+                             SHADER_CONSTANT Uniforms* uniforms,
+                             SHADER_DEVICE const BubbleGroup* groups,
+                             SHADER_DEVICE const Bubble* bubbles,
+                             SHADER_DEVICE const TileBin* tileBins,
+                             SHADER_DEVICE const uint32_t* tileGroupIndices,
+                             uint32_t maxBubblesPerGroup = 0)
 {
-    const auto gridId = gradientAccessorOut.gridId();
+    if (!accessor.isValid())
+    {
+        return;
+    }
     
-    const auto left = sdfAccessorIn.read({gridId.x - 1, gridId.y});
-    const auto right = sdfAccessorIn.read({gridId.x + 1, gridId.y});
-    const auto dX = (right - left) / 2.f;
+    const TileBin bin = tileBinForTexel(accessor.gridId(), uniforms, tileBins);
+    const TileBounds bounds = tileBoundsOfTexel(accessor.gridId(), uniforms->fieldTexelSize);
+    auto pt = accessor.position();
     
-    const auto top = sdfAccessorIn.read({gridId.x, gridId.y - 1});
-    const auto bottom = sdfAccessorIn.read({gridId.x, gridId.y + 1});
-    const auto dY = (bottom - top) / 2.f;
+    using Traits = SDFPointTraits<decltype(pt)>;
     
-    const auto gradient = normalize(float2 { dX, dY });
+    // Outside, keep the distance to the closest group, up to the band.
+    auto closest = Traits::outsideWithGradient(outsideBandDistance(uniforms->fieldTexelSize));
+    for (uint32_t i=0; i < bin.nbGroups; ++i)
+    {
+        SHADER_DEVICE const auto& group = groups[tileGroupIndices[bin.firstGroupIndex + i]];
+        const auto d = computeGroupSDF<typename Traits::DistanceAndGradient>(group, &bubbles[group.firstBubble], pt, bounds, maxBubblesPerGroup);
+        
+        if (foldGroupDistance(closest, d))
+        {
+            break;
+        }
+    }
     
-    const auto distance = sdfAccessorIn.read(gridId);
-    const float4 distanceAndGradient { distance, gradient.x, gradient.y, 0.f };
+    accessor.writeFloat4(packDistanceAndGradient(closest));
+}
+
+/// Returns the distance of an SDF texel and the direction of its gradient, from the central differences of its neighbors.
+inline float4 distanceAndGradientOfNeighbors(float distance, float left, float right, float top, float bottom)
+{
+    const float dX = (right - left) / 2.f;
+    const float dY = (bottom - top) / 2.f;
     
-    gradientAccessorOut.writeFloat4(distanceAndGradient);
+    // The band past the outside one is flat.
+    const float2 delta { dX, dY };
+    const float l = length(delta);
+    const float2 gradient = (l > 0.f) ? delta / l : float2 { 0.f, 0.f };
     
+    return float4 { distance, gradient.x, gradient.y, 0.f };
 }
+
@@ -59,15 +59,173 @@ float computeSDFStrength(float sdf, float k, float m)
     return m * exp(sdf * k);
 }
 
+/// Returns the SDF texel under a texture coordinate.
+uint2 texelOfTextureCoordinate(float2 textureCoordinate, uint2 size)
+{
+    return min(uint2(textureCoordinate * float2(size)), size - 1);
+}
+
+/// Returns whether a group can reach below the outside band in the SDF tile under a texture coordinate.
+///
+/// The texels of the other tiles, and the ones the sampler blends in at their
+/// borders, store positive distances, so the fragment is plain background.
+bool isInNarrowBand(float2 textureCoordinate,
+                    uint2 size,
+                    constant Uniforms& uniforms,
+                    device const TileBin* tileBins)
+{
+    const uint2 gridId = texelOfTextureCoordinate(textureCoordinate, size);
+    
+    return tileBinForTexel(gridId, &uniforms, tileBins).nbGroups > 0;
+}
+
+/// Whether the fragment shaders read the pyramid of the SDF.
+constant bool usesSDFPyramid [[ function_constant(FunctionConstantIndexUsesSDFPyramid) ]];
+
+/// A pyramid of the smallest and largest distances of the blocks of the SDF, in `x` and `y`.
+///
+/// A texel of level `l` bounds the distances of a block of `2 << l` x `2 << l` SDF
+/// texels, so a query that covers a wide radius costs a single fetch at a coarse level.
+struct SDFPyramid
+{
+    texture2d<half> texture;
+    
+    /// The scale from the texture coordinates of the SDF to the ones of the pyramid,
+    /// whose base covers whole tiles.
+    float2 coordinateScale;
+    
+    SDFPyramid(texture2d<half> texture, uint2 sdfSize)
+    : texture(texture),
+    coordinateScale(float2(sdfSize) / float2(2 * texture.get_width(), 2 * texture.get_height()))
+    {}
+    
+    uint levelCount() const
+    {
+        return texture.get_num_mip_levels();
+    }
+    
+    /// Returns the bounds of the distances around a texture coordinate of the SDF at a level, which can be fractional.
+    ///
+    /// The sampler blends the bounds of the neighboring blocks, and of the two closest levels.
+    half2 sample(float2 textureCoordinate, float lod) const
+    {
+        constexpr sampler pyramidSampler (mag_filter::linear,
+                                          min_filter::linear,
+                                          mip_filter::linear);
+        
+        return texture.sample(pyramidSampler, textureCoordinate * coordinateScale, level(lod)).xy;
+    }
+    
+    /// Returns the bounds of the distances of the block under a texture coordinate of the SDF at a level.
+    half2 read(float2 textureCoordinate, uint lod) const
+    {
+        const uint2 levelSize { texture.get_width(lod), texture.get_height(lod) };
+        return texture.read(texelOfTextureCoordinate(textureCoordinate * coordinateScale, levelSize), lod).xy;
+    }
+    
+    /// Returns whether the texels of a tile, and the ones the sampler blends in at its borders,
+    /// all store distances past the outside band.
+    bool isPastOutsideBand(uint2 tile, float outsideBand) const
+    {
+        // The texels a bilinear fetch blends in are at most the diagonal of a texel closer to a bubble.
+        return float(texture.read(tile, SDFPyramidTileLevel).x) > 0.75f * outsideBand;
+    }
+};
+
+/// Returns whether the pyramid of the SDF finds no bubble close to the tile under a texture coordinate.
+///
+/// The bins of a tile list the groups whose bounds reach it, the pyramid
+/// the distances the SDF pass found.
+bool isPastOutsideBand(float2 textureCoordinate,
+                       uint2 size,
+                       constant Uniforms& uniforms,
+                       texture2d<half> sdfPyramidTexture)
+{
+    const SDFPyramid pyramid { sdfPyramidTexture, size };
+    const uint2 tile = texelOfTextureCoordinate(textureCoordinate, size) / uint(SDFTileSize);
+    
+    return pyramid.isPastOutsideBand(tile, outsideBandDistance(uniforms.fieldTexelSize));
+}
+
+/// A field that samples the distances and gradients of an `SDFTexelFormatRGBA16Float` texture.
+struct FilteredSDFGradient
+{
+    texture2d<half> texture;
+    
+    uint2 size() const
+    {
+        return uint2 { texture.get_width(), texture.get_height() };
+    }
+    
+    half3 sample(sampler textureSampler, float2 textureCoordinate) const
+    {
+        return texture.sample(textureSampler, textureCoordinate).xyz;
+    }
+    
+    float distance(int2 gridId) const
+    {
+        const int2 maxGridId = int2(size()) - 1;
+        return texture.read(uint2(clamp(gridId, int2(0), maxGridId))).x;
+    }
+};
+
+/// A field that samples the distances and gradients of an `SDFTexelFormatPacked` texture.
+///
+/// The sampler can't filter the packed texels, so the field decodes the 4 texels
+/// around the texture coordinate before blending them as the sampler would.
+struct PackedSDFGradient
+{
+    texture2d<uint> texture;
+    
+    uint2 size() const
+    {
+        return uint2 { texture.get_width(), texture.get_height() };
+    }
+    
+    float3 read(int2 gridId) const
+    {
+        const int2 maxGridId = int2(size()) - 1;
+        return unpackSDFTexel(texture.read(uint2(clamp(gridId, int2(0), maxGridId))).r);
+    }
+    
+    half3 sample(sampler, float2 textureCoordinate) const
+    {
+        const float2 position = textureCoordinate * float2(size()) - 0.5f;
+        const float2 texel = floor(position);
+        const float2 weights = position - texel;
+        const int2 gridId = int2(texel);
+        
+        const float3 top = mix(read(gridId), read(gridId + int2(1, 0)), weights.x);
+        const float3 bottom = mix(read(gridId + int2(0, 1)), read(gridId + int2(1, 1)), weights.x);
+        
+        return half3(mix(top, bottom, weights.y));
+    }
+    
+    float distance(int2 gridId) const
+    {
+        return read(gridId).x;
+    }
+};
+
+template <typename TSDFGradient>
 half3 computeColor(float2 textureCoordinate,
                     texture2d<half> colorTexture,
-                    texture2d<half> sdfGradientTexture,
-                    constant Uniforms& uniforms)
+                    TSDFGradient sdfGradient,
+                    constant Uniforms& uniforms,
+                    bool inNarrowBand)
 {
+    // The mipmaps of the background keep the refraction lookups, which jump across it, in cache.
     constexpr sampler textureSampler (mag_filter::linear,
-                                      min_filter::linear);
+                                      min_filter::linear,
+                                      mip_filter::linear);
 
-    const half4 distanceAndGradient = sdfGradientTexture.sample (textureSampler, textureCoordinate);
+    // Skip the SDF fetch out of the narrow band.
+    if (!inNarrowBand)
+    {
+        return colorTexture.sample (textureSampler, textureCoordinate).xyz;
+    }
+    
+    const half3 distanceAndGradient = sdfGradient.sample (textureSampler, textureCoordinate);
     
     const float sdf = distanceAndGradient.x;
     if (sdf >= 0.f)
@@ -127,9 +285,32 @@ half3 computeColor(float2 textureCoordinate,
 fragment float4 samplingShader(RasterizerData  in           [[stage_in]],
                                texture2d<half> colorTexture [[ texture(RenderTextureBindingIndex) ]],
                                texture2d<half> sdfGradientTexture [[ texture(SDFGradientTextureBindingIndex) ]],
-                               constant Uniforms& uniforms  [[ buffer(BufferBindingIndexForUniforms) ]])
+                               texture2d<half> sdfPyramidTexture [[ texture(SDFPyramidTextureBindingIndex), function_constant(usesSDFPyramid) ]],
+                               constant Uniforms& uniforms  [[ buffer(BufferBindingIndexForUniforms) ]],
+                               device const TileBin* tileBins [[ buffer(BufferBindingIndexForTileBins) ]])
+{
+    const FilteredSDFGradient sdfGradient { sdfGradientTexture };
+    
+    const bool inNarrowBand = isInNarrowBand(in.textureCoordinate, sdfGradient.size(), uniforms, tileBins) &&
+        !(usesSDFPyramid && isPastOutsideBand(in.textureCoordinate, sdfGradient.size(), uniforms, sdfPyramidTexture));
+    
+    const auto c = computeColor(in.textureCoordinate, colorTexture, sdfGradient, uniforms, inNarrowBand);
+    return float4 { c.r, c.g, c.b, 1.f };
+}
+
+fragment float4 samplingPackedShader(RasterizerData  in           [[stage_in]],
+                                     texture2d<half> colorTexture [[ texture(RenderTextureBindingIndex) ]],
+                                     texture2d<uint> sdfGradientTexture [[ texture(SDFGradientTextureBindingIndex) ]],
+                                     texture2d<half> sdfPyramidTexture [[ texture(SDFPyramidTextureBindingIndex), function_constant(usesSDFPyramid) ]],
+                                     constant Uniforms& uniforms  [[ buffer(BufferBindingIndexForUniforms) ]],
+                                     device const TileBin* tileBins [[ buffer(BufferBindingIndexForTileBins) ]])
 {
-    const auto c = computeColor(in.textureCoordinate, colorTexture, sdfGradientTexture, uniforms);
+    const PackedSDFGradient sdfGradient { sdfGradientTexture };
+    
+    const bool inNarrowBand = isInNarrowBand(in.textureCoordinate, sdfGradient.size(), uniforms, tileBins) &&
+        !(usesSDFPyramid && isPastOutsideBand(in.textureCoordinate, sdfGradient.size(), uniforms, sdfPyramidTexture));
+    
+    const auto c = computeColor(in.textureCoordinate, colorTexture, sdfGradient, uniforms, inNarrowBand);
     return float4 { c.r, c.g, c.b, 1.f };
 }
 
@@ -139,8 +320,8 @@ class MetalTextureAccessor final
 public:
     using TTexture = texture2d<TPixel, TAccess>;
     
-    MetalTextureAccessor(TTexture texture, uint2 gridId)
-    : _texture(texture), _gridId(gridId)
+    MetalTextureAccessor(TTexture texture, uint2 gridId, float2 texelSize = float2 { 1.f, 1.f })
+    : _texture(texture), _gridId(gridId), _texelSize(texelSize)
     {}
     
     TPixel read(uint2 pos)
@@ -165,7 +346,43 @@ public:
     
     float2 position() const
     {
-        return { float(_gridId.x), float(_gridId.y) };
+        return texelPositionInSDFSpace(_gridId, _texelSize);
+    }
+    
+    uint2 gridId() const
+    {
+        return _gridId;
+    }
+    
+private:
+    TTexture _texture;
+    uint2 _gridId;
+    float2 _texelSize;
+};
+
+/// An accessor that writes the distances and gradients of an `SDFTexelFormatPacked` texture.
+class MetalPackedTextureAccessor final
+{
+public:
+    using TTexture = texture2d<uint, access::write>;
+    
+    MetalPackedTextureAccessor(TTexture texture, uint2 gridId, float2 texelSize = float2 { 1.f, 1.f })
+    : _texture(texture), _gridId(gridId), _texelSize(texelSize)
+    {}
+    
+    void writeFloat4(float4 v) const
+    {
+        _texture.write(uint4(packSDFTexel(v)), _gridId);
+    }
+    
+    bool isValid() const
+    {
+        return (_gridId.x < _texture.get_width()) && (_gridId.y < _texture.get_height());
+    }
+    
+    float2 position() const
+    {
+        return texelPositionInSDFSpace(_gridId, _texelSize);
     }
     
     uint2 gridId() const
@@ -176,25 +393,1065 @@ public:
 private:
     TTexture _texture;
     uint2 _gridId;
+    float2 _texelSize;
 };
 
+/// The largest number of bubbles of a group, in the pipelines that specialize the SDF kernels for it.
+constant uint maxBubblesPerGroupConstant [[ function_constant(FunctionConstantIndexMaxBubblesPerGroup) ]];
+
+/// The bound the SDF kernels pass to `computeGroupSDF`, which is `0` in the generic pipelines.
+constant uint maxBubblesPerGroup = is_function_constant_defined(maxBubblesPerGroupConstant) ? maxBubblesPerGroupConstant : 0;
+
+/// Returns the texel of a thread in a dispatch of one threadgroup per tile of a tile list.
+uint2 texelInDirtyTile(device const uint32_t* dirtyTiles, uint threadgroupIndex, uint2 threadInTile)
+{
+    return unpackTileCoordinates(dirtyTiles[threadgroupIndex]) * uint(SDFTileSize) + threadInTile;
+}
+
+/// The number of lanes of the SIMD groups of Apple GPUs.
+constant uint kSIMDGroupSize = 32;
+
+/// The largest group that `computeGroupSDF` unrolls, past which the generic SDF kernels
+/// evaluate a group with the whole SIMD group.
+constant uint kMaxUnrolledGroupSize = 8;
+
+/// Returns the distance of a distance, or of a distance and gradient.
+inline float distanceOf(float d) { return d; }
+inline float distanceOf(float3 d) { return d.x; }
+
+/// Evaluates a circle for the SDF templates, like ``BubbleEvaluator`` does for a bubble in memory.
+template <typename TDistance>
+TDistance evaluateCircle(float2 pt, float2 origin, float radius);
+
+template <>
+float evaluateCircle<float>(float2 pt, float2 origin, float radius)
+{
+    return circleSDF(pt, origin, radius);
+}
+
+template <>
+float3 evaluateCircle<float3>(float2 pt, float2 origin, float radius)
+{
+    return circleSDFAndGradient(pt, origin, radius);
+}
+
+/// Returns the smooth union of the bubbles of a group at the texels of a SIMD group, which all evaluate that group.
+///
+/// The lanes load a chunk of `kSIMDGroupSize` bubbles, one each, and broadcast them
+/// to the other lanes instead of each thread loading every bubble. In the groups that
+/// prune their bubbles, the chunk skips the ones that stay farther than the influence
+/// range of the smooth union, `4 * smoothFactor`, past the distance of every lane over
+/// the rectangle of their texels. `opSmoothUnion` returns the distance it folds into
+/// for them, so the result is the one of `computeSDF`.
+///
+/// - Parameter isActive: Whether the lane needs the distance. Every lane runs the
+///   function, so that the broadcasts read the bubbles of all of them.
+template <typename TDistance>
+TDistance computeGroupSDFInSIMDGroup(device const BubbleGroup& group,
+                                     device const Bubble* bubbles,
+                                     float2 pt,
+                                     bool isActive,
+                                     ushort lane)
+{
+    const float smoothFactor = group.smoothFactor;
+    const float influenceRange = 4.f * smoothFactor;
+    
+    const float2 lo { simd_min(pt.x), simd_min(pt.y) };
+    const float2 hi { simd_max(pt.x), simd_max(pt.y) };
+    
+    // Fold in the order of `computeSDF`, from the first bubble.
+    TDistance d = evaluateCircle<TDistance>(pt, bubbles[0].origin, bubbles[0].radius);
+    
+    for (uint first = 1; first < group.nbBubbles; first += kSIMDGroupSize)
+    {
+        const uint index = first + lane;
+        const bool loads = index < group.nbBubbles;
+        const float2 origin = loads ? bubbles[index].origin : float2(0.f);
+        const float radius = loads ? bubbles[index].radius : 0.f;
+        
+        // The distances of the lanes only decrease within the chunk.
+        const float closestDistance = length(clamp(origin, lo, hi) - origin) - radius;
+        const float threshold = simd_max(isActive ? distanceOf(d) : -FLT_MAX) + influenceRange;
+        
+        const bool influences = !group.prunesBubbles || closestDistance < threshold;
+        
+        uint chunk = uint(static_cast<simd_vote::vote_t>(simd_ballot(loads && influences)));
+        while (chunk != 0)
+        {
+            const ushort source = ushort(ctz(chunk));
+            chunk &= chunk - 1;
+            
+            const TDistance bubbleDistance = evaluateCircle<TDistance>(pt,
+                                                                       simd_broadcast(origin, source),
+                                                                       simd_broadcast(radius, source));
+            d = opSmoothUnion(d, bubbleDistance, smoothFactor);
+        }
+    }
+    
+    return d;
+}
+
+/// Returns the distance of a texel as `computeAndDrawSDF` finds it, with the groups
+/// past `kMaxUnrolledGroupSize` bubbles evaluated by the whole SIMD group.
+///
+/// The threads of a SIMD group, which are in the same tile, walk its bin together
+/// until they're all inside a group, and the ones past the edges of the texture follow them.
+template <typename TDistance, typename TTextureAccessor>
+TDistance computeSDFInSIMDGroup(TTextureAccessor accessor,
+                                TDistance distance,
+                                constant Uniforms* uniforms,
+                                device const BubbleGroup* groups,
+                                device const Bubble* bubbles,
+                                device const TileBin* tileBins,
+                                device const uint32_t* tileGroupIndices,
+                                ushort lane)
+{
+    const TileBin bin = tileBinForTexel(accessor.gridId(), uniforms, tileBins);
+    const TileBounds bounds = tileBoundsOfTexel(accessor.gridId(), uniforms->fieldTexelSize);
+    const float2 pt = accessor.position();
+    
+    bool isActive = accessor.isValid();
+    for (uint32_t i = 0; i < bin.nbGroups && simd_any(isActive); ++i)
+    {
+        device const auto& group = groups[tileGroupIndices[bin.firstGroupIndex + i]];
+        device const Bubble* groupBubbles = &bubbles[group.firstBubble];
+        
+        if (group.nbBubbles > kMaxUnrolledGroupSize)
+        {
+            const TDistance d = computeGroupSDFInSIMDGroup<TDistance>(group, groupBubbles, pt, isActive, lane);
+            isActive = isActive && !foldGroupDistance(distance, d);
+        }
+        else if (isActive)
+        {
+            isActive = !foldGroupDistance(distance, computeGroupSDF<TDistance>(group, groupBubbles, pt, bounds));
+        }
+    }
+    
+    return distance;
+}
+
 kernel void
 computeAndDrawSDF(texture2d<half, access::write> texture [[texture(ComputeTextureBindingIndexForSDF)]],
-                uint2 gridId     [[thread_position_in_grid]],
-               constant Uniforms* uniforms  [[ buffer(BufferBindingIndexForUniforms) ]])
+                uint threadgroupIndex [[threadgroup_position_in_grid]],
+                uint2 threadInTile [[thread_position_in_threadgroup]],
+                ushort lane [[thread_index_in_simdgroup]],
+               constant Uniforms* uniforms  [[ buffer(BufferBindingIndexForUniforms) ]],
+               device const BubbleGroup* groups [[ buffer(BufferBindingIndexForBubbleGroups) ]],
+               device const Bubble* bubbles [[ buffer(BufferBindingIndexForBubbles) ]],
+               device const TileBin* tileBins [[ buffer(BufferBindingIndexForTileBins) ]],
+               device const uint32_t* tileGroupIndices [[ buffer(BufferBindingIndexForTileGroupIndices) ]],
+               device const uint32_t* dirtyTiles [[ buffer(BufferBindingIndexForDirtyTiles) ]])
+{
+    const uint2 gridId = texelInDirtyTile(dirtyTiles, threadgroupIndex, threadInTile);
+    MetalTextureAccessor accessor { texture, gridId, uniforms->fieldTexelSize };
+    
+    // The specialized pipelines unroll their groups, the generic ones share the loads of the large groups.
+    if (maxBubblesPerGroup == 0)
+    {
+        const float distance = computeSDFInSIMDGroup(accessor, outsideBandDistance(uniforms->fieldTexelSize),
+                                                     uniforms, groups, bubbles, tileBins, tileGroupIndices, lane);
+        if (accessor.isValid())
+        {
+            accessor.write(distance);
+        }
+        
+        return;
+    }
+    
+    computeAndDrawSDF(accessor, uniforms, groups, bubbles, tileBins, tileGroupIndices, maxBubblesPerGroup);
+}
+
+/// Computes the distance and gradient of a texel of a fused SDF kernel, and writes them packed.
+template <typename TTextureAccessor>
+void computeAndDrawSDFAndGradientInSIMDGroup(TTextureAccessor accessor,
+                                             constant Uniforms* uniforms,
+                                             device const BubbleGroup* groups,
+                                             device const Bubble* bubbles,
+                                             device const TileBin* tileBins,
+                                             device const uint32_t* tileGroupIndices,
+                                             ushort lane)
+{
+    const float3 outside = SDFPointTraits<float2>::outsideWithGradient(outsideBandDistance(uniforms->fieldTexelSize));
+    const float3 closest = computeSDFInSIMDGroup(accessor, outside, uniforms, groups, bubbles, tileBins, tileGroupIndices, lane);
+    
+    if (accessor.isValid())
+    {
+        accessor.writeFloat4(packDistanceAndGradient(closest));
+    }
+}
+
+kernel void
+computeAndDrawSDFAndGradient(texture2d<float, access::write> sdfGradientTextureOut [[texture(ComputeTextureBindingIndexForGradientSDF)]],
+                             uint threadgroupIndex [[threadgroup_position_in_grid]],
+                             uint2 threadInTile [[thread_position_in_threadgroup]],
+                             ushort lane [[thread_index_in_simdgroup]],
+                             constant Uniforms* uniforms  [[ buffer(BufferBindingIndexForUniforms) ]],
+                             device const BubbleGroup* groups [[ buffer(BufferBindingIndexForBubbleGroups) ]],
+                             device const Bubble* bubbles [[ buffer(BufferBindingIndexForBubbles) ]],
+                             device const TileBin* tileBins [[ buffer(BufferBindingIndexForTileBins) ]],
+                             device const uint32_t* tileGroupIndices [[ buffer(BufferBindingIndexForTileGroupIndices) ]],
+                             device const uint32_t* dirtyTiles [[ buffer(BufferBindingIndexForDirtyTiles) ]])
+{
+    const uint2 gridId = texelInDirtyTile(dirtyTiles, threadgroupIndex, threadInTile);
+    MetalTextureAccessor accessor { sdfGradientTextureOut, gridId, uniforms->fieldTexelSize };
+    
+    if (maxBubblesPerGroup == 0)
+    {
+        computeAndDrawSDFAndGradientInSIMDGroup(accessor, uniforms, groups, bubbles, tileBins, tileGroupIndices, lane);
+        return;
+    }
+    
+    computeAndDrawSDFAndGradient(accessor, uniforms, groups, bubbles, tileBins, tileGroupIndices, maxBubblesPerGroup);
+}
+
+kernel void
+computeAndDrawPackedSDFAndGradient(texture2d<uint, access::write> sdfGradientTextureOut [[texture(ComputeTextureBindingIndexForGradientSDF)]],
+                                   uint threadgroupIndex [[threadgroup_position_in_grid]],
+                                   uint2 threadInTile [[thread_position_in_threadgroup]],
+                                   ushort lane [[thread_index_in_simdgroup]],
+                                   constant Uniforms* uniforms  [[ buffer(BufferBindingIndexForUniforms) ]],
+                                   device const BubbleGroup* groups [[ buffer(BufferBindingIndexForBubbleGroups) ]],
+                                   device const Bubble* bubbles [[ buffer(BufferBindingIndexForBubbles) ]],
+                                   device const TileBin* tileBins [[ buffer(BufferBindingIndexForTileBins) ]],
+                                   device const uint32_t* tileGroupIndices [[ buffer(BufferBindingIndexForTileGroupIndices) ]],
+                                   device const uint32_t* dirtyTiles [[ buffer(BufferBindingIndexForDirtyTiles) ]])
 {
+    const uint2 gridId = texelInDirtyTile(dirtyTiles, threadgroupIndex, threadInTile);
+    MetalPackedTextureAccessor accessor { sdfGradientTextureOut, gridId, uniforms->fieldTexelSize };
+    
+    if (maxBubblesPerGroup == 0)
+    {
+        computeAndDrawSDFAndGradientInSIMDGroup(accessor, uniforms, groups, bubbles, tileBins, tileGroupIndices, lane);
+        return;
+    }
+    
+    computeAndDrawSDFAndGradient(accessor, uniforms, groups, bubbles, tileBins, tileGroupIndices, maxBubblesPerGroup);
+}
 
-    MetalTextureAccessor accessor { texture, gridId };
+/// The width of a tile of the SDF with the apron of one texel the central differences read around it.
+constant uint kSDFApronTileSize = SDFTileSize + 2;
+
+/// Differentiates the SDF of a tile out of a copy of the tile and its apron in threadgroup memory.
+///
+/// The threads load the `kSDFApronTileSize` x `kSDFApronTileSize` texels once, instead
+/// of reading each one for the five central differences that use it. The texels of
+/// the apron past the edges of the SDF repeat the ones on its edges.
+template <typename TAccessorOut>
+void drawSDFGradientOfTile(texture2d<half, access::read> sdfTextureIn,
+                           TAccessorOut gradientAccessorOut,
+                           uint2 tile,
+                           uint2 threadInTile,
+                           threadgroup float* sdfTile)
+{
+    const int2 tileOrigin = int2(tile * uint(SDFTileSize)) - 1;
+    const int2 lastTexel = int2 { int(sdfTextureIn.get_width()), int(sdfTextureIn.get_height()) } - 1;
+    
+    // The threads of the tile load the apron in a second round.
+    for (uint i = threadInTile.y * SDFTileSize + threadInTile.x; i < kSDFApronTileSize * kSDFApronTileSize; i += SDFTileSize * SDFTileSize)
+    {
+        const int2 texel = tileOrigin + int2 { int(i % kSDFApronTileSize), int(i / kSDFApronTileSize) };
+        sdfTile[i] = sdfTextureIn.read(uint2(clamp(texel, int2(0), lastTexel))).r;
+    }
+    
+    threadgroup_barrier(mem_flags::mem_threadgroup);
     
-    computeAndDrawSDF(accessor, uniforms);
+    if (!gradientAccessorOut.isValid())
+    {
+        return;
+    }
+    
+    const uint center = (threadInTile.y + 1) * kSDFApronTileSize + threadInTile.x + 1;
+    gradientAccessorOut.writeFloat4(distanceAndGradientOfNeighbors(sdfTile[center],
+                                                                   sdfTile[center - 1],
+                                                                   sdfTile[center + 1],
+                                                                   sdfTile[center - kSDFApronTileSize],
+                                                                   sdfTile[center + kSDFApronTileSize]));
 }
 
 kernel void drawSDFGradient(texture2d<half, access::read> sdfTextureIn [[texture(ComputeTextureBindingIndexForSDF)]],
                             texture2d<float, access::write> sdfGradientTextureOut [[texture(ComputeTextureBindingIndexForGradientSDF)]],
-                            uint2 gridId     [[thread_position_in_grid]])
+                            uint threadgroupIndex [[threadgroup_position_in_grid]],
+                            uint2 threadInTile [[thread_position_in_threadgroup]],
+                            device const uint32_t* dirtyTiles [[ buffer(BufferBindingIndexForDirtyTiles) ]])
+{
+    threadgroup float sdfTile[kSDFApronTileSize * kSDFApronTileSize];
+    
+    const uint2 tile = unpackTileCoordinates(dirtyTiles[threadgroupIndex]);
+    MetalTextureAccessor accessorOut { sdfGradientTextureOut, tile * uint(SDFTileSize) + threadInTile };
+    
+    drawSDFGradientOfTile(sdfTextureIn, accessorOut, tile, threadInTile, sdfTile);
+}
+
+kernel void drawPackedSDFGradient(texture2d<half, access::read> sdfTextureIn [[texture(ComputeTextureBindingIndexForSDF)]],
+                                  texture2d<uint, access::write> sdfGradientTextureOut [[texture(ComputeTextureBindingIndexForGradientSDF)]],
+                                  uint threadgroupIndex [[threadgroup_position_in_grid]],
+                                  uint2 threadInTile [[thread_position_in_threadgroup]],
+                                  device const uint32_t* dirtyTiles [[ buffer(BufferBindingIndexForDirtyTiles) ]])
+{
+    threadgroup float sdfTile[kSDFApronTileSize * kSDFApronTileSize];
+    
+    const uint2 tile = unpackTileCoordinates(dirtyTiles[threadgroupIndex]);
+    MetalPackedTextureAccessor accessorOut { sdfGradientTextureOut, tile * uint(SDFTileSize) + threadInTile };
+    
+    drawSDFGradientOfTile(sdfTextureIn, accessorOut, tile, threadInTile, sdfTile);
+}
+
+// MARK: - Pyramid
+
+/// Reduces the distances of an SDF tile into the levels of the pyramid up to the tile level.
+///
+/// The threads of the tile halve the bounds in threadgroup memory, level after level.
+template <typename TSDFGradient>
+void reduceSDFTile(TSDFGradient sdfGradient,
+                   texture2d<half, access::write> pyramid,
+                   uint2 tile,
+                   uint2 threadInTile,
+                   threadgroup float2* bounds)
+{
+    // The texels past the edges of the SDF repeat the ones on its edges, which leaves the bounds as they are.
+    const uint index = threadInTile.y * SDFTileSize + threadInTile.x;
+    const float d = sdfGradient.distance(int2(tile * uint(SDFTileSize) + threadInTile));
+    bounds[index] = float2 { d, d };
+    
+    for (uint lod = 0; lod <= SDFPyramidTileLevel; ++lod)
+    {
+        const uint size = uint(SDFTileSize) >> (lod + 1);
+        const bool reduces = all(threadInTile < size);
+        
+        threadgroup_barrier(mem_flags::mem_threadgroup);
+        
+        float2 b = 0.f;
+        if (reduces)
+        {
+            const uint first = 2 * threadInTile.y * SDFTileSize + 2 * threadInTile.x;
+            const float2 b0 = bounds[first];
+            const float2 b1 = bounds[first + 1];
+            const float2 b2 = bounds[first + SDFTileSize];
+            const float2 b3 = bounds[first + SDFTileSize + 1];
+            
+            b = float2 { min(min(b0.x, b1.x), min(b2.x, b3.x)), max(max(b0.y, b1.y), max(b2.y, b3.y)) };
+        }
+        
+        // Wait for the reads of the level below before overwriting it.
+        threadgroup_barrier(mem_flags::mem_threadgroup);
+        
+        if (reduces)
+        {
+            bounds[index] = b;
+            pyramid.write(half4 { half(b.x), half(b.y), 0.h, 0.h }, tile * size + threadInTile, lod);
+        }
+    }
+}
+
+kernel void reduceSDFTiles(texture2d<half> sdfGradientTexture [[texture(ComputeTextureBindingIndexForGradientSDF)]],
+                           texture2d<half, access::write> pyramid [[texture(ComputeTextureBindingIndexForSDFPyramid)]],
+                           uint threadgroupIndex [[threadgroup_position_in_grid]],
+                           uint2 threadInTile [[thread_position_in_threadgroup]],
+                           device const uint32_t* dirtyTiles [[ buffer(BufferBindingIndexForDirtyTiles) ]])
+{
+    threadgroup float2 bounds[SDFTileSize * SDFTileSize];
+    
+    const FilteredSDFGradient sdfGradient { sdfGradientTexture };
+    reduceSDFTile(sdfGradient, pyramid, unpackTileCoordinates(dirtyTiles[threadgroupIndex]), threadInTile, bounds);
+}
+
+kernel void reducePackedSDFTiles(texture2d<uint> sdfGradientTexture [[texture(ComputeTextureBindingIndexForGradientSDF)]],
+                                 texture2d<half, access::write> pyramid [[texture(ComputeTextureBindingIndexForSDFPyramid)]],
+                                 uint threadgroupIndex [[threadgroup_position_in_grid]],
+                                 uint2 threadInTile [[thread_position_in_threadgroup]],
+                                 device const uint32_t* dirtyTiles [[ buffer(BufferBindingIndexForDirtyTiles) ]])
+{
+    threadgroup float2 bounds[SDFTileSize * SDFTileSize];
+    
+    const PackedSDFGradient sdfGradient { sdfGradientTexture };
+    reduceSDFTile(sdfGradient, pyramid, unpackTileCoordinates(dirtyTiles[threadgroupIndex]), threadInTile, bounds);
+}
+
+/// Reduces a level of the pyramid past the tile level into the next one.
+///
+/// The levels each halve the previous one, rounding down, so the last texels
+/// of a row or a column also cover the odd one of the level below.
+kernel void reduceSDFPyramidLevel(texture2d<half, access::read> levelIn [[texture(ComputeTextureBindingIndexForSDFPyramid)]],
+                                  texture2d<half, access::write> levelOut [[texture(ComputeTextureBindingIndexForSDFPyramidLevel)]],
+                                  uint2 gridId [[thread_position_in_grid]])
+{
+    const uint2 sizeIn { levelIn.get_width(), levelIn.get_height() };
+    const uint2 sizeOut { levelOut.get_width(), levelOut.get_height() };
+    
+    if (any(gridId >= sizeOut))
+    {
+        return;
+    }
+    
+    const uint2 first = 2 * gridId;
+    const uint2 last = select(first + 1, sizeIn - 1, gridId == sizeOut - 1);
+    
+    half2 bounds = levelIn.read(first).xy;
+    for (uint y = first.y; y <= last.y; ++y)
+    {
+        for (uint x = first.x; x <= last.x; ++x)
+        {
+            const half2 b = levelIn.read(uint2 { x, y }).xy;
+            bounds = half2 { min(bounds.x, b.x), max(bounds.y, b.y) };
+        }
+    }
+    
+    levelOut.write(half4 { bounds.x, bounds.y, 0.h, 0.h }, gridId);
+}
+
+// MARK: - Grouping
+
+constant uint kScanThreadgroupSize = GroupingScanThreadgroupSize;
+
+/// The number of SIMD groups of the threadgroup of `exclusiveScan`, with the 32 lanes of Apple GPUs.
+constant uint kScanSimdgroupCount = kScanThreadgroupSize / 32;
+
+/// Returns the root of a bubble in the union-find forest.
+uint findRoot(device atomic_uint* labels, uint index)
 {
-    MetalTextureAccessor accessorIn { sdfTextureIn, gridId };
-    MetalTextureAccessor accessorOut { sdfGradientTextureOut, gridId };
+    uint parent = atomic_load_explicit(&labels[index], memory_order_relaxed);
+    while (parent != index)
+    {
+        index = parent;
+        parent = atomic_load_explicit(&labels[index], memory_order_relaxed);
+    }
+    
+    return index;
+}
+
+/// Links the trees of two bubbles, hooking the larger root under the smaller one.
+///
+/// Each root is then the bubble of its component with the smallest index,
+/// as in the grouping on the CPU.
+void uniteBubbles(device atomic_uint* labels, uint a, uint b)
+{
+    a = findRoot(labels, a);
+    b = findRoot(labels, b);
+    
+    while (a != b)
+    {
+        if (a > b)
+        {
+            const uint t = a;
+            a = b;
+            b = t;
+        }
+        
+        uint expected = b;
+        if (atomic_compare_exchange_weak_explicit(&labels[b], &expected, a,
+                                                  memory_order_relaxed, memory_order_relaxed))
+        {
+            return;
+        }
+        
+        // another thread hooked `b` first
+        a = findRoot(labels, a);
+        b = findRoot(labels, expected);
+    }
+}
+
+/// Computes the exclusive prefix sum of `count` values with a single threadgroup.
+kernel void exclusiveScan(device const uint* values [[ buffer(GroupingBufferBindingIndexForScanValues) ]],
+                          device uint* offsets [[ buffer(GroupingBufferBindingIndexForScanOffsets) ]],
+                          device const uint* count [[ buffer(GroupingBufferBindingIndexForScanCount) ]],
+                          device uint* total [[ buffer(GroupingBufferBindingIndexForScanTotal) ]],
+                          uint threadIndex [[ thread_position_in_threadgroup ]],
+                          uint lane [[ thread_index_in_simdgroup ]],
+                          uint simdgroup [[ simdgroup_index_in_threadgroup ]])
+{
+    threadgroup uint simdgroupOffsets[kScanSimdgroupCount];
+    threadgroup uint chunkTotal;
+    
+    const uint n = *count;
+    uint runningTotal = 0;
+    
+    for (uint first = 0; first < n; first += kScanThreadgroupSize)
+    {
+        const uint i = first + threadIndex;
+        const uint value = (i < n) ? values[i] : 0;
+        const uint prefix = simd_prefix_exclusive_sum(value);
+        
+        if (lane == 31)
+        {
+            simdgroupOffsets[simdgroup] = prefix + value;
+        }
+        
+        threadgroup_barrier(mem_flags::mem_threadgroup);
+        
+        if (simdgroup == 0)
+        {
+            simdgroupOffsets[lane] = simd_prefix_exclusive_sum(simdgroupOffsets[lane]);
+        }
+        
+        threadgroup_barrier(mem_flags::mem_threadgroup);
+        
+        const uint offset = simdgroupOffsets[simdgroup] + prefix;
+        if (i < n)
+        {
+            offsets[i] = runningTotal + offset;
+        }
+        
+        if (threadIndex == kScanThreadgroupSize - 1)
+        {
+            chunkTotal = offset + value;
+        }
+        
+        threadgroup_barrier(mem_flags::mem_threadgroup);
+        
+        runningTotal += chunkTotal;
+        
+        // the next chunk overwrites the offsets
+        threadgroup_barrier(mem_flags::mem_threadgroup);
+    }
+    
+    if (threadIndex == 0)
+    {
+        *total = runningTotal;
+    }
+}
+
+/// Counts the bubbles of each cell of the hashed grid, and starts every bubble in a tree of its own.
+kernel void countGridCells(constant GroupingUniforms& uniforms [[ buffer(GroupingBufferBindingIndexForUniforms) ]],
+                           device const float2* origins [[ buffer(GroupingBufferBindingIndexForOrigins) ]],
+                           device const float* radii [[ buffer(GroupingBufferBindingIndexForRadii) ]],
+                           device atomic_uint* cellCounts [[ buffer(GroupingBufferBindingIndexForCellCounts) ]],
+                           device atomic_uint* labels [[ buffer(GroupingBufferBindingIndexForLabels) ]],
+                           device atomic_uint* minDistances [[ buffer(GroupingBufferBindingIndexForMinDistances) ]],
+                           uint index [[ thread_position_in_grid ]])
+{
+    if (index >= uniforms.nbBubbles)
+    {
+        return;
+    }
+    
+    atomic_store_explicit(&labels[index], index, memory_order_relaxed);
+    atomic_store_explicit(&minDistances[index], as_type<uint>(FLT_MAX), memory_order_relaxed);
+    
+    int2 minCell, maxCell;
+    gridCellRange(origins[index], radii[index], minCell, maxCell);
+    
+    for (int y = minCell.y; y <= maxCell.y; ++y)
+    {
+        for (int x = minCell.x; x <= maxCell.x; ++x)
+        {
+            atomic_fetch_add_explicit(&cellCounts[hashGridCell(int2 { x, y }, uniforms.nbCells)], 1, memory_order_relaxed);
+        }
+    }
+}
+
+/// Registers each bubble in the cells its bounding box overlaps.
+///
+/// The pass consumes the counts of the cells.
+kernel void fillGridCells(constant GroupingUniforms& uniforms [[ buffer(GroupingBufferBindingIndexForUniforms) ]],
+                          device const float2* origins [[ buffer(GroupingBufferBindingIndexForOrigins) ]],
+                          device const float* radii [[ buffer(GroupingBufferBindingIndexForRadii) ]],
+                          device atomic_uint* cellCounts [[ buffer(GroupingBufferBindingIndexForCellCounts) ]],
+                          device const uint* cellOffsets [[ buffer(GroupingBufferBindingIndexForCellOffsets) ]],
+                          device uint* cellEntries [[ buffer(GroupingBufferBindingIndexForCellEntries) ]],
+                          uint index [[ thread_position_in_grid ]])
+{
+    if (index >= uniforms.nbBubbles)
+    {
+        return;
+    }
+    
+    int2 minCell, maxCell;
+    gridCellRange(origins[index], radii[index], minCell, maxCell);
+    
+    for (int y = minCell.y; y <= maxCell.y; ++y)
+    {
+        for (int x = minCell.x; x <= maxCell.x; ++x)
+        {
+            const uint cell = hashGridCell(int2 { x, y }, uniforms.nbCells);
+            const uint entry = cellOffsets[cell] + atomic_fetch_sub_explicit(&cellCounts[cell], 1, memory_order_relaxed) - 1;
+            
+            if (entry < uniforms.cellEntriesCapacity)
+            {
+                cellEntries[entry] = index;
+            }
+        }
+    }
+}
+
+/// Links each bubble with the bubbles it overlaps, and records the distance between their centers.
+kernel void uniteOverlappingBubbles(constant GroupingUniforms& uniforms [[ buffer(GroupingBufferBindingIndexForUniforms) ]],
+                                    device const float2* origins [[ buffer(GroupingBufferBindingIndexForOrigins) ]],
+                                    device const float* radii [[ buffer(GroupingBufferBindingIndexForRadii) ]],
+                                    device const uint* cellOffsets [[ buffer(GroupingBufferBindingIndexForCellOffsets) ]],
+                                    device const uint* cellEntries [[ buffer(GroupingBufferBindingIndexForCellEntries) ]],
+                                    device const GroupingCounters& counters [[ buffer(GroupingBufferBindingIndexForCounters) ]],
+                                    device atomic_uint* labels [[ buffer(GroupingBufferBindingIndexForLabels) ]],
+                                    device atomic_uint* minDistances [[ buffer(GroupingBufferBindingIndexForMinDistances) ]],
+                                    uint index [[ thread_position_in_grid ]])
+{
+    if (index >= uniforms.nbBubbles)
+    {
+        return;
+    }
+    
+    const float2 origin = origins[index];
+    const float radius = radii[index];
+    const uint nbEntries = min(counters.nbCellEntries, uniforms.cellEntriesCapacity);
+    
+    int2 minCell, maxCell;
+    gridCellRange(origin, radius, minCell, maxCell);
+    
+    for (int y = minCell.y; y <= maxCell.y; ++y)
+    {
+        for (int x = minCell.x; x <= maxCell.x; ++x)
+        {
+            const uint cell = hashGridCell(int2 { x, y }, uniforms.nbCells);
+            const uint first = min(cellOffsets[cell], nbEntries);
+            const uint end = (cell + 1 < uniforms.nbCells) ? min(cellOffsets[cell + 1], nbEntries) : nbEntries;
+            
+            for (uint entry = first; entry < end; ++entry)
+            {
+                // each pair once per shared cell
+                const uint otherIndex = cellEntries[entry];
+                if (otherIndex <= index)
+                {
+                    continue;
+                }
+                
+                const float distance = length(origin - origins[otherIndex]);
+                if (distance <= radius + radii[otherIndex])
+                {
+                    uniteBubbles(labels, index, otherIndex);
+                    
+                    atomic_fetch_min_explicit(&minDistances[index], as_type<uint>(distance), memory_order_relaxed);
+                    atomic_fetch_min_explicit(&minDistances[otherIndex], as_type<uint>(distance), memory_order_relaxed);
+                }
+            }
+        }
+    }
+}
+
+/// Resolves the root of each bubble, and accumulates the size and smallest distance of each root.
+kernel void resolveBubbleRoots(constant GroupingUniforms& uniforms [[ buffer(GroupingBufferBindingIndexForUniforms) ]],
+                               device atomic_uint* labels [[ buffer(GroupingBufferBindingIndexForLabels) ]],
+                               device uint* roots [[ buffer(GroupingBufferBindingIndexForRoots) ]],
+                               device atomic_uint* minDistances [[ buffer(GroupingBufferBindingIndexForMinDistances) ]],
+                               device uint* rootFlags [[ buffer(GroupingBufferBindingIndexForRootFlags) ]],
+                               device atomic_uint* rootSizes [[ buffer(GroupingBufferBindingIndexForRootSizes) ]],
+                               uint index [[ thread_position_in_grid ]])
+{
+    if (index >= uniforms.nbBubbles)
+    {
+        return;
+    }
+    
+    const uint root = findRoot(labels, index);
+    roots[index] = root;
+    rootFlags[index] = (root == index) ? 1 : 0;
+    
+    atomic_fetch_add_explicit(&rootSizes[root], 1, memory_order_relaxed);
+    
+    // Positive floats compare like their bits.
+    const uint distance = atomic_load_explicit(&minDistances[index], memory_order_relaxed);
+    atomic_fetch_min_explicit(&minDistances[root], distance, memory_order_relaxed);
+}
+
+/// Writes the number of bubbles of each group, which the roots index.
+kernel void sizeBubbleGroups(constant GroupingUniforms& uniforms [[ buffer(GroupingBufferBindingIndexForUniforms) ]],
+                             device const uint* roots [[ buffer(GroupingBufferBindingIndexForRoots) ]],
+                             device const uint* groupIndicesOfRoots [[ buffer(GroupingBufferBindingIndexForGroupIndicesOfRoots) ]],
+                             device atomic_uint* rootSizes [[ buffer(GroupingBufferBindingIndexForRootSizes) ]],
+                             device uint* groupSizes [[ buffer(GroupingBufferBindingIndexForGroupSizes) ]],
+                             uint index [[ thread_position_in_grid ]])
+{
+    if (index >= uniforms.nbBubbles || roots[index] != index)
+    {
+        return;
+    }
+    
+    groupSizes[groupIndicesOfRoots[index]] = atomic_load_explicit(&rootSizes[index], memory_order_relaxed);
+}
+
+/// Ranks the bubbles of each group by their index.
+///
+/// A single threadgroup walks the bubbles in the order of their indices, a chunk at a time,
+/// like `exclusiveScan`. Each bubble of a chunk counts the bubbles of its root before it in the
+/// chunk, and adds the ones the previous chunks ranked. The last bubble of each root in the
+/// chunk then takes them off the size of its root. Each bubble reads the roots of its chunk
+/// once, whatever the size of its group. The pass consumes the sizes of the roots.
+kernel void rankGroupMembers(constant GroupingUniforms& uniforms [[ buffer(GroupingBufferBindingIndexForUniforms) ]],
+                             device const uint* roots [[ buffer(GroupingBufferBindingIndexForRoots) ]],
+                             device const uint* groupIndicesOfRoots [[ buffer(GroupingBufferBindingIndexForGroupIndicesOfRoots) ]],
+                             device uint* rootSizes [[ buffer(GroupingBufferBindingIndexForRootSizes) ]],
+                             device const uint* groupSizes [[ buffer(GroupingBufferBindingIndexForGroupSizes) ]],
+                             device uint* memberRanks [[ buffer(GroupingBufferBindingIndexForMemberRanks) ]],
+                             uint threadIndex [[ thread_position_in_threadgroup ]])
+{
+    threadgroup uint chunkRoots[kScanThreadgroupSize];
+    
+    const uint n = uniforms.nbBubbles;
+    
+    for (uint first = 0; first < n; first += kScanThreadgroupSize)
+    {
+        const uint index = first + threadIndex;
+        const uint chunkSize = min(kScanThreadgroupSize, n - first);
+        const bool isBubble = index < n;
+        
+        const uint root = isBubble ? roots[index] : 0;
+        chunkRoots[threadIndex] = root;
+        
+        threadgroup_barrier(mem_flags::mem_threadgroup);
+        
+        uint chunkRank = 0;
+        bool isLastOfRoot = true;
+        
+        if (isBubble)
+        {
+            for (uint i = 0; i < chunkSize; ++i)
+            {
+                const bool sameRoot = chunkRoots[i] == root;
+                chunkRank += (sameRoot && i < threadIndex) ? 1 : 0;
+                isLastOfRoot = isLastOfRoot && !(sameRoot && i > threadIndex);
+            }
+            
+            // The sizes of the roots count the bubbles the previous chunks didn't rank.
+            memberRanks[index] = groupSizes[groupIndicesOfRoots[root]] - rootSizes[root] + chunkRank;
+        }
+        
+        // Every bubble of the chunk reads the size of its root before the last ones update it.
+        threadgroup_barrier(mem_flags::mem_device);
+        
+        if (isBubble && isLastOfRoot)
+        {
+            rootSizes[root] -= chunkRank + 1;
+        }
+        
+        // the next chunk overwrites the roots, and reads the sizes
+        threadgroup_barrier(mem_flags::mem_device | mem_flags::mem_threadgroup);
+    }
+}
+
+/// Writes the bubbles sorted by group, and by index within their group, and the groups.
+///
+/// The ranks of `rankGroupMembers` keep the order of the smooth unions the same from frame to frame.
+kernel void sortGroupMembers(constant GroupingUniforms& uniforms [[ buffer(GroupingBufferBindingIndexForUniforms) ]],
+                             device const float2* origins [[ buffer(GroupingBufferBindingIndexForOrigins) ]],
+                             device const float* radii [[ buffer(GroupingBufferBindingIndexForRadii) ]],
+                             device const uint* slots [[ buffer(GroupingBufferBindingIndexForSlots) ]],
+                             device const uint* roots [[ buffer(GroupingBufferBindingIndexForRoots) ]],
+                             device const uint* minDistances [[ buffer(GroupingBufferBindingIndexForMinDistances) ]],
+                             device const uint* groupIndicesOfRoots [[ buffer(GroupingBufferBindingIndexForGroupIndicesOfRoots) ]],
+                             device const uint* groupSizes [[ buffer(GroupingBufferBindingIndexForGroupSizes) ]],
+                             device const uint* groupOffsets [[ buffer(GroupingBufferBindingIndexForGroupOffsets) ]],
+                             device const uint* memberRanks [[ buffer(GroupingBufferBindingIndexForMemberRanks) ]],
+                             device BubbleGroup* groups [[ buffer(GroupingBufferBindingIndexForGroups) ]],
+                             device Bubble* bubbles [[ buffer(GroupingBufferBindingIndexForBubbles) ]],
+                             uint index [[ thread_position_in_grid ]])
+{
+    if (index >= uniforms.nbBubbles)
+    {
+        return;
+    }
+    
+    const uint root = roots[index];
+    const uint groupIndex = groupIndicesOfRoots[root];
+    const uint first = groupOffsets[groupIndex];
+    const uint size = groupSizes[groupIndex];
+    
+    device Bubble& bubble = bubbles[first + memberRanks[index]];
+    bubble.origin = origins[index];
+    bubble.radius = radii[index];
+    bubble.id = slots[index];
+    
+    if (root == index)
+    {
+        const BubbleGroup defaultGroup;
+        
+        device BubbleGroup& group = groups[groupIndex];
+        group.nbBubbles = size;
+        group.firstBubble = first;
+        group.smoothFactor = (size > 1) ? groupSmoothFactor(as_type<float>(minDistances[root])) : defaultGroup.smoothFactor;
+    }
+}
+
+/// Computes the circle of each group in SDF texels, and counts the groups of each tile.
+///
+/// The pass also decides which groups the SDF kernels prune, from their bounding circles.
+kernel void countTileGroups(constant GroupingUniforms& uniforms [[ buffer(GroupingBufferBindingIndexForUniforms) ]],
+                            device const GroupingCounters& counters [[ buffer(GroupingBufferBindingIndexForCounters) ]],
+                            device BubbleGroup* groups [[ buffer(GroupingBufferBindingIndexForGroups) ]],
+                            device const Bubble* bubbles [[ buffer(GroupingBufferBindingIndexForBubbles) ]],
+                            device float4* groupCircles [[ buffer(GroupingBufferBindingIndexForGroupCircles) ]],
+                            device atomic_uint* tileCounts [[ buffer(GroupingBufferBindingIndexForTileCounts) ]],
+                            uint groupIndex [[ thread_position_in_grid ]])
+{
+    if (groupIndex >= counters.nbGroups)
+    {
+        return;
+    }
+    
+    device BubbleGroup& group = groups[groupIndex];
+    
+    const float3 bounds = boundingCircle(group, bubbles);
+    group.prunesBubbles = groupPrunesBubbles(bounds.z, group.smoothFactor);
+    
+    const float3 circle = circleInSDFTexels(groupCircle(group, bounds, outsideBandDistance(uniforms.fieldTexelSize)),
+                                            uniforms.fieldTexelSize);
+    groupCircles[groupIndex] = float4(circle, 0.f);
+    
+    TileRange range;
+    if (!tileRangeOfCircle(circle, uniforms.tileGridSize, range))
+    {
+        return;
+    }
+    
+    for (uint y = range.min.y; y <= range.max.y; ++y)
+    {
+        for (uint x = range.min.x; x <= range.max.x; ++x)
+        {
+            if (circleOverlapsTile(circle, uint2 { x, y }))
+            {
+                atomic_fetch_add_explicit(&tileCounts[y * uniforms.tileGridSize.x + x], 1, memory_order_relaxed);
+            }
+        }
+    }
+}
+
+/// Writes the group indices of each tile, in any order.
+///
+/// The pass consumes the counts of the tiles.
+kernel void fillTileGroups(constant GroupingUniforms& uniforms [[ buffer(GroupingBufferBindingIndexForUniforms) ]],
+                           device const GroupingCounters& counters [[ buffer(GroupingBufferBindingIndexForCounters) ]],
+                           device const float4* groupCircles [[ buffer(GroupingBufferBindingIndexForGroupCircles) ]],
+                           device atomic_uint* tileCounts [[ buffer(GroupingBufferBindingIndexForTileCounts) ]],
+                           device const uint* tileOffsets [[ buffer(GroupingBufferBindingIndexForTileOffsets) ]],
+                           device uint32_t* tileGroupIndices [[ buffer(GroupingBufferBindingIndexForTileGroupIndices) ]],
+                           uint groupIndex [[ thread_position_in_grid ]])
+{
+    if (groupIndex >= counters.nbGroups)
+    {
+        return;
+    }
+    
+    const float3 circle = groupCircles[groupIndex].xyz;
+    
+    TileRange range;
+    if (!tileRangeOfCircle(circle, uniforms.tileGridSize, range))
+    {
+        return;
+    }
+    
+    for (uint y = range.min.y; y <= range.max.y; ++y)
+    {
+        for (uint x = range.min.x; x <= range.max.x; ++x)
+        {
+            if (!circleOverlapsTile(circle, uint2 { x, y }))
+            {
+                continue;
+            }
+            
+            const uint tileIndex = y * uniforms.tileGridSize.x + x;
+            const uint slot = tileOffsets[tileIndex] + atomic_fetch_sub_explicit(&tileCounts[tileIndex], 1, memory_order_relaxed) - 1;
+            
+            if (slot < uniforms.tileGroupIndicesCapacity)
+            {
+                tileGroupIndices[slot] = groupIndex;
+            }
+        }
+    }
+}
+
+/// Writes the bin of each tile, and sorts its group indices as the CPU binning does.
+kernel void writeTileBins(constant GroupingUniforms& uniforms [[ buffer(GroupingBufferBindingIndexForUniforms) ]],
+                          device const GroupingCounters& counters [[ buffer(GroupingBufferBindingIndexForCounters) ]],
+                          device const uint* tileOffsets [[ buffer(GroupingBufferBindingIndexForTileOffsets) ]],
+                          device uint32_t* tileGroupIndices [[ buffer(GroupingBufferBindingIndexForTileGroupIndices) ]],
+                          device TileBin* tileBins [[ buffer(GroupingBufferBindingIndexForTileBins) ]],
+                          uint tileIndex [[ thread_position_in_grid ]])
+{
+    if (tileIndex >= uniforms.nbTiles)
+    {
+        return;
+    }
+    
+    // The bins past the capacity lose their groups until the CPU grows the buffer.
+    const uint capacity = uniforms.tileGroupIndicesCapacity;
+    const uint total = counters.nbTileGroupIndices;
+    
+    const uint first = min(tileOffsets[tileIndex], capacity);
+    const uint end = min((tileIndex + 1 < uniforms.nbTiles) ? tileOffsets[tileIndex + 1] : total, capacity);
+    
+    // insertion sort, the tiles only overlap a few groups
+    for (uint i = first + 1; i < end; ++i)
+    {
+        const uint32_t groupIndex = tileGroupIndices[i];
+        
+        uint j = i;
+        while (j > first && tileGroupIndices[j - 1] > groupIndex)
+        {
+            tileGroupIndices[j] = tileGroupIndices[j - 1];
+            --j;
+        }
+        
+        tileGroupIndices[j] = groupIndex;
+    }
+    
+    tileBins[tileIndex].firstGroupIndex = first;
+    tileBins[tileIndex].nbGroups = end - first;
+}
+
+/// Gives the bubbles the CPU edits their positions, and stops them.
+kernel void applySimulationEdits(constant SimulationUniforms& simulation [[ buffer(GroupingBufferBindingIndexForSimulationUniforms) ]],
+                                 device const SimulationEdit* edits [[ buffer(GroupingBufferBindingIndexForSimulationEdits) ]],
+                                 device float2* positions [[ buffer(GroupingBufferBindingIndexForSimulationPositions) ]],
+                                 device float2* velocities [[ buffer(GroupingBufferBindingIndexForSimulationVelocities) ]],
+                                 uint index [[ thread_position_in_grid ]])
+{
+    if (index >= simulation.nbEdits)
+    {
+        return;
+    }
+    
+    const SimulationEdit edit = edits[index];
+    positions[edit.slot] = edit.origin;
+    velocities[edit.slot] = float2(0.f);
+}
+
+/// Copies the simulated position of each bubble into the origins the grouping reads, in the order of ``BubbleSet``.
+kernel void gatherSimulatedOrigins(constant GroupingUniforms& uniforms [[ buffer(GroupingBufferBindingIndexForUniforms) ]],
+                                   device const uint* slots [[ buffer(GroupingBufferBindingIndexForSlots) ]],
+                                   device const float2* positions [[ buffer(GroupingBufferBindingIndexForSimulationPositions) ]],
+                                   device float2* origins [[ buffer(GroupingBufferBindingIndexForOrigins) ]],
+                                   uint index [[ thread_position_in_grid ]])
+{
+    if (index >= uniforms.nbBubbles)
+    {
+        return;
+    }
+    
+    origins[index] = positions[slots[index]];
+}
+
+/// Returns a unit direction that turns slowly with time, which differs for each slot.
+float2 driftDirection(uint slot, float time)
+{
+    const uint hash = slot * 2654435761u;
+    const float phase = float(hash >> 8) * (2.f * M_PI_F / float(1u << 24));
+    const float rate = float(hash & 0xFFu) * (0.5f / 255.f) - 0.25f;
+    
+    const float angle = phase + rate * time;
+    return float2(cos(angle), sin(angle));
+}
+
+/// Moves each bubble by a step of the simulation.
+///
+/// Overlapping bubbles push each other apart, and the ones within the attraction
+/// range of each other pull together. The step reads the origins and the grid of
+/// the start of the step and writes the new positions by slot, so that the threads
+/// don't read the positions the other threads write.
+kernel void simulateBubbles(constant GroupingUniforms& uniforms [[ buffer(GroupingBufferBindingIndexForUniforms) ]],
+                            constant SimulationUniforms& simulation [[ buffer(GroupingBufferBindingIndexForSimulationUniforms) ]],
+                            device const float2* origins [[ buffer(GroupingBufferBindingIndexForOrigins) ]],
+                            device const float* radii [[ buffer(GroupingBufferBindingIndexForRadii) ]],
+                            device const uint* slots [[ buffer(GroupingBufferBindingIndexForSlots) ]],
+                            device const uint* cellOffsets [[ buffer(GroupingBufferBindingIndexForCellOffsets) ]],
+                            device const uint* cellEntries [[ buffer(GroupingBufferBindingIndexForCellEntries) ]],
+                            device const GroupingCounters& counters [[ buffer(GroupingBufferBindingIndexForCounters) ]],
+                            device float2* positions [[ buffer(GroupingBufferBindingIndexForSimulationPositions) ]],
+                            device float2* velocities [[ buffer(GroupingBufferBindingIndexForSimulationVelocities) ]],
+                            uint index [[ thread_position_in_grid ]])
+{
+    if (index >= uniforms.nbBubbles)
+    {
+        return;
+    }
+    
+    const float2 origin = origins[index];
+    const float radius = radii[index];
+    const uint slot = slots[index];
+    const uint nbEntries = min(counters.nbCellEntries, uniforms.cellEntriesCapacity);
+    
+    float2 acceleration = simulation.driftAcceleration * driftDirection(slot, simulation.time);
+    
+    // The grid registers the bounding box of each bubble, so the query widens
+    // the one of this bubble by the attraction range.
+    int2 minCell, maxCell;
+    gridCellRange(origin, radius + simulation.attractionRange, minCell, maxCell);
+    
+    for (int y = minCell.y; y <= maxCell.y; ++y)
+    {
+        for (int x = minCell.x; x <= maxCell.x; ++x)
+        {
+            const uint cell = hashGridCell(int2 { x, y }, uniforms.nbCells);
+            const uint first = min(cellOffsets[cell], nbEntries);
+            const uint end = (cell + 1 < uniforms.nbCells) ? min(cellOffsets[cell + 1], nbEntries) : nbEntries;
+            
+            for (uint entry = first; entry < end; ++entry)
+            {
+                const uint otherIndex = cellEntries[entry];
+                if (otherIndex == index)
+                {
+                    continue;
+                }
+                
+                const float2 otherOrigin = origins[otherIndex];
+                const float otherRadius = radii[otherIndex];
+                
+                // each neighbor once, in the first cell of both ranges
+                int2 otherMinCell, otherMaxCell;
+                gridCellRange(otherOrigin, otherRadius, otherMinCell, otherMaxCell);
+                
+                if (any(max(minCell, otherMinCell) != int2 { x, y }))
+                {
+                    continue;
+                }
+                
+                // Other cells of the neighbor can hash to the same entry of the grid,
+                // which then lists it once for each of them.
+                bool isListedBefore = false;
+                for (uint previous = first; previous < entry && !isListedBefore; ++previous)
+                {
+                    isListedBefore = (cellEntries[previous] == otherIndex);
+                }
+                
+                if (isListedBefore)
+                {
+                    continue;
+                }
+                
+                const float2 offset = otherOrigin - origin;
+                const float distance = length(offset);
+                const float gap = distance - (radius + otherRadius);
+                
+                if (distance <= 0.f || gap >= simulation.attractionRange)
+                {
+                    continue;
+                }
+                
+                const float stiffness = (gap < 0.f) ? simulation.repulsionStiffness : simulation.attractionStiffness;
+                acceleration += (stiffness * gap / distance) * offset;
+            }
+        }
+    }
+    
+    float2 velocity = velocities[slot] + acceleration * simulation.timeStep;
+    velocity *= max(1.f - simulation.damping * simulation.timeStep, 0.f);
+    
+    float2 position = origin + velocity * simulation.timeStep;
+    
+    // Bounce off the edges of SDF space.
+    const float2 lo = float2(radius);
+    const float2 hi = max(simulation.contentSize - radius, lo);
+    
+    for (int axis = 0; axis < 2; ++axis)
+    {
+        if (position[axis] < lo[axis])
+        {
+            position[axis] = lo[axis];
+            velocity[axis] = abs(velocity[axis]) * simulation.restitution;
+        }
+        else if (position[axis] > hi[axis])
+        {
+            position[axis] = hi[axis];
+            velocity[axis] = -abs(velocity[axis]) * simulation.restitution;
+        }
+    }
     
-    drawSDFGradient(accessorIn, accessorOut);
+    positions[slot] = position;
+    velocities[slot] = velocity;
 }
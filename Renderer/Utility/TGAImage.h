@@ -22,6 +22,18 @@
 /// The data's format is equivalent to `MTLPixelFormatBGRA8Unorm`, which is:
 /// - 32 bits-per-pixel (bpp)
 /// - 8 bits per color component: blue, green, red, and alpha (BGRA)
+///
+/// The image converts the pixels of the file the first time it's accessed.
 @property (nonatomic, readonly, nonnull) NSData *data;
 
+/// Converts the pixels of the file into caller-owned storage, in the format of `data`.
+///
+/// The image maps the file instead of reading it, so the conversion is the only copy
+/// of the pixels, for example into a staging buffer.
+///
+/// - Parameters:
+///   - bytes: The storage of at least `bytesPerRow * height` bytes the image writes its rows to.
+///   - bytesPerRow: The distance between the rows of `bytes`, of at least `4 * width` bytes.
+-(void) getPixels:(nonnull void *)bytes bytesPerRow:(NSUInteger)bytesPerRow;
+
 @end
@@ -72,6 +72,15 @@ typedef struct __attribute__ ((packed)) TGAHeader
 
 
 @implementation TGAImage
+{
+    /// The mapped contents of the TGA file.
+    NSData *_fileData;
+
+    /// The number of bytes of each pixel of the file.
+    NSUInteger _sourceBytesPerPixel;
+}
+
+@synthesize data = _data;
 
 - (NSData *) getDataFromFileURL:(NSURL*)fileURL
 {
@@ -85,7 +94,7 @@ typedef struct __attribute__ ((packed)) TGAHeader
 
     NSError * error;
     NSData *fileData = [[NSData alloc] initWithContentsOfURL:fileURL
-                                                     options:0x0
+                                                     options:NSDataReadingMappedIfSafe
                                                        error:&error];
 
     if (!fileData)
@@ -157,7 +166,7 @@ typedef struct __attribute__ ((packed)) TGAHeader
 /// - 8 8 bits per color component
 ///
 /// If the TGA file has 24-bit (BGR) format without the alpha channel,
-/// the initializer converts it to the 32-bit BGRA format because the app works
+/// the image converts it to the 32-bit BGRA format because the app works
 /// with the `MTLPixelFormatBGRA8Unorm` format.
 -(nullable instancetype) initWithTGAFileAtLocation:(nonnull NSURL *)fileURL
 {
@@ -173,6 +182,12 @@ typedef struct __attribute__ ((packed)) TGAHeader
         return nil;
     }
 
+    if (fileData.length < sizeof(TGAHeader))
+    {
+        NSLog(@"The TGA file at %@ is too short for its header.", fileURL);
+        return nil;
+    }
+
     TGAHeader *headerData = (TGAHeader *) fileData.bytes;
     const NSUInteger sourceBytesPerPixel = [self getBytesPerPixelFromHeaderData:headerData];
 
@@ -183,22 +198,34 @@ typedef struct __attribute__ ((packed)) TGAHeader
     _width = headerData->width;
     _height = headerData->height;
 
-    /// The total size of the image data.
-    NSUInteger dataSize = _width * _height * 4;
+    // The image reads the pixels of the mapped file when it converts them.
+    const NSUInteger sourceLength = sizeof(TGAHeader) + headerData->IDSize + sourceBytesPerPixel * _width * _height;
+    if (fileData.length < sourceLength)
+    {
+        NSLog(@"The TGA file at %@ is too short for its pixels.", fileURL);
+        return nil;
+    }
 
-    /// The image's underlying data storage.
-    NSMutableData *mutableData = [[NSMutableData alloc] initWithLength:dataSize];
+    _fileData = fileData;
+    _sourceBytesPerPixel = sourceBytesPerPixel;
+
+    return self;
+}
+
+-(void) getPixels:(nonnull void *)bytes bytesPerRow:(NSUInteger)bytesPerRow
+{
+    NSAssert(bytesPerRow >= 4 * _width, @"The rows need room for %lu pixels", (unsigned long)_width);
+
+    const TGAHeader *headerData = (const TGAHeader *) _fileData.bytes;
+    const NSUInteger sourceBytesPerPixel = _sourceBytesPerPixel;
 
     /// A pointer to the beginning of the image data.
     ///
     /// The TGA specification states the image data starts immediately after the
     /// file's header and ID.
-    uint8_t *sourceData = ((uint8_t*)fileData.bytes +
-                           sizeof(TGAHeader) +
-                           headerData->IDSize);
-
-    /// A pointer to the underlying data that stores the image's final BGRA data.
-    uint8_t *destinationData = mutableData.mutableBytes;
+    const uint8_t *sourceData = ((const uint8_t*)_fileData.bytes +
+                                 sizeof(TGAHeader) +
+                                 headerData->IDSize);
 
     // Process every row of the image.
     for (NSUInteger y = 0; y < _height; y++)
@@ -207,6 +234,9 @@ typedef struct __attribute__ ((packed)) TGAHeader
         // to match Metal's origin for textures, which is the top-left corner.
         NSUInteger row = (headerData->topOrigin) ? y : _height - 1 - y;
 
+        /// A pointer to the row's final BGRA data.
+        uint8_t *destinationData = (uint8_t *)bytes + y * bytesPerRow;
+
         // Process every column of the current row.
         for (NSUInteger x = 0; x < _width; x++)
         {
@@ -217,8 +247,8 @@ typedef struct __attribute__ ((packed)) TGAHeader
             /// The pixel index in the TGA file.
             NSUInteger sourceIndex = sourceBytesPerPixel * (row * _width + column);
 
-            /// The equivalent pixel index in a Metal texture.
-            NSUInteger destinationIndex = 4 * (y * _width + x);
+            /// The equivalent pixel index in the row.
+            NSUInteger destinationIndex = 4 * x;
 
             // Copy the blue channel.
             destinationData[destinationIndex + 0] = sourceData[sourceIndex + 0];
@@ -241,11 +271,21 @@ typedef struct __attribute__ ((packed)) TGAHeader
             }
         }
     }
+}
+
+- (NSData *) data
+{
+    if (nil == _data)
+    {
+        /// The image's underlying data storage.
+        NSMutableData *mutableData = [[NSMutableData alloc] initWithLength:_width * _height * 4];
+        [self getPixels:mutableData.mutableBytes bytesPerRow:4 * _width];
 
-    // Save the data to an immutable instance now that the conversion is done.
-    _data = mutableData;
+        // Save the data to an immutable instance now that the conversion is done.
+        _data = mutableData;
+    }
 
-    return self;
+    return _data;
 }
 
 @end
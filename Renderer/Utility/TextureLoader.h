@@ -0,0 +1,24 @@
+#import <Metal/Metal.h>
+
+/// A type that loads image files into private textures that the GPU samples efficiently.
+///
+/// The loader maps each file instead of reading it, writes its pixels into a staging
+/// buffer, and copies the buffer into a texture with private storage on the GPU.
+///
+/// The loader supports these file formats:
+/// - KTX files with one or more mipmap levels, either in an ASTC format or in 8-bit RGBA
+/// - TGA files the ``TGAImage`` type loads, for which the loader generates the mipmaps
+@interface TextureLoader : NSObject
+
+/// Creates a loader for the textures of a device.
+-(nonnull instancetype) initWithDevice:(nonnull id<MTLDevice>)device;
+
+/// Creates a texture with the contents of a KTX or TGA file.
+///
+/// The method waits for the GPU to finish the copy, so the texture is ready when it returns.
+///
+/// - Parameter fileURL: A URL to a file with a `.ktx` or `.tga` extension.
+/// - Returns: A texture instance if the method succeeds; otherwise `nil`.
+-(nullable id<MTLTexture>) newTextureWithContentsOfURL:(nonnull NSURL *)fileURL;
+
+@end
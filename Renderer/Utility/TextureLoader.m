@@ -0,0 +1,369 @@
+#import "TextureLoader.h"
+#import "TGAImage.h"
+
+
+/// Defines the layout of a KTX 1.1 file's header.
+typedef struct KTXHeader
+{
+    /// The bytes that identify a KTX 1.1 file.
+    uint8_t  identifier[12];
+
+    /// The value `0x04030201` in the byte order of the file.
+    uint32_t endianness;
+
+    /// The OpenGL type of the pixels, which is `0` for compressed formats.
+    uint32_t glType;
+    uint32_t glTypeSize;
+    uint32_t glFormat;
+
+    /// The OpenGL format of the pixels, which maps to a Metal pixel format.
+    uint32_t glInternalFormat;
+    uint32_t glBaseInternalFormat;
+
+    /// The size of the image's first mipmap level, in pixels.
+    uint32_t pixelWidth;
+    uint32_t pixelHeight;
+    uint32_t pixelDepth;
+
+    uint32_t numberOfArrayElements;
+    uint32_t numberOfFaces;
+
+    /// The number of mipmap levels, which is `0` for a file that asks the loader to generate them.
+    uint32_t numberOfMipmapLevels;
+
+    /// The size of the metadata that follows the header.
+    uint32_t bytesOfKeyValueData;
+} KTXHeader;
+
+static const uint8_t kKTXIdentifier[12] = {
+    0xAB, 'K', 'T', 'X', ' ', '1', '1', 0xBB, '\r', '\n', 0x1A, '\n'
+};
+
+/// Maps an OpenGL internal format to a Metal pixel format, along with its blocks.
+typedef struct KTXFormat
+{
+    uint32_t glInternalFormat;
+    MTLPixelFormat pixelFormat;
+
+    /// The size of each block of pixels, which is `1` by `1` for uncompressed formats.
+    uint32_t blockWidth;
+    uint32_t blockHeight;
+
+    /// The number of bytes of each block.
+    uint32_t bytesPerBlock;
+} KTXFormat;
+
+static const KTXFormat kKTXFormats[] = {
+    { 0x8058 /* GL_RGBA8 */,                         MTLPixelFormatRGBA8Unorm,       1, 1, 4 },
+    { 0x8C43 /* GL_SRGB8_ALPHA8 */,                  MTLPixelFormatRGBA8Unorm_sRGB,  1, 1, 4 },
+    { 0x93B0 /* GL_COMPRESSED_RGBA_ASTC_4x4 */,      MTLPixelFormatASTC_4x4_LDR,     4, 4, 16 },
+    { 0x93B2 /* GL_COMPRESSED_RGBA_ASTC_5x5 */,      MTLPixelFormatASTC_5x5_LDR,     5, 5, 16 },
+    { 0x93B4 /* GL_COMPRESSED_RGBA_ASTC_6x6 */,      MTLPixelFormatASTC_6x6_LDR,     6, 6, 16 },
+    { 0x93B7 /* GL_COMPRESSED_RGBA_ASTC_8x8 */,      MTLPixelFormatASTC_8x8_LDR,     8, 8, 16 },
+    { 0x93D0 /* GL_COMPRESSED_SRGB8_ASTC_4x4 */,     MTLPixelFormatASTC_4x4_sRGB,    4, 4, 16 },
+    { 0x93D2 /* GL_COMPRESSED_SRGB8_ASTC_5x5 */,     MTLPixelFormatASTC_5x5_sRGB,    5, 5, 16 },
+    { 0x93D4 /* GL_COMPRESSED_SRGB8_ASTC_6x6 */,     MTLPixelFormatASTC_6x6_sRGB,    6, 6, 16 },
+    { 0x93D7 /* GL_COMPRESSED_SRGB8_ASTC_8x8 */,     MTLPixelFormatASTC_8x8_sRGB,    8, 8, 16 },
+};
+
+/// Returns the format of a KTX file, or `NULL` when the loader doesn't support it.
+static const KTXFormat* formatForGLInternalFormat(uint32_t glInternalFormat)
+{
+    for (size_t i = 0; i < sizeof(kKTXFormats) / sizeof(kKTXFormats[0]); i++)
+    {
+        if (kKTXFormats[i].glInternalFormat == glInternalFormat)
+        {
+            return &kKTXFormats[i];
+        }
+    }
+
+    return NULL;
+}
+
+/// Rounds an offset up to a multiple of `alignment`.
+static NSUInteger alignOffset(NSUInteger offset, NSUInteger alignment)
+{
+    return (offset + alignment - 1) / alignment * alignment;
+}
+
+
+@implementation TextureLoader
+{
+    id<MTLDevice> _device;
+
+    /// A command queue for the copies from the staging buffers to the textures.
+    id<MTLCommandQueue> _commandQueue;
+}
+
+-(nonnull instancetype) initWithDevice:(nonnull id<MTLDevice>)device
+{
+    self = [super init];
+    if (nil == self)
+    {
+        return nil;
+    }
+
+    _device = device;
+    _commandQueue = [device newCommandQueue];
+    _commandQueue.label = @"Texture Loader";
+
+    return self;
+}
+
+-(nullable id<MTLTexture>) newTextureWithContentsOfURL:(nonnull NSURL *)fileURL
+{
+    NSString *fileExtension = fileURL.pathExtension;
+
+    if (NSOrderedSame == [fileExtension caseInsensitiveCompare:@"KTX"])
+    {
+        return [self newTextureWithKTXFileAtLocation:fileURL];
+    }
+
+    if (NSOrderedSame == [fileExtension caseInsensitiveCompare:@"TGA"])
+    {
+        return [self newTextureWithTGAFileAtLocation:fileURL];
+    }
+
+    NSLog(@"The `TextureLoader` type only loads KTX and TGA files.");
+    return nil;
+}
+
+/// Returns a shared buffer the CPU fills sequentially before the GPU copies it.
+- (id<MTLBuffer>) newStagingBufferWithLength:(NSUInteger)length
+{
+    id<MTLBuffer> buffer = [_device newBufferWithLength:length
+                                                options:MTLResourceStorageModeShared | MTLResourceCPUCacheModeWriteCombined];
+    buffer.label = @"Texture Staging Buffer";
+    return buffer;
+}
+
+/// Returns a texture with private storage, which only the GPU accesses.
+- (id<MTLTexture>) newPrivateTextureWithPixelFormat:(MTLPixelFormat)pixelFormat
+                                              width:(NSUInteger)width
+                                             height:(NSUInteger)height
+                                   mipmapLevelCount:(NSUInteger)mipmapLevelCount
+{
+    MTLTextureDescriptor *textureDescriptor = [[MTLTextureDescriptor alloc] init];
+
+    textureDescriptor.pixelFormat = pixelFormat;
+    textureDescriptor.textureType = MTLTextureType2D;
+    textureDescriptor.usage = MTLTextureUsageShaderRead;
+    textureDescriptor.storageMode = MTLStorageModePrivate;
+    textureDescriptor.width = width;
+    textureDescriptor.height = height;
+    textureDescriptor.mipmapLevelCount = mipmapLevelCount;
+
+    return [_device newTextureWithDescriptor:textureDescriptor];
+}
+
+/// Creates a mipmapped texture from a TGA file, which the loader converts into a staging buffer.
+- (id<MTLTexture>) newTextureWithTGAFileAtLocation:(NSURL *)fileURL
+{
+    TGAImage *image = [[TGAImage alloc] initWithTGAFileAtLocation:fileURL];
+
+    if (!image)
+    {
+        return nil;
+    }
+
+    /// The number of bytes in each of the texture's rows.
+    const NSUInteger bytesPerRow = 4 * image.width;
+
+    id<MTLBuffer> stagingBuffer = [self newStagingBufferWithLength:bytesPerRow * image.height];
+
+    // Convert the mapped pixels of the file straight into the staging buffer.
+    [image getPixels:stagingBuffer.contents bytesPerRow:bytesPerRow];
+
+    // The refraction lookups sample the smaller levels where they're minified.
+    const NSUInteger mipmapLevelCount = 1 + (NSUInteger)floor(log2((double)MAX(image.width, image.height)));
+
+    id<MTLTexture> texture = [self newPrivateTextureWithPixelFormat:MTLPixelFormatBGRA8Unorm
+                                                              width:image.width
+                                                             height:image.height
+                                                   mipmapLevelCount:mipmapLevelCount];
+
+    if (nil == texture)
+    {
+        NSLog(@"The device can't create a texture for the image at: %@",
+              fileURL);
+        return nil;
+    }
+
+    id<MTLCommandBuffer> commandBuffer = [_commandQueue commandBuffer];
+    id<MTLBlitCommandEncoder> blitEncoder = [commandBuffer blitCommandEncoder];
+
+    [blitEncoder copyFromBuffer:stagingBuffer
+                   sourceOffset:0
+              sourceBytesPerRow:bytesPerRow
+            sourceBytesPerImage:bytesPerRow * image.height
+                     sourceSize:MTLSizeMake(image.width, image.height, 1)
+                      toTexture:texture
+               destinationSlice:0
+               destinationLevel:0
+              destinationOrigin:MTLOriginMake(0, 0, 0)];
+
+    [blitEncoder generateMipmapsForTexture:texture];
+    [blitEncoder endEncoding];
+
+    [commandBuffer commit];
+    [commandBuffer waitUntilCompleted];
+
+    return texture;
+}
+
+/// Creates a texture from the mipmap levels of a KTX file, which the loader copies as they are.
+- (id<MTLTexture>) newTextureWithKTXFileAtLocation:(NSURL *)fileURL
+{
+    NSError *error;
+    NSData *fileData = [[NSData alloc] initWithContentsOfURL:fileURL
+                                                     options:NSDataReadingMappedIfSafe
+                                                       error:&error];
+
+    if (!fileData)
+    {
+        NSLog(@"Can't open KTX file at:%@\n due to:%@", fileURL,
+              error.localizedDescription);
+        return nil;
+    }
+
+    const KTXHeader *header = (const KTXHeader *)fileData.bytes;
+
+    if (fileData.length < sizeof(KTXHeader) ||
+        0 != memcmp(header->identifier, kKTXIdentifier, sizeof(kKTXIdentifier)))
+    {
+        NSLog(@"The file at %@ isn't a KTX 1.1 file.", fileURL);
+        return nil;
+    }
+
+    if (header->endianness != 0x04030201)
+    {
+        NSLog(@"The `TextureLoader` type only supports little-endian KTX files.");
+        return nil;
+    }
+
+    if (header->pixelDepth > 1 || header->numberOfArrayElements > 1 || header->numberOfFaces != 1)
+    {
+        NSLog(@"The `TextureLoader` type only supports KTX files with a single 2D image.");
+        return nil;
+    }
+
+    const KTXFormat *format = formatForGLInternalFormat(header->glInternalFormat);
+    if (NULL == format)
+    {
+        NSLog(@"The `TextureLoader` type doesn't support the KTX format 0x%x.", header->glInternalFormat);
+        return nil;
+    }
+
+    const NSUInteger width = header->pixelWidth;
+    const NSUInteger height = header->pixelHeight;
+    const NSUInteger mipmapLevelCount = MAX(header->numberOfMipmapLevels, 1u);
+
+    /// The offset of each level in the file, and in the staging buffer.
+    NSUInteger fileOffsets[32];
+    NSUInteger stagingOffsets[32];
+
+    if (mipmapLevelCount > 32)
+    {
+        NSLog(@"The KTX file at %@ has too many mipmap levels.", fileURL);
+        return nil;
+    }
+
+    // Find the levels, which follow the metadata with their sizes.
+    NSUInteger fileOffset = sizeof(KTXHeader) + header->bytesOfKeyValueData;
+    NSUInteger stagingLength = 0;
+
+    for (NSUInteger level = 0; level < mipmapLevelCount; level++)
+    {
+        const NSUInteger levelWidth = MAX(width >> level, 1u);
+        const NSUInteger levelHeight = MAX(height >> level, 1u);
+        const NSUInteger levelLength = ((levelWidth + format->blockWidth - 1) / format->blockWidth) *
+                                       ((levelHeight + format->blockHeight - 1) / format->blockHeight) *
+                                       format->bytesPerBlock;
+
+        if (fileOffset + sizeof(uint32_t) > fileData.length)
+        {
+            NSLog(@"The KTX file at %@ is too short for its mipmap levels.", fileURL);
+            return nil;
+        }
+
+        uint32_t imageSize;
+        memcpy(&imageSize, (const uint8_t *)fileData.bytes + fileOffset, sizeof(imageSize));
+
+        fileOffset += sizeof(uint32_t);
+
+        if (imageSize < levelLength || fileOffset + levelLength > fileData.length)
+        {
+            NSLog(@"The KTX file at %@ is too short for its mipmap levels.", fileURL);
+            return nil;
+        }
+
+        fileOffsets[level] = fileOffset;
+
+        // The copies read whole blocks at aligned offsets.
+        stagingOffsets[level] = alignOffset(stagingLength, format->bytesPerBlock);
+        stagingLength = stagingOffsets[level] + levelLength;
+
+        // The levels start at multiples of 4 bytes in the file.
+        fileOffset = alignOffset(fileOffset + imageSize, 4);
+    }
+
+    // Generate the levels of uncompressed files that don't store them.
+    const BOOL generatesMipmaps = (header->numberOfMipmapLevels == 0 && format->blockWidth == 1);
+    const NSUInteger textureLevelCount = generatesMipmaps
+        ? 1 + (NSUInteger)floor(log2((double)MAX(width, height)))
+        : mipmapLevelCount;
+
+    id<MTLTexture> texture = [self newPrivateTextureWithPixelFormat:format->pixelFormat
+                                                              width:width
+                                                             height:height
+                                                   mipmapLevelCount:textureLevelCount];
+
+    if (nil == texture)
+    {
+        NSLog(@"The device can't create a texture for the image at: %@",
+              fileURL);
+        return nil;
+    }
+
+    id<MTLBuffer> stagingBuffer = [self newStagingBufferWithLength:stagingLength];
+
+    id<MTLCommandBuffer> commandBuffer = [_commandQueue commandBuffer];
+    id<MTLBlitCommandEncoder> blitEncoder = [commandBuffer blitCommandEncoder];
+
+    for (NSUInteger level = 0; level < mipmapLevelCount; level++)
+    {
+        const NSUInteger levelWidth = MAX(width >> level, 1u);
+        const NSUInteger levelHeight = MAX(height >> level, 1u);
+        const NSUInteger bytesPerRow = ((levelWidth + format->blockWidth - 1) / format->blockWidth) * format->bytesPerBlock;
+        const NSUInteger nbRows = (levelHeight + format->blockHeight - 1) / format->blockHeight;
+
+        // Copy the mapped level into the staging buffer.
+        memcpy((uint8_t *)stagingBuffer.contents + stagingOffsets[level],
+               (const uint8_t *)fileData.bytes + fileOffsets[level],
+               bytesPerRow * nbRows);
+
+        [blitEncoder copyFromBuffer:stagingBuffer
+                       sourceOffset:stagingOffsets[level]
+                  sourceBytesPerRow:bytesPerRow
+                sourceBytesPerImage:bytesPerRow * nbRows
+                         sourceSize:MTLSizeMake(levelWidth, levelHeight, 1)
+                          toTexture:texture
+                   destinationSlice:0
+                   destinationLevel:level
+                  destinationOrigin:MTLOriginMake(0, 0, 0)];
+    }
+
+    if (generatesMipmaps)
+    {
+        [blitEncoder generateMipmapsForTexture:texture];
+    }
+
+    [blitEncoder endEncoding];
+
+    [commandBuffer commit];
+    [commandBuffer waitUntilCompleted];
+
+    return texture;
+}
+
+@end